@@ -76,53 +76,105 @@ static void sink_handle_options(struct ctl_sink *s,
 		return cli_vERR(r);
 }
 
-static void sink_handle_get_parameter(struct ctl_sink *s,
-				      struct rtsp_message *m)
+/*
+ * GET_PARAMETER replies only depend on the set of requested parameters and on
+ * our own capabilities, so each distinct reply is serialized once and then
+ * stamped from a template. The cache is dropped whenever the capabilities
+ * change.
+ */
+
+static unsigned int sink_get_parameter_mask(struct rtsp_message *m)
+{
+	unsigned int mask = 0;
+
+	if (rtsp_message_read(m, "{<>}", "wfd_content_protection") >= 0)
+		mask |= SINK_PARAM_CONTENT_PROTECTION;
+	if (rtsp_message_read(m, "{<>}", "wfd_video_formats") >= 0)
+		mask |= SINK_PARAM_VIDEO_FORMATS;
+	if (rtsp_message_read(m, "{<>}", "wfd_audio_codecs") >= 0)
+		mask |= SINK_PARAM_AUDIO_CODECS;
+	if (rtsp_message_read(m, "{<>}", "wfd_client_rtp_ports") >= 0)
+		mask |= SINK_PARAM_CLIENT_RTP_PORTS;
+	if (rtsp_message_read(m, "{<>}", "wfd_uibc_capability") >= 0 && uibc_option)
+		mask |= SINK_PARAM_UIBC_CAPABILITY;
+
+	return mask;
+}
+
+static void sink_flush_param_templates(struct ctl_sink *s)
+{
+	size_t i;
+
+	for (i = 0; i < SHL_ARRAY_LENGTH(s->param_templates); ++i) {
+		rtsp_template_free(s->param_templates[i]);
+		s->param_templates[i] = NULL;
+	}
+}
+
+static void sink_check_param_templates(struct ctl_sink *s)
+{
+	if (s->param_cea == s->resolutions_cea &&
+	    s->param_vesa == s->resolutions_vesa &&
+	    s->param_hh == s->resolutions_hh &&
+	    s->param_rtp_port == rstp_port)
+		return;
+
+	sink_flush_param_templates(s);
+	s->param_cea = s->resolutions_cea;
+	s->param_vesa = s->resolutions_vesa;
+	s->param_hh = s->resolutions_hh;
+	s->param_rtp_port = rstp_port;
+}
+
+static int sink_build_param_template(struct ctl_sink *s,
+				     struct rtsp_message *m,
+				     unsigned int mask,
+				     struct rtsp_template **out)
 {
 	_rtsp_message_unref_ struct rtsp_message *rep = NULL;
 	int r;
 
 	r = rtsp_message_new_reply_for(m, &rep, RTSP_CODE_OK, NULL);
 	if (r < 0)
-		return cli_vERR(r);
+		return cli_ERR(r);
 
 	/* wfd_content_protection */
-	if (rtsp_message_read(m, "{<>}", "wfd_content_protection") >= 0) {
+	if (mask & SINK_PARAM_CONTENT_PROTECTION) {
 		r = rtsp_message_append(rep, "{&}",
 					"wfd_content_protection: none");
 		if (r < 0)
-			return cli_vERR(r);
+			return cli_ERR(r);
 	}
 	/* wfd_video_formats */
-	if (rtsp_message_read(m, "{<>}", "wfd_video_formats") >= 0) {
+	if (mask & SINK_PARAM_VIDEO_FORMATS) {
 		char wfd_video_formats[128];
 		sprintf(wfd_video_formats,
 			"wfd_video_formats: 00 00 03 10 %08x %08x %08x 00 0000 0000 10 none none",
 			s->resolutions_cea, s->resolutions_vesa, s->resolutions_hh);
 		r = rtsp_message_append(rep, "{&}", wfd_video_formats);
 		if (r < 0)
-			return cli_vERR(r);
+			return cli_ERR(r);
 	}
 	/* wfd_audio_codecs */
-	if (rtsp_message_read(m, "{<>}", "wfd_audio_codecs") >= 0) {
+	if (mask & SINK_PARAM_AUDIO_CODECS) {
 		r = rtsp_message_append(rep, "{&}",
 					"wfd_audio_codecs: AAC 00000007 00");
 		if (r < 0)
-			return cli_vERR(r);
+			return cli_ERR(r);
 	}
 	/* wfd_client_rtp_ports */
-	if (rtsp_message_read(m, "{<>}", "wfd_client_rtp_ports") >= 0) {
+	if (mask & SINK_PARAM_CLIENT_RTP_PORTS) {
 		char wfd_client_rtp_ports[128];
 		sprintf(wfd_client_rtp_ports,
 					"wfd_client_rtp_ports: RTP/AVP/UDP;unicast %d 0 mode=play", rstp_port);
 		r = rtsp_message_append(rep, "{&}",
 					wfd_client_rtp_ports);
 		if (r < 0)
-			return cli_vERR(r);
+			return cli_ERR(r);
 	}
 
 	/* wfd_uibc_capability */
-	if (rtsp_message_read(m, "{<>}", "wfd_uibc_capability") >= 0 && uibc_option) {
+	if (mask & SINK_PARAM_UIBC_CAPABILITY) {
 		char wfd_uibc_capability[512];
 		sprintf(wfd_uibc_capability,
 			"wfd_uibc_capability: input_category_list=GENERIC;"
@@ -130,9 +182,38 @@ static void sink_handle_get_parameter(struct ctl_sink *s,
          "hidc_cap_list=none;port=none");
 		r = rtsp_message_append(rep, "{&}", wfd_uibc_capability);
 		if (r < 0)
-			return cli_vERR(r);
+			return cli_ERR(r);
 	}
-	rtsp_message_seal(rep);
+
+	r = rtsp_template_new(out, rep, NULL);
+	if (r < 0)
+		return cli_ERR(r);
+
+	return 0;
+}
+
+static void sink_handle_get_parameter(struct ctl_sink *s,
+				      struct rtsp_message *m)
+{
+	_rtsp_message_unref_ struct rtsp_message *rep = NULL;
+	struct rtsp_template **t;
+	unsigned int mask;
+	int r;
+
+	sink_check_param_templates(s);
+
+	mask = sink_get_parameter_mask(m);
+	t = &s->param_templates[mask];
+	if (!*t) {
+		r = sink_build_param_template(s, m, mask, t);
+		if (r < 0)
+			return;
+	}
+
+	r = rtsp_template_stamp_reply_for(*t, m, &rep, NULL);
+	if (r < 0)
+		return cli_vERR(r);
+
 	cli_debug("OUTGOING: %s\n", rtsp_message_get_raw(rep));
 
 	r = rtsp_send(s->rtsp, rep);
@@ -541,6 +622,7 @@ void ctl_sink_free(struct ctl_sink *s)
 		return;
 
 	ctl_sink_close(s);
+	sink_flush_param_templates(s);
 	free(s->target);
 	free(s->session);
 	free(s->url);
@@ -44,6 +44,15 @@ extern bool uibc_option;
 extern bool uibc_enabled;
 extern int uibc_port;
 
+enum {
+    SINK_PARAM_CONTENT_PROTECTION = 1 << 0,
+    SINK_PARAM_VIDEO_FORMATS = 1 << 1,
+    SINK_PARAM_AUDIO_CODECS = 1 << 2,
+    SINK_PARAM_CLIENT_RTP_PORTS = 1 << 3,
+    SINK_PARAM_UIBC_CAPABILITY = 1 << 4,
+    SINK_PARAM_CNT = 1 << 5,
+};
+
 struct ctl_sink {
     sd_event *event;
 
@@ -68,6 +77,13 @@ struct ctl_sink {
 
     int hres;
     int vres;
+
+    /* GET_PARAMETER reply templates, indexed by SINK_PARAM_* mask */
+    struct rtsp_template *param_templates[SINK_PARAM_CNT];
+    uint32_t param_cea;
+    uint32_t param_vesa;
+    uint32_t param_hh;
+    int param_rtp_port;
 };
 
 #endif /* CTL_SINK_H */
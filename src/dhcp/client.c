@@ -52,6 +52,9 @@
 #define REQUEST_TIMEOUT 5
 #define REQUEST_RETRIES 3
 
+/* INIT-REBOOT gives up early, the server might not know our old address */
+#define REBOOT_TIMEOUT 1
+
 typedef enum _listen_mode {
 	L_NONE,
 	L2,
@@ -154,6 +157,7 @@ struct _GDHCPClient {
 	uint32_t expire;
 	bool retransmit;
 	struct timeval start_time;
+	bool rapid_commit;
 };
 
 static inline void debug(GDHCPClient *client, const char *format, ...)
@@ -450,6 +454,10 @@ static int send_discover(GDHCPClient *dhcp_client, uint32_t requested)
 	 * some buggy DHCP servers to NOT send bigger packets */
 	dhcp_add_option_uint16(&packet, DHCP_MAX_SIZE, 576);
 
+	/* RFC 4039: allow the server to ACK right away */
+	if (dhcp_client->rapid_commit)
+		dhcp_add_option_flag(&packet, DHCP_RAPID_COMMIT);
+
 	add_request_options(dhcp_client, &packet);
 
 	add_send_options(dhcp_client, &packet);
@@ -2331,22 +2339,42 @@ static gboolean listener_event(GIOChannel *channel, GIOCondition condition,
 
 	switch (dhcp_client->state) {
 	case INIT_SELECTING:
-		if (*message_type != DHCPOFFER)
-			return TRUE;
+		if (*message_type == DHCPACK && dhcp_client->rapid_commit &&
+				dhcp_get_option(&packet, DHCP_RAPID_COMMIT)) {
+			/*
+			 * RFC 4039: the server committed the lease on our
+			 * DISCOVER, handle the ACK as if we had requested it.
+			 */
+			option = dhcp_get_option(&packet, DHCP_SERVER_ID);
+			if (!option)
+				return TRUE;
 
-		remove_timeouts(dhcp_client);
-		dhcp_client->timeout = 0;
-		dhcp_client->retry_times = 0;
+			debug(dhcp_client, "rapid commit ACK");
+
+			dhcp_client->server_ip = get_be32(option);
+			dhcp_client->requested_ip = ntohl(packet.yiaddr);
+			dhcp_client->state = REQUESTING;
+		} else {
+			/* servers without rapid commit OFFER as usual */
+			if (*message_type != DHCPOFFER)
+				return TRUE;
+
+			remove_timeouts(dhcp_client);
+			dhcp_client->timeout = 0;
+			dhcp_client->retry_times = 0;
 
-		option = dhcp_get_option(&packet, DHCP_SERVER_ID);
-		dhcp_client->server_ip = get_be32(option);
-		dhcp_client->requested_ip = ntohl(packet.yiaddr);
+			option = dhcp_get_option(&packet, DHCP_SERVER_ID);
+			dhcp_client->server_ip = get_be32(option);
+			dhcp_client->requested_ip = ntohl(packet.yiaddr);
 
-		dhcp_client->state = REQUESTING;
+			dhcp_client->state = REQUESTING;
 
-		start_request(dhcp_client);
+			start_request(dhcp_client);
 
-		return TRUE;
+			return TRUE;
+		}
+
+		/* fall through */
 	case REBOOTING:
 	case REQUESTING:
 	case RENEWING:
@@ -2382,7 +2410,15 @@ static gboolean listener_event(GIOChannel *channel, GIOCondition condition,
 
 			remove_timeouts(dhcp_client);
 
-			dhcp_client->timeout = g_timeout_add_seconds_full(
+			/* a stale address from INIT-REBOOT, DISCOVER right away */
+			if (dhcp_client->state == REBOOTING)
+				dhcp_client->timeout = g_idle_add_full(
+							G_PRIORITY_HIGH,
+							restart_dhcp_timeout,
+							dhcp_client,
+							NULL);
+			else
+				dhcp_client->timeout = g_timeout_add_seconds_full(
 							G_PRIORITY_HIGH, 3,
 							restart_dhcp_timeout,
 							dhcp_client,
@@ -2799,7 +2835,7 @@ int g_dhcp_client_start(GDHCPClient *dhcp_client, const char *last_address)
 
 		dhcp_client->timeout = g_timeout_add_seconds_full(
 								G_PRIORITY_HIGH,
-								REQUEST_TIMEOUT,
+								REBOOT_TIMEOUT,
 								reboot_timeout,
 								dhcp_client,
 								NULL);
@@ -2943,6 +2979,12 @@ int g_dhcp_client_get_index(GDHCPClient *dhcp_client)
 	return dhcp_client->ifindex;
 }
 
+/* Lease time granted by the last ACK in seconds, 0 if there is no lease */
+uint32_t g_dhcp_client_get_lease_time(GDHCPClient *dhcp_client)
+{
+	return dhcp_client->lease_seconds;
+}
+
 char *g_dhcp_client_get_address(GDHCPClient *dhcp_client)
 {
 	return g_strdup(dhcp_client->assigned_ip);
@@ -3179,6 +3221,14 @@ void g_dhcp_client_set_debug(GDHCPClient *dhcp_client,
 	dhcp_client->debug_data = user_data;
 }
 
+void g_dhcp_client_set_rapid_commit(GDHCPClient *dhcp_client, bool enable)
+{
+	if (!dhcp_client)
+		return;
+
+	dhcp_client->rapid_commit = enable;
+}
+
 static GDHCPIAPrefix *copy_prefix(gpointer data)
 {
 	GDHCPIAPrefix *copy, *prefix = data;
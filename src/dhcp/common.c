@@ -282,6 +282,17 @@ static GDHCPOptionType check_option(uint8_t code, uint8_t data_len)
 	return type;
 }
 
+/* Add an option without data, like DHCP_RAPID_COMMIT */
+void dhcp_add_option_flag(struct dhcp_packet *packet, uint8_t code)
+{
+	uint8_t option[2];
+
+	option[OPT_CODE] = code;
+	option[OPT_LEN] = 0;
+
+	dhcp_add_binary_option(packet, option);
+}
+
 void dhcp_add_option_uint32(struct dhcp_packet *packet, uint8_t code,
 							uint32_t data)
 {
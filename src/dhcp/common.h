@@ -106,6 +106,7 @@ struct dhcpv6_packet {
 #define DHCP_MAX_SIZE		0x39
 #define DHCP_VENDOR		0x3c
 #define DHCP_CLIENT_ID		0x3d
+#define DHCP_RAPID_COMMIT	0x50	/* RFC 4039 */
 #define DHCP_END		0xff
 
 #define OPT_CODE		0
@@ -179,6 +180,7 @@ int dhcp_end_option(uint8_t *optionptr);
 void dhcp_add_binary_option(struct dhcp_packet *packet, uint8_t *addopt);
 void dhcpv6_add_binary_option(struct dhcpv6_packet *packet, uint16_t max_len,
 				uint16_t *pkt_len, uint8_t *addopt);
+void dhcp_add_option_flag(struct dhcp_packet *packet, uint8_t code);
 void dhcp_add_option_uint8(struct dhcp_packet *packet,
 				uint8_t code, uint8_t data);
 void dhcp_add_option_uint16(struct dhcp_packet *packet,
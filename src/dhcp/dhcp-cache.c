@@ -0,0 +1,272 @@
+/*
+ * MiracleCast - Wifi-Display/Miracast Implementation
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * MiracleCast is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * MiracleCast is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MiracleCast; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "dhcp-cache.h"
+
+#define DHCP_CACHE_MAGIC 0x4d434443	/* "MCDC" */
+#define DHCP_CACHE_VERSION 1
+#define DHCP_CACHE_SHIFT 8
+#define DHCP_CACHE_SLOTS (1U << DHCP_CACHE_SHIFT)
+/* entries live at most this many slots away from their home slot */
+#define DHCP_CACHE_PROBE 16
+
+struct dhcp_cache_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t n_slots;
+	uint32_t entry_size;
+};
+
+struct dhcp_cache_file {
+	struct dhcp_cache_header hdr;
+	struct dhcp_cache_entry slots[DHCP_CACHE_SLOTS];
+};
+
+struct dhcp_cache {
+	int fd;
+	struct dhcp_cache_file *file;
+};
+
+static bool dhcp_cache_valid(const struct dhcp_cache_header *hdr)
+{
+	return hdr->magic == DHCP_CACHE_MAGIC &&
+	       hdr->version == DHCP_CACHE_VERSION &&
+	       hdr->n_slots == DHCP_CACHE_SLOTS &&
+	       hdr->entry_size == sizeof(struct dhcp_cache_entry);
+}
+
+static bool dhcp_cache_expired(const struct dhcp_cache_entry *e, uint64_t now)
+{
+	return e->expire < now;
+}
+
+static size_t dhcp_cache_home(uint64_t key, unsigned int role)
+{
+	/* fibonacci hashing; the top bits of the product are well mixed */
+	return ((key ^ role) * 0x9e3779b97f4a7c15ULL) >>
+	       (64 - DHCP_CACHE_SHIFT);
+}
+
+static struct dhcp_cache_entry *dhcp_cache_slot(struct dhcp_cache *c,
+						uint64_t key,
+						unsigned int role,
+						size_t i)
+{
+	i = (dhcp_cache_home(key, role) + i) % DHCP_CACHE_SLOTS;
+	return &c->file->slots[i];
+}
+
+int dhcp_cache_open(struct dhcp_cache **out, const char *path)
+{
+	struct dhcp_cache *c;
+	struct stat st;
+	void *map;
+	int r;
+
+	if (!out || !path)
+		return -EINVAL;
+
+	c = calloc(1, sizeof(*c));
+	if (!c)
+		return -ENOMEM;
+
+	c->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (c->fd < 0) {
+		r = -errno;
+		goto error;
+	}
+
+	if (flock(c->fd, LOCK_EX) < 0) {
+		r = -errno;
+		goto error;
+	}
+
+	if (fstat(c->fd, &st) < 0) {
+		r = -errno;
+		goto error_unlock;
+	}
+
+	/* a short or long file is from someone else, start over */
+	if (st.st_size != sizeof(*c->file)) {
+		if (ftruncate(c->fd, 0) < 0 ||
+		    ftruncate(c->fd, sizeof(*c->file)) < 0) {
+			r = -errno;
+			goto error_unlock;
+		}
+	}
+
+	map = mmap(NULL, sizeof(*c->file), PROT_READ | PROT_WRITE,
+		   MAP_SHARED, c->fd, 0);
+	if (map == MAP_FAILED) {
+		r = -errno;
+		goto error_unlock;
+	}
+
+	c->file = map;
+
+	if (!dhcp_cache_valid(&c->file->hdr)) {
+		memset(c->file, 0, sizeof(*c->file));
+		c->file->hdr.magic = DHCP_CACHE_MAGIC;
+		c->file->hdr.version = DHCP_CACHE_VERSION;
+		c->file->hdr.n_slots = DHCP_CACHE_SLOTS;
+		c->file->hdr.entry_size = sizeof(struct dhcp_cache_entry);
+	}
+
+	flock(c->fd, LOCK_UN);
+	*out = c;
+	return 0;
+
+error_unlock:
+	flock(c->fd, LOCK_UN);
+error:
+	dhcp_cache_close(c);
+	return r;
+}
+
+void dhcp_cache_close(struct dhcp_cache *c)
+{
+	if (!c)
+		return;
+
+	if (c->file)
+		munmap(c->file, sizeof(*c->file));
+	if (c->fd >= 0)
+		close(c->fd);
+	free(c);
+}
+
+/*
+ * Look up the non-expired entry of @key in @role. Returns -ENOENT if there is
+ * none. Slots are never cleared, only reused, so probing stops at the first
+ * slot that was never used.
+ */
+int dhcp_cache_lookup(struct dhcp_cache *c,
+		      uint64_t key,
+		      unsigned int role,
+		      struct dhcp_cache_entry *out)
+{
+	struct dhcp_cache_entry *e;
+	uint64_t now;
+	size_t i;
+	int r = -ENOENT;
+
+	if (!c || !key || !out)
+		return -EINVAL;
+
+	now = time(NULL);
+	flock(c->fd, LOCK_SH);
+
+	for (i = 0; i < DHCP_CACHE_PROBE; ++i) {
+		e = dhcp_cache_slot(c, key, role, i);
+		if (!e->key)
+			break;
+		if (e->key != key || e->role != role)
+			continue;
+
+		if (!dhcp_cache_expired(e, now)) {
+			*out = *e;
+			r = 0;
+		}
+		break;
+	}
+
+	flock(c->fd, LOCK_UN);
+	return r;
+}
+
+/*
+ * Insert or update the entry of @key in @role. If neither that entry nor a
+ * free slot is within probing distance, an expired entry or else the one
+ * expiring first is evicted. @key is thus never stored twice.
+ */
+int dhcp_cache_store(struct dhcp_cache *c,
+		     uint64_t key,
+		     unsigned int role,
+		     uint64_t hwaddr,
+		     uint32_t nip,
+		     uint64_t expire)
+{
+	struct dhcp_cache_entry *e, *victim = NULL;
+	uint64_t now;
+	size_t i;
+
+	if (!c || !key || !nip)
+		return -EINVAL;
+
+	now = time(NULL);
+	flock(c->fd, LOCK_EX);
+
+	for (i = 0; i < DHCP_CACHE_PROBE; ++i) {
+		e = dhcp_cache_slot(c, key, role, i);
+		if (!e->key || (e->key == key && e->role == role)) {
+			victim = e;
+			break;
+		}
+
+		if (!victim ||
+		    (!dhcp_cache_expired(victim, now) &&
+		     (dhcp_cache_expired(e, now) ||
+		      e->expire < victim->expire)))
+			victim = e;
+	}
+
+	victim->key = key;
+	victim->role = role;
+	victim->hwaddr = hwaddr;
+	victim->nip = nip;
+	victim->expire = expire;
+
+	flock(c->fd, LOCK_UN);
+	return 0;
+}
+
+void dhcp_cache_foreach(struct dhcp_cache *c,
+			unsigned int role,
+			dhcp_cache_fn fn,
+			void *data)
+{
+	struct dhcp_cache_entry *e;
+	uint64_t now;
+	size_t i;
+
+	if (!c || !fn)
+		return;
+
+	now = time(NULL);
+	flock(c->fd, LOCK_SH);
+
+	for (i = 0; i < DHCP_CACHE_SLOTS; ++i) {
+		e = &c->file->slots[i];
+		if (e->key && e->role == role && !dhcp_cache_expired(e, now))
+			fn(e, data);
+	}
+
+	flock(c->fd, LOCK_UN);
+}
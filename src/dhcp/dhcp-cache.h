@@ -0,0 +1,75 @@
+/*
+ * MiracleCast - Wifi-Display/Miracast Implementation
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * MiracleCast is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * MiracleCast is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MiracleCast; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * DHCP Lease Cache
+ * Remembers the last lease we got from (client) or handed out to (server) a
+ * peer, keyed by the peer's P2P device address. The cache is a small, fixed
+ * size open-addressing table in a memory-mapped file under the runtime dir, so
+ * it outlives the group (and the miracle-dhcp helper) but not a reboot.
+ * Writers take an exclusive flock(), so several processes can share a file.
+ *
+ * MACs are passed as 48-bit integers (see parse_mac()), addresses in host
+ * byte-order and expiry times as wall-clock seconds, like gdhcp does.
+ */
+
+#ifndef MIRACLE_DHCP_CACHE_H
+#define MIRACLE_DHCP_CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+struct dhcp_cache;
+
+enum dhcp_cache_role {
+	DHCP_CACHE_CLIENT,		/* address we got from the peer */
+	DHCP_CACHE_SERVER,		/* address we handed out to the peer */
+};
+
+struct dhcp_cache_entry {
+	uint64_t key;			/* peer P2P device address, 0 if unused */
+	uint64_t hwaddr;		/* DHCP chaddr of the lease */
+	uint32_t nip;
+	uint32_t role;
+	uint64_t expire;
+};
+
+typedef void (*dhcp_cache_fn) (const struct dhcp_cache_entry *entry,
+			       void *data);
+
+int dhcp_cache_open(struct dhcp_cache **out, const char *path);
+void dhcp_cache_close(struct dhcp_cache *c);
+
+int dhcp_cache_lookup(struct dhcp_cache *c,
+		      uint64_t key,
+		      unsigned int role,
+		      struct dhcp_cache_entry *out);
+int dhcp_cache_store(struct dhcp_cache *c,
+		     uint64_t key,
+		     unsigned int role,
+		     uint64_t hwaddr,
+		     uint32_t nip,
+		     uint64_t expire);
+void dhcp_cache_foreach(struct dhcp_cache *c,
+			unsigned int role,
+			dhcp_cache_fn fn,
+			void *data);
+
+#endif /* MIRACLE_DHCP_CACHE_H */
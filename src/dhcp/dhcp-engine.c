@@ -0,0 +1,1145 @@
+/*
+ * MiracleCast - Wifi-Display/Miracast Implementation
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ * Copyright (c) 2013-2014 David Herrmann <dh.herrmann@gmail.com>
+ *
+ * MiracleCast is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * MiracleCast is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MiracleCast; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define LOG_SUBSYSTEM "dhcp"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <glib.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <systemd/sd-event.h>
+#include <unistd.h>
+#include "dhcp-cache.h"
+#include "dhcp-engine.h"
+#include "gdhcp.h"
+#include "shl_log.h"
+#include "shl_macro.h"
+#include "shl_util.h"
+
+/* wake up at least this often if GLib has no timeout pending */
+#define DHCP_GLIB_IDLE (60 * 1000ULL * 1000ULL)
+/* retry interval if mirroring the GLib sources failed */
+#define DHCP_GLIB_RETRY (100 * 1000ULL)
+
+struct dhcp_engine {
+	sd_event *event;
+	struct dhcp_glib *glib;
+	sd_event_source *free_source;
+	unsigned int dispatching;
+
+	dhcp_engine_fn fn;
+	void *data;
+
+	int ifindex;
+	char *netdev;
+	char *ip_binary;
+	bool is_server;
+	bool dead;
+
+	GDHCPClient *client;
+	char *client_addr;
+	char *client_cached;		/* INIT-REBOOT address or NULL */
+
+	GDHCPServer *server;
+
+	/* servers and static clients */
+	char *local;
+	char *subnet;
+	bool local_addr;		/* @local is configured */
+};
+
+/*
+ * GLib Main-Context
+ * gdhcp schedules all its work on the default GMainContext. Instead of running
+ * a GMainLoop, we drive that context from sd-event: before each sd-event poll,
+ * the context is prepared and queried and its fds and timeout are mirrored as
+ * sd-event sources. Once any source of the sd-event loop was dispatched, a
+ * post-source runs the GLib check and dispatch steps. As GLib sources are only
+ * touched from within that dispatch (or from outside the loop), a query stays
+ * valid until the next dispatch.
+ */
+
+struct dhcp_glib {
+	unsigned long ref;
+	sd_event *event;
+	GMainContext *ctx;
+	sd_event_source *timer_source;
+	sd_event_source *post_source;
+
+	GPollFD *fds;
+	size_t fds_size;
+	sd_event_source **io;
+	size_t io_size;
+	size_t n_fds;
+
+	gint max_prio;
+	bool queried;
+};
+
+static struct dhcp_glib *dhcp_glib;
+
+static void dhcp_glib_dispatch(struct dhcp_glib *b)
+{
+	size_t i;
+
+	if (!b->queried)
+		return;
+
+	b->queried = false;
+
+	if (g_main_context_check(b->ctx, b->max_prio, b->fds, b->n_fds))
+		g_main_context_dispatch(b->ctx);
+
+	for (i = 0; i < b->n_fds; ++i)
+		b->fds[i].revents = 0;
+}
+
+static int dhcp_glib_io_fn(sd_event_source *source,
+			   int fd,
+			   uint32_t mask,
+			   void *data)
+{
+	struct dhcp_glib *b = data;
+	size_t i;
+
+	/* EPOLL* and G_IO_* share their values with POLL* */
+	for (i = 0; i < b->n_fds; ++i) {
+		if (b->io[i] == source) {
+			b->fds[i].revents = mask & (EPOLLIN | EPOLLPRI |
+						    EPOLLOUT | EPOLLERR |
+						    EPOLLHUP);
+			break;
+		}
+	}
+
+	return 0;
+}
+
+static int dhcp_glib_timer_fn(sd_event_source *source,
+			      uint64_t usec,
+			      void *data)
+{
+	/* keep our prepare-callback running; the post-source dispatches */
+	sd_event_source_set_enabled(source, SD_EVENT_ON);
+	return 0;
+}
+
+static int dhcp_glib_post_fn(sd_event_source *source, void *data)
+{
+	dhcp_glib_dispatch(data);
+	return 0;
+}
+
+static int dhcp_glib_sync_io(struct dhcp_glib *b, size_t n)
+{
+	sd_event_source **io;
+	uint32_t events;
+	size_t i;
+	int r;
+
+	for (i = 0; i < n; ++i) {
+		io = &b->io[i];
+		events = b->fds[i].events;
+		b->fds[i].revents = 0;
+
+		if (*io && sd_event_source_get_io_fd(*io) == b->fds[i].fd) {
+			r = sd_event_source_set_io_events(*io, events);
+			if (r >= 0)
+				continue;
+		}
+
+		/* fd changed (or got closed behind our back), re-add it */
+		*io = sd_event_source_unref(*io);
+		r = sd_event_add_io(b->event,
+				    io,
+				    b->fds[i].fd,
+				    events,
+				    dhcp_glib_io_fn,
+				    b);
+		if (r < 0) {
+			/* keep track of the sources added so far */
+			b->n_fds = shl_max(b->n_fds, i);
+			return r;
+		}
+	}
+
+	for ( ; i < b->n_fds; ++i)
+		b->io[i] = sd_event_source_unref(b->io[i]);
+
+	b->n_fds = n;
+	return 0;
+}
+
+/*
+ * Errors must not be returned to sd-event, it would disable the timer for good
+ * and with it all engines on the loop. Instead, the query is left invalid, so
+ * nothing is dispatched, and retried shortly.
+ */
+static int dhcp_glib_prepare_fn(sd_event_source *source, void *data)
+{
+	struct dhcp_glib *b = data;
+	gint timeout, n;
+	uint64_t usec;
+	int r;
+
+	/* nothing was dispatched since the last query, it's still valid */
+	if (b->queried)
+		return 0;
+
+	g_main_context_prepare(b->ctx, &b->max_prio);
+
+	for (;;) {
+		n = g_main_context_query(b->ctx,
+					 b->max_prio,
+					 &timeout,
+					 b->fds,
+					 b->fds_size);
+		if (n <= (gint)b->fds_size)
+			break;
+
+		if (!SHL_GREEDY_REALLOC_T(b->fds, b->fds_size, n)) {
+			log_vENOMEM();
+			goto retry;
+		}
+	}
+
+	if (!SHL_GREEDY_REALLOC0_T(b->io, b->io_size, n)) {
+		log_vENOMEM();
+		goto retry;
+	}
+
+	r = dhcp_glib_sync_io(b, n);
+	if (r < 0) {
+		log_vERR(r);
+		goto retry;
+	}
+
+	b->queried = true;
+
+	usec = timeout < 0 ? DHCP_GLIB_IDLE : (uint64_t)timeout * 1000ULL;
+	sd_event_source_set_time(source, shl_now(CLOCK_MONOTONIC) + usec);
+
+	return 0;
+
+retry:
+	sd_event_source_set_time(source,
+				 shl_now(CLOCK_MONOTONIC) + DHCP_GLIB_RETRY);
+	return 0;
+}
+
+static void dhcp_glib_unref(struct dhcp_glib *b)
+{
+	size_t i;
+
+	if (!b || !b->ref || --b->ref)
+		return;
+
+	for (i = 0; i < b->n_fds; ++i)
+		sd_event_source_unref(b->io[i]);
+
+	sd_event_source_unref(b->post_source);
+	sd_event_source_unref(b->timer_source);
+	g_main_context_release(b->ctx);
+	sd_event_unref(b->event);
+	free(b->io);
+	free(b->fds);
+	free(b);
+
+	if (dhcp_glib == b)
+		dhcp_glib = NULL;
+}
+
+static int dhcp_glib_get(struct dhcp_glib **out, sd_event *event)
+{
+	struct dhcp_glib *b;
+	int r;
+
+	if (dhcp_glib) {
+		if (dhcp_glib->event != event)
+			return -EBUSY;
+
+		++dhcp_glib->ref;
+		*out = dhcp_glib;
+		return 0;
+	}
+
+	b = calloc(1, sizeof(*b));
+	if (!b)
+		return -ENOMEM;
+
+	b->ref = 1;
+	b->ctx = g_main_context_default();
+
+	if (!g_main_context_acquire(b->ctx)) {
+		free(b);
+		return -EBUSY;
+	}
+
+	b->event = sd_event_ref(event);
+
+	r = sd_event_add_time(event,
+			      &b->timer_source,
+			      CLOCK_MONOTONIC,
+			      shl_now(CLOCK_MONOTONIC),
+			      0,
+			      dhcp_glib_timer_fn,
+			      b);
+	if (r < 0)
+		goto error;
+
+	r = sd_event_source_set_prepare(b->timer_source, dhcp_glib_prepare_fn);
+	if (r < 0)
+		goto error;
+
+	r = sd_event_add_post(event, &b->post_source, dhcp_glib_post_fn, b);
+	if (r < 0)
+		goto error;
+
+	dhcp_glib = b;
+	*out = b;
+	return 0;
+
+error:
+	dhcp_glib_unref(b);
+	return r;
+}
+
+/*
+ * Local Address
+ * The local address of the netdev is either configured by invoking the "ip"
+ * binary, or directly via rtnetlink. The latter is used in-process, as it
+ * neither forks nor blocks on a child.
+ */
+
+static int dhcp_ip_exec(struct dhcp_engine *e, const char *op, const char *addr)
+{
+	char *argv[64];
+	int i, r;
+	pid_t pid, rp;
+	sigset_t mask;
+
+	pid = fork();
+	if (pid < 0) {
+		return log_ERRNO();
+	} else if (!pid) {
+		/* child */
+
+		sigemptyset(&mask);
+		sigprocmask(SIG_SETMASK, &mask, NULL);
+
+		/* redirect stdout to stderr */
+		dup2(2, 1);
+
+		i = 0;
+		argv[i++] = e->ip_binary;
+		argv[i++] = "addr";
+		argv[i++] = (char*)op;
+		if (addr)
+			argv[i++] = (char*)addr;
+		argv[i++] = "dev";
+		argv[i++] = e->netdev;
+		argv[i] = NULL;
+
+		execve(argv[0], argv, environ);
+		_exit(1);
+	}
+
+	rp = waitpid(pid, &r, 0);
+	if (rp != pid) {
+		log_error("cannot run 'addr %s' via '%s'", op, e->ip_binary);
+		return -EFAULT;
+	} else if (!WIFEXITED(r)) {
+		log_error("'addr %s' via '%s' failed", op, e->ip_binary);
+		return -EFAULT;
+	} else if (WEXITSTATUS(r)) {
+		log_error("'addr %s' via '%s' failed with: %d",
+			  op, e->ip_binary, WEXITSTATUS(r));
+		return -EFAULT;
+	}
+
+	return 0;
+}
+
+struct dhcp_nl_addr {
+	struct nlmsghdr nh;
+	struct ifaddrmsg ifa;
+	char attrs[64];
+};
+
+static void dhcp_nl_add_attr(struct nlmsghdr *nh,
+			     unsigned short type,
+			     const void *data,
+			     size_t len)
+{
+	struct rtattr *rta;
+
+	rta = (struct rtattr*)((char*)nh + NLMSG_ALIGN(nh->nlmsg_len));
+	rta->rta_type = type;
+	rta->rta_len = RTA_LENGTH(len);
+	memcpy(RTA_DATA(rta), data, len);
+	nh->nlmsg_len = NLMSG_ALIGN(nh->nlmsg_len) + RTA_ALIGN(rta->rta_len);
+}
+
+static int dhcp_nl_open(void)
+{
+	int fd;
+
+	fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+	if (fd < 0)
+		return -errno;
+
+	return fd;
+}
+
+/*
+ * Send @req and read replies until it is acknowledged. Dump replies are passed
+ * to @fn (if given) until the dump is done.
+ */
+static int dhcp_nl_call(int fd,
+			struct nlmsghdr *req,
+			void (*fn) (struct nlmsghdr *h, void *data),
+			void *data)
+{
+	static uint32_t seq;
+	char buf[8192] __attribute__((__aligned__(NLMSG_ALIGNTO)));
+	struct nlmsgerr *err;
+	struct nlmsghdr *h;
+	ssize_t l;
+
+	req->nlmsg_flags |= NLM_F_REQUEST | NLM_F_ACK;
+	req->nlmsg_seq = ++seq;
+
+	if (send(fd, req, req->nlmsg_len, 0) < 0)
+		return -errno;
+
+	for (;;) {
+		l = recv(fd, buf, sizeof(buf), 0);
+		if (l < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+
+		for (h = (struct nlmsghdr*)buf;
+		     NLMSG_OK(h, (size_t)l);
+		     h = NLMSG_NEXT(h, l)) {
+			if (h->nlmsg_seq != req->nlmsg_seq)
+				continue;
+
+			if (h->nlmsg_type == NLMSG_DONE)
+				return 0;
+
+			if (h->nlmsg_type == NLMSG_ERROR) {
+				err = NLMSG_DATA(h);
+				return err->error;
+			}
+
+			if (fn)
+				fn(h, data);
+		}
+	}
+}
+
+struct dhcp_nl_flush {
+	int ifindex;
+	struct dhcp_nl_addr *addrs;
+	size_t size;
+	size_t cnt;
+};
+
+static void dhcp_nl_flush_fn(struct nlmsghdr *h, void *data)
+{
+	struct dhcp_nl_flush *f = data;
+	struct ifaddrmsg *ifa = NLMSG_DATA(h);
+	struct dhcp_nl_addr *a;
+	struct rtattr *rta;
+	size_t len;
+
+	if (h->nlmsg_type != RTM_NEWADDR || ifa->ifa_family != AF_INET ||
+	    (int)ifa->ifa_index != f->ifindex)
+		return;
+
+	if (!SHL_GREEDY_REALLOC0_T(f->addrs, f->size, f->cnt + 1))
+		return;
+
+	a = &f->addrs[f->cnt];
+	a->nh.nlmsg_len = NLMSG_LENGTH(sizeof(a->ifa));
+	a->nh.nlmsg_type = RTM_DELADDR;
+	a->ifa = *ifa;
+
+	len = IFA_PAYLOAD(h);
+	for (rta = IFA_RTA(ifa); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		if (rta->rta_type != IFA_LOCAL &&
+		    rta->rta_type != IFA_ADDRESS)
+			continue;
+		if (RTA_PAYLOAD(rta) != sizeof(struct in_addr))
+			continue;
+
+		dhcp_nl_add_attr(&a->nh, rta->rta_type, RTA_DATA(rta),
+				 sizeof(struct in_addr));
+	}
+
+	++f->cnt;
+}
+
+static int dhcp_nl_flush(struct dhcp_engine *e)
+{
+	struct dhcp_nl_flush f = { .ifindex = e->ifindex };
+	struct dhcp_nl_addr req = { };
+	size_t i;
+	int fd, r;
+
+	fd = dhcp_nl_open();
+	if (fd < 0)
+		return fd;
+
+	req.nh.nlmsg_len = NLMSG_LENGTH(sizeof(req.ifa));
+	req.nh.nlmsg_type = RTM_GETADDR;
+	req.nh.nlmsg_flags = NLM_F_DUMP;
+	req.ifa.ifa_family = AF_INET;
+
+	r = dhcp_nl_call(fd, &req.nh, dhcp_nl_flush_fn, &f);
+	for (i = 0; r >= 0 && i < f.cnt; ++i) {
+		r = dhcp_nl_call(fd, &f.addrs[i].nh, NULL, NULL);
+		if (r == -EADDRNOTAVAIL)
+			r = 0;
+	}
+
+	free(f.addrs);
+	close(fd);
+	return r;
+}
+
+/* parses "a.b.c.d" netmasks and plain prefix-lengths */
+static int dhcp_parse_prefixlen(const char *subnet)
+{
+	struct in_addr mask;
+	unsigned long l;
+	uint32_t m;
+	char *end;
+
+	if (inet_pton(AF_INET, subnet, &mask) == 1) {
+		m = ntohl(mask.s_addr);
+		if (m & (~m >> 1))
+			return -EINVAL;
+		return __builtin_popcount(m);
+	}
+
+	l = strtoul(subnet, &end, 10);
+	if (*end || end == subnet || l > 32)
+		return -EINVAL;
+
+	return l;
+}
+
+static int dhcp_nl_add(struct dhcp_engine *e, const char *addr,
+		       const char *subnet)
+{
+	struct dhcp_nl_addr req = { };
+	struct in_addr a;
+	int fd, r, prefixlen;
+
+	if (inet_pton(AF_INET, addr, &a) != 1)
+		return -EINVAL;
+
+	prefixlen = dhcp_parse_prefixlen(subnet);
+	if (prefixlen < 0)
+		return prefixlen;
+
+	fd = dhcp_nl_open();
+	if (fd < 0)
+		return fd;
+
+	req.nh.nlmsg_len = NLMSG_LENGTH(sizeof(req.ifa));
+	req.nh.nlmsg_type = RTM_NEWADDR;
+	req.nh.nlmsg_flags = NLM_F_CREATE | NLM_F_EXCL;
+	req.ifa.ifa_family = AF_INET;
+	req.ifa.ifa_prefixlen = prefixlen;
+	req.ifa.ifa_index = e->ifindex;
+	dhcp_nl_add_attr(&req.nh, IFA_LOCAL, &a, sizeof(a));
+	dhcp_nl_add_attr(&req.nh, IFA_ADDRESS, &a, sizeof(a));
+
+	r = dhcp_nl_call(fd, &req.nh, NULL, NULL);
+	close(fd);
+	return r;
+}
+
+static int dhcp_flush_addr(struct dhcp_engine *e)
+{
+	int r;
+
+	log_info("flushing local if-addr");
+
+	if (e->ip_binary)
+		r = dhcp_ip_exec(e, "flush", NULL);
+	else
+		r = dhcp_nl_flush(e);
+	if (r < 0)
+		log_error("cannot flush addr on local interface %s: %d",
+			  e->netdev, r);
+
+	return r;
+}
+
+static int dhcp_set_addr(struct dhcp_engine *e, const char *addr,
+			 const char *subnet)
+{
+	char *a;
+	int r;
+
+	r = dhcp_flush_addr(e);
+	if (r < 0)
+		return r;
+
+	log_info("adding local if-addr %s/%s", addr, subnet);
+
+	if (e->ip_binary) {
+		r = asprintf(&a, "%s/%s", addr, subnet);
+		if (r < 0)
+			return log_ENOMEM();
+
+		r = dhcp_ip_exec(e, "add", a);
+		free(a);
+	} else {
+		r = dhcp_nl_add(e, addr, subnet);
+	}
+	if (r < 0)
+		log_error("cannot set parameters on local interface %s: %d",
+			  e->netdev, r);
+
+	return r;
+}
+
+static int dhcp_if_name_to_index(const char *name)
+{
+	struct ifreq ifr;
+	int fd, r;
+
+	if (strlen(name) > sizeof(ifr.ifr_name))
+		return -EINVAL;
+
+	fd = socket(PF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -errno;
+
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, name, sizeof(ifr.ifr_name));
+
+	r = ioctl(fd, SIOCGIFINDEX, &ifr);
+	if (r < 0)
+		r = -errno;
+	else
+		r = ifr.ifr_ifindex;
+
+	close(fd);
+	return r;
+}
+
+/*
+ * DHCP Engine
+ * gdhcp must not be torn down from within its own callbacks. If the user frees
+ * the engine while we dispatch one of its callbacks, we only mark it dead and
+ * free it from a defer-source afterwards.
+ */
+
+static void dhcp_engine_notify(struct dhcp_engine *e,
+			       const struct dhcp_engine_event *ev)
+{
+	if (e->dead || !e->fn)
+		return;
+
+	++e->dispatching;
+	e->fn(e, ev, e->data);
+	--e->dispatching;
+}
+
+static void dhcp_engine_fail(struct dhcp_engine *e)
+{
+	struct dhcp_engine_event ev = { .type = DHCP_ENGINE_FAILED };
+
+	dhcp_engine_notify(e, &ev);
+	e->dead = true;
+}
+
+static void dhcp_engine_client_lease_fn(GDHCPClient *client, gpointer data)
+{
+	struct dhcp_engine *e = data;
+	struct dhcp_engine_event ev = { .type = DHCP_ENGINE_LOCAL };
+	char *addr, *a;
+	GList *l;
+	int r;
+
+	log_info("lease available");
+
+	addr = g_dhcp_client_get_address(client);
+	log_info("lease: address: %s", addr);
+
+	l = g_dhcp_client_get_option(client, G_DHCP_SUBNET);
+	for ( ; l; l = l->next) {
+		ev.subnet = ev.subnet ? : (char*)l->data;
+		log_info("lease: subnet: %s", (char*)l->data);
+	}
+
+	l = g_dhcp_client_get_option(client, G_DHCP_DNS_SERVER);
+	for ( ; l; l = l->next) {
+		ev.dns = ev.dns ? : (char*)l->data;
+		log_info("lease: dns-server: %s", (char*)l->data);
+	}
+
+	l = g_dhcp_client_get_option(client, G_DHCP_ROUTER);
+	for ( ; l; l = l->next) {
+		ev.gateway = ev.gateway ? : (char*)l->data;
+		log_info("lease: router: %s", (char*)l->data);
+	}
+
+	if (!addr) {
+		log_error("lease without IP address");
+		goto error;
+	}
+	if (!ev.subnet) {
+		log_warning("lease without subnet mask, using 24");
+		ev.subnet = "24";
+	}
+
+	r = asprintf(&a, "%s/%s", addr, ev.subnet);
+	if (r < 0) {
+		log_vENOMEM();
+		goto error;
+	}
+
+	if (e->client_addr && !strcmp(e->client_addr, a)) {
+		log_info("given address already set");
+		free(a);
+	} else {
+		free(e->client_addr);
+		e->client_addr = a;
+
+		r = dhcp_set_addr(e, addr, ev.subnet);
+		if (r < 0)
+			goto error;
+
+		ev.addr = addr;
+		ev.lease_time = g_dhcp_client_get_lease_time(client);
+		dhcp_engine_notify(e, &ev);
+	}
+
+	g_free(addr);
+	return;
+
+error:
+	g_free(addr);
+	dhcp_engine_fail(e);
+}
+
+static void dhcp_engine_client_no_lease_fn(GDHCPClient *client, gpointer data)
+{
+	struct dhcp_engine *e = data;
+
+	log_error("no lease available");
+	dhcp_engine_fail(e);
+}
+
+static void dhcp_engine_server_log_fn(const char *str, void *data)
+{
+	log_format(NULL, 0, NULL, "gdhcp", LOG_DEBUG, "%s", str);
+}
+
+static void dhcp_engine_server_event_fn(const char *mac,
+					const char *lease,
+					void *data)
+{
+	struct dhcp_engine *e = data;
+	struct dhcp_engine_event ev = {
+		.type = DHCP_ENGINE_REMOTE,
+		.addr = lease,
+		.mac = mac,
+		.lease_time = DHCP_ENGINE_LEASE_TIME,
+	};
+
+	log_debug("remote lease: %s %s", mac, lease);
+	dhcp_engine_notify(e, &ev);
+}
+
+static void dhcp_engine_destroy(struct dhcp_engine *e)
+{
+	if (e->client) {
+		g_dhcp_client_stop(e->client);
+		g_dhcp_client_unref(e->client);
+	}
+
+	if (e->server) {
+		g_dhcp_server_stop(e->server);
+		g_dhcp_server_unref(e->server);
+	}
+
+	if (e->client_addr || e->local_addr)
+		dhcp_flush_addr(e);
+
+	sd_event_source_unref(e->free_source);
+	dhcp_glib_unref(e->glib);
+	sd_event_unref(e->event);
+	free(e->client_addr);
+	free(e->client_cached);
+	free(e->subnet);
+	free(e->local);
+	free(e->ip_binary);
+	free(e->netdev);
+	free(e);
+}
+
+static int dhcp_engine_free_fn(sd_event_source *source, void *data)
+{
+	dhcp_engine_destroy(data);
+	return 0;
+}
+
+void dhcp_engine_free(struct dhcp_engine *e)
+{
+	if (!e)
+		return;
+
+	if (!e->dispatching) {
+		dhcp_engine_destroy(e);
+		return;
+	}
+
+	e->dead = true;
+	e->fn = NULL;
+	sd_event_source_set_enabled(e->free_source, SD_EVENT_ONESHOT);
+}
+
+static int dhcp_engine_new_client(struct dhcp_engine *e,
+				  const struct dhcp_engine_config *config)
+{
+	struct dhcp_cache_entry entry;
+	struct in_addr addr;
+	GDHCPClientError cerr;
+	int r;
+
+	if (config->cache && config->peer) {
+		r = dhcp_cache_lookup(config->cache, config->peer,
+				      DHCP_CACHE_CLIENT, &entry);
+		if (r >= 0) {
+			addr.s_addr = htonl(entry.nip);
+			e->client_cached = strdup(inet_ntoa(addr));
+			if (!e->client_cached)
+				return log_ENOMEM();
+		}
+	}
+
+	e->client = g_dhcp_client_new(G_DHCP_IPV4, e->ifindex, &cerr);
+	if (!e->client) {
+		switch (cerr) {
+		case G_DHCP_CLIENT_ERROR_INTERFACE_UNAVAILABLE:
+			log_error("cannot create GDHCP client: interface %s unavailable",
+				  e->netdev);
+			break;
+		case G_DHCP_CLIENT_ERROR_INTERFACE_IN_USE:
+			log_error("cannot create GDHCP client: interface %s in use",
+				  e->netdev);
+			break;
+		case G_DHCP_CLIENT_ERROR_INTERFACE_DOWN:
+			log_error("cannot create GDHCP client: interface %s down",
+				  e->netdev);
+			break;
+		case G_DHCP_CLIENT_ERROR_NOMEM:
+			return log_ENOMEM();
+		case G_DHCP_CLIENT_ERROR_INVALID_INDEX:
+			log_error("cannot create GDHCP client: invalid interface %s",
+				  e->netdev);
+			break;
+		case G_DHCP_CLIENT_ERROR_INVALID_OPTION:
+			log_error("cannot create GDHCP client: invalid options");
+			break;
+		default:
+			log_error("cannot create GDHCP client (%d)", cerr);
+			break;
+		}
+
+		return -EINVAL;
+	}
+
+	g_dhcp_client_set_send(e->client, G_DHCP_HOST_NAME, "<hostname>");
+
+	g_dhcp_client_set_rapid_commit(e->client, true);
+
+	g_dhcp_client_set_request(e->client, G_DHCP_SUBNET);
+	g_dhcp_client_set_request(e->client, G_DHCP_DNS_SERVER);
+	g_dhcp_client_set_request(e->client, G_DHCP_ROUTER);
+
+	g_dhcp_client_register_event(e->client,
+				     G_DHCP_CLIENT_EVENT_LEASE_AVAILABLE,
+				     dhcp_engine_client_lease_fn, e);
+	g_dhcp_client_register_event(e->client,
+				     G_DHCP_CLIENT_EVENT_NO_LEASE,
+				     dhcp_engine_client_no_lease_fn, e);
+
+	return 0;
+}
+
+static void dhcp_engine_seed_fn(const struct dhcp_cache_entry *entry,
+				void *data)
+{
+	struct dhcp_engine *e = data;
+	struct in_addr addr;
+	uint8_t mac[6];
+	size_t i;
+
+	for (i = 0; i < sizeof(mac); ++i)
+		mac[i] = entry->hwaddr >> (8 * (sizeof(mac) - 1 - i));
+
+	/*
+	 * Leases of other groups are outside of our range and refused. The
+	 * server hands a seeded address to another MAC that asks for it, in
+	 * case the peer returns with a new interface address.
+	 */
+	if (g_dhcp_server_add_lease(e->server, mac, entry->nip,
+				    entry->expire) < 0)
+		return;
+
+	addr.s_addr = htonl(entry->nip);
+	log_debug("pre-seeded lease %s", inet_ntoa(addr));
+}
+
+static int dhcp_engine_new_server(struct dhcp_engine *e,
+				  const struct dhcp_engine_config *config)
+{
+	GDHCPServerError serr;
+	int r;
+
+	e->server = g_dhcp_server_new(G_DHCP_IPV4, e->ifindex, &serr,
+				      dhcp_engine_server_event_fn, e);
+	if (!e->server) {
+		switch (serr) {
+		case G_DHCP_SERVER_ERROR_INTERFACE_UNAVAILABLE:
+			log_error("cannot create GDHCP server: interface %s unavailable",
+				  e->netdev);
+			break;
+		case G_DHCP_SERVER_ERROR_INTERFACE_IN_USE:
+			log_error("cannot create GDHCP server: interface %s in use",
+				  e->netdev);
+			break;
+		case G_DHCP_SERVER_ERROR_INTERFACE_DOWN:
+			log_error("cannot create GDHCP server: interface %s down",
+				  e->netdev);
+			break;
+		case G_DHCP_SERVER_ERROR_NOMEM:
+			return log_ENOMEM();
+		case G_DHCP_SERVER_ERROR_INVALID_INDEX:
+			log_error("cannot create GDHCP server: invalid interface %s",
+				  e->netdev);
+			break;
+		case G_DHCP_SERVER_ERROR_INVALID_OPTION:
+			log_error("cannot create GDHCP server: invalid options");
+			break;
+		case G_DHCP_SERVER_ERROR_IP_ADDRESS_INVALID:
+			log_error("cannot create GDHCP server: invalid ip address");
+			break;
+		default:
+			log_error("cannot create GDHCP server (%d)", serr);
+			break;
+		}
+
+		return -EINVAL;
+	}
+
+	g_dhcp_server_set_debug(e->server, dhcp_engine_server_log_fn, NULL);
+	g_dhcp_server_set_lease_time(e->server, DHCP_ENGINE_LEASE_TIME);
+	g_dhcp_server_set_rapid_commit(e->server, true);
+
+	r = g_dhcp_server_set_option(e->server, G_DHCP_SUBNET, config->subnet);
+	if (r != 0)
+		return log_ERR(r);
+
+	r = g_dhcp_server_set_option(e->server, G_DHCP_ROUTER,
+				     config->gateway);
+	if (r != 0)
+		return log_ERR(r);
+
+	r = g_dhcp_server_set_option(e->server, G_DHCP_DNS_SERVER,
+				     config->dns);
+	if (r != 0)
+		return log_ERR(r);
+
+	r = g_dhcp_server_set_ip_range(e->server, config->from, config->to);
+	if (r != 0)
+		return log_ERR(r);
+
+	if (config->cache)
+		dhcp_cache_foreach(config->cache, DHCP_CACHE_SERVER,
+				   dhcp_engine_seed_fn, e);
+
+	return 0;
+}
+
+int dhcp_engine_new(struct dhcp_engine **out,
+		    sd_event *event,
+		    const struct dhcp_engine_config *config,
+		    dhcp_engine_fn fn,
+		    void *data)
+{
+	struct dhcp_engine *e;
+	int r;
+
+	if (!out || !event || !config || !config->netdev)
+		return log_EINVAL();
+	if (config->server && (!config->local || !config->gateway ||
+			       !config->dns || !config->subnet ||
+			       !config->from || !config->to))
+		return log_EINVAL();
+	if (config->static_addr && (config->server || !config->local ||
+				    !config->subnet))
+		return log_EINVAL();
+
+	e = calloc(1, sizeof(*e));
+	if (!e)
+		return log_ENOMEM();
+
+	e->event = sd_event_ref(event);
+	e->fn = fn;
+	e->data = data;
+	e->is_server = config->server;
+
+	e->netdev = strdup(config->netdev);
+	if (!e->netdev) {
+		r = log_ENOMEM();
+		goto error;
+	}
+
+	if (config->ip_binary) {
+		e->ip_binary = strdup(config->ip_binary);
+		if (!e->ip_binary) {
+			r = log_ENOMEM();
+			goto error;
+		}
+	}
+
+	e->ifindex = dhcp_if_name_to_index(e->netdev);
+	if (e->ifindex < 0) {
+		r = -EINVAL;
+		log_error("cannot find interface %s (%d)",
+			  e->netdev, e->ifindex);
+		goto error;
+	}
+
+	r = sd_event_add_defer(event, &e->free_source, dhcp_engine_free_fn, e);
+	if (r < 0)
+		goto error;
+
+	sd_event_source_set_enabled(e->free_source, SD_EVENT_OFF);
+
+	r = dhcp_glib_get(&e->glib, event);
+	if (r < 0) {
+		log_error("cannot run GLib main-context on sd-event: %d", r);
+		goto error;
+	}
+
+	if (config->server || config->static_addr) {
+		e->local = strdup(config->local);
+		e->subnet = strdup(config->subnet);
+		if (!e->local || !e->subnet) {
+			r = log_ENOMEM();
+			goto error;
+		}
+	}
+
+	/* static clients need neither a gdhcp client nor server */
+	if (e->is_server)
+		r = dhcp_engine_new_server(e, config);
+	else if (!config->static_addr)
+		r = dhcp_engine_new_client(e, config);
+	else
+		r = 0;
+	if (r < 0)
+		goto error;
+
+	*out = e;
+	return 0;
+
+error:
+	dhcp_engine_destroy(e);
+	return r;
+}
+
+/*
+ * Start the client or server. For servers and static clients, the local
+ * address is configured right away and DHCP_ENGINE_LOCAL is reported before
+ * this returns.
+ */
+int dhcp_engine_start(struct dhcp_engine *e)
+{
+	struct dhcp_engine_event ev = { .type = DHCP_ENGINE_LOCAL };
+	int r;
+
+	if (!e || e->dead)
+		return -EINVAL;
+
+	if (e->client) {
+		if (e->client_cached)
+			log_info("running dhcp client on %s, requesting cached address %s",
+				 e->netdev, e->client_cached);
+		else
+			log_info("running dhcp client on %s", e->netdev);
+
+		r = g_dhcp_client_start(e->client, e->client_cached);
+		if (r != 0) {
+			log_error("cannot start DHCP client: %d", r);
+			return -EFAULT;
+		}
+
+		return 0;
+	}
+
+	if (e->server)
+		log_info("running dhcp server on %s", e->netdev);
+	else
+		log_info("using static address %s on %s", e->local, e->netdev);
+
+	e->local_addr = true;
+	r = dhcp_set_addr(e, e->local, e->subnet);
+	if (r < 0)
+		return r;
+
+	if (e->server) {
+		r = g_dhcp_server_start(e->server);
+		if (r != 0) {
+			log_error("cannot start DHCP server: %d", r);
+			return -EFAULT;
+		}
+	}
+
+	ev.addr = e->local;
+	ev.subnet = e->subnet;
+	dhcp_engine_notify(e, &ev);
+
+	return 0;
+}
@@ -0,0 +1,107 @@
+/*
+ * MiracleCast - Wifi-Display/Miracast Implementation
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ * Copyright (c) 2013-2014 David Herrmann <dh.herrmann@gmail.com>
+ *
+ * MiracleCast is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * MiracleCast is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MiracleCast; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * DHCP Engine
+ * Runs a gdhcp client or server for a single network device on an sd-event
+ * loop and configures the local address of that device. This is what the
+ * miracle-dhcp helper is built on, but it can be used in-process just as
+ * well: lease changes are reported via a callback instead of comm-lines.
+ *
+ * gdhcp is GLib based. The default GMainContext is driven from the sd-event
+ * loop the first engine is attached to, so all engines of a process must
+ * share the same sd-event loop and nobody else may run that GMainContext.
+ */
+
+#ifndef MIRACLE_DHCP_ENGINE_H
+#define MIRACLE_DHCP_ENGINE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <systemd/sd-event.h>
+
+struct dhcp_cache;
+struct dhcp_engine;
+
+/* lease time handed out by servers, in seconds */
+#define DHCP_ENGINE_LEASE_TIME (60 * 60)
+
+enum dhcp_engine_event_type {
+	DHCP_ENGINE_LOCAL,		/* local address configured */
+	DHCP_ENGINE_REMOTE,		/* address handed out to a remote device */
+	DHCP_ENGINE_FAILED,		/* no lease or fatal error, engine is dead */
+};
+
+struct dhcp_engine_event {
+	unsigned int type;
+
+	const char *addr;		/* LOCAL, REMOTE */
+	const char *subnet;		/* LOCAL (might be NULL) */
+	const char *dns;		/* LOCAL (might be NULL) */
+	const char *gateway;		/* LOCAL (might be NULL) */
+	const char *mac;		/* REMOTE */
+	uint32_t lease_time;		/* LOCAL, REMOTE (0 if static) */
+};
+
+typedef void (*dhcp_engine_fn) (struct dhcp_engine *e,
+				const struct dhcp_engine_event *ev,
+				void *data);
+
+struct dhcp_engine_config {
+	const char *netdev;
+	/* configure addresses via this "ip" binary, or via netlink if NULL */
+	const char *ip_binary;
+
+	bool server;
+	/* client only; configure @local/@subnet instead of running DHCP */
+	bool static_addr;
+
+	/*
+	 * Optional lease cache. Clients try INIT-REBOOT with the address
+	 * cached for @peer, servers pre-seed all cached server leases. The
+	 * cache is only read here; callers store leases on LOCAL and REMOTE
+	 * as only they know which peer a lease belongs to.
+	 */
+	struct dhcp_cache *cache;
+	uint64_t peer;			/* client only; P2P device address */
+
+	/*
+	 * Server only, except for @local and @subnet which static clients
+	 * use, too (e.g. if the address was assigned during the 4-way
+	 * handshake); dotted-quad addresses.
+	 */
+	const char *local;
+	const char *gateway;
+	const char *dns;
+	const char *subnet;
+	const char *from;
+	const char *to;
+};
+
+int dhcp_engine_new(struct dhcp_engine **out,
+		    sd_event *event,
+		    const struct dhcp_engine_config *config,
+		    dhcp_engine_fn fn,
+		    void *data);
+void dhcp_engine_free(struct dhcp_engine *e);
+int dhcp_engine_start(struct dhcp_engine *e);
+
+#endif /* MIRACLE_DHCP_ENGINE_H */
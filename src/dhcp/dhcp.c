@@ -26,9 +26,10 @@
  * DHCP-server support in sd-dhcp.
  *
  * This program implements a DHCP server and daemon. See --help for usage
- * information. We build on gdhcp from connman as the underlying DHCP protocol
- * implementation. To configure network devices, we actually invoke the "ip"
- * binary.
+ * information. The actual work is done by the DHCP engine (dhcp-engine.c),
+ * which builds on gdhcp from connman as the underlying DHCP protocol
+ * implementation and which miracle-wifid also runs in-process. To configure
+ * network devices, this helper invokes the "ip" binary.
  *
  * Note that this is a gross hack! We don't intend to provide a fully functional
  * DHCP server or client here. This is only a replacement for the current lack
@@ -46,25 +47,23 @@
 
 #include <arpa/inet.h>
 #include <errno.h>
-#include <fcntl.h>
 #include <getopt.h>
-#include <glib.h>
-#include <net/if.h>
 #include <netinet/in.h>
-#include <netinet/udp.h>
 #include <signal.h>
+#include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/epoll.h>
-#include <sys/ioctl.h>
 #include <sys/signalfd.h>
 #include <sys/socket.h>
-#include <sys/wait.h>
+#include <systemd/sd-event.h>
+#include <time.h>
 #include <unistd.h>
-#include "gdhcp.h"
+#include "dhcp-cache.h"
+#include "dhcp-engine.h"
 #include "shl_log.h"
+#include "util.h"
 #include "config.h"
 
 static const char *arg_netdev;
@@ -77,20 +76,15 @@ static char arg_subnet[INET_ADDRSTRLEN];
 static char arg_from[INET_ADDRSTRLEN];
 static char arg_to[INET_ADDRSTRLEN];
 static int arg_comm = -1;
+static const char *arg_lease_cache;
+static uint64_t arg_peer;
 
 struct manager {
-	int ifindex;
-	GMainLoop *loop;
+	sd_event *event;
+	sd_event_source *sigs[6];
 
-	int sfd;
-	GIOChannel *sfd_chan;
-	guint sfd_id;
-
-	GDHCPClient *client;
-	char *client_addr;
-
-	GDHCPServer *server;
-	char *server_addr;
+	struct dhcp_engine *engine;
+	struct dhcp_cache *cache;
 };
 
 /*
@@ -136,311 +130,88 @@ static void writef_comm(const void *format, ...)
 	free(msg);
 }
 
-static int flush_if_addr(void)
-{
-	char *argv[64];
-	int i, r;
-	pid_t pid, rp;
-	sigset_t mask;
-
-	pid = fork();
-	if (pid < 0) {
-		return log_ERRNO();
-	} else if (!pid) {
-		/* child */
-
-		sigemptyset(&mask);
-		sigprocmask(SIG_SETMASK, &mask, NULL);
-
-		/* redirect stdout to stderr */
-		dup2(2, 1);
-
-		i = 0;
-		argv[i++] = (char*)arg_ip_binary;
-		argv[i++] = "addr";
-		argv[i++] = "flush";
-		argv[i++] = "dev";
-		argv[i++] = (char*)arg_netdev;
-		argv[i] = NULL;
-
-		execve(argv[0], argv, environ);
-		_exit(1);
-	}
-
-	log_info("flushing local if-addr");
-	rp = waitpid(pid, &r, 0);
-	if (rp != pid) {
-		log_error("cannot flush local if-addr via '%s'",
-			  arg_ip_binary);
-		return -EFAULT;
-	} else if (!WIFEXITED(r)) {
-		log_error("flushing local if-addr via '%s' failed",
-			  arg_ip_binary);
-		return -EFAULT;
-	} else if (WEXITSTATUS(r)) {
-		log_error("flushing local if-addr via '%s' failed with: %d",
-			  arg_ip_binary, WEXITSTATUS(r));
-		return -EFAULT;
-	}
-
-	log_debug("successfully flushed local if-addr via %s",
-		  arg_ip_binary);
-
-	return 0;
-}
-
-static int add_if_addr(const char *addr)
-{
-	char *argv[64];
-	int i, r;
-	pid_t pid, rp;
-	sigset_t mask;
-
-	pid = fork();
-	if (pid < 0) {
-		return log_ERRNO();
-	} else if (!pid) {
-		/* child */
-
-		sigemptyset(&mask);
-		sigprocmask(SIG_SETMASK, &mask, NULL);
-
-		/* redirect stdout to stderr */
-		dup2(2, 1);
-
-		i = 0;
-		argv[i++] = (char*)arg_ip_binary;
-		argv[i++] = "addr";
-		argv[i++] = "add";
-		argv[i++] = (char*)addr;
-		argv[i++] = "dev";
-		argv[i++] = (char*)arg_netdev;
-		argv[i] = NULL;
-
-		execve(argv[0], argv, environ);
-		_exit(1);
-	}
-
-	log_info("adding local if-addr %s", addr);
-	rp = waitpid(pid, &r, 0);
-	if (rp != pid) {
-		log_error("cannot set local if-addr %s via '%s'",
-			  addr, arg_ip_binary);
-		return -EFAULT;
-	} else if (!WIFEXITED(r)) {
-		log_error("setting local if-addr %s via '%s' failed",
-			  addr, arg_ip_binary);
-		return -EFAULT;
-	} else if (WEXITSTATUS(r)) {
-		log_error("setting local if-addr %s via '%s' failed with: %d",
-			  addr, arg_ip_binary, WEXITSTATUS(r));
-		return -EFAULT;
-	}
-
-	log_debug("successfully set local if-addr %s via %s",
-		  addr, arg_ip_binary);
-
-	return 0;
-}
-
-int if_name_to_index(const char *name)
+static void manager_cache_lease(struct manager *m,
+				uint64_t key,
+				unsigned int role,
+				uint64_t hwaddr,
+				const char *addr,
+				uint32_t lease_time)
 {
-	struct ifreq ifr;
-	int fd, r;
-
-	if (strlen(name) > sizeof(ifr.ifr_name))
-		return -EINVAL;
-
-	fd = socket(PF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
-	if (fd < 0)
-		return -errno;
+	struct in_addr a;
+	int r;
 
-	memset(&ifr, 0, sizeof(ifr));
-	strncpy(ifr.ifr_name, name, sizeof(ifr.ifr_name));
+	if (!m->cache || !key || !lease_time ||
+	    inet_pton(AF_INET, addr, &a) != 1)
+		return;
 
-	r = ioctl(fd, SIOCGIFINDEX, &ifr);
+	r = dhcp_cache_store(m->cache, key, role, hwaddr, ntohl(a.s_addr),
+			     time(NULL) + lease_time);
 	if (r < 0)
-		r = -errno;
-	else
-		r = ifr.ifr_ifindex;
-
-	close(fd);
-	return r;
+		log_warning("cannot cache lease %s: %d", addr, r);
 }
 
-static void sig_dummy(int sig)
-{
-}
-
-static void client_lease_fn(GDHCPClient *client, gpointer data)
+static void manager_engine_fn(struct dhcp_engine *e,
+			      const struct dhcp_engine_event *ev,
+			      void *data)
 {
 	struct manager *m = data;
-	char *addr = NULL, *a, *subnet = NULL, *gateway = NULL, *dns = NULL;
-	GList *l;
-	int r;
-
-	log_info("lease available");
-
-	addr = g_dhcp_client_get_address(client);
-	log_info("lease: address: %s", addr);
-
-	l = g_dhcp_client_get_option(client, G_DHCP_SUBNET);
-	for ( ; l; l = l->next) {
-		subnet = subnet ? : (char*)l->data;
-		log_info("lease: subnet: %s", (char*)l->data);
-	}
-
-	l = g_dhcp_client_get_option(client, G_DHCP_DNS_SERVER);
-	for ( ; l; l = l->next) {
-		dns = dns ? : (char*)l->data;
-		log_info("lease: dns-server: %s", (char*)l->data);
-	}
-
-	l = g_dhcp_client_get_option(client, G_DHCP_ROUTER);
-	for ( ; l; l = l->next) {
-		gateway = gateway ? : (char*)l->data;
-		log_info("lease: router: %s", (char*)l->data);
-	}
-
-	if (!addr) {
-		log_error("lease without IP address");
-		goto error;
-	}
-	if (!subnet) {
-		log_warning("lease without subnet mask, using 24");
-		subnet = "24";
-	}
-
-	r = asprintf(&a, "%s/%s", addr, subnet);
-	if (r < 0) {
-		log_vENOMEM();
-		goto error;
-	}
-
-	if (m->client_addr && !strcmp(m->client_addr, a)) {
-		log_info("given address already set");
-		free(a);
-	} else {
-		free(m->client_addr);
-		m->client_addr = a;
-
-		r = flush_if_addr();
-		if (r < 0) {
-			log_error("cannot flush addr on local interface %s",
-				  arg_netdev);
-			goto error;
-		}
-
-		r = add_if_addr(m->client_addr);
-		if (r < 0) {
-			log_error("cannot set parameters on local interface %s",
-				  arg_netdev);
-			goto error;
+	uint64_t mac;
+
+	switch (ev->type) {
+	case DHCP_ENGINE_LOCAL:
+		writef_comm("L:%s", ev->addr);
+		if (!arg_server) {
+			writef_comm("S:%s", ev->subnet);
+			if (ev->dns)
+				writef_comm("D:%s", ev->dns);
+			if (ev->gateway)
+				writef_comm("G:%s", ev->gateway);
+
+			manager_cache_lease(m, arg_peer, DHCP_CACHE_CLIENT,
+					    0, ev->addr, ev->lease_time);
 		}
-
-		writef_comm("L:%s", addr);
-		writef_comm("S:%s", subnet);
-		if (dns)
-			writef_comm("D:%s", dns);
-		if (gateway)
-			writef_comm("G:%s", gateway);
+		break;
+	case DHCP_ENGINE_REMOTE:
+		writef_comm("R:%s %s", ev->mac, ev->addr);
+
+		/* we don't know P2P addresses, key server leases by chaddr */
+		if (parse_mac(&mac, ev->mac) >= 0)
+			manager_cache_lease(m, mac, DHCP_CACHE_SERVER,
+					    mac, ev->addr, ev->lease_time);
+		break;
+	case DHCP_ENGINE_FAILED:
+		sd_event_exit(m->event, -EFAULT);
+		break;
 	}
-
-	g_free(addr);
-	return;
-
-error:
-	g_free(addr);
-	g_main_loop_quit(m->loop);
-}
-
-static void client_no_lease_fn(GDHCPClient *client, gpointer data)
-{
-	struct manager *m = data;
-
-	log_error("no lease available");
-	g_main_loop_quit(m->loop);
-}
-
-static void server_log_fn(const char *str, void *data)
-{
-	log_format(NULL, 0, NULL, "gdhcp", LOG_DEBUG, "%s", str);
-}
-
-static void server_event_fn(const char *mac, const char *lease, void *data)
-{
-	log_debug("remote lease: %s %s", mac, lease);
-	writef_comm("R:%s %s", mac, lease);
 }
 
-static gboolean manager_signal_fn(GIOChannel *chan, GIOCondition mask,
-				  gpointer data)
+static int manager_signal_fn(sd_event_source *source,
+			     const struct signalfd_siginfo *ssi,
+			     void *data)
 {
 	struct manager *m = data;
-	ssize_t l;
-	struct signalfd_siginfo info;
-
-	if (mask & (G_IO_HUP | G_IO_ERR)) {
-		log_vEPIPE();
-		g_main_loop_quit(m->loop);
-		return FALSE;
-	}
-
-	l = read(m->sfd, &info, sizeof(info));
-	if (l < 0) {
-		log_vERRNO();
-		g_main_loop_quit(m->loop);
-		return FALSE;
-	} else if (l != sizeof(info)) {
-		log_vEFAULT();
-		return TRUE;
-	}
 
 	log_notice("received signal %d: %s",
-		   info.ssi_signo, strsignal(info.ssi_signo));
+		   ssi->ssi_signo, strsignal(ssi->ssi_signo));
 
-	g_main_loop_quit(m->loop);
-	return FALSE;
+	sd_event_exit(m->event, 0);
+	return 0;
 }
 
 static void manager_free(struct manager *m)
 {
+	unsigned int i;
+
 	if (!m)
 		return;
 
-	if (!arg_server) {
-		if (m->client) {
-			g_dhcp_client_stop(m->client);
+	dhcp_engine_free(m->engine);
+	dhcp_cache_close(m->cache);
 
-			if (m->client_addr) {
-				flush_if_addr();
-				free(m->client_addr);
-			}
-
-			g_dhcp_client_unref(m->client);
-		}
-	} else {
-		if (m->server) {
-			g_dhcp_server_stop(m->server);
-
-			g_dhcp_server_unref(m->server);
-		}
-
-		if (m->server_addr) {
-			flush_if_addr();
-			free(m->server_addr);
-		}
-	}
-
-	if (m->sfd >= 0) {
-		g_source_remove(m->sfd_id);
-		g_io_channel_unref(m->sfd_chan);
-		close(m->sfd);
-	}
-
-	if (m->loop)
-		g_main_loop_unref(m->loop);
+	for (i = 0; m->sigs[i]; ++i)
+		sd_event_source_unref(m->sigs[i]);
 
+	sd_event_unref(m->event);
 	free(m);
 }
 
@@ -454,206 +225,67 @@ static int manager_new(struct manager **out)
 		SIGPIPE,
 		0
 	};
+	struct dhcp_engine_config config = {
+		.netdev = arg_netdev,
+		.ip_binary = arg_ip_binary,
+		.server = arg_server,
+		.peer = arg_peer,
+	};
 	int r, i;
 	sigset_t mask;
-	struct sigaction sig;
-	GDHCPClientError cerr;
-	GDHCPServerError serr;
 	struct manager *m;
 
 	m = calloc(1, sizeof(*m));
 	if (!m)
 		return log_ENOMEM();
 
-	m->sfd = -1;
-
 	if (geteuid())
 		log_warning("not running as uid=0, dhcp might not work");
 
-	m->ifindex = if_name_to_index(arg_netdev);
-	if (m->ifindex < 0) {
-		r = -EINVAL;
-		log_error("cannot find interface %s (%d)",
-			  arg_netdev, m->ifindex);
+	r = sd_event_default(&m->event);
+	if (r < 0) {
+		log_vERR(r);
 		goto error;
 	}
 
-	m->loop = g_main_loop_new(NULL, FALSE);
-
-	sigemptyset(&mask);
-	memset(&sig, 0, sizeof(sig));
-	sig.sa_handler = sig_dummy;
-	sig.sa_flags = SA_RESTART;
-
 	for (i = 0; sigs[i]; ++i) {
+		sigemptyset(&mask);
 		sigaddset(&mask, sigs[i]);
-		r = sigaction(sigs[i], &sig, NULL);
+		sigprocmask(SIG_BLOCK, &mask, NULL);
+
+		r = sd_event_add_signal(m->event,
+					&m->sigs[i],
+					sigs[i],
+					manager_signal_fn,
+					m);
 		if (r < 0) {
-			r = log_ERRNO();
+			log_vERR(r);
 			goto error;
 		}
 	}
 
-	r = sigprocmask(SIG_BLOCK, &mask, NULL);
-	if (r < 0) {
-		r = log_ERRNO();
-		goto error;
+	/* the arg_* buffers are only filled in for servers */
+	if (arg_server) {
+		config.local = arg_local;
+		config.gateway = arg_gateway;
+		config.dns = arg_dns;
+		config.subnet = arg_subnet;
+		config.from = arg_from;
+		config.to = arg_to;
 	}
 
-	m->sfd = signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK);
-	if (m->sfd < 0) {
-		r = log_ERRNO();
-		goto error;
+	if (arg_lease_cache) {
+		r = dhcp_cache_open(&m->cache, arg_lease_cache);
+		if (r < 0)
+			log_warning("cannot open lease cache %s (%d), ignoring it",
+				    arg_lease_cache, r);
+		config.cache = m->cache;
 	}
 
-	m->sfd_chan = g_io_channel_unix_new(m->sfd);
-	m->sfd_id = g_io_add_watch(m->sfd_chan,
-				   G_IO_HUP | G_IO_ERR | G_IO_IN,
-				   manager_signal_fn,
-				   m);
-
-	if (!arg_server) {
-		m->client = g_dhcp_client_new(G_DHCP_IPV4, m->ifindex,
-					      &cerr);
-		if (!m->client) {
-			r = -EINVAL;
-
-			switch (cerr) {
-			case G_DHCP_CLIENT_ERROR_INTERFACE_UNAVAILABLE:
-				log_error("cannot create GDHCP client: interface %s unavailable",
-					  arg_netdev);
-				break;
-			case G_DHCP_CLIENT_ERROR_INTERFACE_IN_USE:
-				log_error("cannot create GDHCP client: interface %s in use",
-					  arg_netdev);
-				break;
-			case G_DHCP_CLIENT_ERROR_INTERFACE_DOWN:
-				log_error("cannot create GDHCP client: interface %s down",
-					  arg_netdev);
-				break;
-			case G_DHCP_CLIENT_ERROR_NOMEM:
-				r = log_ENOMEM();
-				break;
-			case G_DHCP_CLIENT_ERROR_INVALID_INDEX:
-				log_error("cannot create GDHCP client: invalid interface %s",
-					  arg_netdev);
-				break;
-			case G_DHCP_CLIENT_ERROR_INVALID_OPTION:
-				log_error("cannot create GDHCP client: invalid options");
-				break;
-			default:
-				log_error("cannot create GDHCP client (%d)",
-					  cerr);
-				break;
-			}
-
-			goto error;
-		}
-
-		g_dhcp_client_set_send(m->client, G_DHCP_HOST_NAME,
-				       "<hostname>");
-
-		g_dhcp_client_set_request(m->client, G_DHCP_SUBNET);
-		g_dhcp_client_set_request(m->client, G_DHCP_DNS_SERVER);
-		g_dhcp_client_set_request(m->client, G_DHCP_ROUTER);
-
-		g_dhcp_client_register_event(m->client,
-					     G_DHCP_CLIENT_EVENT_LEASE_AVAILABLE,
-					     client_lease_fn, m);
-		g_dhcp_client_register_event(m->client,
-					     G_DHCP_CLIENT_EVENT_NO_LEASE,
-					     client_no_lease_fn, m);
-	} else {
-		r = asprintf(&m->server_addr, "%s/%s", arg_local, arg_subnet);
-		if (r < 0) {
-			r = log_ENOMEM();
-			goto error;
-		}
-
-		r = flush_if_addr();
-		if (r < 0) {
-			log_error("cannot flush addr on local interface %s",
-				  arg_netdev);
-			goto error;
-		}
-
-		r = add_if_addr(m->server_addr);
-		if (r < 0) {
-			log_error("cannot set parameters on local interface %s",
-				  arg_netdev);
-			goto error;
-		}
-
-		m->server = g_dhcp_server_new(G_DHCP_IPV4, m->ifindex,
-					      &serr, server_event_fn, m);
-		if (!m->server) {
-			r = -EINVAL;
-
-			switch(serr) {
-			case G_DHCP_SERVER_ERROR_INTERFACE_UNAVAILABLE:
-				log_error("cannot create GDHCP server: interface %s unavailable",
-					  arg_netdev);
-				break;
-			case G_DHCP_SERVER_ERROR_INTERFACE_IN_USE:
-				log_error("cannot create GDHCP server: interface %s in use",
-					  arg_netdev);
-				break;
-			case G_DHCP_SERVER_ERROR_INTERFACE_DOWN:
-				log_error("cannot create GDHCP server: interface %s down",
-					  arg_netdev);
-				break;
-			case G_DHCP_SERVER_ERROR_NOMEM:
-				r = log_ENOMEM();
-				break;
-			case G_DHCP_SERVER_ERROR_INVALID_INDEX:
-				log_error("cannot create GDHCP server: invalid interface %s",
-					  arg_netdev);
-				break;
-			case G_DHCP_SERVER_ERROR_INVALID_OPTION:
-				log_error("cannot create GDHCP server: invalid options");
-				break;
-			case G_DHCP_SERVER_ERROR_IP_ADDRESS_INVALID:
-				log_error("cannot create GDHCP server: invalid ip address");
-				break;
-			default:
-				log_error("cannot create GDHCP server (%d)",
-					  serr);
-				break;
-			}
-
-			goto error;
-		}
-
-		g_dhcp_server_set_debug(m->server, server_log_fn, NULL);
-		g_dhcp_server_set_lease_time(m->server, 60 * 60);
-
-		r = g_dhcp_server_set_option(m->server, G_DHCP_SUBNET,
-					     arg_subnet);
-		if (r != 0) {
-			log_vERR(r);
-			goto error;
-		}
-
-		r = g_dhcp_server_set_option(m->server, G_DHCP_ROUTER,
-					     arg_gateway);
-		if (r != 0) {
-			log_vERR(r);
-			goto error;
-		}
-
-		r = g_dhcp_server_set_option(m->server, G_DHCP_DNS_SERVER,
-					     arg_dns);
-		if (r != 0) {
-			log_vERR(r);
-			goto error;
-		}
-
-		r = g_dhcp_server_set_ip_range(m->server, arg_from, arg_to);
-		if (r != 0) {
-			log_vERR(r);
-			goto error;
-		}
-	}
+	r = dhcp_engine_new(&m->engine, m->event, &config,
+			    manager_engine_fn, m);
+	if (r < 0)
+		goto error;
 
 	*out = m;
 	return 0;
@@ -667,31 +299,14 @@ static int manager_run(struct manager *m)
 {
 	int r;
 
-	if (!arg_server) {
-		log_info("running dhcp client on %s via '%s'",
-			 arg_netdev, arg_ip_binary);
-
-		r = g_dhcp_client_start(m->client, NULL);
-		if (r != 0) {
-			log_error("cannot start DHCP client: %d", r);
-			return -EFAULT;
-		}
-	} else {
-		log_info("running dhcp server on %s via '%s'",
-			 arg_netdev, arg_ip_binary);
+	log_info("running dhcp %s on %s via '%s'",
+		 arg_server ? "server" : "client", arg_netdev, arg_ip_binary);
 
-		r = g_dhcp_server_start(m->server);
-		if (r != 0) {
-			log_error("cannot start DHCP server: %d", r);
-			return -EFAULT;
-		}
-
-		writef_comm("L:%s", arg_local);
-	}
-
-	g_main_loop_run(m->loop);
+	r = dhcp_engine_start(m->engine);
+	if (r < 0)
+		return r;
 
-	return 0;
+	return sd_event_loop(m->event);
 }
 
 static int make_address(char *buf, const char *prefix, const char *suffix,
@@ -751,6 +366,10 @@ static int help(void)
 	       "     --netdev <dev>         Network device to run on\n"
 	       "     --ip-binary <path>     Path to 'ip' binary [default: /bin/ip]\n"
 	       "     --comm-fd <int>        Comm-socket FD passed through execve()\n"
+	       "     --lease-cache <path>   Reuse leases cached in this file\n"
+	       "\n"
+	       "Client Options:\n"
+	       "     --peer <mac>           P2P address of the server's peer\n"
 	       "\n"
 	       "Server Options:\n"
 	       "     --server               Run as DHCP server instead of client\n"
@@ -776,6 +395,9 @@ static int parse_argv(int argc, char *argv[])
 		ARG_NETDEV,
 		ARG_IP_BINARY,
 		ARG_COMM_FD,
+		ARG_LEASE_CACHE,
+
+		ARG_PEER,
 
 		ARG_SERVER,
 		ARG_PREFIX,
@@ -795,6 +417,9 @@ static int parse_argv(int argc, char *argv[])
 		{ "netdev",	required_argument,	NULL,	ARG_NETDEV },
 		{ "ip-binary",	required_argument,	NULL,	ARG_IP_BINARY },
 		{ "comm-fd",	required_argument,	NULL,	ARG_COMM_FD },
+		{ "lease-cache",	required_argument,	NULL,	ARG_LEASE_CACHE },
+
+		{ "peer",	required_argument,	NULL,	ARG_PEER },
 
 		{ "server",	no_argument,		NULL,	ARG_SERVER },
 		{ "prefix",	required_argument,	NULL,	ARG_PREFIX },
@@ -832,6 +457,16 @@ static int parse_argv(int argc, char *argv[])
 		case ARG_COMM_FD:
 			arg_comm = atoi(optarg);
 			break;
+		case ARG_LEASE_CACHE:
+			arg_lease_cache = optarg;
+			break;
+
+		case ARG_PEER:
+			if (parse_mac(&arg_peer, optarg) < 0 || !arg_peer) {
+				log_error("invalid --peer %s", optarg);
+				return -EINVAL;
+			}
+			break;
 
 		case ARG_SERVER:
 			arg_server = true;
@@ -879,6 +514,11 @@ static int parse_argv(int argc, char *argv[])
 		return -EINVAL;
 	}
 
+	if (arg_server && arg_peer) {
+		log_error("client option given, but running as server");
+		return -EINVAL;
+	}
+
 	if (!arg_server) {
 		if (prefix || local || gateway ||
 		    dns || subnet || from || to) {
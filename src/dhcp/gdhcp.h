@@ -155,9 +155,11 @@ char *g_dhcp_client_get_netmask(GDHCPClient *client);
 GList *g_dhcp_client_get_option(GDHCPClient *client,
 						unsigned char option_code);
 int g_dhcp_client_get_index(GDHCPClient *client);
+uint32_t g_dhcp_client_get_lease_time(GDHCPClient *client);
 
 void g_dhcp_client_set_debug(GDHCPClient *client,
 				GDHCPDebugFunc func, gpointer user_data);
+void g_dhcp_client_set_rapid_commit(GDHCPClient *client, bool enable);
 int g_dhcpv6_create_duid(GDHCPDuidType duid_type, int index, int type,
 			unsigned char **duid, int *duid_len);
 int g_dhcpv6_client_set_duid(GDHCPClient *dhcp_client, unsigned char *duid,
@@ -225,6 +227,9 @@ void g_dhcp_server_set_lease_time(GDHCPServer *dhcp_server,
 						unsigned int lease_time);
 void g_dhcp_server_set_save_lease(GDHCPServer *dhcp_server,
 				GDHCPSaveLeaseFunc func, gpointer user_data);
+void g_dhcp_server_set_rapid_commit(GDHCPServer *dhcp_server, bool enable);
+int g_dhcp_server_add_lease(GDHCPServer *dhcp_server, const uint8_t *mac,
+					uint32_t nip, uint32_t expire);
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,153 @@
+/*
+ * MiracleCast - Wifi-Display/Miracast Implementation
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * MiracleCast is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * MiracleCast is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MiracleCast; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ippool.h"
+
+#define IP_POOL_BITS (sizeof(unsigned long) * CHAR_BIT)
+
+static size_t ip_pool_words(struct ip_pool *p)
+{
+	return (p->size + IP_POOL_BITS - 1) / IP_POOL_BITS;
+}
+
+static bool ip_pool_is_reserved(uint32_t addr)
+{
+	return (addr & 0xff) == 0 || (addr & 0xff) == 0xff;
+}
+
+static bool ip_pool_set(struct ip_pool *p, uint32_t off, bool set)
+{
+	unsigned long *word, bit;
+
+	word = &p->map[off / IP_POOL_BITS];
+	bit = 1UL << (off % IP_POOL_BITS);
+
+	if (!!(*word & bit) == set)
+		return false;
+
+	*word ^= bit;
+	if (set)
+		++p->used;
+	else
+		--p->used;
+
+	return true;
+}
+
+int ip_pool_init(struct ip_pool *p, uint32_t start, uint32_t end)
+{
+	uint32_t i;
+	size_t n;
+
+	memset(p, 0, sizeof(*p));
+
+	if (end < start || end - start == UINT32_MAX)
+		return -EINVAL;
+
+	p->start = start;
+	p->size = end - start + 1;
+
+	n = ip_pool_words(p);
+	p->map = calloc(n, sizeof(*p->map));
+	if (!p->map)
+		return -ENOMEM;
+
+	/* padding bits beyond the range are permanently taken */
+	if (p->size % IP_POOL_BITS)
+		p->map[n - 1] = ~0UL << (p->size % IP_POOL_BITS);
+
+	for (i = 0; i < p->size; ++i)
+		if (ip_pool_is_reserved(start + i))
+			ip_pool_set(p, i, true);
+
+	return 0;
+}
+
+void ip_pool_destroy(struct ip_pool *p)
+{
+	free(p->map);
+	memset(p, 0, sizeof(*p));
+}
+
+void ip_pool_take(struct ip_pool *p, uint32_t addr)
+{
+	if (!ip_pool_contains(p, addr))
+		return;
+
+	ip_pool_set(p, addr - p->start, true);
+}
+
+void ip_pool_put(struct ip_pool *p, uint32_t addr)
+{
+	if (!ip_pool_contains(p, addr) || ip_pool_is_reserved(addr))
+		return;
+
+	ip_pool_set(p, addr - p->start, false);
+}
+
+bool ip_pool_is_taken(struct ip_pool *p, uint32_t addr)
+{
+	uint32_t off;
+
+	if (!ip_pool_contains(p, addr))
+		return true;
+
+	off = addr - p->start;
+	return p->map[off / IP_POOL_BITS] & (1UL << (off % IP_POOL_BITS));
+}
+
+/*
+ * Return the first free address at or after the cursor, wrapping around at
+ * the end of the range, and move the cursor behind it. The address is not
+ * taken; call ip_pool_take() once it is leased. Returns 0 if the pool is full.
+ */
+uint32_t ip_pool_next(struct ip_pool *p)
+{
+	size_t i, w, n;
+	unsigned long word;
+	uint32_t off;
+
+	if (!p->map || p->used >= p->size)
+		return 0;
+
+	n = ip_pool_words(p);
+	w = p->cursor / IP_POOL_BITS;
+
+	/* ignore bits before the cursor until we wrapped around */
+	word = ~p->map[w] & (~0UL << (p->cursor % IP_POOL_BITS));
+
+	for (i = 0; i <= n; ++i) {
+		if (word) {
+			off = w * IP_POOL_BITS + __builtin_ctzl(word);
+			p->cursor = (off + 1) % p->size;
+			return p->start + off;
+		}
+
+		w = (w + 1) % n;
+		word = ~p->map[w];
+	}
+
+	return 0;
+}
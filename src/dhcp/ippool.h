@@ -0,0 +1,57 @@
+/*
+ * MiracleCast - Wifi-Display/Miracast Implementation
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * MiracleCast is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * MiracleCast is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MiracleCast; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * IPv4 Address Pool
+ * Tracks which addresses of a DHCP range are in use with one bit per address.
+ * Free addresses are found with find-first-zero on whole words, starting at a
+ * rotating cursor so recently released addresses are handed out last. All
+ * addresses are passed in host byte-order. Network (x.x.x.0) and broadcast
+ * (x.x.x.255) addresses are reserved and never handed out.
+ */
+
+#ifndef MIRACLE_IPPOOL_H
+#define MIRACLE_IPPOOL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+struct ip_pool {
+	uint32_t start;
+	uint32_t size;			/* number of addresses in the range */
+	uint32_t used;			/* taken addresses, including reserved ones */
+	uint32_t cursor;		/* next offset to search from */
+	unsigned long *map;
+};
+
+int ip_pool_init(struct ip_pool *p, uint32_t start, uint32_t end);
+void ip_pool_destroy(struct ip_pool *p);
+
+void ip_pool_take(struct ip_pool *p, uint32_t addr);
+void ip_pool_put(struct ip_pool *p, uint32_t addr);
+bool ip_pool_is_taken(struct ip_pool *p, uint32_t addr);
+uint32_t ip_pool_next(struct ip_pool *p);
+
+static inline bool ip_pool_contains(struct ip_pool *p, uint32_t addr)
+{
+	return p->map && addr >= p->start && addr - p->start < p->size;
+}
+
+#endif /* MIRACLE_IPPOOL_H */
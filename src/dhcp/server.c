@@ -42,6 +42,7 @@
 #include <glib.h>
 
 #include "common.h"
+#include "ippool.h"
 
 /* 8 hours */
 #define DEFAULT_DHCP_LEASE_SEC (8*60*60)
@@ -62,10 +63,16 @@ struct _GDHCPServer {
 	int listener_sockfd;
 	guint listener_watch;
 	GIOChannel *listener_channel;
-	GList *lease_list;
 	GHashTable *nip_lease_hash;
+	GHashTable *mac_lease_hash;
+	struct ip_pool nip_pool; /* addresses of nip_lease_hash */
+	/* min-heap of all leases, the one expiring first on top */
+	struct dhcp_lease **lease_heap;
+	guint lease_heap_len;
+	guint lease_heap_size;
 	GHashTable *option_hash; /* Options send to client */
 	GDHCPSaveLeaseFunc save_lease_func;
+	bool rapid_commit;
 	GDHCPDebugFunc debug_func;
 	gpointer debug_data;
 	g_dhcp_event_fn event_fn;
@@ -76,6 +83,8 @@ struct dhcp_lease {
 	time_t expire;
 	uint32_t lease_nip;
 	uint8_t lease_mac[ETH_ALEN];
+	guint heap_index;
+	bool seeded;
 };
 
 static inline void debug(GDHCPServer *server, const char *format, ...)
@@ -94,28 +103,140 @@ static inline void debug(GDHCPServer *server, const char *format, ...)
 	va_end(ap);
 }
 
-static struct dhcp_lease *find_lease_by_mac(GDHCPServer *dhcp_server,
-						const uint8_t *mac)
+/* FNV-1a over the 6 MAC bytes */
+static guint mac_hash(gconstpointer key)
 {
-	GList *list;
+	const uint8_t *mac = key;
+	guint32 hash = 2166136261U;
+	int i;
 
-	for (list = dhcp_server->lease_list; list; list = list->next) {
-		struct dhcp_lease *lease = list->data;
+	for (i = 0; i < ETH_ALEN; i++) {
+		hash ^= mac[i];
+		hash *= 16777619U;
+	}
+
+	return hash;
+}
 
-		if (memcmp(lease->lease_mac, mac, ETH_ALEN) == 0)
-			return lease;
+static gboolean mac_equal(gconstpointer a, gconstpointer b)
+{
+	return memcmp(a, b, ETH_ALEN) == 0;
+}
+
+static void lease_heap_swap(GDHCPServer *dhcp_server, guint i, guint j)
+{
+	struct dhcp_lease **heap = dhcp_server->lease_heap;
+	struct dhcp_lease *t = heap[i];
+
+	heap[i] = heap[j];
+	heap[j] = t;
+	heap[i]->heap_index = i;
+	heap[j]->heap_index = j;
+}
+
+static void lease_heap_up(GDHCPServer *dhcp_server, guint i)
+{
+	struct dhcp_lease **heap = dhcp_server->lease_heap;
+
+	while (i > 0 && heap[(i - 1) / 2]->expire > heap[i]->expire) {
+		lease_heap_swap(dhcp_server, i, (i - 1) / 2);
+		i = (i - 1) / 2;
 	}
+}
 
-	return NULL;
+static void lease_heap_down(GDHCPServer *dhcp_server, guint i)
+{
+	struct dhcp_lease **heap = dhcp_server->lease_heap;
+	guint len = dhcp_server->lease_heap_len;
+	guint min, c;
+
+	for (;;) {
+		min = i;
+		c = 2 * i + 1;
+		if (c < len && heap[c]->expire < heap[min]->expire)
+			min = c;
+		if (c + 1 < len && heap[c + 1]->expire < heap[min]->expire)
+			min = c + 1;
+		if (min == i)
+			break;
+
+		lease_heap_swap(dhcp_server, i, min);
+		i = min;
+	}
 }
 
-static void remove_lease(GDHCPServer *dhcp_server, struct dhcp_lease *lease)
+static bool lease_heap_reserve(GDHCPServer *dhcp_server)
+{
+	struct dhcp_lease **heap;
+	guint size;
+
+	if (dhcp_server->lease_heap_len < dhcp_server->lease_heap_size)
+		return true;
+
+	size = dhcp_server->lease_heap_size ? dhcp_server->lease_heap_size * 2
+					    : 16;
+	heap = g_try_renew(struct dhcp_lease *, dhcp_server->lease_heap,
+									size);
+	if (!heap)
+		return false;
+
+	dhcp_server->lease_heap = heap;
+	dhcp_server->lease_heap_size = size;
+	return true;
+}
+
+/* Caller must have reserved room via lease_heap_reserve() */
+static void lease_heap_insert(GDHCPServer *dhcp_server,
+					struct dhcp_lease *lease)
+{
+	lease->heap_index = dhcp_server->lease_heap_len++;
+	dhcp_server->lease_heap[lease->heap_index] = lease;
+	lease_heap_up(dhcp_server, lease->heap_index);
+}
+
+static void lease_heap_remove(GDHCPServer *dhcp_server,
+					struct dhcp_lease *lease)
+{
+	guint i = lease->heap_index;
+	guint last = --dhcp_server->lease_heap_len;
+
+	if (i == last)
+		return;
+
+	lease_heap_swap(dhcp_server, i, last);
+	lease_heap_up(dhcp_server, i);
+	lease_heap_down(dhcp_server, i);
+}
+
+static struct dhcp_lease *find_lease_by_mac(GDHCPServer *dhcp_server,
+						const uint8_t *mac)
 {
-	dhcp_server->lease_list =
-			g_list_remove(dhcp_server->lease_list, lease);
+	return g_hash_table_lookup(dhcp_server->mac_lease_hash, mac);
+}
 
+/* Drop @lease from all lookup structures, but keep it allocated */
+static void unlink_lease(GDHCPServer *dhcp_server, struct dhcp_lease *lease)
+{
 	g_hash_table_remove(dhcp_server->nip_lease_hash,
 				GINT_TO_POINTER((int) lease->lease_nip));
+	g_hash_table_remove(dhcp_server->mac_lease_hash, lease->lease_mac);
+	lease_heap_remove(dhcp_server, lease);
+	ip_pool_put(&dhcp_server->nip_pool, lease->lease_nip);
+}
+
+static void link_lease(GDHCPServer *dhcp_server, struct dhcp_lease *lease)
+{
+	g_hash_table_insert(dhcp_server->nip_lease_hash,
+				GINT_TO_POINTER((int) lease->lease_nip), lease);
+	g_hash_table_insert(dhcp_server->mac_lease_hash,
+					lease->lease_mac, lease);
+	lease_heap_insert(dhcp_server, lease);
+	ip_pool_take(&dhcp_server->nip_pool, lease->lease_nip);
+}
+
+static void remove_lease(GDHCPServer *dhcp_server, struct dhcp_lease *lease)
+{
+	unlink_lease(dhcp_server, lease);
 	g_free(lease);
 }
 
@@ -147,11 +268,7 @@ static int get_lease(GDHCPServer *dhcp_server, uint32_t yiaddr,
 	debug(dhcp_server, "lease_mac %p lease_nip %p", lease_mac, lease_nip);
 
 	if (lease_nip) {
-		dhcp_server->lease_list =
-				g_list_remove(dhcp_server->lease_list,
-								lease_nip);
-		g_hash_table_remove(dhcp_server->nip_lease_hash,
-				GINT_TO_POINTER((int) ntohl(yiaddr)));
+		unlink_lease(dhcp_server, lease_nip);
 
 		if (!lease_mac)
 			*lease = lease_nip;
@@ -165,11 +282,7 @@ static int get_lease(GDHCPServer *dhcp_server, uint32_t yiaddr,
 	}
 
 	if (lease_mac) {
-		dhcp_server->lease_list =
-				g_list_remove(dhcp_server->lease_list,
-								lease_mac);
-		g_hash_table_remove(dhcp_server->nip_lease_hash,
-				GINT_TO_POINTER((int) lease_mac->lease_nip));
+		unlink_lease(dhcp_server, lease_mac);
 		*lease = lease_mac;
 
 		return 0;
@@ -182,14 +295,6 @@ static int get_lease(GDHCPServer *dhcp_server, uint32_t yiaddr,
 	return 0;
 }
 
-static gint compare_expire(gconstpointer a, gconstpointer b)
-{
-	const struct dhcp_lease *lease1 = a;
-	const struct dhcp_lease *lease2 = b;
-
-	return lease2->expire - lease1->expire;
-}
-
 static struct dhcp_lease *add_lease(GDHCPServer *dhcp_server, uint32_t expire,
 					const uint8_t *chaddr, uint32_t yiaddr)
 {
@@ -200,6 +305,11 @@ static struct dhcp_lease *add_lease(GDHCPServer *dhcp_server, uint32_t expire,
 	if (ret != 0)
 		return NULL;
 
+	if (!lease_heap_reserve(dhcp_server)) {
+		g_free(lease);
+		return NULL;
+	}
+
 	memset(lease, 0, sizeof(*lease));
 
 	memcpy(lease->lease_mac, chaddr, ETH_ALEN);
@@ -210,11 +320,7 @@ static struct dhcp_lease *add_lease(GDHCPServer *dhcp_server, uint32_t expire,
 	else
 		lease->expire = expire;
 
-	dhcp_server->lease_list = g_list_insert_sorted(dhcp_server->lease_list,
-							lease, compare_expire);
-
-	g_hash_table_insert(dhcp_server->nip_lease_hash,
-				GINT_TO_POINTER((int) lease->lease_nip), lease);
+	link_lease(dhcp_server, lease);
 
 	return lease;
 }
@@ -241,39 +347,46 @@ static bool is_expired_lease(struct dhcp_lease *lease)
 	return false;
 }
 
+/*
+ * Seeded leases only keep an address for a returning client, which might
+ * come back with a different MAC (P2P interface addresses are often random).
+ * So they yield to any other client that explicitly asks for their address.
+ */
+static void release_seeded_lease(GDHCPServer *dhcp_server,
+					uint32_t requested_nip,
+					const uint8_t *chaddr)
+{
+	struct dhcp_lease *lease;
+
+	lease = find_lease_by_nip(dhcp_server, requested_nip);
+	if (lease && lease->seeded &&
+			memcmp(lease->lease_mac, chaddr, ETH_ALEN) != 0) {
+		debug(dhcp_server, "Releasing seeded lease to new client");
+		remove_lease(dhcp_server, lease);
+	}
+}
+
+/*
+ * The pool has a bit set for every address in nip_lease_hash (and for network
+ * and broadcast addresses), so the first clear bit after the rotating cursor
+ * is a free address. No per-address lease lookup is needed.
+ */
 static uint32_t find_free_or_expired_nip(GDHCPServer *dhcp_server,
 					const uint8_t *safe_mac)
 {
 	uint32_t ip_addr;
 	struct dhcp_lease *lease;
-	GList *list;
-	ip_addr = dhcp_server->start_ip;
-	for (; ip_addr <= dhcp_server->end_ip; ip_addr++) {
-		/* e.g. 192.168.55.0 */
-		if ((ip_addr & 0xff) == 0)
-			continue;
-
-		/* e.g. 192.168.55.255 */
-		if ((ip_addr & 0xff) == 0xff)
-			continue;
-
-		lease = find_lease_by_nip(dhcp_server, ip_addr);
-		if (lease)
-			continue;
-
-		if (arp_check(htonl(ip_addr), safe_mac))
-			return ip_addr;
-	}
 
-	/* The last lease is the oldest one */
-	list = g_list_last(dhcp_server->lease_list);
-	if (!list)
-		return 0;
+	ip_addr = ip_pool_next(&dhcp_server->nip_pool);
+	if (ip_addr && arp_check(htonl(ip_addr), safe_mac))
+		return ip_addr;
 
-	lease = list->data;
-	if (!lease)
+	/* The top of the heap is the oldest one */
+	if (!dhcp_server->lease_heap_len)
 		return 0;
 
+	lease = dhcp_server->lease_heap[0];
+
 	 if (!is_expired_lease(lease))
 		return 0;
 
@@ -286,31 +399,32 @@ static uint32_t find_free_or_expired_nip(GDHCPServer *dhcp_server,
 static void lease_set_expire(GDHCPServer *dhcp_server,
 			struct dhcp_lease *lease, uint32_t expire)
 {
-	dhcp_server->lease_list = g_list_remove(dhcp_server->lease_list, lease);
-
 	lease->expire = expire;
 
-	dhcp_server->lease_list = g_list_insert_sorted(dhcp_server->lease_list,
-							lease, compare_expire);
+	lease_heap_up(dhcp_server, lease->heap_index);
+	lease_heap_down(dhcp_server, lease->heap_index);
 }
 
 static void destroy_lease_table(GDHCPServer *dhcp_server)
 {
-	GList *list;
+	guint i;
 
 	g_hash_table_destroy(dhcp_server->nip_lease_hash);
+	g_hash_table_destroy(dhcp_server->mac_lease_hash);
 
 	dhcp_server->nip_lease_hash = NULL;
+	dhcp_server->mac_lease_hash = NULL;
 
-	for (list = dhcp_server->lease_list; list; list = list->next) {
-		struct dhcp_lease *lease = list->data;
+	for (i = 0; i < dhcp_server->lease_heap_len; i++)
+		g_free(dhcp_server->lease_heap[i]);
 
-		g_free(lease);
-	}
+	g_free(dhcp_server->lease_heap);
 
-	g_list_free(dhcp_server->lease_list);
+	dhcp_server->lease_heap = NULL;
+	dhcp_server->lease_heap_len = 0;
+	dhcp_server->lease_heap_size = 0;
 
-	dhcp_server->lease_list = NULL;
+	ip_pool_destroy(&dhcp_server->nip_pool);
 }
 static uint32_t get_interface_address(int index)
 {
@@ -385,6 +499,8 @@ GDHCPServer *g_dhcp_server_new(GDHCPType type,
 
 	dhcp_server->nip_lease_hash = g_hash_table_new_full(g_direct_hash,
 						g_direct_equal, NULL, NULL);
+	dhcp_server->mac_lease_hash = g_hash_table_new_full(mac_hash,
+						mac_equal, NULL, NULL);
 	dhcp_server->option_hash = g_hash_table_new_full(g_direct_hash,
 						g_direct_equal, NULL, NULL);
 
@@ -538,6 +654,20 @@ static void send_packet_to_client(GDHCPServer *dhcp_server,
 		dhcp_server->ifindex);
 }
 
+static uint32_t select_nip(GDHCPServer *dhcp_server,
+			struct dhcp_packet *client_packet,
+				struct dhcp_lease *lease,
+					uint32_t requested_nip)
+{
+	if (lease)
+		return lease->lease_nip;
+	else if (check_requested_nip(dhcp_server, requested_nip))
+		return requested_nip;
+	else
+		return find_free_or_expired_nip(dhcp_server,
+						client_packet->chaddr);
+}
+
 static void send_offer(GDHCPServer *dhcp_server,
 			struct dhcp_packet *client_packet,
 				struct dhcp_lease *lease,
@@ -548,13 +678,8 @@ static void send_offer(GDHCPServer *dhcp_server,
 
 	init_packet(dhcp_server, &packet, client_packet, DHCPOFFER);
 
-	if (lease)
-		packet.yiaddr = htonl(lease->lease_nip);
-	else if (check_requested_nip(dhcp_server, requested_nip))
-		packet.yiaddr = htonl(requested_nip);
-	else
-		packet.yiaddr = htonl(find_free_or_expired_nip(
-					dhcp_server, client_packet->chaddr));
+	packet.yiaddr = htonl(select_nip(dhcp_server, client_packet,
+						lease, requested_nip));
 
 	debug(dhcp_server, "find yiaddr %u", packet.yiaddr);
 
@@ -583,20 +708,21 @@ static void send_offer(GDHCPServer *dhcp_server,
 
 static void save_lease(GDHCPServer *dhcp_server)
 {
-	GList *list;
+	guint i;
 
 	if (!dhcp_server->save_lease_func)
 		return;
 
-	for (list = dhcp_server->lease_list; list; list = list->next) {
-		struct dhcp_lease *lease = list->data;
+	for (i = 0; i < dhcp_server->lease_heap_len; i++) {
+		struct dhcp_lease *lease = dhcp_server->lease_heap[i];
 		dhcp_server->save_lease_func(lease->lease_mac,
 					lease->lease_nip, lease->expire);
 	}
 }
 
 static void send_ACK(GDHCPServer *dhcp_server,
-		struct dhcp_packet *client_packet, uint32_t dest)
+		struct dhcp_packet *client_packet, uint32_t dest,
+							bool rapid_commit)
 {
 	struct dhcp_packet packet;
 	uint32_t lease_time_sec;
@@ -605,6 +731,9 @@ static void send_ACK(GDHCPServer *dhcp_server,
 	init_packet(dhcp_server, &packet, client_packet, DHCPACK);
 	packet.yiaddr = htonl(dest);
 
+	if (rapid_commit)
+		dhcp_add_option_flag(&packet, DHCP_RAPID_COMMIT);
+
 	lease_time_sec = dhcp_server->lease_seconds;
 
 	dhcp_add_option_uint32(&packet, DHCP_LEASE_TIME, lease_time_sec);
@@ -625,6 +754,31 @@ static void send_ACK(GDHCPServer *dhcp_server,
 				      dhcp_server->fn_data);
 }
 
+/* RFC 4039: commit the lease right away and skip OFFER/REQUEST */
+static void send_rapid_ACK(GDHCPServer *dhcp_server,
+			struct dhcp_packet *client_packet,
+				struct dhcp_lease *lease,
+					uint32_t requested_nip)
+{
+	uint32_t nip;
+
+	nip = select_nip(dhcp_server, client_packet, lease, requested_nip);
+	if (!nip) {
+		debug(dhcp_server, "Err: No free IP addresses. ACK abandoned");
+		return;
+	}
+
+	/* reserve the address the same way an OFFER would */
+	if (!add_lease(dhcp_server, OFFER_TIME, client_packet->chaddr,
+							htonl(nip))) {
+		debug(dhcp_server, "Err: No free IP addresses. ACK abandoned");
+		return;
+	}
+
+	debug(dhcp_server, "Sending rapid commit ACK");
+	send_ACK(dhcp_server, client_packet, nip, true);
+}
+
 static void send_NAK(GDHCPServer *dhcp_server,
 			struct dhcp_packet *client_packet)
 {
@@ -691,7 +845,16 @@ static gboolean listener_event(GIOChannel *channel, GIOCondition condition,
 	case DHCPDISCOVER:
 		debug(dhcp_server, "Received DISCOVER");
 
-		send_offer(dhcp_server, &packet, lease, requested_nip);
+		if (!lease && requested_nip)
+			release_seeded_lease(dhcp_server, requested_nip,
+							packet.chaddr);
+
+		if (dhcp_server->rapid_commit &&
+				dhcp_get_option(&packet, DHCP_RAPID_COMMIT))
+			send_rapid_ACK(dhcp_server, &packet, lease,
+							requested_nip);
+		else
+			send_offer(dhcp_server, &packet, lease, requested_nip);
 		break;
 	case DHCPREQUEST:
 		debug(dhcp_server, "Received REQUEST NIP %d",
@@ -703,15 +866,22 @@ static gboolean listener_event(GIOChannel *channel, GIOCondition condition,
 		}
 
 		if (!lease) {
+			release_seeded_lease(dhcp_server, requested_nip,
+							packet.chaddr);
+
 			/* check if requested address free */
-			lease = add_lease(dhcp_server, OFFER_TIME,
+			lease = find_lease_by_nip(dhcp_server, requested_nip);
+			if (lease && !is_expired_lease(lease))
+				lease = NULL;
+			else
+				lease = add_lease(dhcp_server, OFFER_TIME,
 						packet.chaddr, htonl(requested_nip));
 		}
 
 		if (lease && requested_nip == lease->lease_nip) {
 			debug(dhcp_server, "Sending ACK");
 			send_ACK(dhcp_server, &packet,
-				lease->lease_nip);
+				lease->lease_nip, false);
 			break;
 		}
 
@@ -746,7 +916,7 @@ static gboolean listener_event(GIOChannel *channel, GIOCondition condition,
 		if (!lease)
 			break;
 
-		if (packet.ciaddr == lease->lease_nip)
+		if (ntohl(packet.ciaddr) == lease->lease_nip)
 			lease_set_expire(dhcp_server, lease,
 					time(NULL));
 		break;
@@ -879,16 +1049,67 @@ int g_dhcp_server_set_ip_range(GDHCPServer *dhcp_server,
 		const char *start_ip, const char *end_ip)
 {
 	struct in_addr _host_addr;
+	GHashTableIter iter;
+	gpointer key;
+	uint32_t start, end;
+	int ret;
 
 	if (inet_aton(start_ip, &_host_addr) == 0)
 		return -ENXIO;
 
-	dhcp_server->start_ip = ntohl(_host_addr.s_addr);
+	start = ntohl(_host_addr.s_addr);
 
 	if (inet_aton(end_ip, &_host_addr) == 0)
 		return -ENXIO;
 
-	dhcp_server->end_ip = ntohl(_host_addr.s_addr);
+	end = ntohl(_host_addr.s_addr);
+
+	ip_pool_destroy(&dhcp_server->nip_pool);
+	ret = ip_pool_init(&dhcp_server->nip_pool, start, end);
+	if (ret < 0)
+		return ret;
+
+	dhcp_server->start_ip = start;
+	dhcp_server->end_ip = end;
+
+	/* re-sync the pool with leases we already have */
+	g_hash_table_iter_init(&iter, dhcp_server->nip_lease_hash);
+	while (g_hash_table_iter_next(&iter, &key, NULL))
+		ip_pool_take(&dhcp_server->nip_pool,
+					(uint32_t) GPOINTER_TO_INT(key));
+
+	return 0;
+}
+
+void g_dhcp_server_set_rapid_commit(GDHCPServer *dhcp_server, bool enable)
+{
+	if (!dhcp_server)
+		return;
+
+	dhcp_server->rapid_commit = enable;
+}
+
+/*
+ * Add a lease that was handed out before, e.g. by a previous server instance.
+ * @nip is in host byte-order and @expire in seconds since the epoch. Expired
+ * leases and addresses outside the IP range are refused.
+ */
+int g_dhcp_server_add_lease(GDHCPServer *dhcp_server, const uint8_t *mac,
+					uint32_t nip, uint32_t expire)
+{
+	struct dhcp_lease *lease;
+
+	if (!dhcp_server || !mac)
+		return -EINVAL;
+
+	if (expire < time(NULL))
+		return -ETIMEDOUT;
+
+	lease = add_lease(dhcp_server, expire, mac, htonl(nip));
+	if (!lease)
+		return -ENXIO;
+
+	lease->seeded = true;
 
 	return 0;
 }
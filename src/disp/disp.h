@@ -149,6 +149,9 @@ struct wfd_sink
 	struct wfd_session *session;
 
 	sd_event_source *session_cleanup_source;
+
+	/* M4 SET_PARAMETER template, shared by all sessions to this sink */
+	struct rtsp_template *m4_template;
 };
 
 int wfd_sink_new(struct wfd_sink **out,
@@ -740,36 +740,31 @@ static int wfd_out_session_request_not_implement(struct wfd_session *s,
 					NULL);
 }
 
-static int wfd_out_session_request_set_parameter(struct wfd_session *s,
-				const struct wfd_arg_list *args,
-				struct rtsp_message **out)
+/* placeholders of the M4 template, in the order of their stamped values */
+static const char *wfd_out_session_m4_placeholders[] = {
+	"@PRESENTATION_URL@",
+	"@RTP_PORT0@",
+	"@RTP_PORT1@",
+	NULL
+};
+
+static int wfd_out_session_build_m4_template(struct wfd_session *s,
+				struct rtsp_template **out)
 {
 	_rtsp_message_unref_ struct rtsp_message *m = NULL;
 	_shl_free_ char *body = NULL;
 	int r;
 
-	r = wfd_session_gen_stream_url(s,
-					wfd_out_session(s)->sink->peer->local_address,
-					WFD_STREAM_ID_PRIMARY);
-	if(0 > r) {
-		return log_ERRNO();
-	}
-
-	s->stream.id = WFD_STREAM_ID_PRIMARY;
-
 	r = asprintf(&body,
 					"wfd_video_formats: 00 00 02 10 %08X %08X %08X 00 0000 0000 00 none none\n"
 					"wfd_audio_codecs: AAC 00000001 00\n"
-					"wfd_presentation_URL: %s none\n"
-					"wfd_client_rtp_ports: RTP/AVP/UDP;unicast %u %u mode=play",
+					"wfd_presentation_URL: @PRESENTATION_URL@ none\n"
+					"wfd_client_rtp_ports: RTP/AVP/UDP;unicast @RTP_PORT0@ @RTP_PORT1@ mode=play",
 					//"wfd_uibc_capability: input_category_list=GENERIC\n;generic_cap_list=SingleTouch;hidc_cap_list=none;port=5100\n"
 					//"wfd_uibc_setting: disable\n",
 					0x80,
 					0,
-					0,
-					wfd_session_get_stream_url(s),
-					s->rtp_ports[0],
-					s->rtp_ports[1]);
+					0);
 	if(0 > r) {
 		return log_ERRNO();
 	}
@@ -787,8 +782,50 @@ static int wfd_out_session_request_set_parameter(struct wfd_session *s,
 		return log_ERRNO();
 	}
 
-	*out = m;
-	m = NULL;
+	r = rtsp_template_new(out, m, wfd_out_session_m4_placeholders);
+	if (0 > r) {
+		return log_ERR(r);
+	}
+
+	return 0;
+}
+
+static int wfd_out_session_request_set_parameter(struct wfd_session *s,
+				const struct wfd_arg_list *args,
+				struct rtsp_message **out)
+{
+	struct wfd_sink *sink = wfd_out_session(s)->sink;
+	char port0[16], port1[16];
+	const char *values[4];
+	int r;
+
+	r = wfd_session_gen_stream_url(s,
+					sink->peer->local_address,
+					WFD_STREAM_ID_PRIMARY);
+	if(0 > r) {
+		return log_ERRNO();
+	}
+
+	s->stream.id = WFD_STREAM_ID_PRIMARY;
+
+	if(!sink->m4_template) {
+		r = wfd_out_session_build_m4_template(s, &sink->m4_template);
+		if(0 > r) {
+			return r;
+		}
+	}
+
+	snprintf(port0, sizeof(port0), "%u", s->rtp_ports[0]);
+	snprintf(port1, sizeof(port1), "%u", s->rtp_ports[1]);
+	values[0] = wfd_session_get_stream_url(s);
+	values[1] = port0;
+	values[2] = port1;
+	values[3] = NULL;
+
+	r = rtsp_template_stamp(sink->m4_template, s->rtsp, out, values);
+	if (0 > r) {
+		return log_ERR(r);
+	}
 
 	return 0;
 }
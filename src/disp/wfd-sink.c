@@ -20,6 +20,7 @@
 #include <systemd/sd-event.h>
 #include "ctl.h"
 #include "disp.h"
+#include "rtsp.h"
 #include "wfd-dbus.h"
 
 static int wfd_sink_set_session(struct wfd_sink *sink,
@@ -90,6 +91,7 @@ void wfd_sink_free(struct wfd_sink *sink)
 	}
 
 	wfd_sink_set_session(sink, NULL);
+	rtsp_template_free(sink->m4_template);
 
 	if(sink->label) {
 		free(sink->label);
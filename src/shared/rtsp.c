@@ -32,20 +32,52 @@
 #include <time.h>
 #include <unistd.h>
 #include "rtsp.h"
+#include "shl_arena.h"
 #include "shl_dlist.h"
 #include "shl_htable.h"
 #include "shl_macro.h"
 #include "shl_ring.h"
 #include "shl_util.h"
+#include "twheel.h"
 
 /* 5s default timeout for messages */
 #define RTSP_DEFAULT_TIMEOUT (5ULL * 1000ULL * 1000ULL)
 
+/* minimum free space in the parser ring for each receive */
+#define RTSP_READ_SIZE 4096
+
+/* maximum number of queued messages sent with a single sendmsg() */
+#define RTSP_WRITE_IOV 16
+
+/* initial arena size of each message; fits usual control messages */
+#define RTSP_ARENA_SIZE 4096
+
+/* default and maximum number of recycled message arenas per bus */
+#define RTSP_ARENA_CACHE 8
+#define RTSP_ARENA_CACHE_MAX 64
+
+/* sealed messages with at least this many headers get a lookup index */
+#define RTSP_HEADER_INDEX_MIN 8
+
+/* default parser limits; see rtsp_set_limits() */
+#define RTSP_DEFAULT_MAX_RING (1024 * 1024)
+#define RTSP_DEFAULT_MAX_HEADERS 128
+#define RTSP_DEFAULT_MAX_BODY (256 * 1024)
+#define RTSP_DEFAULT_IDLE_SHRINK (30ULL * 1000ULL * 1000ULL)
+
 /* CSeq numbers have separate namespaces for locally and remotely generated
  * messages. We use a single lookup-table, so mark all remotely generated
  * cookies as such to avoid conflicts with local cookies. */
 #define RTSP_FLAG_REMOTE_COOKIE 0x8000000000000000ULL
 
+/* interleaved data channels are addressed by a single byte */
+#define RTSP_DATA_CHANNELS 256
+
+struct rtsp_data_handler {
+	rtsp_data_fn cb_fn;
+	void *data;
+};
+
 struct rtsp {
 	unsigned long ref;
 	uint64_t cookies;
@@ -54,16 +86,36 @@ struct rtsp {
 
 	sd_event *event;
 	int64_t priority;
+	struct twheel *wheel;
 	struct shl_dlist matches;
+	struct rtsp_data_handler *data_handlers;
 
 	/* outgoing messages */
 	struct shl_dlist outgoing;
 	size_t outgoing_cnt;
+	unsigned int corked;
 
 	/* waiting messages */
 	struct shl_htable waiting;
 	size_t waiting_cnt;
 
+	/* recycled message arenas */
+	struct shl_arena *arenas[RTSP_ARENA_CACHE_MAX];
+	size_t arena_cnt;
+	size_t arena_max;
+	size_t arena_bytes;
+	struct rtsp_alloc_stats alloc_stats;
+
+	/* memory limits and idle shrinking */
+	struct rtsp_limits limits;
+	struct rtsp_mem_stats mem_stats;
+	struct twheel_timer idle_timer;
+	uint64_t last_read;
+
+	/* scratch buffer for line parsing */
+	char *scratch;
+	size_t scratch_size;
+
 	/* ring parser */
 	struct rtsp_parser {
 		struct rtsp_message *m;
@@ -86,6 +138,9 @@ struct rtsp {
 		size_t data_size;
 		uint8_t data_channel;
 
+		/* status code if the current message is rejected, or 0 */
+		unsigned int reject;
+
 		bool quoted : 1;
 		bool dead : 1;
 	} parser;
@@ -112,9 +167,15 @@ struct rtsp_header {
 	size_t line_len;
 };
 
+struct rtsp_header_index {
+	size_t mask;
+	uint32_t slots[];		/* header position + 1, 0 if unused */
+};
+
 struct rtsp_message {
 	unsigned long ref;
 	struct rtsp *bus;
+	struct shl_arena *arena;
 	struct shl_dlist list;
 
 	unsigned int type;
@@ -150,6 +211,7 @@ struct rtsp_message {
 	struct rtsp_header *header_clen;
 	struct rtsp_header *header_ctype;
 	struct rtsp_header *header_cseq;
+	struct rtsp_header_index *header_index;
 
 	/* body */
 	uint8_t *body;
@@ -157,9 +219,10 @@ struct rtsp_message {
 	size_t body_cnt;
 	size_t body_used;
 	struct rtsp_header *body_headers;
+	struct rtsp_header_index *body_index;
 
 	/* transmission */
-	sd_event_source *timer_source;
+	struct twheel_timer timer;
 	rtsp_callback_fn cb_fn;
 	void *fn_data;
 	uint64_t timeout;
@@ -185,6 +248,7 @@ struct rtsp_message {
 
 static void rtsp_free_match(struct rtsp_match *match);
 static void rtsp_drop_message(struct rtsp_message *m);
+static void rtsp_timer_fn(struct twheel_timer *t, void *data);
 static int rtsp_incoming_message(struct rtsp_message *m);
 
 /*
@@ -258,6 +322,50 @@ static const char *get_code_description(unsigned int code)
 	return code_descriptions[code] ? : error;
 }
 
+/* recalculate the bytes currently held by the buffers of @bus */
+static void rtsp_update_mem(struct rtsp *bus)
+{
+	struct rtsp_mem_stats *st = &bus->mem_stats;
+
+	st->current = shl_ring_get_capacity(&bus->parser.buf) +
+		      bus->scratch_size +
+		      bus->arena_bytes;
+	if (st->current > st->peak)
+		st->peak = st->current;
+}
+
+/*
+ * Return the scratch buffer of @bus with room for at least @size bytes. It is
+ * used for temporary line copies during parsing and only grows until it is
+ * released by rtsp_shrink(), so it stops allocating once it reached the size
+ * of the longest line seen.
+ */
+static char *rtsp_get_scratch(struct rtsp *bus, size_t size)
+{
+	if (size > bus->scratch_size) {
+		if (!SHL_GREEDY_REALLOC_T(bus->scratch,
+					  bus->scratch_size,
+					  size))
+			return NULL;
+
+		++bus->alloc_stats.heap_allocs;
+		rtsp_update_mem(bus);
+	}
+
+	return bus->scratch;
+}
+
+static void rtsp_drop_arenas(struct rtsp *bus, size_t max)
+{
+	struct shl_arena *a;
+
+	while (bus->arena_cnt > max) {
+		a = bus->arenas[--bus->arena_cnt];
+		bus->arena_bytes -= shl_arena_get_size(a);
+		shl_arena_free(a);
+	}
+}
+
 static size_t sanitize_line(char *line, size_t len)
 {
 	char *src, *dst, c, prev, last_c;
@@ -345,29 +453,50 @@ static size_t sanitize_line(char *line, size_t len)
  * Note that messages provide sealing-capabilities. Once a message is sealed,
  * it can never be modified again. All messages that are submitted to the bus
  * layer, or are received from the bus layer, are always sealed.
+ *
+ * Each message owns an arena which everything it allocates (including the
+ * message object itself) is taken from. Nothing is freed individually, the
+ * arena is released as a whole once the last reference is dropped. Released
+ * arenas are kept on the bus for reuse, so steady traffic of small messages
+ * does not hit the heap at all.
  */
 
 static int rtsp_message_new(struct rtsp *bus,
 			    struct rtsp_message **out)
 {
-	_rtsp_message_unref_ struct rtsp_message *m = NULL;
+	struct shl_arena *a;
+	struct rtsp_message *m;
+	int r;
 
 	if (!bus || !out)
 		return -EINVAL;
 
-	m = calloc(1, sizeof(*m));
-	if (!m)
+	if (bus->arena_cnt > 0) {
+		a = bus->arenas[--bus->arena_cnt];
+		bus->arena_bytes -= shl_arena_get_size(a);
+		++bus->alloc_stats.arenas_recycled;
+	} else {
+		r = shl_arena_new(&a, RTSP_ARENA_SIZE);
+		if (r < 0)
+			return r;
+	}
+
+	m = shl_arena_alloc0(a, sizeof(*m));
+	if (!m) {
+		shl_arena_free(a);
 		return -ENOMEM;
+	}
 
+	m->arena = a;
 	m->ref = 1;
 	m->bus = bus;
 	rtsp_ref(bus);
+	twheel_timer_init(&m->timer, rtsp_timer_fn, m);
 	m->type = RTSP_MESSAGE_UNKNOWN;
 	m->major = 1;
 	m->minor = 0;
 
 	*out = m;
-	m = NULL;
 	return 0;
 }
 
@@ -386,7 +515,7 @@ static int rtsp_message_new_unknown(struct rtsp *bus,
 		return r;
 
 	m->type = RTSP_MESSAGE_UNKNOWN;
-	m->unknown_head = strdup(head);
+	m->unknown_head = shl_arena_strdup(m->arena, head);
 	if (!m->unknown_head)
 		return -ENOMEM;
 
@@ -416,11 +545,11 @@ static int rtsp_message_new_request_n(struct rtsp *bus,
 
 	m->type = RTSP_MESSAGE_REQUEST;
 
-	m->request_method = strndup(method, methodlen);
+	m->request_method = shl_arena_strndup(m->arena, method, methodlen);
 	if (!m->request_method)
 		return -ENOMEM;
 
-	m->request_uri = strndup(uri, urilen);
+	m->request_uri = shl_arena_strndup(m->arena, uri, urilen);
 	if (!m->request_uri)
 		return -ENOMEM;
 
@@ -466,9 +595,10 @@ static int rtsp_message_new_raw_reply(struct rtsp *bus,
 	m->reply_code = code;
 
 	if (shl_isempty(phrase))
-		m->reply_phrase = strdup(get_code_description(code));
+		m->reply_phrase = shl_arena_strdup(m->arena,
+						   get_code_description(code));
 	else
-		m->reply_phrase = strdup(phrase);
+		m->reply_phrase = shl_arena_strdup(m->arena, phrase);
 	if (!m->reply_phrase)
 		return -ENOMEM;
 
@@ -548,7 +678,7 @@ int rtsp_message_new_data(struct rtsp *bus,
 	m->data_channel = channel;
 	m->data_size = size;
 	if (size > 0) {
-		m->data_payload = malloc(size);
+		m->data_payload = shl_arena_alloc(m->arena, size);
 		if (!m->data_payload)
 			return -ENOMEM;
 
@@ -568,40 +698,34 @@ void rtsp_message_ref(struct rtsp_message *m)
 	++m->ref;
 }
 
+static void rtsp_release_arena(struct rtsp *bus, struct shl_arena *a)
+{
+	bus->alloc_stats.allocs += a->allocs;
+	bus->alloc_stats.heap_allocs += a->heap_allocs;
+	a->allocs = 0;
+	a->heap_allocs = 0;
+
+	if (bus->arena_cnt < bus->arena_max) {
+		shl_arena_reset(a);
+		bus->arenas[bus->arena_cnt++] = a;
+		bus->arena_bytes += shl_arena_get_size(a);
+		rtsp_update_mem(bus);
+	} else {
+		shl_arena_free(a);
+	}
+}
+
 void rtsp_message_unref(struct rtsp_message *m)
 {
-	size_t i;
+	struct rtsp *bus;
 
 	if (!m || !m->ref || --m->ref)
 		return;
 
-	for (i = 0; i < m->body_used; ++i) {
-		free(m->body_headers[i].key);
-		free(m->body_headers[i].value);
-		shl_strv_free(m->body_headers[i].tokens);
-		free(m->body_headers[i].line);
-	}
-	free(m->body_headers);
-
-	for (i = 0; i < m->header_used; ++i) {
-		free(m->headers[i].key);
-		free(m->headers[i].value);
-		shl_strv_free(m->headers[i].tokens);
-		free(m->headers[i].line);
-	}
-	free(m->headers);
-
-	free(m->raw);
-	free(m->body);
-
-	free(m->data_payload);
-	free(m->reply_phrase);
-	free(m->request_uri);
-	free(m->request_method);
-	free(m->unknown_head);
-
-	rtsp_unref(m->bus);
-	free(m);
+	/* @m itself lives in its arena, so it is gone after this */
+	bus = m->bus;
+	rtsp_release_arena(bus, m->arena);
+	rtsp_unref(bus);
 }
 
 bool rtsp_message_is_request(struct rtsp_message *m,
@@ -714,46 +838,148 @@ bool rtsp_message_is_sealed(struct rtsp_message *m)
 	return m && m->is_sealed;
 }
 
-static int rtsp_header_set_value(struct rtsp_header *h,
+/*
+ * Split the value of @h into tokens. This works like shl_qstr_tokenize() but
+ * takes all memory from the arena of @m: the value is copied once, tokens are
+ * terminated and decoded in place and the token array is sized upfront.
+ */
+static int rtsp_header_tokenize(struct rtsp_message *m,
+				struct rtsp_header *h)
+{
+	char *buf, *pos, quoted, **tokens;
+	size_t i, len, num;
+	bool escaped;
+
+	len = strlen(h->value);
+	buf = shl_arena_strndup(m->arena, h->value, len);
+	if (!buf)
+		return -ENOMEM;
+
+	/* each token is followed by a separator, except for the last */
+	num = 1;
+	for (i = 0; i < len; ++i)
+		if (buf[i] == ' ')
+			++num;
+
+	tokens = shl_arena_alloc(m->arena, (num + 1) * sizeof(*tokens));
+	if (!tokens)
+		return -ENOMEM;
+
+	num = 0;
+	quoted = 0;
+	escaped = false;
+	pos = buf;
+
+	for (i = 0; i < len; ++i) {
+		if (escaped) {
+			escaped = false;
+		} else if (buf[i] == '\\') {
+			escaped = true;
+		} else if (quoted) {
+			if (buf[i] == '"' && quoted == '"')
+				quoted = 0;
+			else if (buf[i] == '\'' && quoted == '\'')
+				quoted = 0;
+		} else if (buf[i] == '"') {
+			quoted = '"';
+		} else if (buf[i] == '\'') {
+			quoted = '\'';
+		} else if (buf[i] == ' ') {
+			/* ignore multiple separators */
+			if (pos != &buf[i]) {
+				buf[i] = 0;
+				shl_qstr_decode_n(pos, &buf[i] - pos);
+				tokens[num++] = pos;
+			}
+
+			pos = &buf[i + 1];
+		}
+	}
+
+	/* trailing token if available */
+	if (i > 0 && pos != &buf[i]) {
+		shl_qstr_decode_n(pos, &buf[i] - pos);
+		tokens[num++] = pos;
+	}
+
+	tokens[num] = NULL;
+	h->tokens = tokens;
+	h->token_cnt = num + 1;
+	h->token_used = num;
+
+	return 0;
+}
+
+static int rtsp_header_set_value(struct rtsp_message *m,
+				 struct rtsp_header *h,
 				 const char *value,
 				 size_t valuelen,
 				 bool force)
 {
-	int r;
-
 	if (!valuelen || shl_isempty(value))
 		return -EINVAL;
 
 	if (!force) {
 		if (h->value || h->token_used || h->line)
 			return -EINVAL;
-	} else {
-		shl_strv_free(h->tokens);
-		h->tokens = NULL;
-		h->token_used = 0;
-		h->token_cnt = 0;
-
-		free(h->value);
-		h->value = NULL;
-
-		free(h->line);
-		h->line = NULL;
 	}
 
-	h->value = strndup(value, valuelen);
+	/* previous values stay in the arena until the message is freed */
+	h->value = shl_arena_strndup(m->arena, value, valuelen);
 	if (!h->value)
 		return -ENOMEM;
 
-	r = shl_qstr_tokenize(value, &h->tokens);
-	if (r < 0) {
-		free(h->value);
-		h->value = NULL;
+	h->line = NULL;
+	h->line_len = 0;
+
+	return rtsp_header_tokenize(m, h);
+}
+
+/* move @p along if it points into the header array @from that moved to @to */
+static void rtsp_header_rebase(struct rtsp_header **p,
+			       struct rtsp_header *from,
+			       size_t cnt,
+			       struct rtsp_header *to)
+{
+	if (*p && *p >= from && *p < from + cnt)
+		*p = to + (*p - from);
+}
+
+/*
+ * Make sure the header array @arr of @m has room for @need entries. Arrays
+ * grow inside the arena, so they might move. All header pointers cached in
+ * @m are fixed up in that case.
+ */
+static int rtsp_message_grow_headers(struct rtsp_message *m,
+				     struct rtsp_header **arr,
+				     size_t *cnt,
+				     size_t need)
+{
+	struct rtsp_header *old = *arr, *h;
+	size_t ncnt;
+
+	if (need <= *cnt)
+		return 0;
+
+	ncnt = shl_max(need * 2, (size_t)8);
+	h = shl_arena_realloc(m->arena,
+			      old,
+			      *cnt * sizeof(*h),
+			      ncnt * sizeof(*h));
+	if (!h)
 		return -ENOMEM;
-	}
 
-	h->token_cnt = r + 1;
-	h->token_used = r;
+	memset(&h[*cnt], 0, (ncnt - *cnt) * sizeof(*h));
+
+	if (old && h != old) {
+		rtsp_header_rebase(&m->header_clen, old, *cnt, h);
+		rtsp_header_rebase(&m->header_ctype, old, *cnt, h);
+		rtsp_header_rebase(&m->header_cseq, old, *cnt, h);
+		rtsp_header_rebase(&m->iter_header, old, *cnt, h);
+	}
 
+	*arr = h;
+	*cnt = ncnt;
 	return 0;
 }
 
@@ -773,29 +999,33 @@ static int rtsp_message_append_header(struct rtsp_message *m,
 		return -EINVAL;
 
 	if (m->iter_body) {
-		if (!SHL_GREEDY_REALLOC0_T(m->body_headers,
-					   m->body_cnt,
-					   m->body_used + 1))
-			return -ENOMEM;
+		r = rtsp_message_grow_headers(m,
+					      &m->body_headers,
+					      &m->body_cnt,
+					      m->body_used + 1);
+		if (r < 0)
+			return r;
 
 		h = &m->body_headers[m->body_used];
 	} else {
-		if (!SHL_GREEDY_REALLOC0_T(m->headers,
-					   m->header_cnt,
-					   m->header_used + 1))
-			return -ENOMEM;
+		r = rtsp_message_grow_headers(m,
+					      &m->headers,
+					      &m->header_cnt,
+					      m->header_used + 1);
+		if (r < 0)
+			return r;
 
 		h = &m->headers[m->header_used];
 	}
 
-	h->key = strndup(key, keylen);
+	h->key = shl_arena_strndup(m->arena, key, keylen);
 	if (!h->key)
 		return -ENOMEM;
 
 	if (valuelen) {
-		r = rtsp_header_set_value(h, value, valuelen, true);
+		r = rtsp_header_set_value(m, h, value, valuelen, true);
 		if (r < 0) {
-			free(h->key);
+			memset(h, 0, sizeof(*h));
 			return -ENOMEM;
 		}
 	}
@@ -830,7 +1060,7 @@ static int rtsp_message_append_header_line(struct rtsp_message *m,
 	if (!line)
 		return -EINVAL;
 
-	t = malloc(strlen(line) + 3);
+	t = shl_arena_alloc(m->arena, strlen(line) + 3);
 	if (!t)
 		return -ENOMEM;
 
@@ -861,10 +1091,8 @@ static int rtsp_message_append_header_line(struct rtsp_message *m,
 				       keylen,
 				       value,
 				       valuelen);
-	if (r < 0) {
-		free(t);
+	if (r < 0)
 		return r;
-	}
 
 	h->line = t;
 	t = stpcpy(t, line);
@@ -879,29 +1107,44 @@ static int rtsp_message_append_header_line(struct rtsp_message *m,
 	return 0;
 }
 
-static int rtsp_header_append_token(struct rtsp_header *h, const char *token)
+static int rtsp_header_append_token(struct rtsp_message *m,
+				    struct rtsp_header *h,
+				    const char *token)
 {
+	char **tokens;
+	size_t cnt;
+
 	if (!h || !token || h->line || h->value)
 		return -EINVAL;
 
-	if (!SHL_GREEDY_REALLOC0_T(h->tokens,
-				   h->token_cnt,
-				   h->token_used + 2))
-		return -ENOMEM;
+	if (h->token_used + 2 > h->token_cnt) {
+		cnt = shl_max((h->token_used + 2) * 2, (size_t)8);
+		tokens = shl_arena_realloc(m->arena,
+					   h->tokens,
+					   h->token_cnt * sizeof(*tokens),
+					   cnt * sizeof(*tokens));
+		if (!tokens)
+			return -ENOMEM;
+
+		h->tokens = tokens;
+		h->token_cnt = cnt;
+	}
 
-	h->tokens[h->token_used] = strdup(token);
+	h->tokens[h->token_used] = shl_arena_strdup(m->arena, token);
 	if (!h->tokens[h->token_used])
 		return -ENOMEM;
 
-	++h->token_used;
+	h->tokens[++h->token_used] = NULL;
 	return 0;
 }
 
-static int rtsp_header_serialize(struct rtsp_header *h)
+static int rtsp_header_serialize(struct rtsp_message *m,
+				 struct rtsp_header *h)
 {
 	static char *empty_strv[1] = { NULL };
+	char **tokens;
+	size_t l;
 	char *t;
-	int r;
 
 	if (!h)
 		return -EINVAL;
@@ -909,12 +1152,19 @@ static int rtsp_header_serialize(struct rtsp_header *h)
 		return 0;
 
 	if (!h->value) {
-		r = shl_qstr_join(h->tokens ? : empty_strv, &h->value);
-		if (r < 0)
-			return r;
+		tokens = h->tokens ? : empty_strv;
+		l = shl_qstr_join_size(tokens);
+		if (!l)
+			return -ENOMEM;
+
+		h->value = shl_arena_alloc(m->arena, l);
+		if (!h->value)
+			return -ENOMEM;
+
+		shl_qstr_join_buf(tokens, h->value);
 	}
 
-	t = malloc(strlen(h->key) + strlen(h->value) + 5);
+	t = shl_arena_alloc(m->arena, strlen(h->key) + strlen(h->value) + 5);
 	if (!t)
 		return -ENOMEM;
 
@@ -981,7 +1231,7 @@ int rtsp_message_close_header(struct rtsp_message *m)
 	if (!m->iter_header)
 		return -EINVAL;
 
-	r = rtsp_header_serialize(m->iter_header);
+	r = rtsp_header_serialize(m, m->iter_header);
 	if (r < 0)
 		return r;
 
@@ -1055,7 +1305,8 @@ int rtsp_message_appendv_basic(struct rtsp_message *m,
 			orig = "";
 
 		if (m->iter_header)
-			return rtsp_header_set_value(m->iter_header,
+			return rtsp_header_set_value(m,
+						     m->iter_header,
 						     orig,
 						     strlen(orig),
 						     false);
@@ -1097,7 +1348,7 @@ int rtsp_message_appendv_basic(struct rtsp_message *m,
 		return -EINVAL;
 	}
 
-	return rtsp_header_append_token(m->iter_header, orig);
+	return rtsp_header_append_token(m, m->iter_header, orig);
 }
 
 int rtsp_message_append(struct rtsp_message *m,
@@ -1138,83 +1389,34 @@ int rtsp_message_appendv(struct rtsp_message *m,
 
 static int rtsp_message_serialize_common(struct rtsp_message *m)
 {
-	_shl_free_ char *head = NULL, *headers = NULL, *body = NULL;
 	char buf[128];
-	char *raw, *p, *cbody;
-	size_t rawlen, i, l, body_size;
+	char *raw, *p;
+	size_t rawlen, headlen, i, body_size;
 	int r;
 
-	switch (m->type) {
-	case RTSP_MESSAGE_UNKNOWN:
-		head = shl_strcat(m->unknown_head, "\r\n");
-		if (!head)
-			return -ENOMEM;
-
-		break;
-	case RTSP_MESSAGE_REQUEST:
-		r = asprintf(&head, "%s %s RTSP/%u.%u\r\n",
-			     m->request_method,
-			     m->request_uri,
-			     m->major,
-			     m->minor);
-		if (r < 0)
-			return -ENOMEM;
-
-		break;
-	case RTSP_MESSAGE_REPLY:
-		r = asprintf(&head, "RTSP/%u.%u %u %s\r\n",
-			     m->major,
-			     m->minor,
-			     m->reply_code,
-			     m->reply_phrase);
-		if (r < 0)
-			return -ENOMEM;
-
-		break;
-	default:
-		return -EINVAL;
-	}
-
-	rawlen = strlen(head);
-
-	/* concat body */
+	/* compute body size */
 
 	if (m->body) {
 		body_size = m->body_size;
-		cbody = (void*)m->body;
 	} else {
-		l = 0;
-		for (i = 0; i < m->body_used; ++i)
-			l += m->body_headers[i].line_len;
-
-		body = malloc(l + 1);
-		if (!body)
-			return -ENOMEM;
-
-		p = (char*)body;
+		body_size = 0;
 		for (i = 0; i < m->body_used; ++i)
-			p = stpcpy(p, m->body_headers[i].line);
-
-		*p = 0;
-
-		body_size = p - body;
-		cbody = body;
+			body_size += m->body_headers[i].line_len;
 	}
 
-	rawlen += body_size;
-
 	/* set content-length header */
 
 	if (m->header_clen) {
 		sprintf(buf, "%zu", body_size);
-		r = rtsp_header_set_value(m->header_clen,
+		r = rtsp_header_set_value(m,
+					  m->header_clen,
 					  buf,
 					  strlen(buf),
 					  true);
 		if (r < 0)
 			return r;
 
-		r = rtsp_header_serialize(m->header_clen);
+		r = rtsp_header_serialize(m, m->header_clen);
 		if (r < 0)
 			return r;
 	} else if (body_size) {
@@ -1230,14 +1432,15 @@ static int rtsp_message_serialize_common(struct rtsp_message *m)
 	/* set content-type header */
 
 	if (m->body_used && m->header_ctype) {
-		r = rtsp_header_set_value(m->header_ctype,
+		r = rtsp_header_set_value(m,
+					  m->header_ctype,
 					  "text/parameters",
 					  15,
 					  true);
 		if (r < 0)
 			return r;
 
-		r = rtsp_header_serialize(m->header_ctype);
+		r = rtsp_header_serialize(m, m->header_ctype);
 		if (r < 0)
 			return r;
 	} else if (m->body_used) {
@@ -1254,14 +1457,15 @@ static int rtsp_message_serialize_common(struct rtsp_message *m)
 
 	sprintf(buf, "%llu", m->cookie & ~RTSP_FLAG_REMOTE_COOKIE);
 	if (m->header_cseq) {
-		r = rtsp_header_set_value(m->header_cseq,
+		r = rtsp_header_set_value(m,
+					  m->header_cseq,
 					  buf,
 					  strlen(buf),
 					  true);
 		if (r < 0)
 			return r;
 
-		r = rtsp_header_serialize(m->header_cseq);
+		r = rtsp_header_serialize(m, m->header_cseq);
 		if (r < 0)
 			return r;
 	} else {
@@ -1274,37 +1478,98 @@ static int rtsp_message_serialize_common(struct rtsp_message *m)
 			return r;
 	}
 
-	/* concat headers */
+	/* compute head size */
 
-	l = 0;
-	for (i = 0; i < m->header_used; ++i)
-		l += m->headers[i].line_len;
+	switch (m->type) {
+	case RTSP_MESSAGE_UNKNOWN:
+		r = strlen(m->unknown_head) + 2;
+		break;
+	case RTSP_MESSAGE_REQUEST:
+		r = snprintf(NULL, 0, "%s %s RTSP/%u.%u\r\n",
+			     m->request_method,
+			     m->request_uri,
+			     m->major,
+			     m->minor);
+		break;
+	case RTSP_MESSAGE_REPLY:
+		r = snprintf(NULL, 0, "RTSP/%u.%u %u %s\r\n",
+			     m->major,
+			     m->minor,
+			     m->reply_code,
+			     m->reply_phrase);
+		break;
+	default:
+		return -EINVAL;
+	}
 
-	headers = malloc(l + 1);
-	if (!headers)
+	if (r < 0)
 		return -ENOMEM;
 
-	p = headers;
-	for (i = 0; i < m->header_used; ++i)
-		p = stpcpy(p, m->headers[i].line);
+	headlen = r;
 
-	*p = 0;
-	rawlen += p - headers;
+	/* allocate the wire buffer in one go */
 
-	/* final concat */
+	rawlen = headlen;
+	for (i = 0; i < m->header_used; ++i)
+		rawlen += m->headers[i].line_len;
+	rawlen += 2 + body_size;
 
-	rawlen += 2;
-	raw = malloc(rawlen + 1);
+	raw = shl_arena_alloc(m->arena, rawlen + 1);
 	if (!raw)
 		return -ENOMEM;
 
+	/* concat head */
+
 	p = raw;
-	p = stpcpy(p, head);
-	p = stpcpy(p, headers);
+	switch (m->type) {
+	case RTSP_MESSAGE_UNKNOWN:
+		p = stpcpy(p, m->unknown_head);
+		*p++ = '\r';
+		*p++ = '\n';
+		break;
+	case RTSP_MESSAGE_REQUEST:
+		p += sprintf(p, "%s %s RTSP/%u.%u\r\n",
+			     m->request_method,
+			     m->request_uri,
+			     m->major,
+			     m->minor);
+		break;
+	case RTSP_MESSAGE_REPLY:
+		p += sprintf(p, "RTSP/%u.%u %u %s\r\n",
+			     m->major,
+			     m->minor,
+			     m->reply_code,
+			     m->reply_phrase);
+		break;
+	}
+
+	/* concat headers */
+
+	for (i = 0; i < m->header_used; ++i) {
+		memcpy(p, m->headers[i].line, m->headers[i].line_len);
+		p += m->headers[i].line_len;
+	}
+
 	*p++ = '\r';
 	*p++ = '\n';
-	memcpy(p, cbody, body_size);
-	p += body_size;
+
+	/* concat body, it is referenced from @raw from now on */
+
+	if (m->body) {
+		memcpy(p, m->body, body_size);
+		m->body = (void*)p;
+		p += body_size;
+	} else {
+		m->body = (void*)p;
+		for (i = 0; i < m->body_used; ++i) {
+			memcpy(p,
+			       m->body_headers[i].line,
+			       m->body_headers[i].line_len);
+			p += m->body_headers[i].line_len;
+		}
+	}
+
+	m->body_size = body_size;
 
 	/* for debugging */
 	*p = 0;
@@ -1312,10 +1577,6 @@ static int rtsp_message_serialize_common(struct rtsp_message *m)
 	m->raw = (void*)raw;
 	m->raw_size = rawlen;
 
-	m->body = (void*)cbody;
-	m->body_size = body_size;
-	body = NULL;
-
 	return 0;
 }
 
@@ -1324,8 +1585,12 @@ static int rtsp_message_serialize_data(struct rtsp_message *m)
 	uint8_t *raw;
 	size_t rawlen;
 
+	/* incoming frames are assembled in wire-format by the parser */
+	if (m->raw)
+		return 0;
+
 	rawlen = 1 + 1 + 2 + m->data_size;
-	raw = malloc(rawlen + 1);
+	raw = shl_arena_alloc(m->arena, rawlen + 1);
 	if (!raw)
 		return -ENOMEM;
 
@@ -1339,6 +1604,10 @@ static int rtsp_message_serialize_data(struct rtsp_message *m)
 	/* for debugging */
 	raw[rawlen] = 0;
 
+	/* the payload is referenced from @raw from now on */
+	if (m->data_size)
+		m->data_payload = &raw[4];
+
 	m->raw = raw;
 	m->raw_size = rawlen;
 
@@ -1359,35 +1628,128 @@ int rtsp_message_set_cookie(struct rtsp_message *m, uint64_t cookie)
 	return 0;
 }
 
-int rtsp_message_seal(struct rtsp_message *m)
+/*
+ * Header Index
+ * Readers look up headers by name, often once per WFD parameter in a body
+ * with dozens of them. Once a message is sealed its header arrays are fixed,
+ * so we build a small open-addressing table over them, keyed by a
+ * case-insensitive hash of the header name. Only the first header of a given
+ * name is indexed, which matches the linear lookup. Messages with only a few
+ * headers are not indexed; a linear scan is faster for those.
+ */
+
+static uint32_t rtsp__hash_key(const char *key)
 {
-	int r;
+	uint32_t hash = 2166136261U;
 
-	if (!m)
-		return -EINVAL;
-	if (m->is_sealed)
-		return 0;
-	if (m->iter_body || m->iter_header)
-		return -EINVAL;
+	/* FNV-1a; folding bit 5 is enough as we verify with strcasecmp() */
+	for ( ; *key; ++key)
+		hash = (hash ^ ((unsigned char)*key | 0x20)) * 16777619U;
 
-	if (!m->cookie)
-		m->cookie = ++m->bus->cookies ? : ++m->bus->cookies;
-	if (m->type == RTSP_MESSAGE_REPLY)
-		m->cookie |= RTSP_FLAG_REMOTE_COOKIE;
+	return hash;
+}
 
-	switch (m->type) {
-	case RTSP_MESSAGE_UNKNOWN:
-	case RTSP_MESSAGE_REQUEST:
-	case RTSP_MESSAGE_REPLY:
-		r = rtsp_message_serialize_common(m);
-		if (r < 0)
-			return r;
+static struct rtsp_header_index *rtsp_header_index_new(struct rtsp_message *m,
+						       struct rtsp_header *arr,
+						       size_t used)
+{
+	struct rtsp_header_index *idx;
+	size_t i, pos, size;
+	uint32_t slot;
 
-		break;
-	case RTSP_MESSAGE_DATA:
-		r = rtsp_message_serialize_data(m);
-		if (r < 0)
-			return r;
+	if (used < RTSP_HEADER_INDEX_MIN || used >= UINT32_MAX / 2)
+		return NULL;
+
+	/* keep the load factor below 1/2 */
+	size = 16;
+	while (size < used * 2)
+		size <<= 1;
+
+	/* on failure we simply fall back to linear lookups */
+	idx = shl_arena_alloc0(m->arena,
+			       sizeof(*idx) + size * sizeof(*idx->slots));
+	if (!idx)
+		return NULL;
+
+	idx->mask = size - 1;
+
+	for (i = 0; i < used; ++i) {
+		pos = rtsp__hash_key(arr[i].key) & idx->mask;
+		while ((slot = idx->slots[pos])) {
+			if (!strcasecmp(arr[slot - 1].key, arr[i].key))
+				break;
+			pos = (pos + 1) & idx->mask;
+		}
+
+		if (!slot)
+			idx->slots[pos] = i + 1;
+	}
+
+	return idx;
+}
+
+static struct rtsp_header *rtsp_header_find(struct rtsp_header_index *idx,
+					    struct rtsp_header *arr,
+					    size_t used,
+					    const char *name)
+{
+	size_t i, pos;
+	uint32_t slot;
+
+	if (!idx) {
+		for (i = 0; i < used; ++i)
+			if (!strcasecmp(arr[i].key, name))
+				return &arr[i];
+
+		return NULL;
+	}
+
+	pos = rtsp__hash_key(name) & idx->mask;
+	while ((slot = idx->slots[pos])) {
+		if (!strcasecmp(arr[slot - 1].key, name))
+			return &arr[slot - 1];
+		pos = (pos + 1) & idx->mask;
+	}
+
+	return NULL;
+}
+
+int rtsp_message_seal(struct rtsp_message *m)
+{
+	int r;
+
+	if (!m)
+		return -EINVAL;
+	if (m->is_sealed)
+		return 0;
+	if (m->iter_body || m->iter_header)
+		return -EINVAL;
+
+	if (!m->cookie)
+		m->cookie = ++m->bus->cookies ? : ++m->bus->cookies;
+	if (m->type == RTSP_MESSAGE_REPLY)
+		m->cookie |= RTSP_FLAG_REMOTE_COOKIE;
+
+	switch (m->type) {
+	case RTSP_MESSAGE_UNKNOWN:
+	case RTSP_MESSAGE_REQUEST:
+	case RTSP_MESSAGE_REPLY:
+		r = rtsp_message_serialize_common(m);
+		if (r < 0)
+			return r;
+
+		m->header_index = rtsp_header_index_new(m,
+							m->headers,
+							m->header_used);
+		m->body_index = rtsp_header_index_new(m,
+						      m->body_headers,
+						      m->body_used);
+
+		break;
+	case RTSP_MESSAGE_DATA:
+		r = rtsp_message_serialize_data(m);
+		if (r < 0)
+			return r;
 
 		break;
 	}
@@ -1399,7 +1761,7 @@ int rtsp_message_seal(struct rtsp_message *m)
 
 int rtsp_message_enter_header(struct rtsp_message *m, const char *name)
 {
-	size_t i;
+	struct rtsp_header *h;
 
 	if (!m || shl_isempty(name) || m->type == RTSP_MESSAGE_DATA)
 		return -EINVAL;
@@ -1408,25 +1770,23 @@ int rtsp_message_enter_header(struct rtsp_message *m, const char *name)
 	if (m->iter_header)
 		return -EINVAL;
 
-	if (m->iter_body) {
-		for (i = 0; i < m->body_used; ++i) {
-			if (!strcasecmp(m->body_headers[i].key, name)) {
-				m->iter_header = &m->body_headers[i];
-				m->iter_token = 0;
-				return 0;
-			}
-		}
-	} else {
-		for (i = 0; i < m->header_used; ++i) {
-			if (!strcasecmp(m->headers[i].key, name)) {
-				m->iter_header = &m->headers[i];
-				m->iter_token = 0;
-				return 0;
-			}
-		}
-	}
+	if (m->iter_body)
+		h = rtsp_header_find(m->body_index,
+				     m->body_headers,
+				     m->body_used,
+				     name);
+	else
+		h = rtsp_header_find(m->header_index,
+				     m->headers,
+				     m->header_used,
+				     name);
 
-	return -ENOENT;
+	if (!h)
+		return -ENOENT;
+
+	m->iter_header = h;
+	m->iter_token = 0;
+	return 0;
 }
 
 void rtsp_message_exit_header(struct rtsp_message *m)
@@ -1693,6 +2053,415 @@ size_t rtsp_message_get_raw_size(struct rtsp_message *m)
 	return m->raw_size;
 }
 
+/*
+ * Message Templates
+ * Some messages are sent over and over with only a few bytes changing, like
+ * capability replies that differ in their CSeq only. A template keeps the
+ * serialized form of a prototype message plus a list of slots within it, so
+ * new messages are stamped out with a few memcpy()s instead of assembling,
+ * formatting and serializing all headers again.
+ *
+ * Slots are the values of the CSeq and Content-Length headers, plus each
+ * occurrence of the user-supplied placeholder strings. Stamped messages are
+ * sealed right away and carry only their wire-format; the header accessors
+ * do not see their headers.
+ */
+
+enum {
+	RTSP_TEMPLATE_CSEQ = -1,
+	RTSP_TEMPLATE_CLEN = -2,
+};
+
+struct rtsp_template_slot {
+	size_t off;			/* offset of the slot in @raw */
+	size_t len;			/* length of the placeholder in @raw */
+	int value;			/* index into the values or CSEQ/CLEN */
+};
+
+struct rtsp_template {
+	unsigned int type;
+	unsigned int major;
+	unsigned int minor;
+	unsigned int reply_code;
+	char *head;			/* method and uri, or reply phrase */
+	char *uri;
+
+	char *raw;
+	size_t raw_size;
+	size_t body_off;
+	size_t value_cnt;
+
+	size_t slot_cnt;
+	struct rtsp_template_slot slots[];
+};
+
+static size_t rtsp_template_value_off(struct rtsp_header *h,
+				      size_t off,
+				      size_t *len)
+{
+	size_t i;
+
+	/* header lines are "key: value\r\n" as written by the serializer */
+	i = strlen(h->key) + 1;
+	while (i < h->line_len && h->line[i] == ' ')
+		++i;
+
+	*len = h->line_len - 2 - i;
+	return off + i;
+}
+
+static int rtsp_template_add_slot(struct rtsp_template *t,
+				  size_t off,
+				  size_t len,
+				  int value)
+{
+	size_t i;
+
+	/* keep slots sorted, reject overlapping placeholders */
+	for (i = t->slot_cnt; i > 0; --i) {
+		if (t->slots[i - 1].off + t->slots[i - 1].len <= off)
+			break;
+		if (t->slots[i - 1].off < off + len)
+			return -EINVAL;
+
+		t->slots[i] = t->slots[i - 1];
+	}
+
+	t->slots[i].off = off;
+	t->slots[i].len = len;
+	t->slots[i].value = value;
+	++t->slot_cnt;
+
+	return 0;
+}
+
+/**
+ * rtsp_template_new() - Create message template
+ * @out: output storage for the new template
+ * @proto: prototype request or reply
+ * @placeholders: NULL-terminated list of placeholder strings, or NULL
+ *
+ * This seals @proto and turns its serialized form into a template. Every
+ * occurrence of the n-th placeholder is replaced by the n-th value passed to
+ * rtsp_template_stamp(); each placeholder must occur at least once. The CSeq
+ * header and, if the body contains slots, the Content-Length header are
+ * patched automatically. The template does not reference @proto afterwards.
+ *
+ * Returns:
+ * 0 on success, negative error code on failure.
+ */
+int rtsp_template_new(struct rtsp_template **out,
+		      struct rtsp_message *proto,
+		      const char *const *placeholders)
+{
+	struct rtsp_template *t;
+	struct rtsp_header *h;
+	const char *raw, *p;
+	size_t i, cnt, off, len, hdr_off, value_cnt;
+	bool body_slots = false;
+	int r;
+
+	if (!out || !proto)
+		return -EINVAL;
+	if (proto->type != RTSP_MESSAGE_REQUEST &&
+	    proto->type != RTSP_MESSAGE_REPLY)
+		return -EINVAL;
+
+	r = rtsp_message_seal(proto);
+	if (r < 0)
+		return r;
+	if (!proto->header_cseq || !proto->raw || !proto->body)
+		return -EINVAL;
+
+	raw = (const char*)proto->raw;
+
+	/* count all placeholder occurrences for the slot array */
+	cnt = 2;
+	for (value_cnt = 0; placeholders && placeholders[value_cnt];
+	     ++value_cnt) {
+		len = strlen(placeholders[value_cnt]);
+		if (!len)
+			return -EINVAL;
+
+		off = 0;
+		while ((p = memmem(raw + off, proto->raw_size - off,
+				   placeholders[value_cnt], len))) {
+			off = p - raw + len;
+			++cnt;
+		}
+	}
+
+	t = calloc(1, sizeof(*t) + cnt * sizeof(*t->slots));
+	if (!t)
+		return -ENOMEM;
+
+	t->type = proto->type;
+	t->major = proto->major;
+	t->minor = proto->minor;
+	t->reply_code = proto->reply_code;
+	t->value_cnt = value_cnt;
+	t->raw_size = proto->raw_size;
+	t->body_off = (char*)proto->body - raw;
+
+	t->raw = malloc(proto->raw_size + 1);
+	if (proto->type == RTSP_MESSAGE_REQUEST) {
+		t->head = strdup(proto->request_method);
+		t->uri = strdup(proto->request_uri);
+	} else {
+		t->head = strdup(proto->reply_phrase);
+	}
+
+	if (!t->raw || !t->head ||
+	    (proto->type == RTSP_MESSAGE_REQUEST && !t->uri)) {
+		r = -ENOMEM;
+		goto error;
+	}
+
+	memcpy(t->raw, raw, proto->raw_size + 1);
+
+	for (i = 0; i < value_cnt; ++i) {
+		len = strlen(placeholders[i]);
+		off = 0;
+		cnt = 0;
+		while ((p = memmem(raw + off, proto->raw_size - off,
+				   placeholders[i], len))) {
+			off = p - raw;
+			if (off >= t->body_off) {
+				body_slots = true;
+			} else if (off + len > t->body_off - 2) {
+				/* must not span the end of the header */
+				r = -EINVAL;
+				goto error;
+			}
+
+			r = rtsp_template_add_slot(t, off, len, i);
+			if (r < 0)
+				goto error;
+
+			off += len;
+			++cnt;
+		}
+
+		/* unused placeholders are most likely a bug in the caller */
+		if (!cnt) {
+			r = -EINVAL;
+			goto error;
+		}
+	}
+
+	/* header lines directly precede the empty line before the body */
+	hdr_off = t->body_off - 2;
+	for (i = 0; i < proto->header_used; ++i)
+		hdr_off -= proto->headers[i].line_len;
+
+	for (i = 0; i < proto->header_used; ++i) {
+		h = &proto->headers[i];
+
+		if (h == proto->header_cseq) {
+			off = rtsp_template_value_off(h, hdr_off, &len);
+			r = rtsp_template_add_slot(t, off, len,
+						   RTSP_TEMPLATE_CSEQ);
+			if (r < 0)
+				goto error;
+		} else if (h == proto->header_clen && body_slots) {
+			off = rtsp_template_value_off(h, hdr_off, &len);
+			r = rtsp_template_add_slot(t, off, len,
+						   RTSP_TEMPLATE_CLEN);
+			if (r < 0)
+				goto error;
+		}
+
+		hdr_off += h->line_len;
+	}
+
+	*out = t;
+	return 0;
+
+error:
+	rtsp_template_free(t);
+	return r;
+}
+
+void rtsp_template_free(struct rtsp_template *t)
+{
+	if (!t)
+		return;
+
+	free(t->raw);
+	free(t->uri);
+	free(t->head);
+	free(t);
+}
+
+static int rtsp_template_stamp_cookie(struct rtsp_template *t,
+				      struct rtsp *bus,
+				      uint64_t cookie,
+				      struct rtsp_message **out,
+				      const char *const *values)
+{
+	_rtsp_message_unref_ struct rtsp_message *m = NULL;
+	const struct rtsp_template_slot *slot;
+	char cseq[32], clen[32];
+	const char *v;
+	size_t i, vlen[t->slot_cnt], body_off, body_size, raw_size, pos;
+	char *raw, *p;
+	int r;
+
+	body_off = t->body_off;
+	body_size = t->raw_size - t->body_off;
+	raw_size = t->raw_size;
+
+	sprintf(cseq, "%llu", (unsigned long long)cookie);
+
+	/* compute the final size; CLEN depends on all body slots */
+	for (i = 0; i < t->slot_cnt; ++i) {
+		slot = &t->slots[i];
+		if (slot->value == RTSP_TEMPLATE_CSEQ) {
+			vlen[i] = strlen(cseq);
+		} else if (slot->value == RTSP_TEMPLATE_CLEN) {
+			vlen[i] = 0;
+			continue;
+		} else {
+			v = values[slot->value];
+			if (!v)
+				return -EINVAL;
+			vlen[i] = strlen(v);
+		}
+
+		raw_size += vlen[i] - slot->len;
+		if (slot->off >= t->body_off)
+			body_size += vlen[i] - slot->len;
+		else
+			body_off += vlen[i] - slot->len;
+	}
+
+	sprintf(clen, "%zu", body_size);
+	for (i = 0; i < t->slot_cnt; ++i) {
+		if (t->slots[i].value == RTSP_TEMPLATE_CLEN) {
+			vlen[i] = strlen(clen);
+			raw_size += vlen[i] - t->slots[i].len;
+			body_off += vlen[i] - t->slots[i].len;
+		}
+	}
+
+	r = rtsp_message_new(bus, &m);
+	if (r < 0)
+		return r;
+
+	m->type = t->type;
+	m->major = t->major;
+	m->minor = t->minor;
+	m->reply_code = t->reply_code;
+	if (t->type == RTSP_MESSAGE_REQUEST) {
+		m->request_method = shl_arena_strdup(m->arena, t->head);
+		m->request_uri = shl_arena_strdup(m->arena, t->uri);
+		if (!m->request_method || !m->request_uri)
+			return -ENOMEM;
+
+		m->cookie = cookie;
+	} else {
+		m->reply_phrase = shl_arena_strdup(m->arena, t->head);
+		if (!m->reply_phrase)
+			return -ENOMEM;
+
+		m->cookie = cookie | RTSP_FLAG_REMOTE_COOKIE;
+	}
+
+	raw = shl_arena_alloc(m->arena, raw_size + 1);
+	if (!raw)
+		return -ENOMEM;
+
+	p = raw;
+	pos = 0;
+	for (i = 0; i < t->slot_cnt; ++i) {
+		slot = &t->slots[i];
+
+		memcpy(p, &t->raw[pos], slot->off - pos);
+		p += slot->off - pos;
+
+		if (slot->value == RTSP_TEMPLATE_CSEQ)
+			v = cseq;
+		else if (slot->value == RTSP_TEMPLATE_CLEN)
+			v = clen;
+		else
+			v = values[slot->value];
+
+		memcpy(p, v, vlen[i]);
+		p += vlen[i];
+		pos = slot->off + slot->len;
+	}
+
+	memcpy(p, &t->raw[pos], t->raw_size - pos);
+	p += t->raw_size - pos;
+	*p = 0;
+
+	m->raw = (void*)raw;
+	m->raw_size = raw_size;
+	m->body = (void*)&raw[body_off];
+	m->body_size = body_size;
+	m->is_sealed = true;
+
+	*out = m;
+	m = NULL;
+	return 0;
+}
+
+/**
+ * rtsp_template_stamp() - Create request from template
+ * @t: request template
+ * @bus: bus to create the message for
+ * @out: output storage for the new, sealed message
+ * @values: one value per placeholder passed to rtsp_template_new()
+ *
+ * Returns:
+ * 0 on success, negative error code on failure.
+ */
+int rtsp_template_stamp(struct rtsp_template *t,
+			struct rtsp *bus,
+			struct rtsp_message **out,
+			const char *const *values)
+{
+	uint64_t cookie;
+
+	if (!t || !bus || !out || t->type != RTSP_MESSAGE_REQUEST)
+		return -EINVAL;
+	if (t->value_cnt && !values)
+		return -EINVAL;
+
+	cookie = ++bus->cookies ? : ++bus->cookies;
+	return rtsp_template_stamp_cookie(t, bus, cookie, out, values);
+}
+
+/**
+ * rtsp_template_stamp_reply_for() - Create reply from template
+ * @t: reply template
+ * @orig: received request to reply to
+ * @out: output storage for the new, sealed message
+ * @values: one value per placeholder passed to rtsp_template_new()
+ *
+ * Returns:
+ * 0 on success, negative error code on failure.
+ */
+int rtsp_template_stamp_reply_for(struct rtsp_template *t,
+				  struct rtsp_message *orig,
+				  struct rtsp_message **out,
+				  const char *const *values)
+{
+	if (!t || !orig || !out || t->type != RTSP_MESSAGE_REPLY)
+		return -EINVAL;
+	if (t->value_cnt && !values)
+		return -EINVAL;
+	/* @orig must be a message received from the remote peer */
+	if (!orig->is_used || !(orig->cookie & RTSP_FLAG_REMOTE_COOKIE))
+		return -EINVAL;
+
+	return rtsp_template_stamp_cookie(t,
+					  orig->bus,
+					  orig->cookie & ~RTSP_FLAG_REMOTE_COOKIE,
+					  out,
+					  values);
+}
+
 /*
  * Message Assembly
  * These helpers take the raw RTSP input strings, parse them line by line to
@@ -1889,9 +2658,8 @@ static int rtsp_message_append_body(struct rtsp_message *m,
 				    const void *body,
 				    size_t len)
 {
-	_shl_free_ char *line = NULL;
 	const char *d, *v;
-	void *t;
+	char *line;
 	size_t dl, vl;
 	int r;
 
@@ -1909,17 +2677,13 @@ static int rtsp_message_append_body(struct rtsp_message *m,
 	 * input is of fixed length, so we skip that. It's
 	 * the caller's responsibility to do that. */
 
-	/* if content-type is not text/parameters, append the binary blob */
+	/* If content-type is not text/parameters, reference the binary blob.
+	 * It is not copied before the message is sealed, so @body must stay
+	 * valid until then. */
 	if (!m->header_ctype ||
 	    !m->header_ctype->value ||
 	    strcmp(m->header_ctype->value, "text/parameters")) {
-		t = malloc(len + 1);
-		if (!t)
-			return -ENOMEM;
-
-		free(m->body);
-		m->body = t;
-		memcpy(m->body, body, len);
+		m->body = (void*)body;
 		m->body_size = len;
 		return 0;
 	}
@@ -1949,8 +2713,7 @@ static int rtsp_message_append_body(struct rtsp_message *m,
 
 		/* ignore empty body lines */
 		if (vl > 0) {
-			free(line);
-			line = malloc(vl + 1);
+			line = rtsp_get_scratch(m->bus, vl + 1);
 			if (!line)
 				return -ENOMEM;
 
@@ -1978,8 +2741,8 @@ int rtsp_message_new_from_raw(struct rtsp *bus,
 			      size_t len)
 {
 	_rtsp_message_unref_ struct rtsp_message *m = NULL;
-	_shl_free_ char *line = NULL;
 	const char *d, *v;
+	char *line;
 	size_t dl, vl;
 	int r;
 
@@ -2018,8 +2781,7 @@ int rtsp_message_new_from_raw(struct rtsp *bus,
 
 			break;
 		} else {
-			free(line);
-			line = malloc(vl + 1);
+			line = rtsp_get_scratch(bus, vl + 1);
 			if (!line)
 				return -ENOMEM;
 
@@ -2058,8 +2820,11 @@ int rtsp_message_new_from_raw(struct rtsp *bus,
 /*
  * Parser State Machine
  * The parser state-machine is quite simple. We take an input buffer of
- * arbitrary length from the caller and feed it byte by byte into the state
- * machine.
+ * arbitrary length from the caller and feed it block by block into the state
+ * machine. Each state consumes as much input as it can in one step: header
+ * lines are scanned for the next CR, LF or quote via memchr(), bodies and
+ * interleaved data frames are taken in one chunk. Only the characters that
+ * actually cause state transitions are looked at individually.
  *
  * Parsing RTSP messages is rather troublesome due to the ASCII-nature. It's
  * easy to parse as is, but has lots of corner-cases which we want to be
@@ -2099,6 +2864,10 @@ static int parser_append_header(struct rtsp *bus,
 
 		/* overwrite previous lengths */
 		dec->remaining_body = clen;
+
+		/* oversized bodies are skipped without buffering them */
+		if (bus->limits.max_body && clen > bus->limits.max_body)
+			dec->reject = RTSP_CODE_REQUEST_ENTITY_TOO_LARGE;
 	} else if (h == dec->m->header_cseq) {
 		if (h->token_used >= 1) {
 			r = shl_atoi_z(h->tokens[0], 10, &next, &clen);
@@ -2114,28 +2883,109 @@ static int parser_append_header(struct rtsp *bus,
 	return r;
 }
 
-static int parser_finish_header_line(struct rtsp *bus)
+/*
+ * Headers beyond the header limit are not stored, the message is rejected
+ * once complete. We still need the Content-Length to skip the body and the
+ * CSeq to be able to reply, so these two are picked from the raw line.
+ */
+static int parser_skip_header(struct rtsp *bus, char *line)
 {
 	struct rtsp_parser *dec = &bus->parser;
-	_shl_free_ char *line = NULL;
+	const char *next;
+	char *value, *end;
+	size_t val;
 	int r;
 
-	line = malloc(dec->buflen + 1);
-	if (!line)
-		return -ENOMEM;
+	if (!dec->reject)
+		dec->reject = RTSP_CODE_BAD_REQUEST;
 
-	shl_ring_copy(&dec->buf, line, dec->buflen);
-	line[dec->buflen] = 0;
-	sanitize_line(line, dec->buflen);
+	value = strchr(line, ':');
+	if (!value)
+		return 0;
+
+	for (end = value; end > line && end[-1] == ' '; --end)
+		/* empty */ ;
+	*end = 0;
+
+	value += strspn(value + 1, " ") + 1;
+	r = shl_atoi_z(value, 10, &next, &val);
+
+	if (!strcasecmp(line, "Content-Length")) {
+		if (r < 0 || *next)
+			return -EINVAL;
+
+		dec->remaining_body = val;
+	} else if (!strcasecmp(line, "CSeq")) {
+		if (r >= 0 && !*next && !(val & RTSP_FLAG_REMOTE_COOKIE))
+			dec->m->cookie = val | RTSP_FLAG_REMOTE_COOKIE;
+	}
+
+	return 0;
+}
+
+static int parser_finish_header_line(struct rtsp *bus)
+{
+	struct rtsp_parser *dec = &bus->parser;
+	char *line;
+	int r;
+
+	line = rtsp_get_scratch(bus, dec->buflen + 1);
+	if (!line)
+		return -ENOMEM;
+
+	shl_ring_copy(&dec->buf, line, dec->buflen);
+	line[dec->buflen] = 0;
+	sanitize_line(line, dec->buflen);
 
 	if (!dec->m)
 		r = rtsp_message_from_head(bus, &dec->m, line);
+	else if (bus->limits.max_headers &&
+		 dec->m->header_used >= bus->limits.max_headers)
+		r = parser_skip_header(bus, line);
 	else
 		r = parser_append_header(bus, line);
 
 	return r;
 }
 
+/*
+ * Drop the current message as it exceeded the limits of the bus. Requests
+ * are answered with dec->reject as status code, so the remote side does not
+ * wait for a reply that never comes. A reply we cannot accept fails with
+ * -ENOBUFS, which hangs up the bus like an overflowing parser ring. Anything
+ * else is dropped and only counted.
+ */
+static int parser_reject(struct rtsp *bus)
+{
+	_rtsp_message_unref_ struct rtsp_message *m = NULL;
+	_rtsp_message_unref_ struct rtsp_message *rep = NULL;
+	struct rtsp_parser *dec = &bus->parser;
+	unsigned int code;
+	int r;
+
+	m = dec->m;
+	dec->m = NULL;
+	code = dec->reject;
+	dec->reject = 0;
+	++bus->mem_stats.rejected;
+
+	if (m && m->type == RTSP_MESSAGE_REPLY)
+		return -ENOBUFS;
+	if (!m || m->type != RTSP_MESSAGE_REQUEST ||
+	    !(m->cookie & RTSP_FLAG_REMOTE_COOKIE))
+		return 0;
+
+	r = rtsp_message_new_reply(bus, &rep, m->cookie, code, NULL);
+	if (r < 0)
+		return r;
+
+	r = rtsp_message_seal(rep);
+	if (r < 0)
+		return r;
+
+	return rtsp_send(bus, rep);
+}
+
 static int parser_submit(struct rtsp *bus)
 {
 	_rtsp_message_unref_ struct rtsp_message *m = NULL;
@@ -2144,6 +2994,8 @@ static int parser_submit(struct rtsp *bus)
 
 	if (!dec->m)
 		return 0;
+	if (dec->reject)
+		return parser_reject(bus);
 
 	m = dec->m;
 	dec->m = NULL;
@@ -2157,21 +3009,40 @@ static int parser_submit(struct rtsp *bus)
 	return rtsp_incoming_message(m);
 }
 
-static int parser_submit_data(struct rtsp *bus, uint8_t *p)
+static int parser_submit_data(struct rtsp *bus)
 {
 	_rtsp_message_unref_ struct rtsp_message *m = NULL;
 	struct rtsp_parser *dec = &bus->parser;
+	uint8_t *raw;
 	int r;
 
-	r = rtsp_message_new_data(bus,
-				  &m,
-				  dec->data_channel,
-				  p,
-				  dec->data_size);
-	if (r < 0) {
-		free(p);
+	r = rtsp_message_new(bus, &m);
+	if (r < 0)
 		return r;
-	}
+
+	m->type = RTSP_MESSAGE_DATA;
+	m->data_channel = dec->data_channel;
+	m->data_size = dec->data_size;
+
+	/* Copy the frame from the ring straight into its wire-format buffer,
+	 * the payload is referenced from there. Not really needed, but in case
+	 * it's actually a text-payload make sure it's 0-terminated to work
+	 * around client bugs. */
+	raw = shl_arena_alloc(m->arena, 4 + dec->data_size + 1);
+	if (!raw)
+		return -ENOMEM;
+
+	raw[0] = '$';
+	raw[1] = dec->data_channel;
+	raw[2] = (dec->data_size & 0xff00U) >> 8;
+	raw[3] = (dec->data_size & 0x00ffU);
+	shl_ring_copy(&dec->buf, &raw[4], dec->data_size);
+	raw[4 + dec->data_size] = 0;
+
+	m->raw = raw;
+	m->raw_size = 4 + dec->data_size;
+	if (m->data_size)
+		m->data_payload = &raw[4];
 
 	r = rtsp_message_seal(m);
 	if (r < 0)
@@ -2182,21 +3053,137 @@ static int parser_submit_data(struct rtsp *bus, uint8_t *p)
 	return rtsp_incoming_message(m);
 }
 
-static int parser_feed_char_new(struct rtsp *bus, char ch)
+/*
+ * Return the length of the initial segment of @buf which does not contain any
+ * of the bytes in @reject. Unlike strcspn(), @buf is not 0-terminated and may
+ * contain binary zeros. We run one memchr() per rejected byte and shrink the
+ * search-space with each hit, so the hot loop stays in libc.
+ */
+static size_t rtsp__memcspn(const char *buf,
+			    size_t len,
+			    const char *reject)
+{
+	const char *p;
+
+	for ( ; *reject; ++reject) {
+		p = memchr(buf, *reject, len);
+		if (p)
+			len = p - buf;
+	}
+
+	return len;
+}
+
+static int parser_finish_body(struct rtsp *bus)
 {
 	struct rtsp_parser *dec = &bus->parser;
+	struct iovec vec[2];
+	const char *body;
+	char *line;
+	int r;
 
-	switch (ch) {
-	case '\r':
-	case '\n':
-	case '\t':
-	case ' ':
-		/* If no msg has been started, yet, we ignore LWS for
-		 * compatibility reasons. Note that they're actually not
-		 * allowed, but should be ignored by implementations. */
-		++dec->buflen;
-		break;
-	case '$':
+	/* Full body received, submit it and go to STATE_NEW. The message
+	 * references the body until it is sealed, so as long as the body is
+	 * linear in the ring, we hand it over without copying. */
+
+	if (dec->m && dec->reject) {
+		r = parser_reject(bus);
+	} else if (dec->m) {
+		shl_ring_peek(&dec->buf, vec);
+		if (vec[0].iov_len >= dec->buflen) {
+			body = vec[0].iov_base;
+		} else {
+			line = shl_arena_alloc(dec->m->arena, dec->buflen + 1);
+			if (!line)
+				return -ENOMEM;
+
+			shl_ring_copy(&dec->buf, line, dec->buflen);
+			line[dec->buflen] = 0;
+			body = line;
+		}
+
+		r = rtsp_message_append_body(dec->m,
+					     body,
+					     dec->buflen);
+		if (r >= 0)
+			r = parser_submit(bus);
+	} else {
+		r = 0;
+	}
+
+	dec->state = STATE_NEW;
+	shl_ring_pull(&dec->buf, dec->buflen);
+	dec->buflen = 0;
+
+	return r;
+}
+
+static int parser_dispatch_data(struct rtsp *bus,
+				rtsp_data_fn cb_fn,
+				void *data)
+{
+	struct rtsp_parser *dec = &bus->parser;
+	struct iovec vec[2];
+	uint8_t *payload;
+
+	/* Hand the payload to the handler right from the ring. Only if it
+	 * wraps around (no mirrored ring available) we have to linearize it in
+	 * the scratch buffer. */
+
+	shl_ring_peek(&dec->buf, vec);
+	if (vec[0].iov_len >= dec->data_size) {
+		payload = vec[0].iov_base;
+	} else {
+		payload = (uint8_t*)rtsp_get_scratch(bus, dec->data_size);
+		if (!payload)
+			return -ENOMEM;
+
+		shl_ring_copy(&dec->buf, payload, dec->data_size);
+	}
+
+	return cb_fn(bus, dec->data_channel, payload, dec->data_size, data);
+}
+
+static int parser_finish_data(struct rtsp *bus)
+{
+	struct rtsp_parser *dec = &bus->parser;
+	struct rtsp_data_handler *h = NULL;
+	int r;
+
+	if (bus->data_handlers)
+		h = &bus->data_handlers[dec->data_channel];
+
+	if (h && h->cb_fn)
+		r = parser_dispatch_data(bus, h->cb_fn, h->data);
+	else
+		r = parser_submit_data(bus);
+
+	dec->state = STATE_NEW;
+	shl_ring_pull(&dec->buf, dec->buflen);
+	dec->buflen = 0;
+
+	return r;
+}
+
+static ssize_t parser_feed_new(struct rtsp *bus, const char *buf, size_t len)
+{
+	struct rtsp_parser *dec = &bus->parser;
+	size_t i;
+
+	/* If no msg has been started, yet, we ignore LWS for compatibility
+	 * reasons. Note that they're actually not allowed, but should be
+	 * ignored by implementations. */
+	for (i = 0; i < len; ++i)
+		if (buf[i] != '\r' && buf[i] != '\n' &&
+		    buf[i] != '\t' && buf[i] != ' ')
+			break;
+
+	if (i > 0) {
+		dec->buflen += i;
+		return i;
+	}
+
+	if (*buf == '$') {
 		/* Interleaved data. Followed by 1 byte channel-id and 2-byte
 		 * data-length. */
 		dec->state = STATE_DATA_HEAD;
@@ -2206,28 +3193,39 @@ static int parser_feed_char_new(struct rtsp *bus, char ch)
 		/* clear any previous whitespace and leading '$' */
 		shl_ring_pull(&dec->buf, dec->buflen + 1);
 		dec->buflen = 0;
-		break;
-	default:
+	} else {
 		/* Clear any pending data in the ring-buffer and then just
 		 * push the char into the buffer. Any char except LWS is fine
 		 * here. */
 		dec->state = STATE_HEADER;
 		dec->remaining_body = 0;
+		dec->reject = 0;
 
 		shl_ring_pull(&dec->buf, dec->buflen);
 		dec->buflen = 1;
-		break;
 	}
 
-	return 0;
+	return 1;
 }
 
-static int parser_feed_char_header(struct rtsp *bus, char ch)
+static ssize_t parser_feed_header(struct rtsp *bus, const char *buf, size_t len)
 {
 	struct rtsp_parser *dec = &bus->parser;
+	size_t l;
 	int r;
 
-	switch (ch) {
+	/* Unless we're right behind a line-break, everything up to the next
+	 * \r, \n or '"' is part of the current header-line and needs no
+	 * further inspection. Consume it in one go. */
+	if (dec->last_chr != '\r' && dec->last_chr != '\n') {
+		l = rtsp__memcspn(buf, len, "\r\n\"");
+		if (l > 0) {
+			dec->buflen += l;
+			return l;
+		}
+	}
+
+	switch (*buf) {
 	case '\r':
 		if (dec->last_chr == '\r' || dec->last_chr == '\n') {
 			/* \r\r means empty new-line. We actually allow \r\r\n,
@@ -2287,16 +3285,12 @@ static int parser_feed_char_header(struct rtsp *bus, char ch)
 				if (r < 0)
 					return r;
 			}
-		} else if (dec->last_chr == '\r') {
-			/* We got an \r\n. We cannot finish the header line as
-			 * it might be a continuation line. Next character
-			 * decides what to do. Don't do anything here.
-			 * \r\n\r cannot happen here as it is handled by
-			 * STATE_HEADER_NL. */
-			++dec->buflen;
 		} else {
-			/* Same as above, we cannot finish the line as it
-			 * might be a continuation line. Do nothing. */
+			/* We got an \r\n or a single \n. We cannot finish the
+			 * header line as it might be a continuation line. Next
+			 * character decides what to do. Don't do anything
+			 * here. \r\n\r cannot happen here as it is handled by
+			 * STATE_HEADER_NL. */
 			++dec->buflen;
 		}
 		break;
@@ -2323,7 +3317,7 @@ static int parser_feed_char_header(struct rtsp *bus, char ch)
 
 		/* consume character and handle special chars */
 		++dec->buflen;
-		if (ch == '"') {
+		if (*buf == '"') {
 			/* go to STATE_HEADER_QUOTE */
 			dec->state = STATE_HEADER_QUOTE;
 			dec->quoted = false;
@@ -2332,82 +3326,77 @@ static int parser_feed_char_header(struct rtsp *bus, char ch)
 		break;
 	}
 
-	return 0;
+	return 1;
 }
 
-static int parser_feed_char_header_quote(struct rtsp *bus, char ch)
+static ssize_t parser_feed_header_quote(struct rtsp *bus,
+					const char *buf,
+					size_t len)
 {
 	struct rtsp_parser *dec = &bus->parser;
+	size_t l;
 
 	if (dec->last_chr == '\\' && !dec->quoted) {
 		/* This character is quoted, so copy it unparsed. To handle
 		 * double-backslash, we set the "quoted" bit. */
 		++dec->buflen;
 		dec->quoted = true;
-	} else {
-		dec->quoted = false;
+		return 1;
+	}
 
-		/* consume character and handle special chars */
-		++dec->buflen;
-		if (ch == '"')
-			dec->state = STATE_HEADER;
+	dec->quoted = false;
+
+	/* consume everything up to the next special char in one go */
+	l = rtsp__memcspn(buf, len, "\"\\");
+	if (l > 0) {
+		dec->buflen += l;
+		return l;
 	}
 
-	return 0;
+	++dec->buflen;
+	if (*buf == '"')
+		dec->state = STATE_HEADER;
+
+	return 1;
 }
 
-static int parser_feed_char_body(struct rtsp *bus, char ch)
+static ssize_t parser_feed_body(struct rtsp *bus, const char *buf, size_t len)
 {
 	struct rtsp_parser *dec = &bus->parser;
-	char *line;
+	size_t l;
 	int r;
 
 	/* If remaining_body was already 0, the message had no body. Note that
 	 * messages without body are finished early, so no need to call
-	 * decoder_submit() here. Simply forward @ch to STATE_NEW.
-	 * @rlen is usually 0. We don't care and forward it, too. */
+	 * decoder_submit() here. Simply forward @buf to STATE_NEW. */
 	if (!dec->remaining_body) {
 		dec->state = STATE_NEW;
-		return parser_feed_char_new(bus, ch);
+		return parser_feed_new(bus, buf, len);
 	}
 
-	/* *any* character is allowed as body */
-	++dec->buflen;
-
-	if (!--dec->remaining_body) {
-		/* full body received, copy it and go to STATE_NEW */
-
-		if (dec->m) {
-			line = malloc(dec->buflen + 1);
-			if (!line)
-				return -ENOMEM;
-
-			shl_ring_copy(&dec->buf, line, dec->buflen);
-			line[dec->buflen] = 0;
-
-			r = rtsp_message_append_body(dec->m,
-						     line,
-						     dec->buflen);
-			if (r >= 0)
-				r = parser_submit(bus);
+	/* *any* character is allowed as body, take as much as we can */
+	l = shl_min(len, dec->remaining_body);
+	dec->buflen += l;
+	dec->remaining_body -= l;
 
-			free(line);
-		} else {
-			r = 0;
-		}
-
-		dec->state = STATE_NEW;
+	/* bodies of rejected messages are dropped right away */
+	if (dec->reject) {
 		shl_ring_pull(&dec->buf, dec->buflen);
 		dec->buflen = 0;
+	}
 
+	if (!dec->remaining_body) {
+		r = parser_finish_body(bus);
 		if (r < 0)
 			return r;
 	}
 
-	return 0;
+	return l;
 }
 
-static int parser_feed_char_header_nl(struct rtsp *bus, char ch)
+static ssize_t parser_feed_header_nl(struct rtsp *bus,
+				     const char *buf,
+				     size_t len)
 {
 	struct rtsp_parser *dec = &bus->parser;
 
@@ -2419,7 +3408,7 @@ static int parser_feed_char_header_nl(struct rtsp *bus, char ch)
 	 * the ring-buffer that has already been parsed (which normally can
 	 * nothing, but lets be safe). */
 
-	if (ch == '\n') {
+	if (*buf == '\n') {
 		/* discard transition chars plus new \n */
 		shl_ring_pull(&dec->buf, dec->buflen + 1);
 		dec->buflen = 0;
@@ -2428,137 +3417,120 @@ static int parser_feed_char_header_nl(struct rtsp *bus, char ch)
 		if (!dec->remaining_body)
 			dec->state = STATE_NEW;
 
-		return 0;
+		return 1;
 	} else {
-		/* discard any transition chars and push @ch into body */
+		/* discard any transition chars and push @buf into body */
 		shl_ring_pull(&dec->buf, dec->buflen);
 		dec->buflen = 0;
 
 		dec->state = STATE_BODY;
-		return parser_feed_char_body(bus, ch);
+		return parser_feed_body(bus, buf, len);
 	}
 }
 
-static int parser_feed_char_data_head(struct rtsp *bus, char ch)
+static ssize_t parser_feed_data_head(struct rtsp *bus,
+				     const char *buf,
+				     size_t len)
 {
 	struct rtsp_parser *dec = &bus->parser;
-	uint8_t buf[3];
+	uint8_t head[3];
+	size_t l;
+	int r;
 
 	/* Read 1 byte channel-id and 2 byte body length. */
 
-	if (++dec->buflen >= 3) {
-		shl_ring_copy(&dec->buf, buf, 3);
+	l = shl_min(len, 3 - dec->buflen);
+	dec->buflen += l;
+
+	if (dec->buflen >= 3) {
+		shl_ring_copy(&dec->buf, head, 3);
 		shl_ring_pull(&dec->buf, dec->buflen);
 		dec->buflen = 0;
 
-		dec->data_channel = buf[0];
-		dec->data_size = (((uint16_t)buf[1]) << 8) | (uint16_t)buf[2];
+		dec->data_channel = head[0];
+		dec->data_size = (((uint16_t)head[1]) << 8) | (uint16_t)head[2];
 		dec->state = STATE_DATA_BODY;
+
+		/* empty payloads are complete right away */
+		if (!dec->data_size) {
+			r = parser_finish_data(bus);
+			if (r < 0)
+				return r;
+		}
 	}
 
-	return 0;
+	return l;
 }
 
-static int parser_feed_char_data_body(struct rtsp *bus, char ch)
+static ssize_t parser_feed_data_body(struct rtsp *bus,
+				     const char *buf,
+				     size_t len)
 {
 	struct rtsp_parser *dec = &bus->parser;
-	uint8_t *buf;
+	size_t l;
 	int r;
 
-	/* Read @dec->data_size bytes of raw data. */
-
-	if (++dec->buflen >= dec->data_size) {
-		buf = malloc(dec->data_size + 1);
-		if (!buf)
-			return -ENOMEM;
-
-		/* Not really needed, but in case it's actually a text-payload
-		 * make sure it's 0-terminated to work around client bugs. */
-		buf[dec->data_size] = 0;
-
-		shl_ring_copy(&dec->buf, buf, dec->data_size);
-
-		r = parser_submit_data(bus, buf);
-		free(buf);
+	/* Read @dec->data_size bytes of raw data, as much as we have. */
 
-		dec->state = STATE_NEW;
-		shl_ring_pull(&dec->buf, dec->buflen);
-		dec->buflen = 0;
+	l = shl_min(len, dec->data_size - dec->buflen);
+	dec->buflen += l;
 
+	if (dec->buflen >= dec->data_size) {
+		r = parser_finish_data(bus);
 		if (r < 0)
 			return r;
 	}
 
-	return 0;
+	return l;
 }
 
-static int parser_feed_char(struct rtsp *bus, char ch)
+static ssize_t parser_feed(struct rtsp *bus, const char *buf, size_t len)
 {
 	struct rtsp_parser *dec = &bus->parser;
-	int r = 0;
 
 	switch (dec->state) {
 	case STATE_NEW:
-		r = parser_feed_char_new(bus, ch);
-		break;
+		return parser_feed_new(bus, buf, len);
 	case STATE_HEADER:
-		r = parser_feed_char_header(bus, ch);
-		break;
+		return parser_feed_header(bus, buf, len);
 	case STATE_HEADER_QUOTE:
-		r = parser_feed_char_header_quote(bus, ch);
-		break;
+		return parser_feed_header_quote(bus, buf, len);
 	case STATE_HEADER_NL:
-		r = parser_feed_char_header_nl(bus, ch);
-		break;
+		return parser_feed_header_nl(bus, buf, len);
 	case STATE_BODY:
-		r = parser_feed_char_body(bus, ch);
-		break;
+		return parser_feed_body(bus, buf, len);
 	case STATE_DATA_HEAD:
-		r = parser_feed_char_data_head(bus, ch);
-		break;
+		return parser_feed_data_head(bus, buf, len);
 	case STATE_DATA_BODY:
-		r = parser_feed_char_data_body(bus, ch);
-		break;
+		return parser_feed_data_body(bus, buf, len);
 	}
 
-	return r;
+	return -EFAULT;
 }
 
+/*
+ * Parse @len bytes at @buf. The data must already be part of the parser ring,
+ * so the caller has to set dec->buflen to the ring size *before* the data was
+ * added. We go through it block by block, each state consumes as many bytes
+ * as it can handle in one step and increments dec->buflen accordingly. Only
+ * pulling from the ring is allowed while parsing, so @buf stays valid.
+ */
 static int rtsp_parse_data(struct rtsp *bus,
 			   const char *buf,
 			   size_t len)
 {
 	struct rtsp_parser *dec = &bus->parser;
 	size_t i;
-	int r;
-
-	if (!len)
-		return -EAGAIN;
+	ssize_t l;
 
-	/*
-	 * We keep dec->buflen as cache for the current parsed-buffer size. We
-	 * need to push the whole input-buffer into our parser-buffer and go
-	 * through it one-by-one. The parser increments dec->buflen for each of
-	 * these and once we're done, we verify our state is consistent.
-	 */
+	for (i = 0; i < len; i += l) {
+		l = parser_feed(bus, &buf[i], len - i);
+		if (l < 0)
+			return l;
 
-	dec->buflen = shl_ring_get_size(&dec->buf);
-	r = shl_ring_push(&dec->buf, buf, len);
-	if (r < 0)
-		return r;
-
-	for (i = 0; i < len; ++i) {
-		r = parser_feed_char(bus, buf[i]);
-		if (r < 0)
-			return r;
-
-		dec->last_chr = buf[i];
+		dec->last_chr = buf[i + l - 1];
 	}
 
-	/* check for internal parser inconsistencies; should not happen! */
-	if (dec->buflen != shl_ring_get_size(&dec->buf))
-		return -EFAULT;
-
 	return 0;
 }
 
@@ -2661,21 +3633,17 @@ static int rtsp_hup(struct rtsp *bus)
 	return rtsp_call(bus, NULL);
 }
 
-static int rtsp_timer_fn(sd_event_source *src, uint64_t usec, void *data)
+static void rtsp_timer_fn(struct twheel_timer *t, void *data)
 {
 	struct rtsp_message *m = data;
-	int r;
 
 	/* make sure message stays around during unlinking and callbacks */
 	rtsp_message_ref(m);
 
-	sd_event_source_set_enabled(m->timer_source, SD_EVENT_OFF);
 	rtsp_drop_message(m);
-	r = rtsp_call_message(m, NULL);
+	rtsp_call_message(m, NULL);
 
 	rtsp_message_unref(m);
-
-	return r;
 }
 
 static int rtsp_link_waiting(struct rtsp_message *m)
@@ -2687,41 +3655,20 @@ static int rtsp_link_waiting(struct rtsp_message *m)
 		return r;
 
 	/* no need to wait for timeout if no-body listens */
-	if (m->bus->event && m->cb_fn) {
-		r = sd_event_add_time(m->bus->event,
-				      &m->timer_source,
-				      CLOCK_MONOTONIC,
-				      m->timeout,
-				      0,
-				      rtsp_timer_fn,
-				      m);
-		if (r < 0)
-			goto error;
-
-		r = sd_event_source_set_priority(m->timer_source,
-						 m->bus->priority);
-		if (r < 0)
-			goto error;
-	}
+	if (m->bus->wheel && m->cb_fn)
+		twheel_timer_add(m->bus->wheel, &m->timer, m->timeout);
 
 	m->is_waiting = true;
 	++m->bus->waiting_cnt;
 	rtsp_message_ref(m);
 
 	return 0;
-
-error:
-	sd_event_source_unref(m->timer_source);
-	m->timer_source = NULL;
-	shl_htable_remove_u64(&m->bus->waiting, m->cookie, NULL);
-	return r;
 }
 
 static void rtsp_unlink_waiting(struct rtsp_message *m)
 {
 	if (m->is_waiting) {
-		sd_event_source_unref(m->timer_source);
-		m->timer_source = NULL;
+		twheel_timer_remove(&m->timer);
 		shl_htable_remove_u64(&m->bus->waiting, m->cookie, NULL);
 		m->is_waiting = false;
 		--m->bus->waiting_cnt;
@@ -2776,13 +3723,38 @@ static int rtsp_incoming_message(struct rtsp_message *m)
 
 static int rtsp_read(struct rtsp *bus)
 {
-	char buf[4096];
+	struct rtsp_parser *dec = &bus->parser;
+	struct iovec vec[2];
+	struct msghdr msg = { };
 	ssize_t res;
+	size_t i, l;
+	int r;
+
+	/*
+	 * We receive straight into the free space of the parser ring, so there
+	 * is no bounce-buffer to copy from. The ring hands out up to two
+	 * regions, which we fill in a single vectored recvmsg().
+	 *
+	 * The ring only holds the message that is currently parsed. If that
+	 * one does not fit into the ring limit, we cannot make any progress.
+	 */
 
-	res = recv(bus->fd,
-		   buf,
-		   sizeof(buf),
-		   MSG_DONTWAIT);
+	if (bus->limits.max_ring &&
+	    shl_ring_get_size(&dec->buf) + RTSP_READ_SIZE > bus->limits.max_ring) {
+		++bus->mem_stats.rejected;
+		return -EMSGSIZE;
+	}
+
+	r = shl_ring_reserve(&dec->buf, vec, RTSP_READ_SIZE);
+	if (r < 0)
+		return r;
+
+	rtsp_update_mem(bus);
+
+	msg.msg_iov = vec;
+	msg.msg_iovlen = r;
+
+	res = recvmsg(bus->fd, &msg, MSG_DONTWAIT);
 	if (res < 0) {
 		if (errno == EAGAIN || errno == EINTR)
 			return -EAGAIN;
@@ -2791,36 +3763,135 @@ static int rtsp_read(struct rtsp *bus)
 	} else if (!res) {
 		/* there're no 0-length packets on streams; this is EOF */
 		return -EPIPE;
-	} else if (res > sizeof(buf)) {
-		res = sizeof(buf);
 	}
 
+	/*
+	 * We keep dec->buflen as cache for the current parsed-buffer size.
+	 * Everything in the ring up to the new data has already been parsed.
+	 * Once we're done, we verify our state is consistent.
+	 */
+
+	dec->buflen = shl_ring_get_size(&dec->buf);
+	shl_ring_commit(&dec->buf, res);
+
 	/* parses all messages and calls rtsp_incoming_message() for each */
-	return rtsp_parse_data(bus, buf, res);
+	for (i = 0; i < msg.msg_iovlen && res > 0; ++i) {
+		l = shl_min((size_t)res, vec[i].iov_len);
+		r = rtsp_parse_data(bus, vec[i].iov_base, l);
+		if (r < 0)
+			return r;
+
+		res -= l;
+	}
+
+	/* check for internal parser inconsistencies; should not happen! */
+	if (dec->buflen != shl_ring_get_size(&dec->buf))
+		return -EFAULT;
+
+	/* the idle timer is re-armed lazily from rtsp_idle_fn() */
+	bus->last_read = shl_now(CLOCK_MONOTONIC);
+	if (bus->wheel && bus->limits.idle_shrink &&
+	    !twheel_timer_is_pending(&bus->idle_timer))
+		twheel_timer_add(bus->wheel,
+				 &bus->idle_timer,
+				 bus->last_read + bus->limits.idle_shrink);
+
+	return 0;
+}
+
+/*
+ * Release all buffers the bus keeps around for parsing: the parser ring is
+ * shrunk to fit a partially received message (or freed if empty), the scratch
+ * buffer and all cached message arenas are freed. They are re-allocated on
+ * demand once traffic resumes.
+ */
+static void rtsp_shrink(struct rtsp *bus)
+{
+	shl_ring_shrink(&bus->parser.buf);
+
+	free(bus->scratch);
+	bus->scratch = NULL;
+	bus->scratch_size = 0;
+
+	rtsp_drop_arenas(bus, 0);
+
+	++bus->mem_stats.shrinks;
+	rtsp_update_mem(bus);
 }
 
-static int rtsp_write_message(struct rtsp_message *m)
+static void rtsp_idle_fn(struct twheel_timer *t, void *data)
 {
-	size_t remaining;
+	struct rtsp *bus = data;
+	uint64_t expiry;
+
+	if (!bus->limits.idle_shrink)
+		return;
+
+	expiry = bus->last_read + bus->limits.idle_shrink;
+	if (shl_now(CLOCK_MONOTONIC) < expiry) {
+		twheel_timer_add(bus->wheel, t, expiry);
+		return;
+	}
+
+	rtsp_shrink(bus);
+}
+
+static int rtsp_write(struct rtsp *bus)
+{
+	struct iovec vec[RTSP_WRITE_IOV];
+	struct msghdr msg = { };
+	struct rtsp_message *m;
+	struct shl_dlist *i, *t;
+	size_t n, l;
 	ssize_t res;
 
-	m->is_sending = true;
-	remaining = m->raw_size - m->sent;
-	res = send(m->bus->fd,
-		   &m->raw[m->sent],
-		   remaining,
-		   MSG_NOSIGNAL | MSG_DONTWAIT);
+	if (shl_dlist_empty(&bus->outgoing))
+		return 0;
+
+	/*
+	 * Gather the remaining raw data of as many queued messages as we can
+	 * and send them with a single sendmsg(). Whatever the kernel accepted
+	 * is then accounted to the messages in queue order. The first message
+	 * that was only partly sent stays at the front and is marked as being
+	 * sent, so it is never interrupted.
+	 */
+
+	n = 0;
+	shl_dlist_for_each(i, &bus->outgoing) {
+		if (n >= RTSP_WRITE_IOV)
+			break;
+
+		m = shl_dlist_entry(i, struct rtsp_message, list);
+		vec[n].iov_base = &m->raw[m->sent];
+		vec[n].iov_len = m->raw_size - m->sent;
+		++n;
+	}
+
+	msg.msg_iov = vec;
+	msg.msg_iovlen = n;
+
+	res = sendmsg(bus->fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
 	if (res < 0) {
 		if (errno == EAGAIN || errno == EINTR)
 			return -EAGAIN;
 
 		return -errno;
-	} else if (res > (ssize_t)remaining) {
-		res = remaining;
 	}
 
-	m->sent += res;
-	if (m->sent >= m->raw_size) {
+	shl_dlist_for_each_safe(i, t, &bus->outgoing) {
+		if (!res)
+			break;
+
+		m = shl_dlist_entry(i, struct rtsp_message, list);
+		l = shl_min((size_t)res, m->raw_size - m->sent);
+		m->sent += l;
+		res -= l;
+
+		if (m->sent < m->raw_size) {
+			m->is_sending = true;
+			break;
+		}
+
 		/* no need to wait for answer if no-body listens */
 		if (!m->cb_fn)
 			rtsp_unlink_waiting(m);
@@ -2832,17 +3903,6 @@ static int rtsp_write_message(struct rtsp_message *m)
 	return 0;
 }
 
-static int rtsp_write(struct rtsp *bus)
-{
-	struct rtsp_message *m;
-
-	if (shl_dlist_empty(&bus->outgoing))
-		return 0;
-
-	m = shl_dlist_first_entry(&bus->outgoing, struct rtsp_message, list);
-	return rtsp_write_message(m);
-}
-
 static int rtsp_io_fn(sd_event_source *src, int fd, uint32_t mask, void *data)
 {
 	struct rtsp *bus = data;
@@ -2902,7 +3962,7 @@ static int rtsp_io_prepare_fn(sd_event_source *src, void *data)
 	int r;
 
 	mask = EPOLLHUP | EPOLLERR | EPOLLIN;
-	if (!shl_dlist_empty(&bus->outgoing))
+	if (!shl_dlist_empty(&bus->outgoing) && !bus->corked)
 		mask |= EPOLLOUT;
 
 	r = sd_event_source_set_io_events(bus->fd_source, mask);
@@ -2925,10 +3985,19 @@ int rtsp_open(struct rtsp **out, int fd)
 
 	bus->ref = 1;
 	bus->fd = fd;
+	bus->arena_max = RTSP_ARENA_CACHE;
+	bus->limits.max_ring = RTSP_DEFAULT_MAX_RING;
+	bus->limits.max_headers = RTSP_DEFAULT_MAX_HEADERS;
+	bus->limits.max_body = RTSP_DEFAULT_MAX_BODY;
+	bus->limits.idle_shrink = RTSP_DEFAULT_IDLE_SHRINK;
+	twheel_timer_init(&bus->idle_timer, rtsp_idle_fn, bus);
 	shl_dlist_init(&bus->matches);
 	shl_dlist_init(&bus->outgoing);
 	shl_htable_init_u64(&bus->waiting);
 
+	/* linear parser ring, so lines and payloads never need a copy */
+	shl_ring_set_mirror(&bus->parser.buf, true);
+
 	*out = bus;
 	bus = NULL;
 	return 0;
@@ -3008,6 +4077,9 @@ void rtsp_unref(struct rtsp *bus)
 	}
 
 	rtsp_detach_event(bus);
+	rtsp_drop_arenas(bus, 0);
+	free(bus->scratch);
+	free(bus->data_handlers);
 	shl_ring_clear(&bus->parser.buf);
 	shl_htable_clear_u64(&bus->waiting, NULL, NULL);
 	close(bus->fd);
@@ -3019,6 +4091,112 @@ bool rtsp_is_dead(struct rtsp *bus)
 	return !bus || bus->is_dead;
 }
 
+/**
+ * rtsp_set_arena_cache() - Set number of recycled message arenas
+ * @bus: rtsp bus to configure
+ * @max: maximum number of arenas to keep around
+ *
+ * Whenever a message is freed, its arena is kept on the bus for the next
+ * message, unless @max arenas are cached already. Only the initial chunk of
+ * each arena is kept, so this bounds the cache to a few pages. Pass 0 to
+ * disable recycling.
+ *
+ * Returns:
+ * 0 on success, negative error code on failure.
+ */
+int rtsp_set_arena_cache(struct rtsp *bus, size_t max)
+{
+	if (!bus || max > RTSP_ARENA_CACHE_MAX)
+		return -EINVAL;
+
+	bus->arena_max = max;
+	rtsp_drop_arenas(bus, max);
+	rtsp_update_mem(bus);
+
+	return 0;
+}
+
+/**
+ * rtsp_get_alloc_stats() - Retrieve message allocation counters
+ * @bus: rtsp bus to query
+ * @stats: output storage for the counters
+ *
+ * The counters cover all messages of @bus that were freed so far, plus any
+ * allocations for the bus-internal parser buffers.
+ */
+void rtsp_get_alloc_stats(struct rtsp *bus, struct rtsp_alloc_stats *stats)
+{
+	if (!bus || !stats)
+		return;
+
+	*stats = bus->alloc_stats;
+}
+
+/**
+ * rtsp_set_limits() - Set memory limits of the bus
+ * @bus: rtsp bus to configure
+ * @limits: new limits
+ *
+ * @limits->max_headers and @limits->max_body are checked for each incoming
+ * message. A message exceeding them is not delivered. Its remaining headers
+ * and its body are skipped without buffering them. Requests are answered with
+ * RTSP_CODE_BAD_REQUEST or RTSP_CODE_REQUEST_ENTITY_TOO_LARGE respectively.
+ *
+ * @limits->max_ring bounds the parser ring-buffer (rounded up to the next
+ * power of 2). It has to hold a single message head or body at a time, so if
+ * the remote side sends more than that, the connection cannot be recovered
+ * and is treated as HUP. Thus, it should be well above @limits->max_body.
+ *
+ * If no data was received for @limits->idle_shrink microseconds, the parser
+ * buffers and the arena cache are released. A value of 0 disables the
+ * respective limit.
+ *
+ * Returns:
+ * 0 on success, negative error code on failure.
+ */
+int rtsp_set_limits(struct rtsp *bus, const struct rtsp_limits *limits)
+{
+	if (!bus || !limits)
+		return -EINVAL;
+	if (limits->max_ring && limits->max_ring < 2 * RTSP_READ_SIZE)
+		return -EINVAL;
+
+	bus->limits = *limits;
+
+	twheel_timer_remove(&bus->idle_timer);
+	if (bus->wheel && bus->last_read && bus->limits.idle_shrink)
+		twheel_timer_add(bus->wheel,
+				 &bus->idle_timer,
+				 bus->last_read + bus->limits.idle_shrink);
+
+	return 0;
+}
+
+void rtsp_get_limits(struct rtsp *bus, struct rtsp_limits *limits)
+{
+	if (!bus || !limits)
+		return;
+
+	*limits = bus->limits;
+}
+
+/**
+ * rtsp_get_mem_stats() - Retrieve memory usage of the bus
+ * @bus: rtsp bus to query
+ * @stats: output storage for the counters
+ *
+ * This covers the memory kept by the bus itself, that is the parser
+ * ring-buffer, the scratch buffer and the cached message arenas. Messages
+ * that are still referenced are not included.
+ */
+void rtsp_get_mem_stats(struct rtsp *bus, struct rtsp_mem_stats *stats)
+{
+	if (!bus || !stats)
+		return;
+
+	*stats = bus->mem_stats;
+}
+
 int rtsp_attach_event(struct rtsp *bus, sd_event *event, int priority)
 {
 	struct rtsp_message *m;
@@ -3059,26 +4237,21 @@ int rtsp_attach_event(struct rtsp *bus, sd_event *event, int priority)
 	if (r < 0)
 		goto error;
 
+	r = twheel_get(&bus->wheel, bus->event, priority);
+	if (r < 0)
+		goto error;
+
 	RTSP_FOREACH_WAITING(m, bus) {
 		/* no need to wait for timeout if no-body listens */
-		if (!m->cb_fn)
-			continue;
-
-		r = sd_event_add_time(bus->event,
-				      &m->timer_source,
-				      CLOCK_MONOTONIC,
-				      m->timeout,
-				      0,
-				      rtsp_timer_fn,
-				      m);
-		if (r < 0)
-			goto error;
-
-		r = sd_event_source_set_priority(m->timer_source, priority);
-		if (r < 0)
-			goto error;
+		if (m->cb_fn)
+			twheel_timer_add(bus->wheel, &m->timer, m->timeout);
 	}
 
+	if (bus->last_read && bus->limits.idle_shrink)
+		twheel_timer_add(bus->wheel,
+				 &bus->idle_timer,
+				 bus->last_read + bus->limits.idle_shrink);
+
 	return 0;
 
 error:
@@ -3093,10 +4266,12 @@ void rtsp_detach_event(struct rtsp *bus)
 	if (!bus || !bus->event)
 		return;
 
-	RTSP_FOREACH_WAITING(m, bus) {
-		sd_event_source_unref(m->timer_source);
-		m->timer_source = NULL;
-	}
+	RTSP_FOREACH_WAITING(m, bus)
+		twheel_timer_remove(&m->timer);
+	twheel_timer_remove(&bus->idle_timer);
+
+	twheel_unref(bus->wheel);
+	bus->wheel = NULL;
 
 	sd_event_source_unref(bus->fd_source);
 	bus->fd_source = NULL;
@@ -3185,6 +4360,114 @@ static void rtsp_free_match(struct rtsp_match *match)
 	free(match);
 }
 
+/**
+ * rtsp_add_data_handler() - Add interleaved-data handler
+ * @bus: rtsp bus to register handler on
+ * @channel: interleaved channel to handle
+ * @cb_fn: function to be used as handler
+ * @data: user-context data that is passed through unchanged
+ *
+ * Once registered, all '$'-framed interleaved data on @channel is passed to
+ * @cb_fn instead of being turned into RTSP_MESSAGE_DATA messages for the
+ * match-callbacks. The payload is borrowed from the receive buffer and only
+ * valid during the callback; no message object is allocated. This is meant
+ * for high-rate streams like RTP over the RTSP connection.
+ *
+ * Only one handler can be registered per channel. A negative return value of
+ * @cb_fn is treated like a parser error and hangs up the bus.
+ *
+ * Returns:
+ * 0 on success, negative error code on failure.
+ */
+int rtsp_add_data_handler(struct rtsp *bus,
+			  unsigned int channel,
+			  rtsp_data_fn cb_fn,
+			  void *data)
+{
+	struct rtsp_data_handler *h;
+
+	if (!bus || !cb_fn || channel >= RTSP_DATA_CHANNELS)
+		return -EINVAL;
+
+	if (!bus->data_handlers) {
+		bus->data_handlers = calloc(RTSP_DATA_CHANNELS,
+					    sizeof(*bus->data_handlers));
+		if (!bus->data_handlers)
+			return -ENOMEM;
+	}
+
+	h = &bus->data_handlers[channel];
+	if (h->cb_fn)
+		return -EALREADY;
+
+	h->cb_fn = cb_fn;
+	h->data = data;
+
+	return 0;
+}
+
+/**
+ * rtsp_remove_data_handler() - Remove interleaved-data handler
+ * @bus: rtsp bus to unregister handler from
+ * @channel: interleaved channel the handler was registered for
+ * @cb_fn: handler function to unregister
+ * @data: user-context data used during registration
+ *
+ * This reverts a previous call to rtsp_add_data_handler(). Data on @channel
+ * is again delivered as messages to the match-callbacks afterwards.
+ */
+void rtsp_remove_data_handler(struct rtsp *bus,
+			      unsigned int channel,
+			      rtsp_data_fn cb_fn,
+			      void *data)
+{
+	struct rtsp_data_handler *h;
+
+	if (!bus || !bus->data_handlers || channel >= RTSP_DATA_CHANNELS)
+		return;
+
+	h = &bus->data_handlers[channel];
+	if (h->cb_fn == cb_fn && h->data == data) {
+		h->cb_fn = NULL;
+		h->data = NULL;
+	}
+}
+
+/**
+ * rtsp_cork() - Hold back outgoing messages
+ * @bus: rtsp bus to cork
+ *
+ * While a bus is corked, messages passed to rtsp_send() or rtsp_call_async()
+ * are queued but not transmitted. Once the bus is uncorked again, all of them
+ * are sent in a single batch. Use this to combine a whole exchange (like a
+ * reply followed by a new request) into as few segments as possible.
+ *
+ * Calls can be nested, the bus is uncorked once rtsp_uncork() was called as
+ * often as rtsp_cork().
+ */
+void rtsp_cork(struct rtsp *bus)
+{
+	if (!bus)
+		return;
+
+	++bus->corked;
+}
+
+/**
+ * rtsp_uncork() - Release outgoing messages
+ * @bus: rtsp bus to uncork
+ *
+ * This reverts a previous call to rtsp_cork(). If this drops the last cork,
+ * all queued messages are sent during the next event-loop iteration.
+ */
+void rtsp_uncork(struct rtsp *bus)
+{
+	if (!bus || !bus->corked)
+		return;
+
+	--bus->corked;
+}
+
 int rtsp_send(struct rtsp *bus, struct rtsp_message *m)
 {
 	return rtsp_call_async(bus, m, NULL, NULL, 0, NULL);
@@ -114,6 +114,32 @@ typedef int (*rtsp_callback_fn) (struct rtsp *bus,
 				 struct rtsp_message *m,
 				 void *data);
 
+typedef int (*rtsp_data_fn) (struct rtsp *bus,
+			     unsigned int channel,
+			     const void *data,
+			     size_t size,
+			     void *userdata);
+
+struct rtsp_alloc_stats {
+	uint64_t allocs;		/* allocations served by message arenas */
+	uint64_t heap_allocs;		/* heap allocations for messages */
+	uint64_t arenas_recycled;	/* messages created in a cached arena */
+};
+
+struct rtsp_limits {
+	size_t max_ring;		/* bytes buffered by the parser, 0: none */
+	size_t max_headers;		/* headers per message, 0: none */
+	size_t max_body;		/* body size per message, 0: none */
+	uint64_t idle_shrink;		/* usecs until idle buffers are freed */
+};
+
+struct rtsp_mem_stats {
+	size_t current;			/* bytes in parser buffers and caches */
+	size_t peak;			/* maximum of @current so far */
+	uint64_t rejected;		/* messages dropped due to limits */
+	uint64_t shrinks;		/* idle shrinks of the buffers */
+};
+
 /*
  * Bus
  */
@@ -134,9 +160,27 @@ bool rtsp_is_dead(struct rtsp *bus);
 int rtsp_attach_event(struct rtsp *bus, sd_event *event, int priority);
 void rtsp_detach_event(struct rtsp *bus);
 
+int rtsp_set_arena_cache(struct rtsp *bus, size_t max);
+void rtsp_get_alloc_stats(struct rtsp *bus, struct rtsp_alloc_stats *stats);
+int rtsp_set_limits(struct rtsp *bus, const struct rtsp_limits *limits);
+void rtsp_get_limits(struct rtsp *bus, struct rtsp_limits *limits);
+void rtsp_get_mem_stats(struct rtsp *bus, struct rtsp_mem_stats *stats);
+
 int rtsp_add_match(struct rtsp *bus, rtsp_callback_fn cb_fn, void *data);
 void rtsp_remove_match(struct rtsp *bus, rtsp_callback_fn cb_fn, void *data);
 
+int rtsp_add_data_handler(struct rtsp *bus,
+			  unsigned int channel,
+			  rtsp_data_fn cb_fn,
+			  void *data);
+void rtsp_remove_data_handler(struct rtsp *bus,
+			      unsigned int channel,
+			      rtsp_data_fn cb_fn,
+			      void *data);
+
+void rtsp_cork(struct rtsp *bus);
+void rtsp_uncork(struct rtsp *bus);
+
 int rtsp_send(struct rtsp *bus, struct rtsp_message *m);
 int rtsp_call_async(struct rtsp *bus,
 		    struct rtsp_message *m,
@@ -260,4 +304,29 @@ size_t rtsp_message_get_body_size(struct rtsp_message *m);
 void *rtsp_message_get_raw(struct rtsp_message *m);
 size_t rtsp_message_get_raw_size(struct rtsp_message *m);
 
+/* templates */
+
+struct rtsp_template;
+
+int rtsp_template_new(struct rtsp_template **out,
+		      struct rtsp_message *proto,
+		      const char *const *placeholders);
+void rtsp_template_free(struct rtsp_template *t);
+
+static inline void rtsp_template_freep(struct rtsp_template **t)
+{
+	rtsp_template_free(*t);
+}
+
+#define _rtsp_template_free_ __attribute__((__cleanup__(rtsp_template_freep)))
+
+int rtsp_template_stamp(struct rtsp_template *t,
+			struct rtsp *bus,
+			struct rtsp_message **out,
+			const char *const *values);
+int rtsp_template_stamp_reply_for(struct rtsp_template *t,
+				  struct rtsp_message *orig,
+				  struct rtsp_message **out,
+				  const char *const *values);
+
 #endif /* MIRACLE_RTSP_H */
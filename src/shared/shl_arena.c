@@ -0,0 +1,183 @@
+/*
+ * SHL - Arena allocator
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ * Dedicated to the Public Domain
+ */
+
+/*
+ * Arena allocator
+ */
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "shl_arena.h"
+#include "shl_macro.h"
+
+/* minimum size of chunks allocated on demand */
+#define ARENA_CHUNK_SIZE 4096
+
+#define ARENA_ALIGN(_v) \
+	(((_v) + sizeof(max_align_t) - 1) & ~(sizeof(max_align_t) - 1))
+
+/*
+ * The arena head and its initial chunk are allocated in one block. The
+ * initial chunk is always the last one in the chunk list, so a reset only has
+ * to free everything in front of it.
+ */
+int shl_arena_new(struct shl_arena **out, size_t size)
+{
+	struct shl_arena *a;
+	struct shl_arena_chunk *c;
+	size_t head;
+
+	if (!out)
+		return -EINVAL;
+
+	size = ARENA_ALIGN(size);
+	head = ARENA_ALIGN(sizeof(*a));
+
+	a = malloc(head + sizeof(*c) + size);
+	if (!a)
+		return -ENOMEM;
+
+	c = (void*)((uint8_t*)a + head);
+	c->next = NULL;
+	c->size = size;
+	c->used = 0;
+
+	a->chunks = c;
+	a->last = NULL;
+	a->allocs = 0;
+	a->heap_allocs = 1;
+
+	*out = a;
+	return 0;
+}
+
+void shl_arena_free(struct shl_arena *a)
+{
+	if (!a)
+		return;
+
+	shl_arena_reset(a);
+	free(a);
+}
+
+void shl_arena_reset(struct shl_arena *a)
+{
+	struct shl_arena_chunk *c;
+
+	if (!a)
+		return;
+
+	while (a->chunks->next) {
+		c = a->chunks;
+		a->chunks = c->next;
+		free(c);
+	}
+
+	a->chunks->used = 0;
+	a->last = NULL;
+}
+
+size_t shl_arena_get_size(struct shl_arena *a)
+{
+	struct shl_arena_chunk *c;
+	size_t size;
+
+	size = ARENA_ALIGN(sizeof(*a));
+	for (c = a->chunks; c; c = c->next)
+		size += sizeof(*c) + c->size;
+
+	return size;
+}
+
+void *shl_arena_alloc(struct shl_arena *a, size_t size)
+{
+	struct shl_arena_chunk *c = a->chunks;
+	size_t csize;
+	void *p;
+
+	size = ARENA_ALIGN(size ? : 1);
+	if (!size)
+		return NULL;
+
+	if (c->size - c->used < size) {
+		csize = shl_max(size, (size_t)ARENA_CHUNK_SIZE);
+		if (csize + sizeof(*c) < csize)
+			return NULL;
+
+		c = malloc(sizeof(*c) + csize);
+		if (!c)
+			return NULL;
+
+		c->next = a->chunks;
+		c->size = csize;
+		c->used = 0;
+		a->chunks = c;
+		++a->heap_allocs;
+	}
+
+	p = (uint8_t*)c->data + c->used;
+	c->used += size;
+	a->last = p;
+	++a->allocs;
+
+	return p;
+}
+
+void *shl_arena_alloc0(struct shl_arena *a, size_t size)
+{
+	void *p;
+
+	p = shl_arena_alloc(a, size);
+	if (p)
+		memset(p, 0, size);
+
+	return p;
+}
+
+/*
+ * Resize the allocation @ptr of @old bytes to @size bytes. If @ptr is the
+ * last allocation and its chunk has enough room left, it is grown in place.
+ * Otherwise, a new block is allocated and @old bytes are copied over. The old
+ * block is not reclaimed before the arena is reset. @ptr may be NULL.
+ */
+void *shl_arena_realloc(struct shl_arena *a, void *ptr, size_t old, size_t size)
+{
+	struct shl_arena_chunk *c = a->chunks;
+	size_t start, end;
+	void *p;
+
+	if (ptr && ptr == a->last) {
+		start = (uint8_t*)ptr - (uint8_t*)c->data;
+		end = ARENA_ALIGN(size);
+		if (end >= size && c->size - start >= end) {
+			c->used = start + end;
+			return ptr;
+		}
+	}
+
+	p = shl_arena_alloc(a, size);
+	if (p && ptr)
+		memcpy(p, ptr, shl_min(old, size));
+
+	return p;
+}
+
+char *shl_arena_strndup(struct shl_arena *a, const char *str, size_t len)
+{
+	char *s;
+
+	s = shl_arena_alloc(a, len + 1);
+	if (!s)
+		return NULL;
+
+	memcpy(s, str, len);
+	s[len] = 0;
+
+	return s;
+}
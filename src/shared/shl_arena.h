@@ -0,0 +1,74 @@
+/*
+ * SHL - Arena allocator
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ * Dedicated to the Public Domain
+ */
+
+/*
+ * Arena allocator
+ * Simple bump-allocator for objects which share a common lifetime. Memory is
+ * carved out of larger chunks and only ever released as a whole, either via
+ * shl_arena_reset() (keeps the initial chunk for reuse) or shl_arena_free().
+ */
+
+#ifndef SHL_ARENA_H
+#define SHL_ARENA_H
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct shl_arena_chunk {
+	struct shl_arena_chunk *next;	/* next (older) chunk or NULL */
+	size_t size;			/* usable size of @data */
+	size_t used;			/* bytes allocated from @data */
+	max_align_t data[];
+};
+
+struct shl_arena {
+	struct shl_arena_chunk *chunks;	/* current chunk, initial one is last */
+	void *last;			/* last allocation, can grow in place */
+	size_t allocs;			/* number of served allocations */
+	size_t heap_allocs;		/* number of heap allocations done */
+};
+
+/* allocate a new arena with an initial chunk of @size bytes */
+int shl_arena_new(struct shl_arena **out, size_t size);
+
+/* free arena and all memory allocated from it */
+void shl_arena_free(struct shl_arena *a);
+
+/* drop all allocations but keep the initial chunk for reuse */
+void shl_arena_reset(struct shl_arena *a);
+
+/* allocate @size bytes; never fails unless OOM */
+void *shl_arena_alloc(struct shl_arena *a, size_t size);
+
+/* same as shl_arena_alloc() but zero the memory */
+void *shl_arena_alloc0(struct shl_arena *a, size_t size);
+
+/* grow allocation @ptr of size @old to @size; in place if possible */
+void *shl_arena_realloc(struct shl_arena *a, void *ptr, size_t old, size_t size);
+
+/* return number of heap bytes held by the arena */
+size_t shl_arena_get_size(struct shl_arena *a);
+
+/* copy @len bytes of @str into the arena and 0-terminate them */
+char *shl_arena_strndup(struct shl_arena *a, const char *str, size_t len);
+
+static inline char *shl_arena_strdup(struct shl_arena *a, const char *str)
+{
+	return shl_arena_strndup(a, str, strlen(str));
+}
+
+static inline void shl_arena_freep(struct shl_arena **a)
+{
+	shl_arena_free(*a);
+}
+
+#define _shl_arena_free_ __attribute__((__cleanup__(shl_arena_freep)))
+
+#endif  /* SHL_ARENA_H */
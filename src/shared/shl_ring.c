@@ -10,9 +10,12 @@
  */
 
 #include <errno.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/uio.h>
+#include <unistd.h>
 #include "shl_macro.h"
 #include "shl_ring.h"
 
@@ -26,8 +29,32 @@ void shl_ring_flush(struct shl_ring *r)
 
 void shl_ring_clear(struct shl_ring *r)
 {
-	free(r->buf);
+	bool mirror = r->mirror;
+
+	if (r->mirror && r->buf) {
+		munmap(r->buf, r->size * 2);
+		close(r->fd);
+	} else {
+		free(r->buf);
+	}
+
 	memset(r, 0, sizeof(*r));
+	r->mirror = mirror;
+}
+
+/*
+ * Select the mirrored backend for @r. This is only possible as long as the
+ * ring has no buffer allocated, -EBUSY is returned otherwise. If the mirror
+ * cannot be set up on first use (no memfd support), the ring silently falls
+ * back to the heap backend.
+ */
+int shl_ring_set_mirror(struct shl_ring *r, bool mirror)
+{
+	if (r->buf)
+		return -EBUSY;
+
+	r->mirror = mirror;
+	return 0;
 }
 
 /*
@@ -46,7 +73,7 @@ size_t shl_ring_peek(struct shl_ring *r, struct iovec *vec)
 {
 	if (r->used == 0) {
 		return 0;
-	} else if (r->start + r->used <= r->size) {
+	} else if (r->mirror || r->start + r->used <= r->size) {
 		if (vec) {
 			vec[0].iov_base = &r->buf[r->start];
 			vec[0].iov_len = r->used;
@@ -77,7 +104,7 @@ size_t shl_ring_copy(struct shl_ring *r, void *buf, size_t size)
 
 	if (size > 0) {
 		l = r->size - r->start;
-		if (size <= l) {
+		if (r->mirror || size <= l) {
 			memcpy(buf, &r->buf[r->start], size);
 		} else {
 			memcpy(buf, &r->buf[r->start], l);
@@ -88,14 +115,137 @@ size_t shl_ring_copy(struct shl_ring *r, void *buf, size_t size)
 	return size;
 }
 
+/*
+ * Mirrored rings map the pages of a memfd twice back-to-back, so @buf[i] and
+ * @buf[i + size] alias each other and any run of up to @size bytes starting
+ * at a ring position is linear in memory. The whole 2 * @size area is
+ * reserved first and then both views are mapped into it with MAP_FIXED.
+ */
+static int mirror_map(int fd, size_t size, uint8_t **out)
+{
+	uint8_t *base;
+	void *p;
+	int r;
+
+	base = mmap(NULL, size * 2, PROT_NONE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (base == MAP_FAILED)
+		return -errno;
+
+	p = mmap(base, size, PROT_READ | PROT_WRITE,
+		 MAP_SHARED | MAP_FIXED, fd, 0);
+	if (p == MAP_FAILED)
+		goto error;
+
+	p = mmap(base + size, size, PROT_READ | PROT_WRITE,
+		 MAP_SHARED | MAP_FIXED, fd, 0);
+	if (p == MAP_FAILED)
+		goto error;
+
+	*out = base;
+	return 0;
+
+error:
+	r = -errno;
+	munmap(base, size * 2);
+	return r;
+}
+
+static int mirror_alloc(struct shl_ring *r, size_t nsize)
+{
+	int fd, err;
+
+	fd = memfd_create("shl-ring", MFD_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	if (ftruncate(fd, nsize) < 0) {
+		err = -errno;
+		goto error;
+	}
+
+	err = mirror_map(fd, nsize, &r->buf);
+	if (err < 0)
+		goto error;
+
+	r->fd = fd;
+	r->size = nsize;
+	r->start = 0;
+	return 0;
+
+error:
+	close(fd);
+	return err;
+}
+
+/*
+ * Grow a mirrored ring to @nsize. The memfd is extended and the first view
+ * is moved via mremap() into a new reservation, growing over the new pages.
+ * Only the second view is mapped from scratch. Live data is never copied,
+ * except for the part that wrapped around the old ring end, which has to be
+ * moved behind the old data to stay linear in the bigger ring.
+ */
+static int mirror_resize(struct shl_ring *r, size_t nsize)
+{
+	uint8_t *base;
+	size_t osize = r->size;
+	void *p;
+	int err;
+
+	if (ftruncate(r->fd, nsize) < 0)
+		return -errno;
+
+	base = mmap(NULL, nsize * 2, PROT_NONE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (base == MAP_FAILED)
+		return -errno;
+
+	p = mmap(base + nsize, nsize, PROT_READ | PROT_WRITE,
+		 MAP_SHARED | MAP_FIXED, r->fd, 0);
+	if (p == MAP_FAILED)
+		goto error;
+
+	p = mremap(r->buf, osize, nsize, MREMAP_MAYMOVE | MREMAP_FIXED, base);
+	if (p == MAP_FAILED)
+		goto error;
+
+	munmap(r->buf + osize, osize);
+	r->buf = base;
+	r->size = nsize;
+
+	if (r->start + r->used > osize)
+		memcpy(&r->buf[osize], r->buf, r->start + r->used - osize);
+
+	return 0;
+
+error:
+	err = -errno;
+	munmap(base, nsize * 2);
+	return err;
+}
+
 /*
  * Resize ring-buffer to size @nsize. @nsize must be a power-of-2, otherwise
- * ring operations will behave incorrectly.
+ * ring operations will behave incorrectly. For mirrored rings it must also be
+ * a multiple of the page size.
  */
 static int ring_resize(struct shl_ring *r, size_t nsize)
 {
 	uint8_t *buf;
 	size_t l;
+	int err;
+
+	if (r->mirror) {
+		if (r->buf)
+			return mirror_resize(r, nsize);
+
+		err = mirror_alloc(r, nsize);
+		if (err >= 0)
+			return 0;
+
+		/* fall back to the heap backend */
+		r->mirror = false;
+	}
 
 	buf = malloc(nsize);
 	if (!buf)
@@ -137,6 +287,9 @@ static int ring_grow(struct shl_ring *r, size_t add)
 	else if (need < 4096)
 		need = 4096;
 
+	if (r->mirror && need < (size_t)sysconf(_SC_PAGESIZE))
+		need = sysconf(_SC_PAGESIZE);
+
 	need = SHL_ALIGN_POWER2(need);
 	if (need == 0)
 		return -ENOMEM;
@@ -162,7 +315,7 @@ int shl_ring_push(struct shl_ring *r, const void *u8, size_t size)
 
 	pos = RING_MASK(r, r->start + r->used);
 	l = r->size - pos;
-	if (l >= size) {
+	if (r->mirror || l >= size) {
 		memcpy(&r->buf[pos], u8, size);
 	} else {
 		memcpy(&r->buf[pos], u8, l);
@@ -185,4 +338,94 @@ void shl_ring_pull(struct shl_ring *r, size_t size)
 
 	r->start = RING_MASK(r, r->start + size);
 	r->used -= size;
+
+	/* rewind empty buffers so following data stays linear */
+	if (!r->used)
+		r->start = 0;
+}
+
+/*
+ * Get data pointers for the free space at the end of the ring-buffer. The
+ * buffer is resized so at least @size bytes are available. @vec must be an
+ * array of 2 iovec objects which are filled with the free regions in order.
+ * The number of filled iovec objects (1 or 2) is returned, or -ENOMEM on OOM.
+ *
+ * Data written into these regions becomes part of the buffer only once it is
+ * committed via shl_ring_commit(). Any other ring operation in between might
+ * invalidate the returned pointers.
+ */
+int shl_ring_reserve(struct shl_ring *r, struct iovec *vec, size_t size)
+{
+	size_t pos, l, avail;
+	int err;
+
+	if (size == 0)
+		size = 1;
+
+	err = ring_grow(r, size);
+	if (err < 0)
+		return err;
+
+	pos = RING_MASK(r, r->start + r->used);
+	avail = r->size - r->used;
+	l = r->size - pos;
+
+	if (r->mirror || avail <= l) {
+		vec[0].iov_base = &r->buf[pos];
+		vec[0].iov_len = avail;
+		return 1;
+	} else {
+		vec[0].iov_base = &r->buf[pos];
+		vec[0].iov_len = l;
+		vec[1].iov_base = r->buf;
+		vec[1].iov_len = avail - l;
+		return 2;
+	}
+}
+
+/*
+ * Append @size bytes that were written into the regions returned by
+ * shl_ring_reserve() to the ring-buffer. We protect against overflows so
+ * committing more bytes than reserved is safe.
+ */
+void shl_ring_commit(struct shl_ring *r, size_t size)
+{
+	if (size > r->size - r->used)
+		size = r->size - r->used;
+
+	r->used += size;
+}
+
+/*
+ * Shrink the ring-buffer to the smallest size that still fits all buffered
+ * data. Empty buffers are released entirely, the next push allocates a new
+ * one. All pointers into the ring are invalidated. Returns -ENOMEM on OOM, in
+ * which case the ring is left untouched.
+ */
+int shl_ring_shrink(struct shl_ring *r)
+{
+	struct shl_ring n = { .mirror = r->mirror };
+	int err;
+
+	if (!r->used) {
+		shl_ring_clear(r);
+		return 0;
+	}
+
+	err = ring_grow(&n, r->used);
+	if (err < 0)
+		return err;
+
+	if (n.size >= r->size) {
+		shl_ring_clear(&n);
+		return 0;
+	}
+
+	/* @n is empty, so its buffer is linear from the start */
+	n.used = shl_ring_copy(r, n.buf, r->used);
+
+	shl_ring_clear(r);
+	*r = n;
+
+	return 0;
 }
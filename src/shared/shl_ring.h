@@ -7,6 +7,12 @@
 
 /*
  * Ring buffer
+ * The default backend uses a single heap buffer, so data and free space can
+ * wrap around its end and are handed out as two iovecs. A ring can instead be
+ * switched to the mirrored backend via shl_ring_set_mirror() before first use.
+ * The buffer is then a memfd mapped twice back-to-back, so every readable and
+ * writable region is linear and shl_ring_peek()/shl_ring_reserve() always
+ * return a single iovec. The API is the same for both backends.
  */
 
 #ifndef SHL_RING_H
@@ -14,6 +20,7 @@
 
 #include <errno.h>
 #include <inttypes.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/uio.h>
@@ -23,12 +30,18 @@ struct shl_ring {
 	size_t size;		/* actual size of @buf */
 	size_t start;		/* start position of ring */
 	size_t used;		/* number of actually used bytes */
+	int fd;			/* memfd backing @buf if mirrored */
+	bool mirror;		/* map @buf twice so data never wraps */
 };
 
+/* use mirrored backend; only allowed while the ring has no buffer */
+int shl_ring_set_mirror(struct shl_ring *r, bool mirror);
+
 /* flush buffer so it is empty again */
 void shl_ring_flush(struct shl_ring *r);
 
-/* flush buffer, free allocated data and reset to initial state */
+/* flush buffer, free allocated data and reset to initial state (the backend
+ * selection is kept) */
 void shl_ring_clear(struct shl_ring *r);
 
 /* get pointers to buffer data and their length */
@@ -43,10 +56,25 @@ int shl_ring_push(struct shl_ring *r, const void *u8, size_t size);
 /* pull data from the front of the buffer */
 void shl_ring_pull(struct shl_ring *r, size_t size);
 
+/* get pointers to at least @size bytes of free space at the end of the buffer */
+int shl_ring_reserve(struct shl_ring *r, struct iovec *vec, size_t size);
+
+/* mark @size bytes of previously reserved space as pushed */
+void shl_ring_commit(struct shl_ring *r, size_t size);
+
+/* shrink allocation to fit the buffered data, free it if empty */
+int shl_ring_shrink(struct shl_ring *r);
+
 /* return size of occupied buffer in bytes */
 static inline size_t shl_ring_get_size(struct shl_ring *r)
 {
 	return r->used;
 }
 
+/* return size of allocated buffer in bytes */
+static inline size_t shl_ring_get_capacity(struct shl_ring *r)
+{
+	return r->size;
+}
+
 #endif  /* SHL_RING_H */
@@ -460,6 +460,75 @@ int shl_strsplit(const char *str, const char *sep, char ***out)
 	return shl_strsplit_n(str, str ? strlen(str) : 0, sep, out);
 }
 
+static int shl__inplace_push(char ***strv,
+			     size_t *strv_size,
+			     size_t *strv_num,
+			     char *str)
+{
+	if (!SHL_GREEDY_REALLOC_T(*strv, *strv_size, *strv_num + 2))
+		return -ENOMEM;
+
+	(*strv)[*strv_num] = str;
+	*strv_num += 1;
+
+	return 0;
+}
+
+/*
+ * shl_strsplit_inplace() - Split string without copying
+ * Same as shl_strsplit_n() but the separators in @str are overwritten with
+ * binary 0 and the tokens stored in @strv point into @str. @str must be
+ * writable up to and including @str[len]. @strv is a greedy array of
+ * @strv_size entries which is grown as needed and can be reused across calls.
+ * The resulting vector is NULL-terminated; the number of tokens is returned.
+ */
+int shl_strsplit_inplace(char *str,
+			 size_t len,
+			 const char *sep,
+			 char ***strv,
+			 size_t *strv_size)
+{
+	size_t i, strv_num = 0;
+	char *pos;
+	int r;
+
+	if (!str || !sep || !strv || !strv_size)
+		return -EINVAL;
+
+	pos = str;
+
+	for (i = 0; i < len; ++i) {
+		if (!strchr(sep, str[i]) || !str[i])
+			continue;
+
+		/* ignore empty tokens */
+		if (pos != &str[i]) {
+			r = shl__inplace_push(strv, strv_size, &strv_num, pos);
+			if (r < 0)
+				return r;
+		}
+
+		str[i] = 0;
+		pos = &str[i + 1];
+	}
+
+	if (pos != &str[i]) {
+		r = shl__inplace_push(strv, strv_size, &strv_num, pos);
+		if (r < 0)
+			return r;
+	}
+
+	str[i] = 0;
+
+	if ((int)strv_num < (ssize_t)strv_num)
+		return -ENOMEM;
+	if (!SHL_GREEDY_REALLOC_T(*strv, *strv_size, strv_num + 1))
+		return -ENOMEM;
+
+	(*strv)[strv_num] = NULL;
+	return strv_num;
+}
+
 /*
  * strv
  */
@@ -669,6 +738,77 @@ int shl_qstr_tokenize(const char *str, char ***out)
 	return shl_qstr_tokenize_n(str, str ? strlen(str) : 0, out);
 }
 
+/*
+ * shl_qstr_tokenize_inplace() - Tokenize quoted string without copying
+ * Same as shl_qstr_tokenize_n() but each token is decoded in place inside of
+ * @str and @strv is filled with pointers into @str. Decoding never grows a
+ * token, so the terminating 0 of a token always lands on its separator (or on
+ * @str[length] for the trailing token, which must be writable). @strv and
+ * @strv_size behave as for shl_strsplit_inplace().
+ */
+int shl_qstr_tokenize_inplace(char *str,
+			      size_t length,
+			      char ***strv,
+			      size_t *strv_size)
+{
+	size_t i, strv_num = 0;
+	char *pos, quoted;
+	bool escaped;
+	int r;
+
+	if (!str || !strv || !strv_size)
+		return -EINVAL;
+
+	quoted = 0;
+	escaped = false;
+	pos = str;
+
+	for (i = 0; i < length; ++i) {
+		if (escaped) {
+			escaped = false;
+		} else if (str[i] == '\\') {
+			escaped = true;
+		} else if (quoted) {
+			if (str[i] == '"' && quoted == '"')
+				quoted = 0;
+			else if (str[i] == '\'' && quoted == '\'')
+				quoted = 0;
+		} else if (str[i] == '"') {
+			quoted = '"';
+		} else if (str[i] == '\'') {
+			quoted = '\'';
+		} else if (str[i] == ' ') {
+			/* ignore multiple separators */
+			if (pos != &str[i]) {
+				shl_qstr_decode_n(pos, &str[i] - pos);
+				r = shl__inplace_push(strv,
+						      strv_size,
+						      &strv_num,
+						      pos);
+				if (r < 0)
+					return r;
+			}
+
+			pos = &str[i + 1];
+		}
+	}
+
+	if (pos != &str[i]) {
+		shl_qstr_decode_n(pos, &str[i] - pos);
+		r = shl__inplace_push(strv, strv_size, &strv_num, pos);
+		if (r < 0)
+			return r;
+	}
+
+	if ((int)strv_num < (ssize_t)strv_num)
+		return -ENOMEM;
+	if (!SHL_GREEDY_REALLOC_T(*strv, *strv_size, strv_num + 1))
+		return -ENOMEM;
+
+	(*strv)[strv_num] = NULL;
+	return strv_num;
+}
+
 size_t shl__qstr_encode(char *dst, const char *src, bool need_quote)
 {
 	size_t l = 0;
@@ -716,6 +856,53 @@ size_t shl__qstr_length(const char *str, bool *need_quote)
 	return l - 1;
 }
 
+/*
+ * Return the buffer size needed to join @strv via shl_qstr_join_buf(),
+ * including the terminating binary zero. This is an upper bound, not the
+ * exact size. 0 is returned on overflow.
+ */
+size_t shl_qstr_join_size(char **strv)
+{
+	size_t need, l;
+	bool need_quote;
+
+	need = 1;
+	for ( ; *strv; ++strv) {
+		l = shl__qstr_length(*strv, &need_quote);
+
+		/* at most 2 byte per char (escapes) plus 2 quotes + separator */
+		if (l * 2 < l || l * 2 + 3 < l * 2 || need + l * 2 + 3 < need)
+			return 0;
+
+		need += l * 2 + 3;
+	}
+
+	return need;
+}
+
+/*
+ * Same as shl_qstr_join() but write the result into @buf, which must be at
+ * least shl_qstr_join_size() bytes big. Returns the length of the result.
+ */
+size_t shl_qstr_join_buf(char **strv, char *buf)
+{
+	size_t len;
+	bool need_quote;
+
+	len = 0;
+	for ( ; *strv; ++strv) {
+		shl__qstr_length(*strv, &need_quote);
+
+		if (len)
+			buf[len++] = ' ';
+
+		len += shl__qstr_encode(buf + len, *strv, need_quote);
+	}
+
+	buf[len] = 0;
+	return len;
+}
+
 int shl_qstr_join(char **strv, char **out)
 {
 	_shl_free_ char *line = NULL;
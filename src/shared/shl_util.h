@@ -95,6 +95,11 @@ char *shl_strcat(const char *first, const char *second);
 _shl_sentinel_ char *shl_strjoin(const char *first, ...);
 int shl_strsplit_n(const char *str, size_t len, const char *sep, char ***out);
 int shl_strsplit(const char *str, const char *sep, char ***out);
+int shl_strsplit_inplace(char *str,
+			 size_t len,
+			 const char *sep,
+			 char ***strv,
+			 size_t *strv_size);
 
 static inline bool shl_isempty(const char *str)
 {
@@ -126,7 +131,13 @@ char shl_qstr_unescape_char(char c);
 void shl_qstr_decode_n(char *str, size_t length);
 int shl_qstr_tokenize_n(const char *str, size_t length, char ***out);
 int shl_qstr_tokenize(const char *str, char ***out);
+int shl_qstr_tokenize_inplace(char *str,
+			      size_t length,
+			      char ***strv,
+			      size_t *strv_size);
 int shl_qstr_join(char **strv, char **out);
+size_t shl_qstr_join_size(char **strv);
+size_t shl_qstr_join_buf(char **strv, char *buf);
 
 /* mkdir */
 
@@ -0,0 +1,430 @@
+/*
+ * MiracleCast - Wifi-Display/Miracast Implementation
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * MiracleCast is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * MiracleCast is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MiracleCast; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <systemd/sd-event.h>
+#include <time.h>
+#include "shl_dlist.h"
+#include "shl_macro.h"
+#include "shl_util.h"
+#include "twheel.h"
+
+/* each tick is 4096us; all timers are rounded up to full ticks */
+#define TWHEEL_TICK_SHIFT 12
+#define TWHEEL_TICK_USEC (1ULL << TWHEEL_TICK_SHIFT)
+
+/* 4 levels of 64 slots each cover 2^24 ticks, roughly 19 hours */
+#define TWHEEL_LEVEL_BITS 6
+#define TWHEEL_LEVEL_SIZE (1U << TWHEEL_LEVEL_BITS)
+#define TWHEEL_LEVEL_MASK (TWHEEL_LEVEL_SIZE - 1)
+#define TWHEEL_LEVELS 4
+#define TWHEEL_MAX_DELTA ((1ULL << (TWHEEL_LEVELS * TWHEEL_LEVEL_BITS)) - 1)
+
+#define TWHEEL_DISARMED UINT64_MAX
+
+struct twheel {
+	unsigned long ref;
+	struct shl_dlist list;
+	sd_event *event;
+	int priority;
+	sd_event_source *source;
+
+	uint64_t now;			/* next tick to process */
+	uint64_t armed;			/* tick @source fires at */
+	size_t cnt;			/* number of queued timers */
+
+	uint64_t bitmap[TWHEEL_LEVELS];
+	struct shl_dlist slots[TWHEEL_LEVELS][TWHEEL_LEVEL_SIZE];
+};
+
+/* all wheels, so users of a single event loop can share them */
+static struct shl_dlist twheel_list = SHL_DLIST_INIT(twheel_list);
+
+static uint64_t twheel__tick(uint64_t usec)
+{
+	/* round up, so timers never fire early */
+	return (usec >> TWHEEL_TICK_SHIFT) + !!(usec & (TWHEEL_TICK_USEC - 1));
+}
+
+static uint64_t twheel__rotr(uint64_t v, unsigned int n)
+{
+	return n ? (v >> n) | (v << (64 - n)) : v;
+}
+
+static void twheel__move(struct shl_dlist *from, struct shl_dlist *to)
+{
+	shl_dlist_init(to);
+	if (shl_dlist_empty(from))
+		return;
+
+	to->next = from->next;
+	to->prev = from->prev;
+	to->next->prev = to;
+	to->prev->next = to;
+	shl_dlist_init(from);
+}
+
+static uint64_t twheel__insert(struct twheel *w, struct twheel_timer *t)
+{
+	uint64_t tick, delta;
+	unsigned int level, slot;
+
+	tick = twheel__tick(t->expiry);
+	if (tick < w->now)
+		tick = w->now;
+
+	/* far-away timers are parked and re-checked once they "expire" */
+	delta = tick - w->now;
+	if (delta > TWHEEL_MAX_DELTA) {
+		delta = TWHEEL_MAX_DELTA;
+		tick = w->now + delta;
+	}
+
+	for (level = 0; level < TWHEEL_LEVELS - 1; ++level)
+		if (delta < 1ULL << ((level + 1) * TWHEEL_LEVEL_BITS))
+			break;
+
+	slot = (tick >> (level * TWHEEL_LEVEL_BITS)) & TWHEEL_LEVEL_MASK;
+
+	shl_dlist_link_tail(&w->slots[level][slot], &t->list);
+	w->bitmap[level] |= 1ULL << slot;
+	t->slot = level * TWHEEL_LEVEL_SIZE + slot;
+
+	return tick;
+}
+
+static void twheel__unlink(struct twheel *w, struct twheel_timer *t)
+{
+	unsigned int level = t->slot / TWHEEL_LEVEL_SIZE;
+	unsigned int slot = t->slot % TWHEEL_LEVEL_SIZE;
+
+	shl_dlist_unlink(&t->list);
+	if (shl_dlist_empty(&w->slots[level][slot]))
+		w->bitmap[level] &= ~(1ULL << slot);
+}
+
+/*
+ * Returns the next tick that needs processing. For the first level this is
+ * the tick the timer expires at, for all other levels it's the tick at which
+ * the slot is cascaded down. Either way, it's never late.
+ */
+static uint64_t twheel__next(struct twheel *w)
+{
+	uint64_t next = TWHEEL_DISARMED, base, tick;
+	unsigned int level, shift;
+
+	for (level = 0; level < TWHEEL_LEVELS; ++level) {
+		if (!w->bitmap[level])
+			continue;
+
+		shift = level * TWHEEL_LEVEL_BITS;
+		base = (w->now + (1ULL << shift) - 1) >> shift;
+		tick = twheel__rotr(w->bitmap[level], base & TWHEEL_LEVEL_MASK);
+		tick = (base + __builtin_ctzll(tick)) << shift;
+		if (tick < next)
+			next = tick;
+	}
+
+	return next;
+}
+
+static void twheel__arm(struct twheel *w, uint64_t tick)
+{
+	if (tick >= w->armed)
+		return;
+
+	sd_event_source_set_time(w->source, tick << TWHEEL_TICK_SHIFT);
+	sd_event_source_set_enabled(w->source, SD_EVENT_ON);
+	w->armed = tick;
+}
+
+static void twheel__cascade(struct twheel *w)
+{
+	struct shl_dlist list;
+	struct twheel_timer *t;
+	unsigned int level, slot;
+
+	for (level = 1; level < TWHEEL_LEVELS; ++level) {
+		slot = (w->now >> (level * TWHEEL_LEVEL_BITS)) &
+		       TWHEEL_LEVEL_MASK;
+
+		twheel__move(&w->slots[level][slot], &list);
+		w->bitmap[level] &= ~(1ULL << slot);
+
+		while (!shl_dlist_empty(&list)) {
+			t = shl_dlist_first_entry(&list,
+						  struct twheel_timer,
+						  list);
+			shl_dlist_unlink(&t->list);
+			twheel__insert(w, t);
+		}
+
+		if (slot)
+			break;
+	}
+}
+
+static void twheel__run(struct twheel *w, uint64_t usec)
+{
+	struct shl_dlist list;
+	struct twheel_timer *t;
+	uint64_t target, bits;
+	unsigned int idx;
+
+	target = usec >> TWHEEL_TICK_SHIFT;
+
+	while (w->now <= target) {
+		if (!w->cnt) {
+			w->now = target + 1;
+			break;
+		}
+
+		idx = w->now & TWHEEL_LEVEL_MASK;
+		if (!idx)
+			twheel__cascade(w);
+
+		twheel__move(&w->slots[0][idx], &list);
+		w->bitmap[0] &= ~(1ULL << idx);
+
+		/* timers added by callbacks must go behind this slot */
+		++w->now;
+
+		while (!shl_dlist_empty(&list)) {
+			t = shl_dlist_first_entry(&list,
+						  struct twheel_timer,
+						  list);
+			shl_dlist_unlink(&t->list);
+
+			if (t->expiry > usec) {
+				twheel__insert(w, t);
+				continue;
+			}
+
+			t->wheel = NULL;
+			--w->cnt;
+			t->fn(t, t->data);
+		}
+
+		/* skip empty slots up to the next cascade */
+		idx = w->now & TWHEEL_LEVEL_MASK;
+		if (idx) {
+			bits = w->bitmap[0] >> idx;
+			if (bits)
+				w->now += __builtin_ctzll(bits);
+			else
+				w->now = (w->now | TWHEEL_LEVEL_MASK) + 1;
+
+			if (w->now > target + 1)
+				w->now = target + 1;
+		}
+	}
+}
+
+static int twheel_fn(sd_event_source *source, uint64_t usec, void *data)
+{
+	struct twheel *w = data;
+
+	/* make sure the wheel stays around during callbacks */
+	twheel_ref(w);
+
+	sd_event_source_set_enabled(w->source, SD_EVENT_OFF);
+	w->armed = TWHEEL_DISARMED;
+
+	twheel__run(w, shl_now(CLOCK_MONOTONIC));
+	twheel__arm(w, twheel__next(w));
+
+	twheel_unref(w);
+	return 0;
+}
+
+/**
+ * twheel_get() - Get timer wheel of an event loop
+ * @out: output storage for the new reference
+ * @event: event loop to drive the wheel
+ * @priority: priority of the sd-event source driving the wheel
+ *
+ * All users of the same event loop and priority share a single wheel, and
+ * thus a single sd-event timer source. The wheel is created on first use and
+ * destroyed once the last reference is dropped.
+ *
+ * Returns:
+ * 0 on success, negative error code on failure.
+ */
+int twheel_get(struct twheel **out, sd_event *event, int priority)
+{
+	struct twheel *w;
+	struct shl_dlist *i;
+	unsigned int level, slot;
+	int r;
+
+	if (!out || !event)
+		return -EINVAL;
+
+	shl_dlist_for_each(i, &twheel_list) {
+		w = shl_dlist_entry(i, struct twheel, list);
+		if (w->event == event && w->priority == priority) {
+			twheel_ref(w);
+			*out = w;
+			return 0;
+		}
+	}
+
+	w = calloc(1, sizeof(*w));
+	if (!w)
+		return -ENOMEM;
+
+	w->ref = 1;
+	w->priority = priority;
+	w->now = shl_now(CLOCK_MONOTONIC) >> TWHEEL_TICK_SHIFT;
+	w->armed = TWHEEL_DISARMED;
+	for (level = 0; level < TWHEEL_LEVELS; ++level)
+		for (slot = 0; slot < TWHEEL_LEVEL_SIZE; ++slot)
+			shl_dlist_init(&w->slots[level][slot]);
+
+	r = sd_event_add_time(event,
+			      &w->source,
+			      CLOCK_MONOTONIC,
+			      0,
+			      0,
+			      twheel_fn,
+			      w);
+	if (r < 0)
+		goto error;
+
+	r = sd_event_source_set_enabled(w->source, SD_EVENT_OFF);
+	if (r < 0)
+		goto error;
+
+	r = sd_event_source_set_priority(w->source, priority);
+	if (r < 0)
+		goto error;
+
+	w->event = sd_event_ref(event);
+	shl_dlist_link(&twheel_list, &w->list);
+	*out = w;
+	return 0;
+
+error:
+	sd_event_source_unref(w->source);
+	free(w);
+	return r;
+}
+
+void twheel_ref(struct twheel *w)
+{
+	if (!w || !w->ref)
+		return;
+
+	++w->ref;
+}
+
+void twheel_unref(struct twheel *w)
+{
+	struct twheel_timer *t;
+	unsigned int level, slot;
+
+	if (!w || !w->ref || --w->ref)
+		return;
+
+	/* users should remove their timers, but never leave them dangling */
+	for (level = 0; level < TWHEEL_LEVELS; ++level) {
+		for (slot = 0; slot < TWHEEL_LEVEL_SIZE; ++slot) {
+			while (!shl_dlist_empty(&w->slots[level][slot])) {
+				t = shl_dlist_first_entry(&w->slots[level][slot],
+							  struct twheel_timer,
+							  list);
+				shl_dlist_unlink(&t->list);
+				t->wheel = NULL;
+			}
+		}
+	}
+
+	shl_dlist_unlink(&w->list);
+	sd_event_source_unref(w->source);
+	sd_event_unref(w->event);
+	free(w);
+}
+
+void twheel_timer_init(struct twheel_timer *t, twheel_timer_fn fn, void *data)
+{
+	if (!t)
+		return;
+
+	t->list.next = NULL;
+	t->list.prev = NULL;
+	t->wheel = NULL;
+	t->slot = 0;
+	t->expiry = 0;
+	t->fn = fn;
+	t->data = data;
+}
+
+/**
+ * twheel_timer_add() - Schedule timer
+ * @w: wheel to queue the timer on
+ * @t: initialized timer
+ * @expiry: absolute CLOCK_MONOTONIC time in usec
+ *
+ * Queues @t on @w so its callback is invoked once @expiry elapsed. If @t is
+ * already pending, it is rescheduled. This never allocates and cannot fail.
+ */
+void twheel_timer_add(struct twheel *w, struct twheel_timer *t, uint64_t expiry)
+{
+	uint64_t tick;
+
+	if (!w || !t || !t->fn)
+		return;
+
+	twheel_timer_remove(t);
+
+	/* an idle wheel may lag behind; catch up to keep slots precise */
+	if (!w->cnt && w->armed == TWHEEL_DISARMED) {
+		tick = shl_now(CLOCK_MONOTONIC) >> TWHEEL_TICK_SHIFT;
+		if (tick > w->now)
+			w->now = tick;
+	}
+
+	t->wheel = w;
+	t->expiry = expiry;
+	tick = twheel__insert(w, t);
+	++w->cnt;
+
+	twheel__arm(w, tick);
+}
+
+/**
+ * twheel_timer_remove() - Cancel timer
+ * @t: timer to cancel
+ *
+ * Removes @t from its wheel, if queued. The wheel's sd-event source is not
+ * re-armed; if it fires without anything to do, that's cheaper than touching
+ * the event loop for every cancelled timeout.
+ */
+void twheel_timer_remove(struct twheel_timer *t)
+{
+	if (!t || !t->wheel)
+		return;
+
+	twheel__unlink(t->wheel, t);
+	--t->wheel->cnt;
+	t->wheel = NULL;
+}
@@ -0,0 +1,74 @@
+/*
+ * MiracleCast - Wifi-Display/Miracast Implementation
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * MiracleCast is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * MiracleCast is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MiracleCast; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Timer Wheel
+ * Hierarchical timer wheel for request timeouts. Timeouts are usually
+ * re-armed or cancelled long before they fire, so instead of one sd-event
+ * timer per request, all timers of an event loop are bucketed into a wheel
+ * that is driven by a single sd-event source. Adding and removing timers is
+ * O(1) and never allocates; the timer object is embedded by the caller.
+ *
+ * Timers fire with a granularity of a few milliseconds, but never early.
+ */
+
+#ifndef MIRACLE_TWHEEL_H
+#define MIRACLE_TWHEEL_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <systemd/sd-event.h>
+#include "shl_dlist.h"
+
+struct twheel;
+struct twheel_timer;
+
+typedef void (*twheel_timer_fn) (struct twheel_timer *t, void *data);
+
+struct twheel_timer {
+	struct shl_dlist list;
+	struct twheel *wheel;		/* wheel we're queued on or NULL */
+	unsigned int slot;		/* slot index on @wheel */
+	uint64_t expiry;		/* CLOCK_MONOTONIC in usec */
+	twheel_timer_fn fn;
+	void *data;
+};
+
+int twheel_get(struct twheel **out, sd_event *event, int priority);
+void twheel_ref(struct twheel *w);
+void twheel_unref(struct twheel *w);
+
+static inline void twheel_unref_p(struct twheel **w)
+{
+	twheel_unref(*w);
+}
+
+#define _twheel_unref_ __attribute__((__cleanup__(twheel_unref_p)))
+
+void twheel_timer_init(struct twheel_timer *t, twheel_timer_fn fn, void *data);
+void twheel_timer_add(struct twheel *w, struct twheel_timer *t, uint64_t expiry);
+void twheel_timer_remove(struct twheel_timer *t);
+
+static inline bool twheel_timer_is_pending(struct twheel_timer *t)
+{
+	return t && t->wheel;
+}
+
+#endif /* MIRACLE_TWHEEL_H */
@@ -22,6 +22,7 @@
 
 #include <alloca.h>
 #include <errno.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <libudev.h>
 #include <stdbool.h>
@@ -118,6 +119,40 @@ static inline void reformat_mac(char *dst, const char *src)
 		x1, x2, x3, x4, x5, x6);
 }
 
+/*
+ * MACs as 48-bit integers (first octet in the most significant byte). These
+ * are cheap to hash and compare; use parse_mac()/format_mac() only where a
+ * MAC enters or leaves as text. 0 is never a valid station address and is
+ * used as "unset" by callers.
+ */
+
+static inline int parse_mac(uint64_t *out, const char *src)
+{
+	unsigned char x[6];
+	int r;
+
+	r = sscanf(src, "%2hhx:%2hhx:%2hhx:%2hhx:%2hhx:%2hhx",
+		   &x[0], &x[1], &x[2], &x[3], &x[4], &x[5]);
+	if (r != 6)
+		return -EINVAL;
+
+	*out = (uint64_t)x[0] << 40 | (uint64_t)x[1] << 32 |
+	       (uint64_t)x[2] << 24 | (uint64_t)x[3] << 16 |
+	       (uint64_t)x[4] << 8 | (uint64_t)x[5];
+	return 0;
+}
+
+static inline void format_mac(char *dst, uint64_t mac)
+{
+	sprintf(dst, "%02x:%02x:%02x:%02x:%02x:%02x",
+		(unsigned int)(mac >> 40) & 0xff,
+		(unsigned int)(mac >> 32) & 0xff,
+		(unsigned int)(mac >> 24) & 0xff,
+		(unsigned int)(mac >> 16) & 0xff,
+		(unsigned int)(mac >> 8) & 0xff,
+		(unsigned int)mac & 0xff);
+}
+
 static inline const char *bus_error_message(const sd_bus_error *e, int error)
 {
 	if (e) {
@@ -34,6 +34,7 @@
 #include <unistd.h>
 #include "shl_dlist.h"
 #include "shl_util.h"
+#include "twheel.h"
 #include "wpas.h"
 #include "shl_log.h"
 
@@ -49,6 +50,20 @@
 /* max message size */
 #define WPAS_MAX_LEN 16384
 
+/* max number of messages received and dispatched per wakeup */
+#define WPAS_RECV_BATCH 16
+
+/* max number of idle receive messages kept for recycling */
+#define WPAS_POOL_MAX (WPAS_RECV_BATCH * 2)
+
+struct wpas_dict_entry {
+	size_t hash;
+	size_t arg;			/* argv index + 1, 0 if unused */
+	long long num;			/* parsed integer value */
+	bool parsed : 1;		/* @num is valid */
+	bool valid : 1;			/* entry parsed as integer */
+};
+
 struct wpas_message {
 	unsigned long ref;
 	struct wpas *w;
@@ -62,9 +77,13 @@ struct wpas_message {
 
 	char *raw;
 	size_t rawlen;
+	size_t raw_size;
+	char *tokens;
+	size_t tokens_size;
 	unsigned int type;
 	char *name;
 	unsigned int level;
+	unsigned int event_id;
 	char *ifname;
 
 	size_t argc;
@@ -72,11 +91,17 @@ struct wpas_message {
 	char **argv;
 	size_t iter;
 
+	size_t dict_size;
+	size_t dict_mask;
+	struct wpas_dict_entry *dict;
+
 	bool queued : 1;
 	bool sent : 1;
 	bool sealed : 1;
 	bool removed : 1;
 	bool has_peer : 1;
+	bool pooled : 1;
+	bool indexed : 1;
 };
 
 struct wpas_match {
@@ -97,20 +122,34 @@ struct wpas {
 	int priority;
 	sd_event *event;
 	sd_event_source *fd_source;
-	sd_event_source *timer_source;
+	struct twheel *wheel;
+	struct twheel_timer timer;
 
 	struct shl_dlist match_list;
 
+	/* sorted user table of known events, see wpas_set_event_table() */
+	const void *event_table;
+	size_t event_cnt;
+	size_t event_size;
+
 	uint64_t cookies;
 	size_t msg_list_cnt;
 	struct shl_dlist msg_list;
-	char recvbuf[WPAS_MAX_LEN];
+
+	/* idle receive messages, each owning a WPAS_MAX_LEN buffer */
+	size_t pool_cnt;
+	struct wpas_message *pool[WPAS_POOL_MAX];
+	struct wpas_stats stats;
 
 	bool server : 1;
 	bool dead : 1;
 	bool calling : 1;
 };
 
+static void wpas_timer_fn(struct twheel_timer *t, void *d);
+static unsigned int wpas__event_id(struct wpas *w, const char *name);
+static void wpas__message_put(struct wpas *w, struct wpas_message *m);
+
 /*
  * WPAS Message
  */
@@ -167,6 +206,7 @@ int wpas_message_new_event(struct wpas *w,
 
 	m->type = WPAS_MESSAGE_EVENT;
 	m->level = level;
+	m->event_id = wpas__event_id(w, name);
 
 	*out = m;
 	return 0;
@@ -242,10 +282,20 @@ void wpas_message_ref(struct wpas_message *m)
 
 void wpas_message_unref(struct wpas_message *m)
 {
+	struct wpas *w;
+
 	if (!m || !m->ref || --m->ref)
 		return;
 
+	if (m->pooled) {
+		w = m->w;
+		wpas__message_put(w, m);
+		wpas_unref(w);
+		return;
+	}
+
 	shl_strv_free(m->argv);
+	free(m->dict);
 	wpas_unref(m->w);
 	free(m->ifname);
 	free(m->raw);
@@ -305,6 +355,14 @@ unsigned int wpas_message_get_level(struct wpas_message *msg)
 		return WPAS_LEVEL_UNKNOWN;
 }
 
+unsigned int wpas_message_get_event_id(struct wpas_message *msg)
+{
+	if (msg && msg->type == WPAS_MESSAGE_EVENT)
+		return msg->event_id;
+	else
+		return 0;
+}
+
 const char *wpas_message_get_name(struct wpas_message *msg)
 {
 	return msg ? msg->name : NULL;
@@ -364,6 +422,7 @@ void wpas_message_set_peer(struct wpas_message *msg, const char *peer)
 		}
 
 		msg->has_peer = true;
+		msg->peer.sun_family = AF_UNIX;
 		msg->peer.sun_path[sizeof(msg->peer.sun_path) - 1] = 0;
 	} else {
 		msg->has_peer = false;
@@ -508,6 +567,7 @@ int wpas_message_seal(struct wpas_message *m)
 
 		free(str);
 		str = t;
+		r += strlen(buf);
 	}
 
 	m->rawlen = r;
@@ -672,17 +732,162 @@ int wpas_message_argv_read(struct wpas_message *m,
 	return 0;
 }
 
+/*
+ * Events like P2P-DEVICE-FOUND carry a dozen key=value pairs and wifid looks
+ * up most of them. Instead of scanning argv on every lookup, the first dict
+ * access on a sealed message builds an open-addressed index over all keys.
+ * Integer values are parsed once and cached in their index entry. Unsealed
+ * messages can still change, so they are scanned linearly.
+ */
+
+static size_t wpas__dict_hash(const char *key, size_t len)
+{
+	size_t i, hash = 5381;
+
+	for (i = 0; i < len; ++i)
+		hash = (hash << 5) + hash + (size_t)key[i];
+
+	return hash;
+}
+
+static int wpas__dict_index(struct wpas_message *m)
+{
+	struct wpas_dict_entry *e;
+	const char *entry;
+	size_t i, j, n, l, hash;
+
+	n = 4;
+	while (n < m->argc * 2)
+		n <<= 1;
+
+	l = m->dict_size;
+	if (!SHL_GREEDY_REALLOC_T(m->dict, m->dict_size, n))
+		return -ENOMEM;
+	if (m->pooled && m->dict_size != l)
+		++m->w->stats.allocs;
+
+	memset(m->dict, 0, n * sizeof(*m->dict));
+	m->dict_mask = n - 1;
+
+	for (i = m->name ? 1 : 0; i < m->argc; ++i) {
+		entry = strchr(m->argv[i], '=');
+		if (!entry)
+			continue;
+
+		l = entry - m->argv[i];
+		hash = wpas__dict_hash(m->argv[i], l);
+
+		/* duplicate keys resolve to the first entry */
+		for (j = hash & m->dict_mask; ; j = (j + 1) & m->dict_mask) {
+			e = &m->dict[j];
+			if (!e->arg) {
+				e->hash = hash;
+				e->arg = i + 1;
+				break;
+			} else if (e->hash == hash &&
+				   !strncmp(m->argv[e->arg - 1],
+					    m->argv[i],
+					    l + 1)) {
+				break;
+			}
+		}
+	}
+
+	m->indexed = true;
+	return 0;
+}
+
+static struct wpas_dict_entry *wpas__dict_find(struct wpas_message *m,
+					       const char *name)
+{
+	struct wpas_dict_entry *e;
+	const char *key;
+	size_t i, l, hash;
+
+	l = strlen(name);
+	hash = wpas__dict_hash(name, l);
+
+	for (i = hash & m->dict_mask; ; i = (i + 1) & m->dict_mask) {
+		e = &m->dict[i];
+		if (!e->arg)
+			return NULL;
+		if (e->hash != hash)
+			continue;
+
+		key = m->argv[e->arg - 1];
+		if (!strncmp(key, name, l) && key[l] == '=')
+			return e;
+	}
+}
+
+static int wpas__dict_num(struct wpas_dict_entry *e,
+			  const char *entry,
+			  long long *out)
+{
+	char *end;
+
+	if (!e->parsed) {
+		errno = 0;
+		e->num = strtoll(entry, &end, 10);
+		e->valid = end != entry && !errno;
+		e->parsed = true;
+	}
+
+	if (!e->valid)
+		return -EINVAL;
+
+	*out = e->num;
+	return 0;
+}
+
 int wpas_message_dict_read(struct wpas_message *m,
 			   const char *name,
 			   char type,
 			   void *out)
 {
+	struct wpas_dict_entry *e;
 	const char *entry;
+	long long num;
 	size_t i, l;
+	int r;
 
 	if (!m || !name || !out)
 		return -EINVAL;
 
+	if (m->sealed && !m->indexed) {
+		r = wpas__dict_index(m);
+		if (r < 0)
+			return r;
+	}
+
+	if (m->indexed) {
+		e = wpas__dict_find(m, name);
+		if (!e)
+			return -ENOENT;
+
+		entry = strchr(m->argv[e->arg - 1], '=') + 1;
+
+		switch (type) {
+		case WPAS_TYPE_STRING:
+			*(const char**)out = entry;
+			return 0;
+		case WPAS_TYPE_INT32:
+			r = wpas__dict_num(e, entry, &num);
+			if (r < 0)
+				return r;
+			*(int32_t*)out = num;
+			return 0;
+		case WPAS_TYPE_UINT32:
+			r = wpas__dict_num(e, entry, &num);
+			if (r < 0)
+				return r;
+			*(uint32_t*)out = num;
+			return 0;
+		default:
+			return -EINVAL;
+		}
+	}
+
 	for (i = m->name ? 1 : 0; i < m->argc; ++i) {
 		entry = strchr(m->argv[i], '=');
 		if (!entry)
@@ -716,34 +921,84 @@ int wpas_message_dict_read(struct wpas_message *m,
 	return -ENOENT;
 }
 
-static int wpas__parse_args(struct wpas_message *m,
-			    char **argv,
-			    int argc)
+/*
+ * Received messages are never built through the append helpers. Instead, each
+ * one owns the buffer the datagram was received into (@raw, kept verbatim) and
+ * a token area that grows to the largest payload seen. The payload is copied
+ * once into the token area and tokenized in place, so @argv, @name and @ifname
+ * all point into @tokens. Both buffers and @argv are kept when the message is
+ * recycled, hence a warm bus parses messages without touching the heap.
+ */
+
+static void wpas__message_free(struct wpas_message *m)
 {
-	int i, r;
+	free(m->dict);
+	free(m->argv);
+	free(m->tokens);
+	free(m->raw);
+	free(m);
+}
 
-	for (i = 0; i < argc; ++i) {
-		r = wpas_message_append_basic(m, 's', argv[i]);
-		if (r < 0)
-			return r;
+static int wpas__message_get(struct wpas *w, struct wpas_message **out)
+{
+	struct wpas_message *m;
+
+	if (w->pool_cnt) {
+		*out = w->pool[--w->pool_cnt];
+		return 0;
 	}
 
+	m = calloc(1, sizeof(*m));
+	if (!m)
+		return -ENOMEM;
+
+	m->pooled = true;
+	m->raw_size = WPAS_MAX_LEN;
+	m->raw = malloc(m->raw_size);
+	if (!m->raw) {
+		free(m);
+		return -ENOMEM;
+	}
+
+	w->stats.allocs += 2;
+	*out = m;
 	return 0;
 }
 
+static void wpas__message_put(struct wpas *w, struct wpas_message *m)
+{
+	struct wpas_message t;
+
+	if (w->pool_cnt >= WPAS_POOL_MAX) {
+		wpas__message_free(m);
+		return;
+	}
+
+	t = *m;
+	memset(m, 0, sizeof(*m));
+	m->pooled = true;
+	m->raw = t.raw;
+	m->raw_size = t.raw_size;
+	m->tokens = t.tokens;
+	m->tokens_size = t.tokens_size;
+	m->argv = t.argv;
+	m->argv_size = t.argv_size;
+	m->dict = t.dict;
+	m->dict_size = t.dict_size;
+
+	w->pool[w->pool_cnt++] = m;
+}
+
+/* parse the @len bytes in @m->raw; @m->raw[len] must be 0 */
 static int wpas__parse_message(struct wpas *w,
-			       char *raw,
+			       struct wpas_message *m,
 			       size_t len,
-			       struct sockaddr_un *src,
-			       struct wpas_message **out)
+			       struct sockaddr_un *src)
 {
-	_wpas_message_unref_ struct wpas_message *m = NULL;
-	_shl_strv_free_ char **args = NULL;
 	const char *ifname = NULL;
-	unsigned int level;
-	char *pos;
-	char *orig_raw = raw;
-	int r, num;
+	size_t ifname_len = 0, tokens_size, argv_size, need;
+	char *raw = m->raw, *t, *pos;
+	int num;
 	bool is_event = false;
 
 	log_trace("raw message: %s", raw);
@@ -751,6 +1006,7 @@ static int wpas__parse_message(struct wpas *w,
 	if ((pos = shl_startswith(raw, "IFNAME="))) {
 		ifname = pos;
 		pos = strchrnul(pos, ' ');
+		ifname_len = pos - ifname;
 		if (*pos)
 			pos++;
 
@@ -758,76 +1014,80 @@ static int wpas__parse_message(struct wpas *w,
 		raw = pos;
 	}
 
+	need = len + 1 + (ifname ? ifname_len + 1 : 0);
+	tokens_size = m->tokens_size;
+	if (!SHL_GREEDY_REALLOC_T(m->tokens, m->tokens_size, need))
+		return -ENOMEM;
+	if (m->tokens_size != tokens_size)
+		++w->stats.allocs;
+
+	t = m->tokens;
+	if (ifname) {
+		memcpy(t, ifname, ifname_len);
+		t[ifname_len] = 0;
+		m->ifname = t;
+		t += ifname_len + 1;
+	}
+
+	memcpy(t, raw, len);
+	t[len] = 0;
+
 	is_event = len > 0 && raw[0] == '<';
 
 	/* replies are split on new-lines, everything else like a qstr */
-	if (!w->server && !is_event) {
-		num = shl_strsplit_n(raw, len, "\n", &args);
-		if (num < 0)
-			return num;
-	} else {
-		num = shl_qstr_tokenize_n(raw, len, &args);
-		if (num < 0)
-			return num;
-	}
+	argv_size = m->argv_size;
+	if (!w->server && !is_event)
+		num = shl_strsplit_inplace(t, len, "\n", &m->argv,
+					   &m->argv_size);
+	else
+		num = shl_qstr_tokenize_inplace(t, len, &m->argv,
+						&m->argv_size);
+	if (num < 0)
+		return num;
 
-	if (!w->server && is_event) {
-		pos = strchr(args[0], '>');
-		if (pos && pos[1]) {
-			*pos = 0;
-			level = atoi(args[0] + 1);
-			*pos = '>';
+	/* unknown messages carry an empty name and no arguments */
+	if (!SHL_GREEDY_REALLOC_T(m->argv, m->argv_size, 2))
+		return -ENOMEM;
+	if (m->argv_size != argv_size)
+		++w->stats.allocs;
 
-			r = wpas_message_new_event(w, &pos[1], level, &m);
-			if (r < 0)
-				return r;
+	m->type = WPAS_MESSAGE_UNKNOWN;
 
-			r = wpas__parse_args(m, args + 1, num - 1);
-			if (r < 0)
-				return r;
+	if (!w->server && is_event) {
+		pos = strchr(m->argv[0], '>');
+		if (pos && pos[1]) {
+			m->type = WPAS_MESSAGE_EVENT;
+			m->level = atoi(m->argv[0] + 1);
+			m->argv[0] = &pos[1];
+			m->event_id = wpas__event_id(w, m->argv[0]);
 		}
 	} else if (!w->server) {
-		r = wpas_message_new_reply(w, &m);
-		if (r < 0)
-			return r;
-
-		r = wpas__parse_args(m, args, num);
-		if (r < 0)
-			return r;
-	} else if (w->server && num && args[0][0]) {
-		r = wpas_message_new_request(w, args[0], &m);
-		if (r < 0)
-			return r;
-
-		r = wpas__parse_args(m, args + 1, num - 1);
-		if (r < 0)
-			return r;
+		m->type = WPAS_MESSAGE_REPLY;
+	} else if (w->server && num && m->argv[0][0]) {
+		m->type = WPAS_MESSAGE_REQUEST;
 	}
 
-	if (!m) {
-		r = wpas_message_new(w, "", &m);
-		if (r < 0)
-			return r;
+	if (m->type == WPAS_MESSAGE_REPLY) {
+		m->argc = num;
+	} else {
+		if (m->type == WPAS_MESSAGE_UNKNOWN) {
+			m->argv[0] = &t[len];
+			m->argv[1] = NULL;
+			num = 1;
+		}
+
+		m->name = m->argv[0];
+		m->argc = num;
+		m->iter = 1;
 	}
 
 	m->sealed = true;
 	m->rawlen = len;
-	m->raw = strdup(orig_raw);
-	if (!m->raw)
-		return -ENOMEM;
-
-	if (ifname) {
-		m->ifname = strndup(ifname, strchrnul(ifname, ' ') - ifname);
-		if (!m->ifname)
-			return -ENOMEM;
-	}
 
 	/* copy message source */
 	memcpy(&m->peer, src, sizeof(*src));
 	m->has_peer = true;
 
-	*out = m;
-	m = NULL;
 	return 0;
 }
 
@@ -1121,6 +1381,7 @@ static int wpas_new(const char *ctrl_path, bool server, struct wpas **out)
 	w->server = server;
 	shl_dlist_init(&w->match_list);
 	shl_dlist_init(&w->msg_list);
+	twheel_timer_init(&w->timer, wpas_timer_fn, w);
 
 	w->ctrl_path = strdup(ctrl_path);
 	if (!ctrl_path)
@@ -1208,6 +1469,8 @@ void wpas_unref(struct wpas *w)
 	}
 
 	wpas__close(w);
+	while (w->pool_cnt)
+		wpas__message_free(w->pool[--w->pool_cnt]);
 	free(w->ctrl_path);
 	free(w);
 }
@@ -1349,44 +1612,9 @@ static int wpas__write(struct wpas *w)
 	return 0;
 }
 
-static int wpas__read_message(struct wpas *w, struct wpas_message **out)
+static void wpas__dispatch(struct wpas *w, struct wpas_message *a)
 {
-	struct sockaddr_un src = { };
-	socklen_t src_len = sizeof(src);
-	ssize_t l;
-
-	l = recvfrom(w->fd,
-		     w->recvbuf,
-		     sizeof(w->recvbuf) - 1,
-		     MSG_DONTWAIT,
-		     (struct sockaddr*)&src,
-		     &src_len);
-	if (l < 0) {
-		if (errno == EAGAIN || errno == EINTR)
-			return -EAGAIN;
-
-		return -errno;
-	} else if (!l) {
-		return -EAGAIN;
-	} else if (src_len > sizeof(src)) {
-		return -EFAULT;
-	} else if (l > sizeof(w->recvbuf) - 1) {
-		l = sizeof(w->recvbuf) - 1;
-	}
-
-	w->recvbuf[l] = 0;
-	return wpas__parse_message(w, w->recvbuf, l, &src, out);
-}
-
-static int wpas__read(struct wpas *w)
-{
-	_wpas_message_unref_ struct wpas_message *a = NULL;
 	_wpas_message_unref_ struct wpas_message *m = NULL;
-	int r;
-
-	r = wpas__read_message(w, &a);
-	if (r < 0)
-		return r;
 
 	switch (a->type) {
 	case WPAS_MESSAGE_UNKNOWN:
@@ -1407,8 +1635,101 @@ static int wpas__read(struct wpas *w)
 		wpas__message_call(m, a);
 		break;
 	}
+}
 
-	return 0;
+/*
+ * During P2P discovery, wpas floods us with events. Instead of a single
+ * datagram per wakeup, we receive up to WPAS_RECV_BATCH of them with one
+ * recvmmsg() and dispatch them in order. We never loop on the socket, so a
+ * busy supplicant cannot starve other event sources: anything beyond the
+ * batch is picked up on the next wakeup.
+ */
+static int wpas__read(struct wpas *w)
+{
+	struct mmsghdr msgs[WPAS_RECV_BATCH] = { };
+	struct iovec vecs[WPAS_RECV_BATCH];
+	struct sockaddr_un srcs[WPAS_RECV_BATCH];
+	struct wpas_message *ms[WPAS_RECV_BATCH] = { }, *a;
+	size_t l;
+	int i, n, r;
+
+	for (i = 0; i < WPAS_RECV_BATCH; ++i) {
+		r = wpas__message_get(w, &ms[i]);
+		if (r < 0) {
+			n = 0;
+			goto out;
+		}
+
+		vecs[i].iov_base = ms[i]->raw;
+		vecs[i].iov_len = ms[i]->raw_size - 1;
+		msgs[i].msg_hdr.msg_iov = &vecs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		msgs[i].msg_hdr.msg_name = &srcs[i];
+		msgs[i].msg_hdr.msg_namelen = sizeof(srcs[i]);
+	}
+
+	n = recvmmsg(w->fd, msgs, WPAS_RECV_BATCH, MSG_DONTWAIT, NULL);
+	if (n < 0) {
+		if (errno == EAGAIN || errno == EINTR)
+			r = -EAGAIN;
+		else
+			r = -errno;
+		n = 0;
+		goto out;
+	} else if (!n) {
+		r = -EAGAIN;
+		goto out;
+	}
+
+	++w->stats.wakeups;
+	w->stats.messages += n;
+	if (n > w->stats.batch_max)
+		w->stats.batch_max = n;
+	if (n == WPAS_RECV_BATCH)
+		++w->stats.batch_full;
+
+	log_trace("received %d messages in one batch", n);
+
+	/* callbacks might hup the bus, drop the rest of the batch then */
+	r = 0;
+	for (i = 0; i < n && !w->dead; ++i) {
+		a = ms[i];
+		ms[i] = NULL;
+
+		if (msgs[i].msg_hdr.msg_namelen > sizeof(srcs[i]))
+			r = -EFAULT;
+
+		l = msgs[i].msg_len;
+		if (r < 0 || !l) {
+			wpas__message_put(w, a);
+			if (r < 0)
+				break;
+			continue;
+		}
+
+		a->raw[l] = 0;
+
+		r = wpas__parse_message(w, a, l, &srcs[i]);
+		if (r < 0) {
+			wpas__message_put(w, a);
+			break;
+		}
+
+		a->ref = 1;
+		a->w = w;
+		wpas_ref(w);
+
+		wpas__dispatch(w, a);
+		wpas_message_unref(a);
+	}
+
+out:
+	/* return unused messages to the pool */
+	for (i = 0; i < WPAS_RECV_BATCH; ++i)
+		if (ms[i])
+			wpas__message_put(w, ms[i]);
+
+	return r;
 }
 
 static int wpas_io_fn(sd_event_source *source, int fd, uint32_t mask, void *d)
@@ -1435,10 +1756,10 @@ static int wpas_io_fn(sd_event_source *source, int fd, uint32_t mask, void *d)
 	}
 
 	if (mask & EPOLLIN || write_r < 0) {
-		/* Read one packet from the FD and return. Don't block the
-		 * event loop by reading in a loop. We're called again if
-		 * there's still data so make sure higher priority tasks will
-		 * get a change to interrupt us. */
+		/* Read one batch of packets from the FD and return. Don't
+		 * block the event loop by reading in a loop. We're called
+		 * again if there's still data so make sure higher priority
+		 * tasks will get a change to interrupt us. */
 		r = wpas__read(w);
 		if (r < 0 && r != -EAGAIN)
 			goto error;
@@ -1483,24 +1804,17 @@ static int wpas_io_prepare_fn(sd_event_source *source, void *d)
 	if (r < 0)
 		return r;
 
-	if (m) {
-		r = sd_event_source_set_time(w->timer_source, m->timeout);
-		if (r < 0)
-			return r;
-
-		r = sd_event_source_set_enabled(w->timer_source, SD_EVENT_ON);
-		if (r < 0)
-			return r;
-	} else {
-		r = sd_event_source_set_enabled(w->timer_source, SD_EVENT_OFF);
-		if (r < 0)
-			return r;
-	}
+	/* only touch the wheel if the head of the queue changed */
+	if (!m)
+		twheel_timer_remove(&w->timer);
+	else if (!twheel_timer_is_pending(&w->timer) ||
+		 w->timer.expiry != m->timeout)
+		twheel_timer_add(w->wheel, &w->timer, m->timeout);
 
 	return 0;
 }
 
-static int wpas_timer_fn(sd_event_source *source, uint64_t timeout, void *d)
+static void wpas_timer_fn(struct twheel_timer *t, void *d)
 {
 	struct wpas *w = d;
 	struct wpas_message *m;
@@ -1508,9 +1822,6 @@ static int wpas_timer_fn(sd_event_source *source, uint64_t timeout, void *d)
 	/* make sure WPAS stays around during any user-callbacks */
 	wpas_ref(w);
 
-	/* always disable timer, ->prepare() takes care of rescheduling */
-	sd_event_source_set_enabled(w->timer_source, SD_EVENT_OFF);
-
 	/* No message? What was this timer for? */
 	m = wpas__get_current(w);
 	if (!m)
@@ -1525,7 +1836,6 @@ static int wpas_timer_fn(sd_event_source *source, uint64_t timeout, void *d)
 
 out:
 	wpas_unref(w);
-	return 0;
 }
 
 int wpas_attach_event(struct wpas *w, sd_event *event, int priority)
@@ -1568,21 +1878,7 @@ int wpas_attach_event(struct wpas *w, sd_event *event, int priority)
 	if (r < 0)
 		goto error;
 
-	r = sd_event_add_time(w->event,
-			      &w->timer_source,
-			      CLOCK_MONOTONIC,
-			      0,
-			      0,
-			      wpas_timer_fn,
-			      w);
-	if (r < 0)
-		goto error;
-
-	r = sd_event_source_set_enabled(w->timer_source, SD_EVENT_OFF);
-	if (r < 0)
-		goto error;
-
-	r = sd_event_source_set_priority(w->timer_source, priority);
+	r = twheel_get(&w->wheel, w->event, priority);
 	if (r < 0)
 		goto error;
 
@@ -1600,7 +1896,9 @@ void wpas_detach_event(struct wpas *w)
 
 	w->event = sd_event_unref(w->event);
 	w->fd_source = sd_event_source_unref(w->fd_source);
-	w->timer_source = sd_event_source_unref(w->timer_source);
+	twheel_timer_remove(&w->timer);
+	twheel_unref(w->wheel);
+	w->wheel = NULL;
 }
 
 int wpas_add_match(struct wpas *w, wpas_callback_fn cb_fn, void *data)
@@ -1657,3 +1955,72 @@ bool wpas_is_server(struct wpas *w)
 {
 	return w && w->server;
 }
+
+static const char *wpas__event_name(struct wpas *w, size_t i)
+{
+	const char *entry = w->event_table;
+
+	return *(const char* const*)&entry[i * w->event_size];
+}
+
+static unsigned int wpas__event_id(struct wpas *w, const char *name)
+{
+	size_t lo = 0, hi = w->event_cnt, mid;
+	int c;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		c = strcmp(name, wpas__event_name(w, mid));
+		if (!c)
+			return mid + 1;
+		else if (c < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	return 0;
+}
+
+/*
+ * wpas_set_event_table() - Resolve event names at parse time
+ * @table points to @cnt entries of @size bytes each, every entry starting with
+ * a "const char *" event name. Entries must be sorted by strcmp() and names
+ * must be unique. Each received event is looked up once while it is parsed
+ * and wpas_message_get_event_id() then returns its table index plus one, or
+ * 0 for events that are not in the table. This lets callers dispatch events
+ * by index instead of comparing names. The table is not copied.
+ */
+int wpas_set_event_table(struct wpas *w,
+			 const void *table,
+			 size_t cnt,
+			 size_t size)
+{
+	size_t i;
+
+	if (!w || (cnt && (!table || size < sizeof(const char*))))
+		return -EINVAL;
+
+	w->event_table = table;
+	w->event_cnt = cnt;
+	w->event_size = size;
+
+	for (i = 1; i < cnt; ++i) {
+		if (strcmp(wpas__event_name(w, i - 1),
+			   wpas__event_name(w, i)) >= 0) {
+			w->event_table = NULL;
+			w->event_cnt = 0;
+			return -EINVAL;
+		}
+	}
+
+	return 0;
+}
+
+void wpas_get_stats(struct wpas *w, struct wpas_stats *stats)
+{
+	if (!w || !stats)
+		return;
+
+	*stats = w->stats;
+}
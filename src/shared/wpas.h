@@ -53,6 +53,14 @@ enum {
 	WPAS_LEVEL_CNT
 };
 
+struct wpas_stats {
+	uint64_t wakeups;		/* reads that returned messages */
+	uint64_t messages;		/* messages received */
+	uint64_t batch_max;		/* most messages read in one wakeup */
+	uint64_t batch_full;		/* wakeups that hit the batch limit */
+	uint64_t allocs;		/* heap allocations for received messages */
+};
+
 #define WPAS_TYPE_STRING			's'
 #define WPAS_TYPE_INT32				'i'
 #define WPAS_TYPE_UINT32			'u'
@@ -84,6 +92,11 @@ void wpas_remove_match(struct wpas *w, wpas_callback_fn cb_fn, void *data);
 
 bool wpas_is_dead(struct wpas *w);
 bool wpas_is_server(struct wpas *w);
+void wpas_get_stats(struct wpas *w, struct wpas_stats *stats);
+int wpas_set_event_table(struct wpas *w,
+			 const void *table,
+			 size_t cnt,
+			 size_t size);
 
 static inline void wpas_unref_p(struct wpas **w)
 {
@@ -119,6 +132,7 @@ uint64_t wpas_message_get_cookie(struct wpas_message *msg);
 struct wpas *wpas_message_get_bus(struct wpas_message *msg);
 unsigned int wpas_message_get_type(struct wpas_message *msg);
 unsigned int wpas_message_get_level(struct wpas_message *msg);
+unsigned int wpas_message_get_event_id(struct wpas_message *msg);
 const char *wpas_message_get_name(struct wpas_message *msg);
 const char *wpas_message_get_raw(struct wpas_message *msg);
 const char *wpas_message_get_ifname(struct wpas_message *msg);
@@ -65,6 +65,145 @@ static char *link_dbus_get_path(struct link *l)
 	return node;
 }
 
+/*
+ * Property Notifications
+ * During discovery, peer properties are updated at a high rate. Instead of a
+ * PropertiesChanged signal per update, changed properties are collected as a
+ * bitmask per object and flushed as a single signal per object once the
+ * current event-loop iteration is done, via a defer source. Any other signal
+ * on an object flushes its pending properties first to keep ordering intact.
+ */
+
+static const char *peer_dbus_props[] = {
+	"FriendlyName",
+	"Connected",
+	"Interface",
+	"LocalAddress",
+	"RemoteAddress",
+	"WfdSubelements",
+	NULL
+};
+
+static const char *link_dbus_props[] = {
+	"InterfaceName",
+	"FriendlyName",
+	"Managed",
+	"P2PState",
+	"P2PScanning",
+	"WfdSubelements",
+	NULL
+};
+
+/* returns the bitmask of @props or 0 if one of them is unknown */
+static unsigned int dbus_props_mask(const char **table, char **props)
+{
+	unsigned int i, mask = 0;
+
+	for ( ; *props; ++props) {
+		for (i = 0; table[i]; ++i)
+			if (!strcmp(table[i], *props))
+				break;
+
+		if (!table[i])
+			return 0;
+
+		mask |= 1U << i;
+	}
+
+	return mask;
+}
+
+static void dbus_props_emit(sd_bus *bus,
+			    const char *node,
+			    const char *iface,
+			    const char **table,
+			    unsigned int mask)
+{
+	const char *strv[16];
+	unsigned int i, n = 0;
+	int r;
+
+	for (i = 0; table[i]; ++i)
+		if (mask & (1U << i))
+			strv[n++] = table[i];
+	strv[n] = NULL;
+
+	if (!n)
+		return;
+
+	r = sd_bus_emit_properties_changed_strv(bus, node, iface, (char**)strv);
+	if (r < 0)
+		log_vERR(r);
+}
+
+static void dbus_flush_schedule(struct manager *m)
+{
+	if (m->dbus_flush_source)
+		sd_event_source_set_enabled(m->dbus_flush_source,
+					    SD_EVENT_ONESHOT);
+}
+
+static void peer_dbus_flush(struct peer *p)
+{
+	_shl_free_ char *node = NULL;
+	unsigned int mask = p->dbus_dirty;
+
+	if (!mask)
+		return;
+
+	p->dbus_dirty = 0;
+	shl_dlist_unlink(&p->dbus_list);
+
+	node = peer_dbus_get_path(p);
+	if (!node)
+		return;
+
+	dbus_props_emit(p->l->m->bus,
+			node,
+			"org.freedesktop.miracle.wifi.Peer",
+			peer_dbus_props,
+			mask);
+}
+
+static void link_dbus_flush(struct link *l)
+{
+	_shl_free_ char *node = NULL;
+	unsigned int mask = l->dbus_dirty;
+
+	if (!mask)
+		return;
+
+	l->dbus_dirty = 0;
+	shl_dlist_unlink(&l->dbus_list);
+
+	node = link_dbus_get_path(l);
+	if (!node)
+		return;
+
+	dbus_props_emit(l->m->bus,
+			node,
+			"org.freedesktop.miracle.wifi.Link",
+			link_dbus_props,
+			mask);
+}
+
+static int manager_dbus_flush_fn(sd_event_source *source, void *data)
+{
+	struct manager *m = data;
+
+	while (!shl_dlist_empty(&m->dbus_dirty_links))
+		link_dbus_flush(shl_dlist_first_entry(&m->dbus_dirty_links,
+						      struct link,
+						      dbus_list));
+
+	while (!shl_dlist_empty(&m->dbus_dirty_peers))
+		peer_dbus_flush(shl_dlist_first_entry(&m->dbus_dirty_peers,
+						      struct peer,
+						      dbus_list));
+
+	return 0;
+}
+
 /*
  * Peer DBus
  */
@@ -366,17 +505,28 @@ static int peer_dbus_find(sd_bus *bus,
 void peer_dbus_properties_changed(struct peer *p, const char *prop, ...)
 {
 	_shl_free_ char *node = NULL;
+	unsigned int mask;
 	char **strv;
 	int r;
 
 	if (!p->public)
 		return;
 
+	strv = strv_from_stdarg_alloca(prop);
+	mask = dbus_props_mask(peer_dbus_props, strv);
+	if (mask) {
+		if (!p->dbus_dirty)
+			shl_dlist_link_tail(&p->l->m->dbus_dirty_peers,
+					    &p->dbus_list);
+		p->dbus_dirty |= mask;
+		dbus_flush_schedule(p->l->m);
+		return;
+	}
+
 	node = peer_dbus_get_path(p);
 	if (!node)
 		return;
 
-	strv = strv_from_stdarg_alloca(prop);
 	r = sd_bus_emit_properties_changed_strv(p->l->m->bus,
 						node,
 						"org.freedesktop.miracle.wifi.Peer",
@@ -397,6 +547,8 @@ void peer_dbus_provision_discovery(struct peer *p,
 	if (!pin)
 		pin = "";
 
+	peer_dbus_flush(p);
+
 	node = peer_dbus_get_path(p);
 	if (!node)
 		return;
@@ -422,6 +574,8 @@ void peer_dbus_go_neg_request(struct peer *p,
 	if (!pin)
 		pin = "";
 
+	peer_dbus_flush(p);
+
 	node = peer_dbus_get_path(p);
 	if (!node)
 		return;
@@ -440,6 +594,8 @@ void peer_dbus_formation_failure(struct peer *p, const char *reason)
 	_shl_free_ char *node = NULL;
 	int r;
 
+	peer_dbus_flush(p);
+
 	node = peer_dbus_get_path(p);
 	if (!node)
 		return;
@@ -458,6 +614,12 @@ void peer_dbus_added(struct peer *p)
 	_shl_free_ char *node = NULL;
 	int r;
 
+	/* InterfacesAdded carries all properties */
+	if (p->dbus_dirty) {
+		p->dbus_dirty = 0;
+		shl_dlist_unlink(&p->dbus_list);
+	}
+
 	node = peer_dbus_get_path(p);
 	if (!node)
 		return;
@@ -475,6 +637,11 @@ void peer_dbus_removed(struct peer *p)
 	_shl_free_ char *node = NULL;
 	int r;
 
+	if (p->dbus_dirty) {
+		p->dbus_dirty = 0;
+		shl_dlist_unlink(&p->dbus_list);
+	}
+
 	node = peer_dbus_get_path(p);
 	if (!node)
 		return;
@@ -809,17 +976,28 @@ static int link_dbus_find(sd_bus *bus,
 void link_dbus_properties_changed(struct link *l, const char *prop, ...)
 {
 	_shl_free_ char *node = NULL;
+	unsigned int mask;
 	char **strv;
 	int r;
 
 	if (!l->public)
 		return;
 
+	strv = strv_from_stdarg_alloca(prop);
+	mask = dbus_props_mask(link_dbus_props, strv);
+	if (mask) {
+		if (!l->dbus_dirty)
+			shl_dlist_link_tail(&l->m->dbus_dirty_links,
+					    &l->dbus_list);
+		l->dbus_dirty |= mask;
+		dbus_flush_schedule(l->m);
+		return;
+	}
+
 	node = link_dbus_get_path(l);
 	if (!node)
 		return;
 
-	strv = strv_from_stdarg_alloca(prop);
 	r = sd_bus_emit_properties_changed_strv(l->m->bus,
 						node,
 						"org.freedesktop.miracle.wifi.Link",
@@ -833,6 +1011,12 @@ void link_dbus_added(struct link *l)
 	_shl_free_ char *node = NULL;
 	int r;
 
+	/* InterfacesAdded carries all properties */
+	if (l->dbus_dirty) {
+		l->dbus_dirty = 0;
+		shl_dlist_unlink(&l->dbus_list);
+	}
+
 	node = link_dbus_get_path(l);
 	if (!node)
 		return;
@@ -854,6 +1038,11 @@ void link_dbus_removed(struct link *l)
 	_shl_free_ char *node = NULL;
 	int r;
 
+	if (l->dbus_dirty) {
+		l->dbus_dirty = 0;
+		shl_dlist_unlink(&l->dbus_list);
+	}
+
 	node = link_dbus_get_path(l);
 	if (!node)
 		return;
@@ -955,6 +1144,17 @@ int manager_dbus_connect(struct manager *m)
 {
 	int r;
 
+	r = sd_event_add_defer(m->event,
+			       &m->dbus_flush_source,
+			       manager_dbus_flush_fn,
+			       m);
+	if (r < 0)
+		goto error;
+
+	r = sd_event_source_set_enabled(m->dbus_flush_source, SD_EVENT_OFF);
+	if (r < 0)
+		goto error;
+
 	r = sd_bus_add_object_vtable(m->bus, NULL,
 				     "/org/freedesktop/miracle/wifi",
 				     "org.freedesktop.miracle.wifi.Manager",
@@ -1013,5 +1213,11 @@ void manager_dbus_disconnect(struct manager *m)
 	if (!m || !m->bus)
 		return;
 
+	if (m->dbus_flush_source) {
+		manager_dbus_flush_fn(m->dbus_flush_source, m);
+		sd_event_source_unref(m->dbus_flush_source);
+		m->dbus_flush_source = NULL;
+	}
+
 	sd_bus_release_name(m->bus, "org.freedesktop.miracle.wifi");
 }
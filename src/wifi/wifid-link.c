@@ -54,6 +54,18 @@ struct peer *link_find_peer_by_label(struct link *l, const char *label)
 	return link_find_peer(l, mac);
 }
 
+struct peer *link_find_peer_by_sta_mac(struct link *l, uint64_t sta_mac)
+{
+	uint64_t *elem;
+	bool res;
+
+	res = shl_htable_lookup_u64(&l->sta_peers, sta_mac, &elem);
+	if (!res)
+		return NULL;
+
+	return peer_from_sta_htable(elem);
+}
+
 int link_new(struct manager *m,
 	     unsigned int ifindex,
 	     const char *ifname,
@@ -78,6 +90,7 @@ int link_new(struct manager *m,
 	l->m = m;
 	l->ifindex = ifindex;
 	shl_htable_init_str(&l->peers);
+	shl_htable_init_u64(&l->sta_peers);
 
 	l->ifname = strdup(ifname);
 	if (!l->ifname) {
@@ -128,6 +141,9 @@ void link_free(struct link *l)
 	link_dbus_removed(l);
 	l->public = false;
 
+	if (l->dbus_dirty)
+		shl_dlist_unlink(&l->dbus_list);
+
 	if (shl_htable_remove_uint(&l->m->links, l->ifindex, NULL)) {
 		log_info("remove link: %s", l->ifname);
 		--l->m->link_cnt;
@@ -137,6 +153,7 @@ void link_free(struct link *l)
 
 	/* link_manage(l, false) already removed all peers */
 	shl_htable_clear_str(&l->peers, NULL, NULL);
+	shl_htable_clear_u64(&l->sta_peers, NULL, NULL);
 
 	free(l->mac_addr);
 	free(l->wfd_subelements);
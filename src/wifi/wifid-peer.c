@@ -89,6 +89,11 @@ void peer_free(struct peer *p)
 
 	log_debug("free peer: %s @ %s", p->p2p_mac, p->l->ifname);
 
+	if (p->dbus_dirty)
+		shl_dlist_unlink(&p->dbus_list);
+
+	peer_set_sta_mac(p, 0);
+
 	if (shl_htable_remove_str(&p->l->peers, p->p2p_mac, NULL, NULL)) {
 		log_info("remove peer: %s", p->p2p_mac);
 		--p->l->peer_cnt;
@@ -98,6 +103,47 @@ void peer_free(struct peer *p)
 	free(p);
 }
 
+/*
+ * Set the station MAC of @p (0 clears it) and keep l->sta_peers in sync. A
+ * station address belongs to at most one peer; if another peer still claims
+ * it, that binding is stale and gets dropped.
+ */
+int peer_set_sta_mac(struct peer *p, uint64_t sta_mac)
+{
+	struct peer *o;
+	int r;
+
+	if (!p)
+		return log_EINVAL();
+	if (p->sta_mac == sta_mac)
+		return 0;
+
+	if (p->sta_mac) {
+		shl_htable_remove_u64(&p->l->sta_peers, p->sta_mac, NULL);
+		p->sta_mac = 0;
+	}
+
+	if (!sta_mac)
+		return 0;
+
+	o = link_find_peer_by_sta_mac(p->l, sta_mac);
+	if (o) {
+		log_debug("move STA-MAC from peer %s to %s",
+			  o->p2p_mac, p->p2p_mac);
+		shl_htable_remove_u64(&p->l->sta_peers, sta_mac, NULL);
+		o->sta_mac = 0;
+	}
+
+	p->sta_mac = sta_mac;
+	r = shl_htable_insert_u64(&p->l->sta_peers, &p->sta_mac);
+	if (r < 0) {
+		p->sta_mac = 0;
+		return log_ERR(r);
+	}
+
+	return 0;
+}
+
 const char *peer_get_friendly_name(struct peer *p)
 {
 	if (!p)
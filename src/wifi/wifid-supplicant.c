@@ -19,16 +19,25 @@
 
 #define LOG_SUBSYSTEM "supplicant"
 
+#include <arpa/inet.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <netinet/in.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <systemd/sd-event.h>
 #include <systemd/sd-journal.h>
 #include <unistd.h>
+#include "dhcp-cache.h"
+#include "dhcp-engine.h"
 #include "shl_dlist.h"
 #include "shl_log.h"
 #include "shl_util.h"
@@ -37,6 +46,16 @@
 #include "wpas.h"
 #include "config.h"
 
+/* re-query a peer that is re-reported unchanged after 30s */
+#define SUPPLICANT_PEER_REFRESH (30 * 1000ULL * 1000ULL)
+/* at most 4 P2P_PEER queries outstanding at once */
+#define SUPPLICANT_PEER_TOKENS 4
+/* startup poll interval; long if inotify tells us when wpas is up */
+#define SUPPLICANT_OPEN_POLL (200 * 1000ULL)
+#define SUPPLICANT_OPEN_FALLBACK (2 * 1000ULL * 1000ULL)
+/* GO subnet for --eapol-ip; wpas hands out addresses of a single subnet */
+#define SUPPLICANT_EAPOL_SUBNET 49
+
 struct supplicant_group {
 	unsigned long users;
 	struct shl_dlist list;
@@ -46,13 +65,19 @@ struct supplicant_group {
 	unsigned int subnet;
 	char *ifname;
 	char *local_addr;
+	uint64_t peer;			/* P2P address of the GO, clients only */
+
+	uint64_t start_time;		/* group start until connected or 0 */
 
-	int dhcp_comm;
+	struct dhcp_engine *dhcp;	/* in-process DHCP */
+
+	int dhcp_comm;			/* miracle-dhcp, see --external-dhcp */
 	sd_event_source *dhcp_comm_source;
 	pid_t dhcp_pid;
 	sd_event_source *dhcp_pid_source;
 
 	bool go : 1;
+	bool eapol : 1;			/* clients only; address from EAPOL */
 };
 
 struct supplicant_peer {
@@ -65,27 +90,73 @@ struct supplicant_peer {
 	char *wfd_subelements;
 	char *prov;
 	char *pin;
-	char *sta_mac;
+	char *wfd_dev_info;		/* as last reported by P2P-DEVICE-FOUND */
+
+	uint64_t query_cookie;		/* outstanding P2P_PEER or 0 */
+	uint64_t query_time;		/* last P2P_PEER reply or 0 */
+
+	bool eapol : 1;			/* our GO assigned @remote_addr in EAPOL */
+};
+
+/* logged when the supplicant is closed */
+struct supplicant_ready_stats {
+	uint64_t count;			/* wpas instances that became ready */
+	uint64_t last;			/* exec -> ready of the last one, usec */
+	uint64_t max;			/* slowest exec -> ready, usec */
+	uint64_t total;			/* sum of all exec -> ready, usec */
+	uint64_t watched;		/* ctrl socket found via inotify */
+	uint64_t polled;		/* ctrl socket found by startup timer */
+	uint64_t adopted;		/* running wpas reused, see --wpa-persist */
+};
+
+struct supplicant_dhcp_stats {
+	uint64_t count;			/* groups that got connected */
+	uint64_t last;			/* group start -> connected, usec */
+	uint64_t max;			/* slowest start -> connected, usec */
+	uint64_t total;			/* sum of all start -> connected, usec */
+	uint64_t external;		/* of @count, via miracle-dhcp helper */
+	uint64_t eapol;			/* of @count, address from EAPOL */
+};
+
+struct supplicant_query_stats {
+	uint64_t issued;		/* P2P_PEER queries sent */
+	uint64_t cached;		/* skipped, cached report still current */
+	uint64_t deduped;		/* skipped, query already in flight */
+	uint64_t throttled;		/* skipped, out of query budget */
 };
 
 struct supplicant {
 	struct link *l;
 
 	pid_t pid;
-	sd_event_source *child_source;
+	sd_event_source *child_source;	/* child watch or io on @pidfd */
+	int pidfd;			/* adopted wpas of someone else or -1 */
 	sd_event_source *timer_source;
+	sd_event_source *ctrl_source;	/* inotify on the ctrl dir or NULL */
 	struct shl_ratelimit restart_rate;
 	struct shl_ratelimit exec_rate;
 	uint64_t open_cnt;
 	char *conf_path;
+	char *pid_path;
+	char *lease_path;
+	struct dhcp_cache *lease_cache;	/* NULL if it cannot be opened */
 	char *global_ctrl;
 	char *dev_ctrl;
 
+	uint64_t exec_time;		/* fork() of wpas until it's ready */
+	struct supplicant_ready_stats ready_stats;
+	struct supplicant_dhcp_stats dhcp_stats;
+
 	struct wpas *bus_global;
 	struct wpas *bus_dev;
 
 	size_t setup_cnt;
 
+	/* P2P_PEER query budget, a token is returned on reply */
+	unsigned int query_tokens;
+	struct shl_ratelimit query_rate;
+	struct supplicant_query_stats query_stats;
+
 	char *p2p_mac;
 	struct shl_dlist groups;
 	struct supplicant_peer *pending;
@@ -94,6 +165,7 @@ struct supplicant {
 	bool has_p2p : 1;
 	bool has_wfd : 1;
 	bool p2p_scanning : 1;
+	bool adopted : 1;		/* wpas was not spawned by us */
 };
 
 /* Device Password ID */
@@ -108,6 +180,7 @@ enum wps_dev_password_id {
 };
 
 static void supplicant_failed(struct supplicant *s);
+static void supplicant_unwatch_child(struct supplicant *s);
 static void supplicant_peer_drop_group(struct supplicant_peer *sp);
 
 static struct supplicant_peer *find_peer_by_p2p_mac(struct supplicant *s,
@@ -123,16 +196,18 @@ static struct supplicant_peer *find_peer_by_p2p_mac(struct supplicant *s,
 }
 
 static struct supplicant_peer *find_peer_by_any_mac(struct supplicant *s,
-						    const char *mac)
+						    uint64_t mac)
 {
+	char buf[MAC_STRLEN];
 	struct peer *p;
 
-	LINK_FOREACH_PEER(p, s->l) {
-		if (!strcmp(p->p2p_mac, mac) || (p->sp->sta_mac && !strcmp(p->sp->sta_mac, mac)))
-			return p->sp;
+	p = link_find_peer_by_sta_mac(s->l, mac);
+	if (!p) {
+		format_mac(buf, mac);
+		p = link_find_peer(s->l, buf);
 	}
 
-	return NULL;
+	return p ? p->sp : NULL;
 }
 
 static struct supplicant_group *find_group_by_ifname(struct supplicant *s,
@@ -190,6 +265,9 @@ static void supplicant_group_free(struct supplicant_group *g)
 		log_vERR(r);
 	}
 
+	dhcp_engine_free(g->dhcp);
+	g->dhcp = NULL;
+
 	if (g->dhcp_pid > 0) {
 		sd_event_source_unref(g->dhcp_pid_source);
 		g->dhcp_pid_source = NULL;
@@ -225,17 +303,186 @@ static void supplicant_group_free(struct supplicant_group *g)
 	free(g);
 }
 
+static void supplicant_group_connected_latency(struct supplicant_group *g,
+					       struct supplicant_peer *sp)
+{
+	struct supplicant_dhcp_stats *st = &g->s->dhcp_stats;
+	uint64_t usec;
+	bool eapol;
+
+	if (!g->start_time)
+		return;
+
+	usec = shl_now(CLOCK_MONOTONIC) - g->start_time;
+	g->start_time = 0;
+
+	/* GOs may serve EAPOL and DHCP clients, count the one connecting */
+	eapol = g->go ? sp->eapol : g->eapol;
+
+	++st->count;
+	if (eapol)
+		++st->eapol;
+	else if (!g->dhcp)
+		++st->external;
+	st->last = usec;
+	st->total += usec;
+	if (usec > st->max)
+		st->max = usec;
+
+	log_info("group %s connected %" PRIu64 "ms after start (%s)",
+		 g->ifname, usec / 1000,
+		 eapol ? "EAPOL address" :
+		 g->dhcp ? "in-process DHCP" : "external DHCP");
+}
+
+static void supplicant_group_check_connected(struct supplicant_group *g)
+{
+	struct peer *p;
+
+	if (!g->local_addr)
+		return;
+
+	if (g->sp) {
+		p = g->sp->p;
+		if (p->sp->remote_addr) {
+			supplicant_group_connected_latency(g, p->sp);
+			peer_supplicant_connected_changed(p, true);
+		}
+	} else {
+		LINK_FOREACH_PEER(p, g->s->l) {
+			if (p->sp->g != g || !p->sp->remote_addr)
+				continue;
+
+			supplicant_group_connected_latency(g, p->sp);
+			peer_supplicant_connected_changed(p, true);
+		}
+	}
+}
+
+static void supplicant_group_cache_lease(struct supplicant_group *g,
+					 uint64_t key,
+					 unsigned int role,
+					 uint64_t hwaddr,
+					 const char *addr,
+					 uint32_t lease_time)
+{
+	struct in_addr a;
+	int r;
+
+	if (!g->s->lease_cache || !key || !lease_time)
+		return;
+
+	if (inet_pton(AF_INET, addr, &a) != 1)
+		return;
+
+	r = dhcp_cache_store(g->s->lease_cache, key, role, hwaddr,
+			     ntohl(a.s_addr), time(NULL) + lease_time);
+	if (r < 0)
+		log_debug("cannot cache lease %s of %s: %d",
+			  addr, g->ifname, r);
+}
+
+static void supplicant_group_set_local(struct supplicant_group *g,
+				       const char *addr)
+{
+	char *t;
+
+	t = strdup(addr);
+	if (!t)
+		return log_vENOMEM();
+
+	free(g->local_addr);
+	g->local_addr = t;
+}
+
+static void supplicant_group_set_gateway(struct supplicant_group *g,
+					 const char *addr)
+{
+	char *t;
+
+	if (!g->sp)
+		return;
+
+	t = strdup(addr);
+	if (!t)
+		return log_vENOMEM();
+
+	free(g->sp->remote_addr);
+	g->sp->remote_addr = t;
+}
+
+static void supplicant_group_set_remote(struct supplicant_group *g,
+					const char *mac_str,
+					const char *addr,
+					uint32_t lease_time)
+{
+	struct supplicant_peer *sp;
+	uint64_t mac, key;
+	char *t;
+
+	if (parse_mac(&mac, mac_str) < 0) {
+		log_warning("invalid mac in remote lease: %s", mac_str);
+		return;
+	}
+
+	sp = find_peer_by_any_mac(g->s, mac);
+	if (!sp) {
+		log_debug("ignore remote lease for unknown mac");
+		return;
+	}
+
+	t = strdup(addr);
+	if (!t)
+		return log_vENOMEM();
+
+	free(sp->remote_addr);
+	sp->remote_addr = t;
+
+	if (parse_mac(&key, sp->p->p2p_mac) >= 0)
+		supplicant_group_cache_lease(g, key, DHCP_CACHE_SERVER,
+					     mac, addr, lease_time);
+}
+
+static void supplicant_group_dhcp_fn(struct dhcp_engine *e,
+				     const struct dhcp_engine_event *ev,
+				     void *data)
+{
+	struct supplicant_group *g = data;
+
+	switch (ev->type) {
+	case DHCP_ENGINE_LOCAL:
+		supplicant_group_set_local(g, ev->addr);
+		if (ev->gateway)
+			supplicant_group_set_gateway(g, ev->gateway);
+
+		/* remember what the GO gave us for INIT-REBOOT next time */
+		if (!g->go)
+			supplicant_group_cache_lease(g, g->peer,
+						     DHCP_CACHE_CLIENT, 0,
+						     ev->addr, ev->lease_time);
+		break;
+	case DHCP_ENGINE_REMOTE:
+		supplicant_group_set_remote(g, ev->mac, ev->addr,
+					    ev->lease_time);
+		break;
+	case DHCP_ENGINE_FAILED:
+		log_error("DHCP client/server for %s failed, stopping connection",
+			  g->ifname);
+		supplicant_group_free(g);
+		return;
+	}
+
+	supplicant_group_check_connected(g);
+}
+
 static int supplicant_group_comm_fn(sd_event_source *source,
 				    int fd,
 				    uint32_t mask,
 				    void *data)
 {
 	struct supplicant_group *g = data;
-	struct supplicant_peer *sp;
-	struct peer *p;
 	char buf[512], *t, *ip;
 	ssize_t l;
-	char mac[MAC_STRLEN];
 
 	l = recv(fd, buf, sizeof(buf) - 1, MSG_DONTWAIT);
 	if (l < 0) {
@@ -259,74 +506,32 @@ static int supplicant_group_comm_fn(sd_event_source *source,
 	if (l < 3 || buf[1] != ':' || !buf[2])
 		return 0;
 
-	t = strdup(&buf[2]);
-	if (!t) {
-		log_vENOMEM();
-		return 0;
-	}
+	t = &buf[2];
 
+	/*
+	 * miracle-dhcp caches client leases itself (it knows the lease time),
+	 * but server leases are keyed by the P2P address only we know here.
+	 */
 	switch (buf[0]) {
 	case 'L':
-		free(g->local_addr);
-		g->local_addr = t;
+		supplicant_group_set_local(g, t);
 		break;
 	case 'G':
-		if (g->sp) {
-			free(g->sp->remote_addr);
-			g->sp->remote_addr = t;
-		} else {
-			free(t);
-		}
+		supplicant_group_set_gateway(g, t);
 		break;
 	case 'R':
 		ip = strchr(t, ' ');
 		if (!ip || ip == t || !ip[1]) {
 			log_warning("invalid dhcp 'R' line: %s", t);
-			free(t);
 			break;
 		}
 
 		*ip++ = 0;
-		reformat_mac(mac, t);
-		sp = find_peer_by_any_mac(g->s, mac);
-		if (sp) {
-			ip = strdup(ip);
-			if (!ip) {
-				log_vENOMEM();
-				free(t);
-				break;
-			}
-
-			free(t);
-
-			free(sp->remote_addr);
-			sp->remote_addr = ip;
-		} else {
-			log_debug("ignore 'R' line for unknown mac");
-			free(t);
-		}
-
-		break;
-	default:
-		free(t);
+		supplicant_group_set_remote(g, t, ip, DHCP_ENGINE_LEASE_TIME);
 		break;
 	}
 
-	if (g->local_addr) {
-		if (g->sp) {
-			p = g->sp->p;
-			if (p->sp->remote_addr)
-				peer_supplicant_connected_changed(p, true);
-		} else {
-			LINK_FOREACH_PEER(p, g->s->l) {
-				if (p->sp->g != g || !p->sp->remote_addr)
-					continue;
-
-				peer_supplicant_connected_changed(p, true);
-			}
-		}
-	}
-
+	supplicant_group_check_connected(g);
 	return 0;
 
 error:
@@ -399,6 +604,10 @@ static int supplicant_group_spawn_dhcp_server(struct supplicant_group *g,
 		argv[i++] = g->ifname;
 		argv[i++] = "--comm-fd";
 		argv[i++] = commfd;
+		if (g->s->lease_cache) {
+			argv[i++] = "--lease-cache";
+			argv[i++] = g->s->lease_path;
+		}
 		argv[i] = NULL;
 
 		if (execvpe(argv[0], argv, environ)< 0) {
@@ -416,7 +625,7 @@ static int supplicant_group_spawn_dhcp_server(struct supplicant_group *g,
 
 static int supplicant_group_spawn_dhcp_client(struct supplicant_group *g)
 {
-	char *argv[64], loglevel[64], commfd[64];
+	char *argv[64], loglevel[64], commfd[64], peer[MAC_STRLEN];
 	char journal_id[128];
 	int i, r, fds[2], fd_journal;
 	pid_t pid;
@@ -460,6 +669,15 @@ static int supplicant_group_spawn_dhcp_client(struct supplicant_group *g)
 		argv[i++] = g->ifname;
 		argv[i++] = "--comm-fd";
 		argv[i++] = commfd;
+		if (g->s->lease_cache) {
+			argv[i++] = "--lease-cache";
+			argv[i++] = g->s->lease_path;
+		}
+		if (g->peer) {
+			format_mac(peer, g->peer);
+			argv[i++] = "--peer";
+			argv[i++] = peer;
+		}
 		argv[i] = NULL;
 
 		if (execvpe(argv[0], argv, environ) < 0) {
@@ -475,10 +693,57 @@ static int supplicant_group_spawn_dhcp_client(struct supplicant_group *g)
 	return 0;
 }
 
+static int supplicant_group_start_dhcp(struct supplicant_group *g,
+				       const char *ip_addr,
+				       const char *ip_mask)
+{
+	char local[INET_ADDRSTRLEN], from[INET_ADDRSTRLEN];
+	char to[INET_ADDRSTRLEN];
+	struct dhcp_engine_config config = {
+		.netdev = g->ifname,
+		.server = g->go,
+		.cache = g->s->lease_cache,
+		.peer = g->peer,
+	};
+	int r;
+
+	if (g->go) {
+		/* as "miracle-dhcp --server --prefix 192.168.<subnet>" */
+		sprintf(local, "192.168.%u.1", g->subnet);
+		sprintf(from, "192.168.%u.100", g->subnet);
+		sprintf(to, "192.168.%u.199", g->subnet);
+
+		config.local = local;
+		config.gateway = local;
+		config.dns = local;
+		config.subnet = "255.255.255.0";
+		config.from = from;
+		config.to = to;
+	} else if (ip_addr) {
+		/* no DHCP, the GO assigned us an address during EAPOL */
+		config.static_addr = true;
+		config.local = ip_addr;
+		config.subnet = ip_mask;
+	}
+
+	r = dhcp_engine_new(&g->dhcp,
+			    g->s->l->m->event,
+			    &config,
+			    supplicant_group_dhcp_fn,
+			    g);
+	if (r < 0)
+		return r;
+
+	return dhcp_engine_start(g->dhcp);
+}
+
 static int supplicant_group_new(struct supplicant *s,
 				struct supplicant_group **out,
 				const char *ifname,
-				bool go)
+				bool go,
+				const char *go_mac,
+				const char *ip_addr,
+				const char *ip_mask)
 {
 	struct supplicant_group *g, *j;
 	struct shl_dlist *i;
@@ -497,6 +762,7 @@ static int supplicant_group_new(struct supplicant *s,
 	g->s = s;
 	g->go = go;
 	g->dhcp_comm = -1;
+	g->start_time = shl_now(CLOCK_MONOTONIC);
 
 	g->ifname = strdup(ifname);
 	if (!g->ifname) {
@@ -504,7 +770,27 @@ static int supplicant_group_new(struct supplicant *s,
 		goto error;
 	}
 
-	if (g->go) {
+	if (!g->go && parse_mac(&g->peer, go_mac) < 0)
+		g->peer = 0;
+
+	if (g->go && arg_eapol_ip) {
+		/*
+		 * wpas hands out EAPOL addresses of a single subnet to the
+		 * clients of all its GOs, so there can only be one GO. The
+		 * error path removes the refused group from wpas again.
+		 */
+		shl_dlist_for_each(i, &s->groups) {
+			j = shl_dlist_entry(i, struct supplicant_group, list);
+			if (j->subnet == SUPPLICANT_EAPOL_SUBNET) {
+				log_warning("EAPOL subnet in use by %s, refusing GO group %s",
+					    j->ifname, g->ifname);
+				r = -EBUSY;
+				goto error;
+			}
+		}
+
+		g->subnet = SUPPLICANT_EAPOL_SUBNET;
+	} else if (g->go) {
 		/* find free subnet */
 		for (subnet = 50; subnet < 256; ++subnet) {
 			shl_dlist_for_each(i, &s->groups) {
@@ -521,15 +807,33 @@ static int supplicant_group_new(struct supplicant *s,
 			}
 		}
 
-		if (g->subnet) {
-			r = supplicant_group_spawn_dhcp_server(g, g->subnet);
-		} else {
+		if (!g->subnet) {
 			log_warning("out of free subnets for local groups");
 			r = -EINVAL;
+			goto error;
 		}
-	} else {
-		r = supplicant_group_spawn_dhcp_client(g);
 	}
+
+	if (!g->go && ip_addr && ip_mask) {
+		log_debug("got %s/%s for %s via EAPOL, skipping DHCP",
+			  ip_addr, ip_mask, g->ifname);
+		g->eapol = true;
+	}
+
+	/* static EAPOL addresses are configured in-process, too */
+	if (!arg_external_dhcp || g->eapol) {
+		r = supplicant_group_start_dhcp(g, g->eapol ? ip_addr : NULL,
+						ip_mask);
+		if (r < 0)
+			goto error;
+
+		goto done;
+	}
+
+	if (g->go)
+		r = supplicant_group_spawn_dhcp_server(g, g->subnet);
+	else
+		r = supplicant_group_spawn_dhcp_client(g);
 	if (r < 0)
 		goto error;
 
@@ -555,6 +859,7 @@ static int supplicant_group_new(struct supplicant *s,
 		goto error;
 	}
 
+done:
 	shl_dlist_link(&s->groups, &g->list);
 	if (out)
 		*out = g;
@@ -619,8 +924,8 @@ static void supplicant_peer_drop_group(struct supplicant_peer *sp)
 
 	free(sp->remote_addr);
 	sp->remote_addr = NULL;
-	free(sp->sta_mac);
-	sp->sta_mac = NULL;
+	sp->eapol = false;
+	peer_set_sta_mac(sp->p, 0);
 
 	peer_supplicant_connected_changed(sp->p, false);
 }
@@ -665,11 +970,16 @@ static void supplicant_peer_free(struct supplicant_peer *sp)
 		peer_supplicant_formation_failure(sp->p, "lost");
 	}
 
+	if (sp->query_cookie) {
+		wpas_call_async_cancel(sp->s->bus_global, sp->query_cookie);
+		++sp->s->query_tokens;
+	}
+
 	supplicant_peer_drop_group(sp);
 	peer_supplicant_stopped(sp->p);
 	peer_free(sp->p);
 
-	free(sp->sta_mac);
+	free(sp->wfd_dev_info);
 	free(sp->remote_addr);
 	free(sp->pin);
 	free(sp->prov);
@@ -823,12 +1133,31 @@ void supplicant_peer_disconnect(struct supplicant_peer *sp)
  * schedule a restart.
  */
 
+/* update a cached peer property and notify only if it really changed */
+static void supplicant_peer_update(struct supplicant_peer *sp,
+				   char **prop,
+				   const char *val,
+				   void (*changed) (struct peer *p))
+{
+	char *t;
+
+	if (*prop && !strcmp(*prop, val))
+		return;
+
+	t = strdup(val);
+	if (!t)
+		return log_vENOMEM();
+
+	free(*prop);
+	*prop = t;
+	changed(sp->p);
+}
+
 static void supplicant_parse_peer(struct supplicant *s,
 				  struct wpas_message *m)
 {
 	struct supplicant_peer *sp;
 	const char *mac, *name, *val;
-	char *t;
 	int r;
 
 	r = wpas_message_read(m, "s", &mac);
@@ -851,14 +1180,10 @@ static void supplicant_parse_peer(struct supplicant *s,
 	if (r < 0)
 		r = wpas_message_dict_read(m, "name", 's', &name);
 	if (r >= 0) {
-		t = strdup(name);
-		if (!t) {
-			log_vENOMEM();
-		} else {
-			free(sp->friendly_name);
-			sp->friendly_name = t;
-			peer_supplicant_friendly_name_changed(sp->p);
-		}
+		supplicant_peer_update(sp,
+				       &sp->friendly_name,
+				       name,
+				       peer_supplicant_friendly_name_changed);
 	} else {
 		log_debug("no device-name in P2P_PEER information: %s",
 			  wpas_message_get_raw(m));
@@ -866,14 +1191,10 @@ static void supplicant_parse_peer(struct supplicant *s,
 
 	r = wpas_message_dict_read(m, "wfd_subelems", 's', &val);
 	if (r >= 0) {
-		t = strdup(val);
-		if (!t) {
-			log_vENOMEM();
-		} else {
-			free(sp->wfd_subelements);
-			sp->wfd_subelements = t;
-			peer_supplicant_wfd_subelements_changed(sp->p);
-		}
+		supplicant_peer_update(sp,
+				       &sp->wfd_subelements,
+				       val,
+				       peer_supplicant_wfd_subelements_changed);
 	} else {
 		/* TODO: wfd_dev_info only contains the dev-info sub-elem,
 		 * while wfd_sublemens contains all. Fix that! The user has no
@@ -886,16 +1207,12 @@ static void supplicant_parse_peer(struct supplicant *s,
 			 * subelement ID and lenght to it to make it compliant
 			 * with the format of wfd_subelems */
 			char buf[19] = "000006";
-			t = strdup(strncmp("0x", val, 2)
+			supplicant_peer_update(sp,
+					       &sp->wfd_subelements,
+					       strncmp("0x", val, 2)
 							? val
-							: strncat(buf, val + 2, sizeof(buf) - 7));
-			if (!t) {
-				log_vENOMEM();
-			} else {
-				free(sp->wfd_subelements);
-				sp->wfd_subelements = t;
-				peer_supplicant_wfd_subelements_changed(sp->p);
-			}
+							: strncat(buf, val + 2, sizeof(buf) - 7),
+					       peer_supplicant_wfd_subelements_changed);
 		}
 	}
 
@@ -914,39 +1231,69 @@ static void supplicant_event_p2p_find_stopped(struct supplicant *s,
 	link_supplicant_p2p_scan_changed(s->l, false);
 }
 
+/*
+ * Every scan cycle re-reports all peers around via P2P-DEVICE-FOUND. Instead
+ * of asking for a full P2P_PEER report each time, a peer is only queried if
+ * we have no recent report or its advertised name or WFD info changed. At
+ * most one query per peer is in flight, and all queries of a link share a
+ * bucket of SUPPLICANT_PEER_TOKENS outstanding requests plus a rate-limit.
+ * Throttled peers keep their stale state and are retried once re-reported.
+ */
+
 static int supplicant_p2p_peer_fn(struct wpas *w,
 				  struct wpas_message *reply,
 				  void *data)
 {
-	struct supplicant *s = data;
+	struct supplicant_peer *sp = data;
+	struct supplicant *s = sp->s;
+
+	sp->query_cookie = 0;
+	++s->query_tokens;
 
 	if (wpas_message_is_fail(reply))
 		return 0;
 
+	sp->query_time = shl_now(CLOCK_MONOTONIC);
 	supplicant_parse_peer(s, reply);
 	return 0;
 }
 
-static void supplicant_event_p2p_device_found(struct supplicant *s,
-					      struct wpas_message *ev)
+static bool supplicant_peer_is_current(struct supplicant_peer *sp,
+				       struct wpas_message *ev)
+{
+	const char *name = NULL, *info = NULL;
+
+	if (!sp->query_time ||
+	    sp->query_time + SUPPLICANT_PEER_REFRESH < shl_now(CLOCK_MONOTONIC))
+		return false;
+
+	wpas_message_dict_read(ev, "name", 's', &name);
+	if (name && (!sp->friendly_name || strcmp(name, sp->friendly_name)))
+		return false;
+
+	wpas_message_dict_read(ev, "wfd_dev_info", 's', &info);
+	if (!info != !sp->wfd_dev_info ||
+	    (info && strcmp(info, sp->wfd_dev_info)))
+		return false;
+
+	return true;
+}
+
+static void supplicant_peer_query(struct supplicant_peer *sp)
 {
 	_wpas_message_unref_ struct wpas_message *m = NULL;
-	const char *mac;
+	struct supplicant *s = sp->s;
 	int r;
 
-	/*
-	 * The P2P-DEVICE-FOUND event is quite small. Request a full
-	 * peer-report.
-	 */
-
-	r = wpas_message_dict_read(ev, "p2p_dev_addr", 's', &mac);
-	if (r < 0) {
-		log_debug("no p2p_dev_addr in P2P-DEVICE-FOUND: %s",
-			  wpas_message_get_raw(ev));
+	if (sp->query_cookie) {
+		++s->query_stats.deduped;
 		return;
 	}
 
-	supplicant_parse_peer(s, ev);
+	if (!s->query_tokens || !shl_ratelimit_test(&s->query_rate)) {
+		++s->query_stats.throttled;
+		return;
+	}
 
 	r = wpas_message_new_request(s->bus_global,
 				     "P2P_PEER",
@@ -954,25 +1301,72 @@ static void supplicant_event_p2p_device_found(struct supplicant *s,
 	if (r < 0)
 		goto error;
 
-	r = wpas_message_append(m, "s", mac);
+	r = wpas_message_append(m, "s", sp->p->p2p_mac);
 	if (r < 0)
 		goto error;
 
 	r = wpas_call_async(s->bus_global,
 			    m,
 			    supplicant_p2p_peer_fn,
-			    s,
+			    sp,
 			    0,
-			    NULL);
+			    &sp->query_cookie);
 	if (r < 0)
 		goto error;
 
-	log_debug("requesting data for new peer %s", mac);
+	--s->query_tokens;
+	++s->query_stats.issued;
+	log_debug("requesting data for new peer %s", sp->p->p2p_mac);
 	return;
 
 error:
 	log_warning("cannot retrieve peer information from wpas for %s",
-		    mac);
+		    sp->p->p2p_mac);
+}
+
+static void supplicant_event_p2p_device_found(struct supplicant *s,
+					      struct wpas_message *ev)
+{
+	struct supplicant_peer *sp;
+	const char *mac, *info = NULL;
+	bool current;
+	int r;
+
+	/*
+	 * The P2P-DEVICE-FOUND event is quite small. Request a full
+	 * peer-report unless the cached one is still current.
+	 */
+
+	r = wpas_message_dict_read(ev, "p2p_dev_addr", 's', &mac);
+	if (r < 0) {
+		log_debug("no p2p_dev_addr in P2P-DEVICE-FOUND: %s",
+			  wpas_message_get_raw(ev));
+		return;
+	}
+
+	sp = find_peer_by_p2p_mac(s, mac);
+	current = sp && supplicant_peer_is_current(sp, ev);
+
+	supplicant_parse_peer(s, ev);
+
+	sp = find_peer_by_p2p_mac(s, mac);
+	if (!sp)
+		return;
+
+	/* on ENOMEM, the next report simply doesn't match and re-queries */
+	wpas_message_dict_read(ev, "wfd_dev_info", 's', &info);
+	if (!info != !sp->wfd_dev_info ||
+	    (info && strcmp(info, sp->wfd_dev_info))) {
+		free(sp->wfd_dev_info);
+		sp->wfd_dev_info = info ? strdup(info) : NULL;
+	}
+
+	if (current) {
+		++s->query_stats.cached;
+		return;
+	}
+
+	supplicant_peer_query(sp);
 }
 
 static void supplicant_event_p2p_device_lost(struct supplicant *s,
@@ -1164,7 +1558,8 @@ static void supplicant_event_p2p_go_neg_success(struct supplicant *s,
 {
 	struct supplicant_peer *sp;
 	const char *mac, *sta;
-	char *t;
+	char old[MAC_STRLEN];
+	uint64_t sta_mac;
 	int r;
 
 	r = wpas_message_dict_read(ev, "peer_dev", 's', &mac);
@@ -1194,16 +1589,18 @@ static void supplicant_event_p2p_go_neg_success(struct supplicant *s,
 		return;
 	}
 
-	if (!sp->sta_mac || strcmp(sp->sta_mac, sta)) {
-		t = strdup(sta);
-		if (!t)
-			return log_vENOMEM();
+	if (parse_mac(&sta_mac, sta) < 0) {
+		log_debug("invalid peer_iface in P2P-GO-NEG-SUCCESS: %s",
+			  wpas_message_get_raw(ev));
+		return;
+	}
 
+	if (sp->p->sta_mac != sta_mac) {
+		format_mac(old, sp->p->sta_mac);
 		log_debug("set STA-MAC for %s from %s to %s (via GO-NEG-SUCCESS)",
-			  mac, sp->sta_mac ? : "<none>", sta);
+			  mac, sp->p->sta_mac ? old : "<none>", sta);
 
-		free(sp->sta_mac);
-		sp->sta_mac = t;
+		peer_set_sta_mac(sp->p, sta_mac);
 	}
 }
 
@@ -1213,6 +1610,7 @@ static void supplicant_event_p2p_group_started(struct supplicant *s,
 	struct supplicant_peer *sp;
 	struct supplicant_group *g;
 	const char *mac, *ssid, *ifname, *go;
+	const char *ip_addr = NULL, *ip_mask = NULL, *go_ip_addr = NULL;
 	bool is_go;
 	int r;
 
@@ -1244,6 +1642,13 @@ static void supplicant_event_p2p_group_started(struct supplicant *s,
 
 	is_go = !strcmp(go, "GO");
 
+	/* only set if the GO assigned us an address, see --eapol-ip */
+	if (!is_go) {
+		wpas_message_dict_read(ev, "ip_addr", 's', &ip_addr);
+		wpas_message_dict_read(ev, "ip_mask", 's', &ip_mask);
+		wpas_message_dict_read(ev, "go_ip_addr", 's', &go_ip_addr);
+	}
+
 	sp = find_peer_by_p2p_mac(s, mac);
 	if (!sp) {
 		if (!s->p2p_mac || strcmp(s->p2p_mac, mac)) {
@@ -1255,7 +1660,8 @@ static void supplicant_event_p2p_group_started(struct supplicant *s,
 
 	g = find_group_by_ifname(s, ifname);
 	if (!g) {
-		r = supplicant_group_new(s, &g, ifname, is_go);
+		r = supplicant_group_new(s, &g, ifname, is_go, mac,
+					 ip_addr, ip_mask);
 		if (r < 0)
 			return;
 
@@ -1271,6 +1677,12 @@ static void supplicant_event_p2p_group_started(struct supplicant *s,
 		g->sp = sp;
 	}
 
+	/* with EAPOL addresses we know the GO's address right away */
+	if (g->eapol && go_ip_addr) {
+		supplicant_group_set_gateway(g, go_ip_addr);
+		supplicant_group_check_connected(g);
+	}
+
 	/* TODO: For local-groups, we should schedule some timer so the
 	 * group gets removed in case the remote side never connects. */
 }
@@ -1336,8 +1748,9 @@ static void supplicant_event_ap_sta_connected(struct supplicant *s,
 {
 	struct supplicant_peer *sp;
 	struct supplicant_group *g;
-	const char *sta_mac, *p2p_mac, *ifname;
-	char *t;
+	const char *sta_mac, *p2p_mac, *ifname, *ip_addr;
+	char old[MAC_STRLEN];
+	uint64_t sta;
 	int r;
 
 	r = wpas_message_dict_read(ev, "p2p_dev_addr", 's', &p2p_mac);
@@ -1367,16 +1780,18 @@ static void supplicant_event_ap_sta_connected(struct supplicant *s,
 		return;
 	}
 
-	if (!sp->sta_mac || strcmp(sp->sta_mac, sta_mac)) {
-		t = strdup(sta_mac);
-		if (!t)
-			return log_vENOMEM();
+	if (parse_mac(&sta, sta_mac) < 0) {
+		log_debug("invalid station-mac in AP-STA-CONNECTED: %s",
+			  wpas_message_get_raw(ev));
+		return;
+	}
 
+	if (sp->p->sta_mac != sta) {
+		format_mac(old, sp->p->sta_mac);
 		log_debug("set STA-MAC for %s from %s to %s (via AP-STA-CONNECTED)",
-			  p2p_mac, sp->sta_mac ? : "<none>", sta_mac);
+			  p2p_mac, sp->p->sta_mac ? old : "<none>", sta_mac);
 
-		free(sp->sta_mac);
-		sp->sta_mac = t;
+		peer_set_sta_mac(sp->p, sta);
 	}
 
 	ifname = wpas_message_get_ifname(ev);
@@ -1395,6 +1810,22 @@ static void supplicant_event_ap_sta_connected(struct supplicant *s,
 
 	log_debug("bind peer %s to existing local group %s", p2p_mac, ifname);
 	supplicant_peer_set_group(sp, g);
+
+	/*
+	 * We assigned the address during EAPOL, the peer won't do DHCP. Only
+	 * the GO on the EAPOL subnet has wpas hand out addresses that work.
+	 */
+	r = wpas_message_dict_read(ev, "ip_addr", 's', &ip_addr);
+	if (r >= 0 && g->subnet != SUPPLICANT_EAPOL_SUBNET) {
+		log_warning("ignoring EAPOL address %s of peer %s outside of the EAPOL subnet on %s",
+			    ip_addr, p2p_mac, ifname);
+	} else if (r >= 0) {
+		log_debug("peer %s got %s via EAPOL", p2p_mac, ip_addr);
+		sp->eapol = true;
+		/* not a DHCP lease, so nothing to cache */
+		supplicant_group_set_remote(g, sta_mac, ip_addr, 0);
+		supplicant_group_check_connected(g);
+	}
 }
 
 static void supplicant_event_ap_sta_disconnected(struct supplicant *s,
@@ -1430,87 +1861,108 @@ static void supplicant_event_ap_sta_disconnected(struct supplicant *s,
 	supplicant_peer_drop_group(sp);
 }
 
-static void supplicant_event(struct supplicant *s, struct wpas_message *m)
-{
+typedef void (*supplicant_event_fn) (struct supplicant *s,
+				     struct wpas_message *m);
+
+struct supplicant_event_handler {
 	const char *name;
+	supplicant_event_fn fn;		/* NULL for ignored events */
+};
 
-	if (wpas_message_is_event(m, NULL)) {
-		name = wpas_message_get_name(m);
-		if (!name) {
-			log_debug("unnamed wpas-event: %s",
-				  wpas_message_get_raw(m));
-			return;
-		}
+/*
+ * Known wpas events, sorted by name (strcmp()). The bus resolves each event
+ * against this table while parsing, so dispatching is a plain array lookup.
+ * Events with no handler are known noise and dropped silently.
+ */
+static const struct supplicant_event_handler supplicant_events[] = {
+	{ "AP-ENABLED", NULL },
+	{ "AP-STA-CONNECTED", supplicant_event_ap_sta_connected },
+	{ "AP-STA-DISCONNECTED", supplicant_event_ap_sta_disconnected },
+	{ "Associated", NULL },
+	{ "CTRL-EVENT-BSS-ADDED", NULL },
+	{ "CTRL-EVENT-BSS-REMOVED", NULL },
+	{ "CTRL-EVENT-CONNECTED", NULL },
+	{ "CTRL-EVENT-DISCONNECTED", NULL },
+	{ "CTRL-EVENT-EAP-FAILURE", NULL },
+	{ "CTRL-EVENT-EAP-METHOD", NULL },
+	{ "CTRL-EVENT-EAP-PROPOSED-METHOD", NULL },
+	{ "CTRL-EVENT-EAP-STARTED", NULL },
+	{ "CTRL-EVENT-EAP-STATUS", NULL },
+	{ "CTRL-EVENT-SCAN-RESULTS", NULL },
+	{ "CTRL-EVENT-SCAN-STARTED", NULL },
+	{ "No network configuration found for the current AP", NULL },
+	{ "P2P-DEVICE-FOUND", supplicant_event_p2p_device_found },
+	{ "P2P-DEVICE-LOST", supplicant_event_p2p_device_lost },
+	{ "P2P-FIND-STOPPED", supplicant_event_p2p_find_stopped },
+	{ "P2P-GO-NEG-FAILURE", supplicant_event_p2p_go_neg_failure },
+	{ "P2P-GO-NEG-REQUEST", supplicant_event_p2p_go_neg_request },
+	{ "P2P-GO-NEG-SUCCESS", supplicant_event_p2p_go_neg_success },
+	{ "P2P-GROUP-FORMATION-FAILURE", supplicant_event_p2p_group_formation_failure },
+	{ "P2P-GROUP-FORMATION-SUCCESS", NULL },
+	{ "P2P-GROUP-REMOVED", supplicant_event_p2p_group_removed },
+	{ "P2P-GROUP-STARTED", supplicant_event_p2p_group_started },
+	{ "P2P-PROV-DISC-ENTER-PIN", supplicant_event_p2p_prov_disc_enter_pin },
+	{ "P2P-PROV-DISC-PBC-REQ", supplicant_event_p2p_prov_disc_pbc_req },
+	{ "P2P-PROV-DISC-SHOW-PIN", supplicant_event_p2p_prov_disc_show_pin },
+	{ "SME:", NULL },
+	{ "Trying", NULL },
+	{ "WPA:", NULL },
+	{ "WPS-AP-AVAILABLE", NULL },
+	{ "WPS-AP-AVAILABLE-AUTH", NULL },
+	{ "WPS-AP-AVAILABLE-PBC", NULL },
+	{ "WPS-AP-AVAILABLE-PIN", NULL },
+	{ "WPS-CRED-RECEIVED", NULL },
+	{ "WPS-ENROLLEE-SEEN", NULL },
+	{ "WPS-PBC-ACTIVE", NULL },
+	{ "WPS-PBC-DISABLE", NULL },
+	{ "WPS-REG-SUCCESS", NULL },
+	{ "WPS-SUCCESS", NULL },
+};
 
-		/* ignored events */
-		if (!strcmp(name, "CTRL-EVENT-SCAN-STARTED") ||
-		    !strcmp(name, "CTRL-EVENT-SCAN-RESULTS") ||
-		    !strcmp(name, "CTRL-EVENT-EAP-STARTED") ||
-		    !strcmp(name, "CTRL-EVENT-EAP-PROPOSED-METHOD") ||
-		    !strcmp(name, "CTRL-EVENT-EAP-FAILURE") ||
-		    !strcmp(name, "CTRL-EVENT-BSS-REMOVED") ||
-		    !strcmp(name, "CTRL-EVENT-BSS-ADDED") ||
-		    !strcmp(name, "CTRL-EVENT-CONNECTED") ||
-		    !strcmp(name, "CTRL-EVENT-DISCONNECTED") ||
-		    !strcmp(name, "WPS-PBC-ACTIVE") ||
-		    !strcmp(name, "WPS-PBC-DISABLE") ||
-		    !strcmp(name, "WPS-AP-AVAILABLE-PBC") ||
-		    !strcmp(name, "WPS-AP-AVAILABLE-AUTH") ||
-		    !strcmp(name, "WPS-AP-AVAILABLE-PIN") ||
-		    !strcmp(name, "CTRL-EVENT-EAP-STATUS") ||
-		    !strcmp(name, "CTRL-EVENT-EAP-METHOD") ||
-		    !strcmp(name, "CTRL-EVENT-EAP-STATUS") ||
-		    !strcmp(name, "WPS-CRED-RECEIVED") ||
-		    !strcmp(name, "WPS-AP-AVAILABLE") ||
-		    !strcmp(name, "WPS-REG-SUCCESS") ||
-		    !strcmp(name, "WPS-SUCCESS") ||
-		    !strcmp(name, "WPS-ENROLLEE-SEEN") ||
-		    !strcmp(name, "P2P-GROUP-FORMATION-SUCCESS") ||
-		    !strcmp(name, "AP-ENABLED") ||
-		    !strcmp(name, "SME:") ||
-		    !strcmp(name, "WPA:") ||
-		    !strcmp(name, "Trying") ||
-		    !strcmp(name, "No network configuration found for the current AP") ||
-		    !strcmp(name, "Associated"))
-			return;
+static int supplicant_set_event_table(struct wpas *w)
+{
+	return wpas_set_event_table(w,
+				    supplicant_events,
+				    SHL_ARRAY_LENGTH(supplicant_events),
+				    sizeof(*supplicant_events));
+}
 
-		if (!strcmp(name, "P2P-FIND-STOPPED"))
-			supplicant_event_p2p_find_stopped(s, m);
-		else if (!strcmp(name, "P2P-DEVICE-FOUND"))
-			supplicant_event_p2p_device_found(s, m);
-		else if (!strcmp(name, "P2P-DEVICE-LOST"))
-			supplicant_event_p2p_device_lost(s, m);
-		else if (!strcmp(name, "P2P-PROV-DISC-PBC-REQ"))
-			supplicant_event_p2p_prov_disc_pbc_req(s, m);
-		else if (!strcmp(name, "P2P-PROV-DISC-SHOW-PIN"))
-			supplicant_event_p2p_prov_disc_show_pin(s, m);
-		else if (!strcmp(name, "P2P-PROV-DISC-ENTER-PIN"))
-			supplicant_event_p2p_prov_disc_enter_pin(s, m);
-		else if (!strcmp(name, "P2P-GO-NEG-SUCCESS"))
-			supplicant_event_p2p_go_neg_success(s, m);
-		else if (!strcmp(name, "P2P-GO-NEG-REQUEST"))
-			supplicant_event_p2p_go_neg_request(s, m);
-		else if (!strcmp(name, "P2P-GROUP-STARTED"))
-			supplicant_event_p2p_group_started(s, m);
-		else if (!strcmp(name, "P2P-GROUP-REMOVED"))
-			supplicant_event_p2p_group_removed(s, m);
-		else if (!strcmp(name, "P2P-GO-NEG-FAILURE"))
-			supplicant_event_p2p_go_neg_failure(s, m);
-		else if (!strcmp(name, "P2P-GROUP-FORMATION-FAILURE"))
-			supplicant_event_p2p_group_formation_failure(s, m);
-		else if (!strcmp(name, "AP-STA-CONNECTED"))
-			supplicant_event_ap_sta_connected(s, m);
-		else if (!strcmp(name, "AP-STA-DISCONNECTED"))
-			supplicant_event_ap_sta_disconnected(s, m);
-		else
+static void supplicant_event(struct supplicant *s, struct wpas_message *m)
+{
+	unsigned int id;
+
+	if (wpas_message_is_event(m, NULL)) {
+		id = wpas_message_get_event_id(m);
+		if (id) {
+			if (supplicant_events[id - 1].fn)
+				supplicant_events[id - 1].fn(s, m);
+		} else if (!wpas_message_get_name(m)) {
+			log_debug("unnamed wpas-event: %s",
+				  wpas_message_get_raw(m));
+		} else {
 			log_debug("unhandled wpas-event: %s",
 				  wpas_message_get_raw(m));
+		}
 	} else {
 		log_debug("unhandled wpas-message: %s",
 			  wpas_message_get_raw(m));
 	}
 }
 
+static void supplicant_ready_latency(struct supplicant *s, uint64_t usec)
+{
+	struct supplicant_ready_stats *st = &s->ready_stats;
+
+	++st->count;
+	st->last = usec;
+	st->total += usec;
+	if (usec > st->max)
+		st->max = usec;
+
+	log_info("wpas of %s ready %" PRIu64 "ms after exec",
+		 s->l->ifname, usec / 1000);
+}
+
 static void supplicant_try_ready(struct supplicant *s)
 {
 	struct peer *p;
@@ -1527,6 +1979,12 @@ static void supplicant_try_ready(struct supplicant *s)
 
 	s->running = true;
 
+	if (s->exec_time) {
+		supplicant_ready_latency(s, shl_now(CLOCK_MONOTONIC) -
+					    s->exec_time);
+		s->exec_time = 0;
+	}
+
 	LINK_FOREACH_PEER(p, s->l)
 		peer_supplicant_started(p);
 
@@ -1557,6 +2015,7 @@ static int supplicant_init_p2p_peer_fn(struct wpas *w,
 	_wpas_message_unref_ struct wpas_message *m = NULL;
 	_shl_free_ char *next = NULL;
 	struct supplicant *s = data;
+	struct supplicant_peer *sp;
 	const char *mac;
 	int r;
 
@@ -1582,6 +2041,11 @@ static int supplicant_init_p2p_peer_fn(struct wpas *w,
 		wpas_message_rewind(reply);
 		supplicant_parse_peer(s, reply);
 
+		/* this is a full report, no need to query it again */
+		sp = find_peer_by_p2p_mac(s, mac);
+		if (sp)
+			sp->query_time = shl_now(CLOCK_MONOTONIC);
+
 		r = wpas_message_new_request(s->bus_global,
 					     "P2P_PEER",
 					     &m);
@@ -1856,6 +2320,42 @@ error:
 	return 0;
 }
 
+/*
+ * An adopted wpas may still run P2P operations on behalf of a previous wifid
+ * instance. Its peer table is kept (and picked up by the P2P_PEER listing
+ * during setup), but scans and groups are reset as their owners are gone.
+ */
+static void supplicant_reset_p2p(struct supplicant *s)
+{
+	static const char *cmds[][2] = {
+		{ "P2P_STOP_FIND", NULL },
+		{ "P2P_GROUP_REMOVE", "*" },
+	};
+	struct wpas_message *m;
+	size_t i;
+	int r;
+
+	log_debug("reset P2P state of adopted wpas on %s", s->l->ifname);
+
+	for (i = 0; i < SHL_ARRAY_LENGTH(cmds); ++i) {
+		r = wpas_message_new_request(s->bus_global, cmds[i][0], &m);
+		if (r < 0) {
+			log_vERR(r);
+			continue;
+		}
+
+		if (cmds[i][1])
+			r = wpas_message_append(m, "s", cmds[i][1]);
+		if (r >= 0)
+			r = wpas_call_async(s->bus_global,
+					    m, NULL, NULL, 0, NULL);
+		if (r < 0)
+			log_vERR(r);
+
+		wpas_message_unref(m);
+	}
+}
+
 static void supplicant_started(struct supplicant *s)
 {
 	_wpas_message_unref_ struct wpas_message *m = NULL;
@@ -1863,6 +2363,8 @@ static void supplicant_started(struct supplicant *s)
 
 	/* clear left-overs from previous runs */
 	s->p2p_scanning = false;
+	if (s->adopted)
+		supplicant_reset_p2p(s);
 
 	/* require STATUS response */
 	++s->setup_cnt;
@@ -2127,12 +2629,16 @@ int supplicant_new(struct link *l,
 
 	s->l = l;
 	s->pid = -1;
+	s->pidfd = -1;
 	shl_dlist_init(&s->groups);
 
 	/* allow 2 restarts in 10s */
 	SHL_RATELIMIT_INIT(s->restart_rate, 10 * 1000ULL * 1000ULL, 2);
 	/* allow 3 execs in 10s */
 	SHL_RATELIMIT_INIT(s->exec_rate, 10 * 1000ULL * 1000ULL, 3);
+	/* allow 16 P2P_PEER queries per second */
+	SHL_RATELIMIT_INIT(s->query_rate, 1000ULL * 1000ULL, 16);
+	s->query_tokens = SUPPLICANT_PEER_TOKENS;
 
 	if (out)
 		*out = s;
@@ -2148,6 +2654,7 @@ void supplicant_free(struct supplicant *s)
 	log_debug("free supplicant of %s", s->l->ifname);
 
 	supplicant_stop(s);
+	supplicant_unwatch_child(s);
 	free(s);
 }
 
@@ -2241,6 +2748,10 @@ static int supplicant_global_attach_fn(struct wpas *w,
 
 	r = wpas_open(s->dev_ctrl, &s->bus_dev);
 	if (r >= 0) {
+		r = supplicant_set_event_table(s->bus_dev);
+		if (r < 0)
+			goto error;
+
 		r = wpas_attach_event(s->bus_dev, s->l->m->event, 0);
 		if (r < 0)
 			goto error;
@@ -2289,11 +2800,15 @@ static int supplicant_open(struct supplicant *s)
 
 	r = wpas_open(s->global_ctrl, &s->bus_global);
 	if (r < 0) {
-		if (r != -ENOENT && r != ECONNREFUSED)
+		if (r != -ENOENT && r != -ECONNREFUSED)
 			log_error("cannot connect to wpas: %d", r);
 		return r;
 	}
 
+	r = supplicant_set_event_table(s->bus_global);
+	if (r < 0)
+		goto error;
+
 	r = wpas_attach_event(s->bus_global, s->l->m->event, 0);
 	if (r < 0)
 		goto error;
@@ -2324,10 +2839,28 @@ error:
 	return r;
 }
 
+static void supplicant_log_stats(struct supplicant *s,
+				 const char *name,
+				 struct wpas *bus)
+{
+	struct wpas_stats st;
+
+	if (!bus)
+		return;
+
+	wpas_get_stats(bus, &st);
+	log_debug("%s bus of %s: %" PRIu64 " messages in %" PRIu64 " wakeups, max batch %" PRIu64 " (%" PRIu64 " full)",
+		  name, s->l->ifname, st.messages, st.wakeups,
+		  st.batch_max, st.batch_full);
+}
+
 static void supplicant_close(struct supplicant *s)
 {
 	log_debug("close supplicant of %s", s->l->ifname);
 
+	supplicant_log_stats(s, "global", s->bus_global);
+	supplicant_log_stats(s, "dev", s->bus_dev);
+
 	wpas_remove_match(s->bus_dev, supplicant_dev_fn, s);
 	wpas_detach_event(s->bus_dev);
 	wpas_unref(s->bus_dev);
@@ -2337,6 +2870,34 @@ static void supplicant_close(struct supplicant *s)
 	wpas_detach_event(s->bus_global);
 	wpas_unref(s->bus_global);
 	s->bus_global = NULL;
+
+	log_debug("wpas of %s: %" PRIu64 " ready, %" PRIu64 "ms avg, %" PRIu64 "ms max after exec, %" PRIu64 " via inotify, %" PRIu64 " via timer, %" PRIu64 " adopted",
+		  s->l->ifname, s->ready_stats.count,
+		  s->ready_stats.total / (s->ready_stats.count ? : 1) / 1000,
+		  s->ready_stats.max / 1000, s->ready_stats.watched,
+		  s->ready_stats.polled, s->ready_stats.adopted);
+
+	log_debug("P2P_PEER queries of %s: %" PRIu64 " issued, %" PRIu64 " cached, %" PRIu64 " deduped, %" PRIu64 " throttled",
+		  s->l->ifname, s->query_stats.issued, s->query_stats.cached,
+		  s->query_stats.deduped, s->query_stats.throttled);
+
+	if (s->dhcp_stats.count)
+		log_debug("groups of %s: %" PRIu64 " connected, %" PRIu64 "ms avg, %" PRIu64 "ms max after start, %" PRIu64 " via external DHCP, %" PRIu64 " via EAPOL",
+			  s->l->ifname, s->dhcp_stats.count,
+			  s->dhcp_stats.total / s->dhcp_stats.count / 1000,
+			  s->dhcp_stats.max / 1000, s->dhcp_stats.external,
+			  s->dhcp_stats.eapol);
+}
+
+static void supplicant_unwatch_child(struct supplicant *s)
+{
+	sd_event_source_unref(s->child_source);
+	s->child_source = NULL;
+
+	if (s->pidfd >= 0) {
+		close(s->pidfd);
+		s->pidfd = -1;
+	}
 }
 
 static void supplicant_failed(struct supplicant *s)
@@ -2372,24 +2933,60 @@ static void supplicant_failed(struct supplicant *s)
 	}
 
 	s->pid = 0;
-	sd_event_source_unref(s->child_source);
-	s->child_source = NULL;
+	supplicant_unwatch_child(s);
 
 	supplicant_close(s);
 	supplicant_stopped(s);
 }
 
+static void supplicant_exited(struct supplicant *s)
+{
+	if (s->pid < 0) {
+		/* left running by supplicant_stop(), nothing to relaunch */
+		log_info("wpas left running on %s exited", s->l->ifname);
+		supplicant_unwatch_child(s);
+	} else {
+		supplicant_failed(s);
+	}
+}
+
 static int supplicant_child_fn(sd_event_source *source,
 			       const siginfo_t *si,
 			       void *data)
 {
 	struct supplicant *s = data;
 
-	supplicant_failed(s);
+	/* sd-event reaps the child once we return */
+	supplicant_exited(s);
+
+	return 0;
+}
+
+static int supplicant_pidfd_fn(sd_event_source *source,
+			       int fd,
+			       uint32_t mask,
+			       void *data)
+{
+	struct supplicant *s = data;
+
+	/* pidfds become readable once the process exited */
+	supplicant_exited(s);
 
 	return 0;
 }
 
+static int supplicant_pidfd_open(pid_t pid)
+{
+#ifdef __NR_pidfd_open
+	int fd;
+
+	fd = syscall(__NR_pidfd_open, pid, 0);
+	return fd < 0 ? -errno : fd;
+#else
+	return -ENOSYS;
+#endif
+}
+
 static void supplicant_run(struct supplicant *s, const char *binary)
 {
 	char *argv[64], journal_id[128];
@@ -2483,6 +3080,74 @@ end:
 	return -EINVAL;
 }
 
+static void supplicant_write_pid(struct supplicant *s)
+{
+	FILE *f;
+
+	f = fopen(s->pid_path, "we");
+	if (!f) {
+		log_warning("cannot write %s: %m", s->pid_path);
+		return;
+	}
+
+	fprintf(f, "%d\n", (int)s->pid);
+	fclose(f);
+}
+
+static int supplicant_write_config(struct supplicant *s)
+{
+	_shl_free_ char *path = NULL;
+	FILE *f;
+	int r;
+
+	r = asprintf(&path, "/run/miracle/wifi/%s-%u.conf",
+		     s->l->ifname, s->l->ifindex);
+	if (r < 0)
+		return log_ENOMEM();
+
+	f = fopen(path, "we");
+	if (!f)
+		return log_ERRNO();
+
+	r = fprintf(f,
+		    "# Generated configuration - DO NOT EDIT!\n"
+		    "device_name=%s\n"
+		    "device_type=%s\n"
+		    "config_methods=%s\n"
+		    "driver_param=%s\n"
+		    "ap_scan=%s\n",
+		    s->l->friendly_name ? : "unknown",
+		    "1-0050F204-1",
+		    "pbc",
+		    //"pbc keypad pin display",
+		    "p2p_device=1",
+		    "1");
+	if (r >= 0 && arg_eapol_ip) {
+		/* as GO, hand out .2-.99 during EAPOL, DHCP uses .100-.199 */
+		r = fprintf(f,
+			    "ip_addr_go=192.168.%u.1\n"
+			    "ip_addr_mask=255.255.255.0\n"
+			    "ip_addr_start=192.168.%u.2\n"
+			    "ip_addr_end=192.168.%u.99\n",
+			    SUPPLICANT_EAPOL_SUBNET, SUPPLICANT_EAPOL_SUBNET,
+			    SUPPLICANT_EAPOL_SUBNET);
+	}
+	if (r >= 0)
+		r = fprintf(f, "# End of configuration\n");
+	if (r < 0) {
+		r = log_ERRNO();
+		fclose(f);
+		return r;
+	}
+
+	fclose(f);
+	free(s->conf_path);
+	s->conf_path = path;
+	path = NULL;
+
+	return 0;
+}
+
 static int supplicant_spawn(struct supplicant *s)
 {
 	_shl_free_ char *binary = NULL;
@@ -2503,6 +3168,11 @@ static int supplicant_spawn(struct supplicant *s)
 
 	log_info("wpa_supplicant found: %s", binary);
 
+	/* an adopted wpas keeps the config it was started with */
+	r = supplicant_write_config(s);
+	if (r < 0)
+		return r;
+
 	pid = fork();
 	if (pid < 0) {
 		return log_ERRNO();
@@ -2513,10 +3183,15 @@ static int supplicant_spawn(struct supplicant *s)
 
 	s->pid = pid;
 	s->open_cnt = 0;
+	s->exec_time = shl_now(CLOCK_MONOTONIC);
+	s->adopted = false;
 	log_info("wpas spawned as pid:%d", (int)pid);
 
-	sd_event_source_unref(s->child_source);
-	s->child_source = NULL;
+	/* wpas writes no pid-file unless daemonized, remember it ourselves */
+	if (arg_wpa_persist)
+		supplicant_write_pid(s);
+
+	supplicant_unwatch_child(s);
 
 	r = sd_event_add_child(s->l->m->event,
 			       &s->child_source,
@@ -2530,6 +3205,138 @@ static int supplicant_spawn(struct supplicant *s)
 	return 0;
 }
 
+/*
+ * With --wpa-persist, wpas is left running when we stop managing a link (or
+ * exit). On the next start, we look up its pid-file and reuse the instance if
+ * it is still alive and answers on the known ctrl path. This skips the
+ * fork/exec and driver re-initialization entirely.
+ *
+ * If wpas is our own child (the link was stopped and started again), we watch
+ * it via sd_event_add_child() like a spawned one, so it is also reaped. The
+ * child watch is kept across supplicant_stop() for that reason. A wpas left
+ * behind by a previous wifid is not our child; we poll a pidfd to notice its
+ * death instead. Without pidfd support (linux <5.3), a HUP on the ctrl
+ * socket is all that tells us.
+ */
+static int supplicant_adopt(struct supplicant *s)
+{
+	char path[64], comm[32];
+	siginfo_t si = { };
+	unsigned long pid;
+	bool child;
+	FILE *f;
+	int r;
+
+	f = fopen(s->pid_path, "re");
+	if (!f)
+		return -errno;
+
+	r = fscanf(f, "%lu", &pid);
+	fclose(f);
+	if (r != 1 || !pid || pid > INT_MAX)
+		return -EINVAL;
+
+	if (kill((pid_t)pid, 0) < 0)
+		return -errno;
+
+	/* pids get recycled, make sure it's still wpas */
+	sprintf(path, "/proc/%lu/comm", pid);
+	f = fopen(path, "re");
+	if (!f)
+		return -errno;
+
+	if (!fgets(comm, sizeof(comm), f))
+		comm[0] = 0;
+	fclose(f);
+	if (strcmp(comm, "wpa_supplicant\n"))
+		return -ESRCH;
+
+	/* succeeds only for our children; si_pid is set if it is a zombie */
+	child = !waitid(P_PID, (pid_t)pid, &si,
+			WEXITED | WNOHANG | WNOWAIT);
+	if (child && si.si_pid) {
+		waitpid((pid_t)pid, NULL, 0);
+		return -ESRCH;
+	}
+
+	r = supplicant_open(s);
+	if (r < 0) {
+		/* don't let it fight over the iface with a new instance */
+		log_warning("stale wpas pid:%lu on %s, terminating it",
+			    pid, s->l->ifname);
+		kill((pid_t)pid, SIGTERM);
+		if (child)
+			waitpid((pid_t)pid, NULL, 0);
+		return r;
+	}
+
+	supplicant_unwatch_child(s);
+
+	if (child) {
+		r = sd_event_add_child(s->l->m->event,
+				       &s->child_source,
+				       (pid_t)pid,
+				       WEXITED,
+				       supplicant_child_fn,
+				       s);
+	} else {
+		r = supplicant_pidfd_open((pid_t)pid);
+		if (r >= 0) {
+			s->pidfd = r;
+			r = sd_event_add_io(s->l->m->event,
+					    &s->child_source,
+					    s->pidfd,
+					    EPOLLIN,
+					    supplicant_pidfd_fn,
+					    s);
+		}
+	}
+	if (r < 0) {
+		log_warning("cannot watch wpas pid:%lu on %s (%d), relying on ctrl-socket HUP",
+			    pid, s->l->ifname, r);
+		supplicant_unwatch_child(s);
+	}
+
+	s->pid = pid;
+	s->adopted = true;
+	++s->ready_stats.adopted;
+	sd_event_source_set_enabled(s->timer_source, SD_EVENT_OFF);
+
+	log_info("adopted running wpas pid:%d for %s",
+		 (int)s->pid, s->l->ifname);
+	return 0;
+}
+
+/*
+ * Open the control connection unless already done. On success, the startup
+ * timer is no longer needed. @polled tells whether the startup timer or the
+ * ctrl-dir watch triggered this.
+ */
+static int supplicant_try_open(struct supplicant *s, bool polled)
+{
+	int r;
+
+	if (!s->bus_global) {
+		r = supplicant_open(s);
+		if (r < 0)
+			return r;
+
+		if (polled)
+			++s->ready_stats.polled;
+		else
+			++s->ready_stats.watched;
+	}
+
+	sd_event_source_set_enabled(s->timer_source, SD_EVENT_OFF);
+	return 0;
+}
+
+/* poll interval while waiting for the wpas ctrl socket to show up */
+static uint64_t supplicant_open_interval(struct supplicant *s)
+{
+	return s->ctrl_source ? SUPPLICANT_OPEN_FALLBACK : SUPPLICANT_OPEN_POLL;
+}
+
 static int supplicant_timer_fn(sd_event_source *source,
 			       uint64_t usec,
 			       void *data)
@@ -2563,27 +3370,25 @@ static int supplicant_timer_fn(sd_event_source *source,
 			sd_event_source_set_time(source, ms);
 			sd_event_source_set_enabled(source, SD_EVENT_ON);
 		} else {
+			/* startup timer, only a fallback if inotify works */
 			ms = shl_now(CLOCK_MONOTONIC);
-			ms += 200 * 1000ULL; /* 200ms startup timer */
+			ms += supplicant_open_interval(s);
 			sd_event_source_set_time(source, ms);
 			sd_event_source_set_enabled(source, SD_EVENT_ON);
 		}
 	} else if (s->pid > 0 && !s->running) {
-		r = supplicant_open(s);
+		r = supplicant_try_open(s, true);
 		if (r < 0) {
-			/* Cannot connect to supplicant, retry in 200ms
-			 * but increase the timeout for each attempt so
-			 * we lower the rate in case sth goes wrong. */
+			/* Cannot connect to supplicant, retry later but
+			 * increase the timeout for each attempt so we
+			 * lower the rate in case sth goes wrong. */
 			s->open_cnt = shl_min(s->open_cnt + 1, (uint64_t)1000);
-			ms = s->open_cnt * 200 * 1000ULL;
+			ms = s->open_cnt * supplicant_open_interval(s);
 			ms += shl_now(CLOCK_MONOTONIC);
 			sd_event_source_set_time(source, ms);
 			sd_event_source_set_enabled(source, SD_EVENT_ON);
 			if (s->open_cnt == 5)
 				log_warning("still cannot connect to wpas after 5 retries");
-		} else {
-			/* wpas is running smoothly, disable timer */
-			sd_event_source_set_enabled(source, SD_EVENT_OFF);
 		}
 	} else {
 		/* Who armed this timer? What timer is this? */
@@ -2593,45 +3398,99 @@ static int supplicant_timer_fn(sd_event_source *source,
 	return 0;
 }
 
-static int supplicant_write_config(struct supplicant *s)
+/*
+ * Control Directory Watch
+ * wpas binds its global ctrl socket in /run/miracle/wifi during startup. We
+ * watch that directory and open the control connection the moment the socket
+ * shows up, rather than polling for it. Sockets are created before wpas
+ * enters its main-loop, so the ATTACH reply (and thus the p2p-dev-* lookup in
+ * supplicant_global_attach_fn()) still happens after all interfaces are up.
+ * The startup timer stays armed with a longer interval as fallback in case
+ * the watch misses something (or inotify is unavailable).
+ */
+
+static void supplicant_ctrl_unwatch(struct supplicant *s)
 {
-	_shl_free_ char *path = NULL;
-	FILE *f;
-	int r;
+	if (!s->ctrl_source)
+		return;
 
-	r = asprintf(&path, "/run/miracle/wifi/%s-%u.conf",
-		     s->l->ifname, s->l->ifindex);
-	if (r < 0)
-		return log_ENOMEM();
+	close(sd_event_source_get_io_fd(s->ctrl_source));
+	sd_event_source_unref(s->ctrl_source);
+	s->ctrl_source = NULL;
+}
 
-	f = fopen(path, "we");
-	if (!f)
-		return log_ERRNO();
+static int supplicant_ctrl_fn(sd_event_source *source,
+			      int fd,
+			      uint32_t mask,
+			      void *data)
+{
+	struct supplicant *s = data;
+	char buf[sizeof(struct inotify_event) + NAME_MAX + 1]
+		__attribute__((__aligned__(__alignof__(struct inotify_event))));
+	const struct inotify_event *ev;
+	const char *name;
+	bool found = false;
+	ssize_t l;
+	char *pos;
 
-	r = fprintf(f,
-		    "# Generated configuration - DO NOT EDIT!\n"
-		    "device_name=%s\n"
-		    "device_type=%s\n"
-		    "config_methods=%s\n"
-		    "driver_param=%s\n"
-		    "ap_scan=%s\n"
-		    "# End of configuration\n",
-		    s->l->friendly_name ? : "unknown",
-		    "1-0050F204-1",
-		    "pbc",
-		    //"pbc keypad pin display",
-		    "p2p_device=1",
-		    "1");
+	name = strrchr(s->global_ctrl, '/');
+	name = name ? name + 1 : s->global_ctrl;
+
+	for (;;) {
+		l = read(fd, buf, sizeof(buf));
+		if (l < 0) {
+			if (errno == EAGAIN)
+				break;
+			if (errno == EINTR)
+				continue;
+
+			log_warning("cannot read ctrl-dir watch of %s: %m",
+				    s->l->ifname);
+			supplicant_ctrl_unwatch(s);
+			return 0;
+		}
+
+		for (pos = buf; pos < buf + l; pos += sizeof(*ev) + ev->len) {
+			ev = (const struct inotify_event*)pos;
+			if (ev->mask & IN_Q_OVERFLOW)
+				found = true;
+			else if (ev->len && !strcmp(ev->name, name))
+				found = true;
+		}
+	}
+
+	if (found && s->pid > 0 && !s->running)
+		supplicant_try_open(s, false);
+
+	return 0;
+}
+
+static int supplicant_ctrl_watch(struct supplicant *s)
+{
+	int fd, r;
+
+	fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	r = inotify_add_watch(fd, "/run/miracle/wifi",
+			      IN_CREATE | IN_MOVED_TO | IN_ONLYDIR);
 	if (r < 0) {
-		r = log_ERRNO();
-		fclose(f);
+		r = -errno;
+		close(fd);
 		return r;
 	}
 
-	fclose(f);
-	free(s->conf_path);
-	s->conf_path = path;
-	path = NULL;
+	r = sd_event_add_io(s->l->m->event,
+			    &s->ctrl_source,
+			    fd,
+			    EPOLLIN,
+			    supplicant_ctrl_fn,
+			    s);
+	if (r < 0) {
+		close(fd);
+		return r;
+	}
 
 	return 0;
 }
@@ -2664,15 +3523,37 @@ int supplicant_start(struct supplicant *s)
 		goto error;
 	}
 
-	r = supplicant_write_config(s);
-	if (r < 0)
+	r = asprintf(&s->pid_path, "/run/miracle/wifi/%s-%u.pid",
+		     s->l->ifname, s->l->ifindex);
+	if (r < 0) {
+		r = log_ENOMEM();
 		goto error;
+	}
 
-	/* add initial 200ms startup timer */
+	r = asprintf(&s->lease_path, "/run/miracle/wifi/%s-%u.leases",
+		     s->l->ifname, s->l->ifindex);
+	if (r < 0) {
+		r = log_ENOMEM();
+		goto error;
+	}
+
+	/* leases are only an optimization, run without them on failure */
+	r = dhcp_cache_open(&s->lease_cache, s->lease_path);
+	if (r < 0)
+		log_warning("cannot open lease cache %s (%d), reconnects will do full DHCP",
+			    s->lease_path, r);
+
+	r = supplicant_ctrl_watch(s);
+	if (r < 0)
+		log_warning("cannot watch wpas ctrl-dir of %s (%d), polling instead",
+			    s->l->ifname, r);
+
+	/* add initial startup timer */
 	r = sd_event_add_time(s->l->m->event,
 			      &s->timer_source,
 			      CLOCK_MONOTONIC,
-			      shl_now(CLOCK_MONOTONIC) + 200 * 1000ULL,
+			      shl_now(CLOCK_MONOTONIC) +
+					supplicant_open_interval(s),
 			      0,
 			      supplicant_timer_fn,
 			      s);
@@ -2681,6 +3562,9 @@ int supplicant_start(struct supplicant *s)
 		goto error;
 	}
 
+	if (arg_wpa_persist && supplicant_adopt(s) >= 0)
+		return 0;
+
 	r = supplicant_spawn(s);
 	if (r < 0)
 		goto error;
@@ -2703,12 +3587,17 @@ void supplicant_stop(struct supplicant *s)
 
 	supplicant_close(s);
 
-	sd_event_source_unref(s->child_source);
-	s->child_source = NULL;
 	sd_event_source_unref(s->timer_source);
 	s->timer_source = NULL;
-
-	if (s->pid > 0) {
+	supplicant_ctrl_unwatch(s);
+	s->exec_time = 0;
+
+	if (s->pid > 0 && arg_wpa_persist && s->running) {
+		/* keep it warm (and watched), supplicant_adopt() picks it up */
+		log_info("leaving wpas pid:%d of %s running",
+			 (int)s->pid, s->l->ifname);
+	} else if (s->pid > 0) {
+		supplicant_unwatch_child(s);
 		r = kill(s->pid, SIGTERM);
 		if (r < 0)
 			r = kill(s->pid, SIGKILL);
@@ -2718,11 +3607,24 @@ void supplicant_stop(struct supplicant *s)
 	}
 
 	if (s->conf_path) {
-		unlink(s->conf_path);
+		if (!arg_wpa_persist)
+			unlink(s->conf_path);
 		free(s->conf_path);
 		s->conf_path = NULL;
 	}
 
+	if (s->pid_path) {
+		if (!arg_wpa_persist || !s->running)
+			unlink(s->pid_path);
+		free(s->pid_path);
+		s->pid_path = NULL;
+	}
+
+	dhcp_cache_close(s->lease_cache);
+	s->lease_cache = NULL;
+	free(s->lease_path);
+	s->lease_path = NULL;
+
 	free(s->global_ctrl);
 	s->global_ctrl = NULL;
 	free(s->dev_ctrl);
@@ -42,6 +42,9 @@
 
 const char *interface_name = NULL;
 unsigned int arg_wpa_loglevel = LOG_NOTICE;
+bool arg_wpa_persist = false;
+bool arg_external_dhcp = false;
+bool arg_eapol_ip = false;
 bool use_dev = false;
 bool lazy_managed = false;
 
@@ -239,6 +242,8 @@ static int manager_new(struct manager **out)
 		return log_ENOMEM();
 
 	shl_htable_init_uint(&m->links);
+	shl_dlist_init(&m->dbus_dirty_links);
+	shl_dlist_init(&m->dbus_dirty_peers);
 
 	r = sd_event_default(&m->event);
 	if (r < 0) {
@@ -467,6 +472,9 @@ static int help(void)
 	       "  -i --interface           Choose the interface to use\n"
 	       "\n"
 	       "     --wpa-loglevel <lvl   wpa_supplicant log-level\n"
+	       "     --wpa-persist         keep wpa_supplicant running and reuse it\n"
+	       "     --external-dhcp       spawn miracle-dhcp instead of in-process DHCP\n"
+	       "     --eapol-ip            assign P2P addresses in the 4-way handshake\n"
 	       "     --use-dev             enable workaround for 'no ifname' issue\n"
 	       "     --lazy-managed        manage interface only when user decide to do\n"
 	       , program_invocation_short_name);
@@ -486,6 +494,9 @@ static int parse_argv(int argc, char *argv[])
 		ARG_LOG_TIME,
 
 		ARG_WPA_LOGLEVEL,
+		ARG_WPA_PERSIST,
+		ARG_EXTERNAL_DHCP,
+		ARG_EAPOL_IP,
 
 		ARG_USE_DEV,
 		ARG_LAZY_MANAGED,
@@ -497,6 +508,9 @@ static int parse_argv(int argc, char *argv[])
 		{ "log-time",	no_argument,		NULL,	ARG_LOG_TIME },
 
 		{ "wpa-loglevel",	required_argument,	NULL,	ARG_WPA_LOGLEVEL },
+		{ "wpa-persist",	no_argument,	NULL,	ARG_WPA_PERSIST },
+		{ "external-dhcp",	no_argument,	NULL,	ARG_EXTERNAL_DHCP },
+		{ "eapol-ip",	no_argument,	NULL,	ARG_EAPOL_IP },
 		{ "interface",	required_argument,	NULL,	'i' },
 		{ "use-dev",	no_argument,	NULL,	ARG_USE_DEV },
 		{ "lazy-managed",	no_argument,	NULL,	ARG_LAZY_MANAGED },
@@ -530,6 +544,15 @@ static int parse_argv(int argc, char *argv[])
 		case ARG_WPA_LOGLEVEL:
 			arg_wpa_loglevel = log_parse_arg(optarg);
 			break;
+		case ARG_WPA_PERSIST:
+			arg_wpa_persist = true;
+			break;
+		case ARG_EXTERNAL_DHCP:
+			arg_external_dhcp = true;
+			break;
+		case ARG_EAPOL_IP:
+			arg_eapol_ip = true;
+			break;
 		case '?':
 			return -EINVAL;
 		}
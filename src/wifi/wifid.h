@@ -69,19 +69,27 @@ void supplicant_peer_disconnect(struct supplicant_peer *sp);
 struct peer {
 	struct link *l;
 	char *p2p_mac;
+	uint64_t sta_mac;		/* 0 if unknown, see peer_set_sta_mac() */
 	struct supplicant_peer *sp;
 
+	/* pending PropertiesChanged, see peer_dbus_properties_changed() */
+	unsigned int dbus_dirty;
+	struct shl_dlist dbus_list;
+
 	bool public : 1;
 	bool connected : 1;
 };
 
 #define peer_from_htable(_p) \
 	shl_htable_entry((_p), struct peer, p2p_mac)
+#define peer_from_sta_htable(_p) \
+	shl_htable_entry((_p), struct peer, sta_mac)
 
 int peer_new(struct link *l,
 	     const char *p2p_mac,
 	     struct peer **out);
 void peer_free(struct peer *p);
+int peer_set_sta_mac(struct peer *p, uint64_t sta_mac);
 
 const char *peer_get_friendly_name(struct peer *p);
 const char *peer_get_interface(struct peer *p);
@@ -134,6 +142,11 @@ struct link {
 
 	size_t peer_cnt;
 	struct shl_htable peers;
+	struct shl_htable sta_peers;	/* peers with sta_mac set */
+
+	/* pending PropertiesChanged, see link_dbus_properties_changed() */
+	unsigned int dbus_dirty;
+	struct shl_dlist dbus_list;
 
 	bool managed : 1;
 	bool public : 1;
@@ -149,6 +162,7 @@ struct link {
 
 struct peer *link_find_peer(struct link *l, const char *p2p_mac);
 struct peer *link_find_peer_by_label(struct link *l, const char *label);
+struct peer *link_find_peer_by_sta_mac(struct link *l, uint64_t sta_mac);
 
 int link_new(struct manager *m,
 	     unsigned int ifindex,
@@ -199,6 +213,11 @@ struct manager {
 
 	size_t link_cnt;
 	struct shl_htable links;
+
+	/* objects with pending property notifications */
+	sd_event_source *dbus_flush_source;
+	struct shl_dlist dbus_dirty_links;
+	struct shl_dlist dbus_dirty_peers;
 };
 
 #define MANAGER_FIRST_LINK(_m) \
@@ -217,5 +236,8 @@ void manager_dbus_disconnect(struct manager *m);
 /* cli arguments */
 
 extern unsigned int arg_wpa_loglevel;
+extern bool arg_wpa_persist;
+extern bool arg_external_dhcp;
+extern bool arg_eapol_ip;
 
 #endif /* WIFID_H */
@@ -0,0 +1,271 @@
+/*
+ * MiracleCast - Wifi-Display/Miracast Implementation
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * MiracleCast is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * MiracleCast is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MiracleCast; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * DHCP Address Allocation Benchmarks
+ * Drives the lease table of a real GDHCPServer the way listener_event() does,
+ * minus the sockets: N clients send DISCOVER at once and get an offer-lease,
+ * then all of them REQUEST it. Afterwards, repeatedly, half of the clients
+ * RELEASE their lease and as many new clients join, each doing DISCOVER and
+ * REQUEST; the pool is full then, so these hit the expired-lease fallback.
+ * "bitmap" is the server's find_free_or_expired_nip(), "linear" the previous
+ * implementation: a scan of the whole range with a find_lease_by_nip() lookup
+ * per address. Both fall back to the top of the lease heap. Run without
+ * arguments.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "shl_macro.h"
+#include "shl_util.h"
+
+/* white-box: the allocator and lease table are static in server.c */
+#include "server.c"
+
+#define BENCH_ROUNDS 4
+
+struct bench_range {
+	const char *name;
+	const char *start;
+	const char *end;
+};
+
+static const struct bench_range bench_ranges[] = {
+	{ "/24", "192.168.77.1", "192.168.77.254" },
+	{ "/22", "192.168.76.1", "192.168.79.254" },
+	{ "/20", "192.168.64.1", "192.168.79.254" },
+};
+
+static uint32_t bench_linear_nip(GDHCPServer *server, const uint8_t *mac)
+{
+	struct dhcp_lease *lease;
+	uint32_t ip_addr;
+
+	for (ip_addr = server->start_ip; ip_addr <= server->end_ip; ip_addr++) {
+		if ((ip_addr & 0xff) == 0 || (ip_addr & 0xff) == 0xff)
+			continue;
+
+		if (find_lease_by_nip(server, ip_addr))
+			continue;
+
+		if (arp_check(htonl(ip_addr), mac))
+			return ip_addr;
+	}
+
+	if (!server->lease_heap_len)
+		return 0;
+
+	lease = server->lease_heap[0];
+	if (!is_expired_lease(lease))
+		return 0;
+
+	return lease->lease_nip;
+}
+
+static GDHCPServer *bench_server_new(const struct bench_range *range)
+{
+	GDHCPServer *server;
+
+	server = g_try_new0(GDHCPServer, 1);
+	if (!server)
+		return NULL;
+
+	server->ref_count = 1;
+	server->listener_sockfd = -1;
+	server->lease_seconds = DEFAULT_DHCP_LEASE_SEC;
+	server->nip_lease_hash = g_hash_table_new_full(g_direct_hash,
+						g_direct_equal, NULL, NULL);
+	server->mac_lease_hash = g_hash_table_new_full(mac_hash,
+						mac_equal, NULL, NULL);
+	server->option_hash = g_hash_table_new_full(g_direct_hash,
+						g_direct_equal, NULL, NULL);
+
+	if (g_dhcp_server_set_ip_range(server, range->start, range->end) < 0) {
+		g_dhcp_server_unref(server);
+		return NULL;
+	}
+
+	return server;
+}
+
+static void bench_mac(uint8_t *mac, uint32_t id)
+{
+	mac[0] = 0x02;
+	mac[1] = 0x00;
+	mac[2] = id >> 24;
+	mac[3] = id >> 16;
+	mac[4] = id >> 8;
+	mac[5] = id;
+}
+
+static int bench_discover(GDHCPServer *server, const uint8_t *mac,
+			  uint32_t *nip, bool linear)
+{
+	*nip = linear ? bench_linear_nip(server, mac)
+		      : find_free_or_expired_nip(server, mac);
+	if (!*nip)
+		return -ENOSPC;
+
+	if (!add_lease(server, OFFER_TIME, mac, htonl(*nip)))
+		return -EINVAL;
+
+	return 0;
+}
+
+static int bench_request(GDHCPServer *server, const uint8_t *mac,
+			 uint32_t nip)
+{
+	struct dhcp_lease *lease;
+
+	lease = add_lease(server, 0, mac, htonl(nip));
+	if (!lease)
+		return -EINVAL;
+
+	return 0;
+}
+
+static int bench_alloc(const struct bench_range *range, bool linear)
+{
+	GDHCPServer *server;
+	struct dhcp_lease *lease;
+	uint8_t (*macs)[ETH_ALEN] = NULL;
+	uint32_t *nips = NULL, id = 0;
+	uint64_t start, usec, n_discover = 0;
+	size_t i, j, n, round;
+	int r;
+
+	server = bench_server_new(range);
+	if (!server)
+		return -ENOMEM;
+
+	/* every address but the reserved ones is handed out */
+	n = server->nip_pool.size - server->nip_pool.used;
+
+	macs = calloc(n, sizeof(*macs));
+	nips = calloc(n, sizeof(*nips));
+	if (!macs || !nips) {
+		r = -ENOMEM;
+		goto out;
+	}
+
+	srand(1);
+	start = shl_now(CLOCK_MONOTONIC);
+
+	for (i = 0; i < n; ++i) {
+		bench_mac(macs[i], ++id);
+		r = bench_discover(server, macs[i], &nips[i], linear);
+		if (r < 0)
+			goto out;
+	}
+
+	for (i = 0; i < n; ++i) {
+		r = bench_request(server, macs[i], nips[i]);
+		if (r < 0)
+			goto out;
+	}
+
+	n_discover += n;
+
+	for (round = 0; round < BENCH_ROUNDS; ++round) {
+		for (i = 0; i < n; i += 2) {
+			j = (i + rand()) % n;
+			if (!nips[j])
+				continue;
+
+			lease = find_lease_by_mac(server, macs[j]);
+			if (!lease) {
+				r = -EINVAL;
+				goto out;
+			}
+
+			lease_set_expire(server, lease, time(NULL) - 1);
+			nips[j] = 0;
+		}
+
+		/*
+		 * Offer-leases expire right away (OFFER_TIME is not relative
+		 * to now), so a second DISCOVER would steal the first offer
+		 * from the fallback; let each new client finish first.
+		 */
+		for (i = 0; i < n; ++i) {
+			if (nips[i])
+				continue;
+
+			bench_mac(macs[i], ++id);
+			r = bench_discover(server, macs[i], &nips[i], linear);
+			if (r < 0)
+				goto out;
+
+			r = bench_request(server, macs[i], nips[i]);
+			if (r < 0)
+				goto out;
+
+			++n_discover;
+		}
+	}
+
+	usec = shl_now(CLOCK_MONOTONIC) - start;
+
+	/* all clients hold a distinct, committed lease */
+	if (ip_pool_next(&server->nip_pool) ||
+	    server->lease_heap_len != n ||
+	    g_hash_table_size(server->nip_lease_hash) != n ||
+	    is_expired_lease(server->lease_heap[0])) {
+		r = -EINVAL;
+		goto out;
+	}
+
+	printf("%-8s %-4s %6zu clients %12.0f DISCOVER+REQUEST/s\n",
+	       linear ? "linear" : "bitmap", range->name, n,
+	       (double)n_discover * 1000000.0 / (usec ? : 1));
+	r = 0;
+
+out:
+	free(nips);
+	free(macs);
+	g_dhcp_server_unref(server);
+	return r;
+}
+
+int main(int argc, char **argv)
+{
+	size_t i;
+	int r;
+
+	for (i = 0; i < SHL_ARRAY_LENGTH(bench_ranges); ++i) {
+		r = bench_alloc(&bench_ranges[i], false);
+		if (r < 0)
+			goto error;
+
+		r = bench_alloc(&bench_ranges[i], true);
+		if (r < 0)
+			goto error;
+	}
+
+	return EXIT_SUCCESS;
+
+error:
+	fprintf(stderr, "benchmark failed: %s\n", strerror(-r));
+	return EXIT_FAILURE;
+}
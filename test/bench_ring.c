@@ -0,0 +1,200 @@
+/*
+ * MiracleCast - Wifi-Display/Miracast Implementation
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * MiracleCast is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * MiracleCast is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MiracleCast; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Ring-Buffer Benchmarks
+ * Compares the heap and the mirrored shl_ring backends. The ring is kept
+ * about half full with RTP-sized chunks so data regularly wraps around the
+ * ring end. "push/pull" copies chunks in and out, "peek" reads every chunk
+ * in place (linearizing wrapped chunks like a parser would), "reserve"
+ * fills chunks via shl_ring_reserve()/shl_ring_commit() and "grow" pushes
+ * into an empty ring until it reached its final size. Run without arguments.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <time.h>
+#include "shl_macro.h"
+#include "shl_ring.h"
+#include "shl_util.h"
+
+#define BENCH_CHUNK 1400
+#define BENCH_FILL (64 * 1024)
+#define BENCH_BYTES (1024ULL * 1024 * 1024)
+#define BENCH_GROW (16 * 1024 * 1024)
+
+enum {
+	BENCH_PUSH_PULL,
+	BENCH_PEEK,
+	BENCH_RESERVE,
+	BENCH_GROWTH,
+};
+
+static const char *bench_names[] = {
+	[BENCH_PUSH_PULL] = "push/pull",
+	[BENCH_PEEK] = "peek",
+	[BENCH_RESERVE] = "reserve",
+	[BENCH_GROWTH] = "grow",
+};
+
+static uint8_t chunk[BENCH_CHUNK];
+static uint8_t sink[BENCH_CHUNK];
+static uint64_t sum;
+
+static int bench_fill(struct shl_ring *r)
+{
+	int err;
+
+	while (shl_ring_get_size(r) < BENCH_FILL) {
+		err = shl_ring_push(r, chunk, sizeof(chunk));
+		if (err < 0)
+			return err;
+	}
+
+	return 0;
+}
+
+static int bench_step(struct shl_ring *r, int type)
+{
+	struct iovec vec[2];
+	const uint8_t *p;
+	int err, n;
+
+	switch (type) {
+	case BENCH_PUSH_PULL:
+		err = shl_ring_push(r, chunk, sizeof(chunk));
+		if (err < 0)
+			return err;
+
+		shl_ring_copy(r, sink, sizeof(sink));
+		break;
+	case BENCH_PEEK:
+		err = shl_ring_push(r, chunk, sizeof(chunk));
+		if (err < 0)
+			return err;
+
+		shl_ring_peek(r, vec);
+		if (vec[0].iov_len >= sizeof(sink)) {
+			p = vec[0].iov_base;
+		} else {
+			shl_ring_copy(r, sink, sizeof(sink));
+			p = sink;
+		}
+
+		sum += p[0] + p[sizeof(sink) - 1];
+		break;
+	case BENCH_RESERVE:
+		n = shl_ring_reserve(r, vec, sizeof(chunk));
+		if (n < 0)
+			return n;
+
+		if (vec[0].iov_len >= sizeof(chunk)) {
+			memcpy(vec[0].iov_base, chunk, sizeof(chunk));
+		} else {
+			memcpy(vec[0].iov_base, chunk, vec[0].iov_len);
+			memcpy(vec[1].iov_base, &chunk[vec[0].iov_len],
+			       sizeof(chunk) - vec[0].iov_len);
+		}
+
+		shl_ring_commit(r, sizeof(chunk));
+		shl_ring_copy(r, sink, sizeof(sink));
+		break;
+	}
+
+	shl_ring_pull(r, sizeof(sink));
+	return 0;
+}
+
+static int bench_ring(int type, bool mirror)
+{
+	struct shl_ring r = { };
+	uint64_t start, usec, bytes;
+	int err;
+
+	err = shl_ring_set_mirror(&r, mirror);
+	if (err < 0)
+		return err;
+
+	if (type == BENCH_GROWTH) {
+		bytes = 0;
+		start = shl_now(CLOCK_MONOTONIC);
+
+		for (int i = 0; i < 16; ++i) {
+			while (shl_ring_get_size(&r) < BENCH_GROW) {
+				err = shl_ring_push(&r, chunk, sizeof(chunk));
+				if (err < 0)
+					goto out;
+			}
+
+			bytes += shl_ring_get_size(&r);
+			shl_ring_clear(&r);
+		}
+	} else {
+		err = bench_fill(&r);
+		if (err < 0)
+			goto out;
+
+		start = shl_now(CLOCK_MONOTONIC);
+
+		for (bytes = 0; bytes < BENCH_BYTES; bytes += sizeof(chunk)) {
+			err = bench_step(&r, type);
+			if (err < 0)
+				goto out;
+		}
+	}
+
+	usec = shl_now(CLOCK_MONOTONIC) - start;
+	printf("%-10s %-8s %10.1f MiB/s\n",
+	       bench_names[type],
+	       r.mirror ? "mirror" : "heap",
+	       (double)bytes / (1024.0 * 1024.0) * 1000000.0 / (usec ? : 1));
+	err = 0;
+
+out:
+	shl_ring_clear(&r);
+	return err;
+}
+
+int main(int argc, char **argv)
+{
+	int r, type;
+
+	memset(chunk, 0x80, sizeof(chunk));
+
+	for (type = 0; type < (int)SHL_ARRAY_LENGTH(bench_names); ++type) {
+		r = bench_ring(type, false);
+		if (r < 0)
+			goto error;
+
+		r = bench_ring(type, true);
+		if (r < 0)
+			goto error;
+	}
+
+	return EXIT_SUCCESS;
+
+error:
+	fprintf(stderr, "benchmark failed: %s\n", strerror(-r));
+	return EXIT_FAILURE;
+}
@@ -0,0 +1,165 @@
+/*
+ * MiracleCast - Wifi-Display/Miracast Implementation
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * MiracleCast is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * MiracleCast is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MiracleCast; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * RTSP Benchmarks
+ * Pushes TCP-interleaved RTP-sized frames through an rtsp bus and reports
+ * the packet rate. Each frame is delivered once through the match-callbacks
+ * (one rtsp_message per frame) and once through a per-channel data handler
+ * (borrowed payload, no message). Run without arguments.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <systemd/sd-event.h>
+#include <time.h>
+#include <unistd.h>
+#include "rtsp.h"
+#include "shl_macro.h"
+#include "shl_util.h"
+
+#define BENCH_PACKETS (256 * 1024)
+#define BENCH_PAYLOAD 1400
+#define BENCH_FRAME (4 + BENCH_PAYLOAD)
+#define BENCH_BATCH 32
+
+static size_t received;
+
+static int bench_match(struct rtsp *bus, struct rtsp_message *m, void *data)
+{
+	if (m && rtsp_message_get_type(m) == RTSP_MESSAGE_DATA)
+		++received;
+
+	return 0;
+}
+
+static int bench_handler(struct rtsp *bus,
+			 unsigned int channel,
+			 const void *data,
+			 size_t size,
+			 void *userdata)
+{
+	++received;
+	return 0;
+}
+
+static int bench_data(const char *name, bool use_handler)
+{
+	static uint8_t batch[BENCH_BATCH * BENCH_FRAME];
+	struct rtsp *bus = NULL;
+	sd_event *event = NULL;
+	uint64_t start, usec;
+	size_t i, off, written, total;
+	ssize_t l;
+	int r, fds[2];
+
+	for (i = 0; i < BENCH_BATCH; ++i) {
+		batch[i * BENCH_FRAME + 0] = '$';
+		batch[i * BENCH_FRAME + 1] = 0;
+		batch[i * BENCH_FRAME + 2] = BENCH_PAYLOAD >> 8;
+		batch[i * BENCH_FRAME + 3] = BENCH_PAYLOAD & 0xff;
+		memset(&batch[i * BENCH_FRAME + 4], 0x80, BENCH_PAYLOAD);
+	}
+
+	r = socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds);
+	if (r < 0)
+		return -errno;
+
+	r = rtsp_open(&bus, fds[0]);
+	if (r < 0) {
+		close(fds[0]);
+		goto out;
+	}
+
+	r = sd_event_new(&event);
+	if (r < 0)
+		goto out;
+
+	r = rtsp_attach_event(bus, event, 0);
+	if (r < 0)
+		goto out;
+
+	if (use_handler)
+		r = rtsp_add_data_handler(bus, 0, bench_handler, NULL);
+	else
+		r = rtsp_add_match(bus, bench_match, NULL);
+	if (r < 0)
+		goto out;
+
+	received = 0;
+	off = 0;
+	written = 0;
+	total = (size_t)BENCH_PACKETS * BENCH_FRAME;
+	start = shl_now(CLOCK_MONOTONIC);
+
+	while (received < BENCH_PACKETS) {
+		if (written < total) {
+			l = send(fds[1],
+				 &batch[off],
+				 sizeof(batch) - off,
+				 MSG_DONTWAIT | MSG_NOSIGNAL);
+			if (l < 0 && errno != EAGAIN) {
+				r = -errno;
+				goto out;
+			} else if (l > 0) {
+				written += l;
+				off = (off + l) % sizeof(batch);
+			}
+		}
+
+		r = sd_event_run(event, written < total ? 0 : (uint64_t)-1);
+		if (r < 0)
+			goto out;
+	}
+
+	usec = shl_now(CLOCK_MONOTONIC) - start;
+	printf("%-16s %10.0f packets/s\n",
+	       name, (double)BENCH_PACKETS * 1000000.0 / (usec ? : 1));
+	r = 0;
+
+out:
+	rtsp_unref(bus);
+	sd_event_unref(event);
+	close(fds[1]);
+	return r;
+}
+
+int main(int argc, char **argv)
+{
+	int r;
+
+	r = bench_data("data (message)", false);
+	if (r < 0)
+		goto error;
+
+	r = bench_data("data (handler)", true);
+	if (r < 0)
+		goto error;
+
+	return EXIT_SUCCESS;
+
+error:
+	fprintf(stderr, "benchmark failed: %s\n", strerror(-r));
+	return EXIT_FAILURE;
+}
@@ -0,0 +1,230 @@
+/*
+ * MiracleCast - Wifi-Display/Miracast Implementation
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * MiracleCast is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * MiracleCast is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MiracleCast; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * WPAS Benchmarks
+ * Replays a recorded P2P discovery trace from a fake wpa_supplicant socket
+ * into a wpas client bus and reports how many messages per second are
+ * received, parsed and dispatched, plus the heap allocations the bus did per
+ * received message. Every event is read back through wpas_message_read() and
+ * wpas_message_dict_read() like wifid does. Run without arguments.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <systemd/sd-event.h>
+#include <time.h>
+#include <unistd.h>
+#include "shl_macro.h"
+#include "shl_util.h"
+#include "wpas.h"
+
+#define BENCH_MESSAGES (256 * 1024)
+
+/* recorded from a wpa_supplicant 2.x P2P_FIND with three peers around */
+static const char *trace[] = {
+	"IFNAME=p2p-dev-wlan0 <3>CTRL-EVENT-SCAN-STARTED ",
+	"IFNAME=p2p-dev-wlan0 <3>P2P-DEVICE-FOUND 02:1a:11:f0:3c:6e p2p_dev_addr=02:1a:11:f0:3c:6e pri_dev_type=7-0050F204-1 name='Living Room TV' config_methods=0x188 dev_capab=0x25 group_capab=0x0 wfd_dev_info=0x01111c440032 new=1",
+	"IFNAME=p2p-dev-wlan0 <3>P2P-DEVICE-FOUND 2a:3f:8d:12:77:01 p2p_dev_addr=2a:3f:8d:12:77:01 pri_dev_type=10-0050F204-5 name='Pixel 7' config_methods=0x188 dev_capab=0x25 group_capab=0x0 wfd_dev_info=0x00111c440032 new=1",
+	"<3>CTRL-EVENT-SCAN-RESULTS ",
+	"IFNAME=p2p-dev-wlan0 <3>P2P-DEVICE-FOUND 02:1a:11:f0:3c:6e p2p_dev_addr=02:1a:11:f0:3c:6e pri_dev_type=7-0050F204-1 name='Living Room TV' config_methods=0x188 dev_capab=0x25 group_capab=0x0 wfd_dev_info=0x01111c440032 new=0",
+	"IFNAME=p2p-dev-wlan0 <3>P2P-DEVICE-FOUND 5e:cf:7f:a0:09:b4 p2p_dev_addr=5e:cf:7f:a0:09:b4 pri_dev_type=1-0050F204-1 name=\"DIRECT-roku-\\\"Bedroom\\\"\" config_methods=0x80 dev_capab=0x25 group_capab=0x2b wfd_dev_info=0x01111c440032 new=1",
+	"IFNAME=p2p-dev-wlan0 <3>P2P-PROV-DISC-PBC-REQ 2a:3f:8d:12:77:01 p2p_dev_addr=2a:3f:8d:12:77:01 pri_dev_type=10-0050F204-5 name='Pixel 7' config_methods=0x188 dev_capab=0x25 group_capab=0x0",
+	"IFNAME=p2p-dev-wlan0 <3>P2P-DEVICE-LOST p2p_dev_addr=5e:cf:7f:a0:09:b4",
+	"<3>CTRL-EVENT-BSS-ADDED 14 02:1a:11:f0:3c:6e",
+	"IFNAME=p2p-dev-wlan0 <3>P2P-FIND-STOPPED ",
+};
+
+static size_t received;
+
+static int bench_match(struct wpas *w, struct wpas_message *m, void *data)
+{
+	const char *mac, *name;
+
+	if (!m || wpas_message_get_type(m) != WPAS_MESSAGE_EVENT)
+		return 0;
+
+	++received;
+
+	if (wpas_message_is_event(m, "P2P-DEVICE-FOUND")) {
+		wpas_message_read(m, "s", &mac);
+		wpas_message_dict_read(m, "name", 's', &name);
+		wpas_message_dict_read(m, "wfd_dev_info", 's', &name);
+	}
+
+	return 0;
+}
+
+static int bench_socket(const char *path, int *out)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	int fd, r;
+
+	fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -errno;
+
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+	unlink(path);
+
+	r = bind(fd, (struct sockaddr*)&addr, sizeof(addr));
+	if (r < 0) {
+		r = -errno;
+		close(fd);
+		return r;
+	}
+
+	*out = fd;
+	return 0;
+}
+
+/* send a request and remember its source, that's where events go to */
+static int bench_attach(struct wpas *w,
+			sd_event *event,
+			int fd,
+			struct sockaddr_un *peer)
+{
+	struct wpas_message *m;
+	socklen_t len = sizeof(*peer);
+	char buf[64];
+	int r;
+
+	r = wpas_message_new_request(w, "ATTACH", &m);
+	if (r < 0)
+		return r;
+
+	r = wpas_send(w, m, 0);
+	wpas_message_unref(m);
+	if (r < 0)
+		return r;
+
+	while (recvfrom(fd, buf, sizeof(buf), MSG_DONTWAIT,
+			(struct sockaddr*)peer, &len) < 0) {
+		if (errno != EAGAIN)
+			return -errno;
+
+		r = sd_event_run(event, 10 * 1000);
+		if (r < 0)
+			return r;
+	}
+
+	return 0;
+}
+
+static int bench_trace(void)
+{
+	struct sockaddr_un peer;
+	struct wpas_stats stats;
+	struct wpas *w = NULL;
+	sd_event *event = NULL;
+	char path[64];
+	uint64_t start, usec;
+	size_t sent, l;
+	ssize_t res;
+	int r, fd = -1;
+
+	sprintf(path, "/tmp/miracle-bench-wpas-%d", getpid());
+	r = bench_socket(path, &fd);
+	if (r < 0)
+		return r;
+
+	r = wpas_open(path, &w);
+	if (r < 0)
+		goto out;
+
+	r = sd_event_new(&event);
+	if (r < 0)
+		goto out;
+
+	r = wpas_attach_event(w, event, 0);
+	if (r < 0)
+		goto out;
+
+	r = wpas_add_match(w, bench_match, NULL);
+	if (r < 0)
+		goto out;
+
+	r = bench_attach(w, event, fd, &peer);
+	if (r < 0)
+		goto out;
+
+	received = 0;
+	sent = 0;
+	start = shl_now(CLOCK_MONOTONIC);
+
+	while (received < BENCH_MESSAGES) {
+		for ( ; sent < BENCH_MESSAGES; ++sent) {
+			l = strlen(trace[sent % SHL_ARRAY_LENGTH(trace)]);
+			res = sendto(fd,
+				     trace[sent % SHL_ARRAY_LENGTH(trace)],
+				     l,
+				     MSG_DONTWAIT,
+				     (struct sockaddr*)&peer,
+				     sizeof(peer));
+			if (res < 0 && errno == EAGAIN)
+				break;
+			else if (res < 0) {
+				r = -errno;
+				goto out;
+			}
+		}
+
+		r = sd_event_run(event, (uint64_t)-1);
+		if (r < 0)
+			goto out;
+	}
+
+	usec = shl_now(CLOCK_MONOTONIC) - start;
+	wpas_get_stats(w, &stats);
+
+	printf("%-16s %10.0f msgs/s %8.4f allocs/msg %6.2f msgs/wakeup\n",
+	       "p2p-find trace",
+	       (double)BENCH_MESSAGES * 1000000.0 / (usec ? : 1),
+	       (double)stats.allocs / (stats.messages ? : 1),
+	       (double)stats.messages / (stats.wakeups ? : 1));
+	r = 0;
+
+out:
+	wpas_unref(w);
+	sd_event_unref(event);
+	close(fd);
+	unlink(path);
+	return r;
+}
+
+int main(int argc, char **argv)
+{
+	int r;
+
+	r = bench_trace();
+	if (r < 0)
+		goto error;
+
+	return EXIT_SUCCESS;
+
+error:
+	fprintf(stderr, "benchmark failed: %s\n", strerror(-r));
+	return EXIT_FAILURE;
+}
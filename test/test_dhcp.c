@@ -0,0 +1,630 @@
+/*
+ * MiracleCast - Wifi-Display/Miracast Implementation
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * MiracleCast is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * MiracleCast is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MiracleCast; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The engines run on "lo" with /bin/true as "ip" binary, so addresses are
+ * never actually touched. Starting a DHCP client needs raw sockets and fails
+ * without root, so only static setups can be started unconditionally.
+ */
+
+#include "test_common.h"
+#include "dhcp-cache.h"
+#include "dhcp-engine.h"
+#include "ippool.h"
+
+static unsigned int n_local;
+static char local_addr[64];
+
+static void test_engine_fn(struct dhcp_engine *e,
+			   const struct dhcp_engine_event *ev,
+			   void *data)
+{
+	if (ev->type != DHCP_ENGINE_LOCAL)
+		return;
+
+	++n_local;
+	snprintf(local_addr, sizeof(local_addr), "%s", ev->addr);
+}
+
+static struct dhcp_engine *start_test_engine(sd_event **event,
+					     const struct dhcp_engine_config *c)
+{
+	struct dhcp_engine *e;
+	int r;
+
+	n_local = 0;
+	local_addr[0] = 0;
+
+	r = sd_event_new(event);
+	ck_assert_int_ge(r, 0);
+
+	r = dhcp_engine_new(&e, *event, c, test_engine_fn, NULL);
+	ck_assert_int_ge(r, 0);
+
+	return e;
+}
+
+START_TEST(engine_invalid)
+{
+	struct dhcp_engine_config c = {
+		.netdev = "lo",
+		.ip_binary = "/bin/true",
+	};
+	struct dhcp_engine *e;
+	sd_event *event;
+	int r;
+
+	r = sd_event_new(&event);
+	ck_assert_int_ge(r, 0);
+
+	/* static clients need an address and subnet */
+	c.static_addr = true;
+	r = dhcp_engine_new(&e, event, &c, test_engine_fn, NULL);
+	ck_assert_int_eq(r, -EINVAL);
+
+	c.local = "192.168.49.2";
+	r = dhcp_engine_new(&e, event, &c, test_engine_fn, NULL);
+	ck_assert_int_eq(r, -EINVAL);
+
+	/* servers need the full set of addresses and can't be static */
+	c.subnet = "255.255.255.0";
+	c.server = true;
+	r = dhcp_engine_new(&e, event, &c, test_engine_fn, NULL);
+	ck_assert_int_eq(r, -EINVAL);
+
+	c.static_addr = false;
+	r = dhcp_engine_new(&e, event, &c, test_engine_fn, NULL);
+	ck_assert_int_eq(r, -EINVAL);
+
+	sd_event_unref(event);
+}
+END_TEST
+
+START_TEST(engine_client)
+{
+	/*
+	 * miracle-dhcp passes its server-only fields as empty strings if they
+	 * are not given; neither these nor @local must make this static.
+	 */
+	struct dhcp_engine_config c = {
+		.netdev = "lo",
+		.ip_binary = "/bin/true",
+		.local = "",
+		.subnet = "",
+	};
+	struct dhcp_engine *e;
+	sd_event *event;
+	int r;
+
+	e = start_test_engine(&event, &c);
+
+	r = dhcp_engine_start(e);
+	if (!geteuid())
+		ck_assert_int_ge(r, 0);
+
+	/* a DHCP client never reports an address before it got a lease */
+	ck_assert_int_eq(n_local, 0);
+
+	dhcp_engine_free(e);
+	sd_event_unref(event);
+}
+END_TEST
+
+START_TEST(engine_static)
+{
+	struct dhcp_engine_config c = {
+		.netdev = "lo",
+		.ip_binary = "/bin/true",
+		.static_addr = true,
+		.local = "192.168.49.2",
+		.subnet = "255.255.255.0",
+	};
+	struct dhcp_engine *e;
+	sd_event *event;
+	int r;
+
+	e = start_test_engine(&event, &c);
+
+	r = dhcp_engine_start(e);
+	ck_assert_int_ge(r, 0);
+	ck_assert_int_eq(n_local, 1);
+	ck_assert_str_eq(local_addr, "192.168.49.2");
+
+	dhcp_engine_free(e);
+	sd_event_unref(event);
+}
+END_TEST
+
+TEST_DEFINE_CASE(engine)
+	TEST(engine_invalid)
+	TEST(engine_client)
+	TEST(engine_static)
+TEST_END_CASE
+
+#define POOL_IP(a, b, c, d) \
+	((uint32_t)(a) << 24 | (uint32_t)(b) << 16 | (uint32_t)(c) << 8 | (d))
+
+/* hand out addresses until the pool is full, return how many */
+static unsigned int pool_drain(struct ip_pool *p, uint32_t *addrs,
+			       unsigned int max)
+{
+	unsigned int n = 0;
+	uint32_t addr;
+
+	while ((addr = ip_pool_next(p))) {
+		ck_assert_int_lt(n, max);
+		ck_assert(ip_pool_contains(p, addr));
+		ck_assert(!ip_pool_is_taken(p, addr));
+		ip_pool_take(p, addr);
+		addrs[n++] = addr;
+	}
+
+	return n;
+}
+
+START_TEST(pool_reserved)
+{
+	struct ip_pool p;
+	uint32_t addrs[512];
+	unsigned int i, n;
+	int r;
+
+	/* crosses 10.0.0.255 and 10.0.1.0 */
+	r = ip_pool_init(&p, POOL_IP(10, 0, 0, 200), POOL_IP(10, 0, 1, 20));
+	ck_assert_int_ge(r, 0);
+	ck_assert_int_eq(p.size, 77);
+	ck_assert_int_eq(p.used, 2);
+	ck_assert(ip_pool_is_taken(&p, POOL_IP(10, 0, 0, 255)));
+	ck_assert(ip_pool_is_taken(&p, POOL_IP(10, 0, 1, 0)));
+
+	/* outside the range is always taken */
+	ck_assert(ip_pool_is_taken(&p, POOL_IP(10, 0, 0, 199)));
+	ck_assert(ip_pool_is_taken(&p, POOL_IP(10, 0, 1, 21)));
+
+	n = pool_drain(&p, addrs, 512);
+	ck_assert_int_eq(n, 75);
+	for (i = 0; i < n; ++i) {
+		ck_assert_int_ne(addrs[i] & 0xff, 0);
+		ck_assert_int_ne(addrs[i] & 0xff, 0xff);
+	}
+
+	/* reserved addresses can't be put back */
+	ip_pool_put(&p, POOL_IP(10, 0, 1, 0));
+	ck_assert_int_eq(ip_pool_next(&p), 0);
+
+	ip_pool_destroy(&p);
+}
+END_TEST
+
+START_TEST(pool_unaligned)
+{
+	static const uint32_t sizes[] = { 1, 3, 63, 64, 65, 70, 128, 200 };
+	struct ip_pool p;
+	uint32_t addrs[256], start;
+	unsigned int i, j, n;
+	int r;
+
+	for (i = 0; i < SHL_ARRAY_LENGTH(sizes); ++i) {
+		start = POOL_IP(10, 0, 2, 1);
+		r = ip_pool_init(&p, start, start + sizes[i] - 1);
+		ck_assert_int_ge(r, 0);
+
+		/* padding bits past the end are never handed out */
+		n = pool_drain(&p, addrs, 256);
+		ck_assert_int_eq(n, sizes[i]);
+		ck_assert_int_eq(p.used, p.size);
+
+		for (j = 0; j < n; ++j) {
+			ck_assert_int_ge(addrs[j], start);
+			ck_assert_int_lt(addrs[j] - start, sizes[i]);
+		}
+
+		ip_pool_destroy(&p);
+	}
+
+	r = ip_pool_init(&p, POOL_IP(10, 0, 0, 2), POOL_IP(10, 0, 0, 1));
+	ck_assert_int_eq(r, -EINVAL);
+}
+END_TEST
+
+START_TEST(pool_wrap)
+{
+	struct ip_pool p;
+	uint32_t addrs[128];
+	unsigned int i, n;
+	int r;
+
+	/* 100 addresses, so the range spans a partial second word */
+	r = ip_pool_init(&p, POOL_IP(10, 0, 3, 1), POOL_IP(10, 0, 3, 100));
+	ck_assert_int_ge(r, 0);
+
+	/* the cursor hands out addresses in order */
+	for (i = 1; i <= 80; ++i) {
+		ck_assert_int_eq(ip_pool_next(&p), POOL_IP(10, 0, 3, i));
+		ip_pool_take(&p, POOL_IP(10, 0, 3, i));
+	}
+
+	/* released addresses come last, after the rest of the range */
+	ip_pool_put(&p, POOL_IP(10, 0, 3, 2));
+	ip_pool_put(&p, POOL_IP(10, 0, 3, 70));
+
+	n = pool_drain(&p, addrs, 128);
+	ck_assert_int_eq(n, 22);
+	for (i = 0; i < 20; ++i)
+		ck_assert_int_eq(addrs[i], POOL_IP(10, 0, 3, 81 + i));
+	ck_assert_int_eq(addrs[20], POOL_IP(10, 0, 3, 2));
+	ck_assert_int_eq(addrs[21], POOL_IP(10, 0, 3, 70));
+
+	/* a cursor on the last address wraps to the start */
+	ip_pool_put(&p, POOL_IP(10, 0, 3, 1));
+	ip_pool_put(&p, POOL_IP(10, 0, 3, 100));
+	ck_assert_int_eq(ip_pool_next(&p), POOL_IP(10, 0, 3, 100));
+	ck_assert_int_eq(ip_pool_next(&p), POOL_IP(10, 0, 3, 1));
+
+	ip_pool_destroy(&p);
+}
+END_TEST
+
+START_TEST(pool_full)
+{
+	struct ip_pool p;
+	uint32_t addrs[256];
+	unsigned int n;
+	int r;
+
+	r = ip_pool_init(&p, POOL_IP(10, 0, 4, 0), POOL_IP(10, 0, 4, 255));
+	ck_assert_int_ge(r, 0);
+
+	n = pool_drain(&p, addrs, 256);
+	ck_assert_int_eq(n, 254);
+	ck_assert_int_eq(ip_pool_next(&p), 0);
+
+	/* taking twice doesn't count twice */
+	ip_pool_take(&p, POOL_IP(10, 0, 4, 7));
+	ck_assert_int_eq(p.used, p.size);
+
+	ip_pool_put(&p, POOL_IP(10, 0, 4, 7));
+	ip_pool_put(&p, POOL_IP(10, 0, 4, 7));
+	ck_assert_int_eq(p.used, p.size - 1);
+	ck_assert_int_eq(ip_pool_next(&p), POOL_IP(10, 0, 4, 7));
+	ip_pool_take(&p, POOL_IP(10, 0, 4, 7));
+	ck_assert_int_eq(ip_pool_next(&p), 0);
+
+	ip_pool_destroy(&p);
+	ck_assert_int_eq(ip_pool_next(&p), 0);
+}
+END_TEST
+
+TEST_DEFINE_CASE(pool)
+	TEST(pool_reserved)
+	TEST(pool_unaligned)
+	TEST(pool_wrap)
+	TEST(pool_full)
+TEST_END_CASE
+
+#define CACHE_MAC 0x020000000001ULL
+
+static struct dhcp_cache *open_test_cache(char *path, bool clear)
+{
+	struct dhcp_cache *c;
+	int r;
+
+	sprintf(path, "/tmp/miracle-test-cache-%d", getpid());
+	if (clear)
+		unlink(path);
+
+	r = dhcp_cache_open(&c, path);
+	ck_assert_int_ge(r, 0);
+
+	return c;
+}
+
+static void count_entry(const struct dhcp_cache_entry *e, void *data)
+{
+	++*(unsigned int *)data;
+}
+
+static unsigned int count_entries(struct dhcp_cache *c, unsigned int role)
+{
+	unsigned int n = 0;
+
+	dhcp_cache_foreach(c, role, count_entry, &n);
+	return n;
+}
+
+/* same as dhcp_cache_home() */
+static size_t cache_home(uint64_t key, unsigned int role)
+{
+	return ((key ^ role) * 0x9e3779b97f4a7c15ULL) >> (64 - 8);
+}
+
+START_TEST(cache_store)
+{
+	struct dhcp_cache_entry e;
+	struct dhcp_cache *c;
+	char path[128];
+	uint64_t expire;
+	int r;
+
+	c = open_test_cache(path, true);
+	expire = time(NULL) + 100;
+
+	r = dhcp_cache_store(c, 0, DHCP_CACHE_CLIENT, 1, 1, expire);
+	ck_assert_int_eq(r, -EINVAL);
+	r = dhcp_cache_store(c, 1, DHCP_CACHE_CLIENT, 1, 0, expire);
+	ck_assert_int_eq(r, -EINVAL);
+	r = dhcp_cache_lookup(c, 0, DHCP_CACHE_CLIENT, &e);
+	ck_assert_int_eq(r, -EINVAL);
+
+	r = dhcp_cache_lookup(c, CACHE_MAC, DHCP_CACHE_CLIENT, &e);
+	ck_assert_int_eq(r, -ENOENT);
+
+	/* both roles of a peer are kept apart */
+	r = dhcp_cache_store(c, CACHE_MAC, DHCP_CACHE_CLIENT, 0x0a,
+			     0xc0a83102, expire);
+	ck_assert_int_ge(r, 0);
+	r = dhcp_cache_store(c, CACHE_MAC, DHCP_CACHE_SERVER, 0x0b,
+			     0xc0a83202, expire + 1);
+	ck_assert_int_ge(r, 0);
+
+	r = dhcp_cache_lookup(c, CACHE_MAC, DHCP_CACHE_CLIENT, &e);
+	ck_assert_int_ge(r, 0);
+	ck_assert(e.key == CACHE_MAC);
+	ck_assert(e.hwaddr == 0x0a);
+	ck_assert_int_eq(e.nip, 0xc0a83102);
+	ck_assert_int_eq(e.role, DHCP_CACHE_CLIENT);
+	ck_assert(e.expire == expire);
+
+	r = dhcp_cache_lookup(c, CACHE_MAC, DHCP_CACHE_SERVER, &e);
+	ck_assert_int_ge(r, 0);
+	ck_assert(e.hwaddr == 0x0b);
+	ck_assert_int_eq(e.nip, 0xc0a83202);
+
+	r = dhcp_cache_lookup(c, CACHE_MAC + 1, DHCP_CACHE_CLIENT, &e);
+	ck_assert_int_eq(r, -ENOENT);
+
+	/* entries outlive the process that stored them */
+	dhcp_cache_close(c);
+	c = open_test_cache(path, false);
+
+	r = dhcp_cache_lookup(c, CACHE_MAC, DHCP_CACHE_CLIENT, &e);
+	ck_assert_int_ge(r, 0);
+	ck_assert_int_eq(e.nip, 0xc0a83102);
+	ck_assert_int_eq(count_entries(c, DHCP_CACHE_CLIENT), 1);
+	ck_assert_int_eq(count_entries(c, DHCP_CACHE_SERVER), 1);
+
+	dhcp_cache_close(c);
+	unlink(path);
+}
+END_TEST
+
+START_TEST(cache_update)
+{
+	struct dhcp_cache_entry e;
+	struct dhcp_cache *c;
+	char path[128];
+	uint64_t now;
+	int r;
+
+	c = open_test_cache(path, true);
+	now = time(NULL);
+
+	r = dhcp_cache_store(c, CACHE_MAC, DHCP_CACHE_CLIENT, 0x0a,
+			     0xc0a83102, now + 100);
+	ck_assert_int_ge(r, 0);
+	r = dhcp_cache_store(c, CACHE_MAC, DHCP_CACHE_CLIENT, 0x0c,
+			     0xc0a83103, now + 200);
+	ck_assert_int_ge(r, 0);
+
+	r = dhcp_cache_lookup(c, CACHE_MAC, DHCP_CACHE_CLIENT, &e);
+	ck_assert_int_ge(r, 0);
+	ck_assert(e.hwaddr == 0x0c);
+	ck_assert_int_eq(e.nip, 0xc0a83103);
+	ck_assert(e.expire == now + 200);
+
+	/* updates replace the entry, they don't add another one */
+	ck_assert_int_eq(count_entries(c, DHCP_CACHE_CLIENT), 1);
+
+	dhcp_cache_close(c);
+	unlink(path);
+}
+END_TEST
+
+START_TEST(cache_expire)
+{
+	struct dhcp_cache_entry e;
+	struct dhcp_cache *c;
+	char path[128];
+	uint64_t now;
+	int r;
+
+	c = open_test_cache(path, true);
+	now = time(NULL);
+
+	r = dhcp_cache_store(c, CACHE_MAC, DHCP_CACHE_CLIENT, 0x0a,
+			     0xc0a83102, now - 1);
+	ck_assert_int_ge(r, 0);
+
+	r = dhcp_cache_lookup(c, CACHE_MAC, DHCP_CACHE_CLIENT, &e);
+	ck_assert_int_eq(r, -ENOENT);
+	ck_assert_int_eq(count_entries(c, DHCP_CACHE_CLIENT), 0);
+
+	/* a fresh lease revives the entry */
+	r = dhcp_cache_store(c, CACHE_MAC, DHCP_CACHE_CLIENT, 0x0a,
+			     0xc0a83102, now + 100);
+	ck_assert_int_ge(r, 0);
+	r = dhcp_cache_lookup(c, CACHE_MAC, DHCP_CACHE_CLIENT, &e);
+	ck_assert_int_ge(r, 0);
+	ck_assert_int_eq(count_entries(c, DHCP_CACHE_CLIENT), 1);
+
+	dhcp_cache_close(c);
+	unlink(path);
+}
+END_TEST
+
+START_TEST(cache_evict)
+{
+	struct dhcp_cache_entry e;
+	struct dhcp_cache *c;
+	char path[128];
+	uint64_t keys[18], key, now;
+	unsigned int i, n;
+	int r;
+
+	/* find keys that all share one home slot, one more than fit */
+	n = 0;
+	for (key = 1; n < SHL_ARRAY_LENGTH(keys); ++key)
+		if (cache_home(key, DHCP_CACHE_CLIENT) == 7)
+			keys[n++] = key;
+
+	c = open_test_cache(path, true);
+	now = time(NULL);
+
+	for (i = 0; i < 16; ++i) {
+		r = dhcp_cache_store(c, keys[i], DHCP_CACHE_CLIENT, i + 1,
+				     0xc0a83102 + i, now + 100 + i);
+		ck_assert_int_ge(r, 0);
+	}
+
+	/* the window is full, so the entry expiring first goes */
+	r = dhcp_cache_store(c, keys[16], DHCP_CACHE_CLIENT, 17,
+			     0xc0a83102 + 16, now + 200);
+	ck_assert_int_ge(r, 0);
+
+	r = dhcp_cache_lookup(c, keys[0], DHCP_CACHE_CLIENT, &e);
+	ck_assert_int_eq(r, -ENOENT);
+	for (i = 1; i <= 16; ++i) {
+		r = dhcp_cache_lookup(c, keys[i], DHCP_CACHE_CLIENT, &e);
+		ck_assert_int_ge(r, 0);
+		ck_assert_int_eq(e.nip, 0xc0a83102 + i);
+	}
+
+	/* ...unless there is an expired one */
+	r = dhcp_cache_store(c, keys[5], DHCP_CACHE_CLIENT, 6,
+			     0xc0a83102 + 5, now - 1);
+	ck_assert_int_ge(r, 0);
+	r = dhcp_cache_store(c, keys[17], DHCP_CACHE_CLIENT, 18,
+			     0xc0a83102 + 17, now + 200);
+	ck_assert_int_ge(r, 0);
+
+	r = dhcp_cache_lookup(c, keys[1], DHCP_CACHE_CLIENT, &e);
+	ck_assert_int_ge(r, 0);
+	r = dhcp_cache_lookup(c, keys[17], DHCP_CACHE_CLIENT, &e);
+	ck_assert_int_ge(r, 0);
+	ck_assert_int_eq(e.nip, 0xc0a83102 + 17);
+	ck_assert_int_eq(count_entries(c, DHCP_CACHE_CLIENT), 16);
+
+	/* updates within a full window don't evict anything */
+	r = dhcp_cache_store(c, keys[1], DHCP_CACHE_CLIENT, 2,
+			     0xc0a83102 + 1, now + 300);
+	ck_assert_int_ge(r, 0);
+	ck_assert_int_eq(count_entries(c, DHCP_CACHE_CLIENT), 16);
+
+	dhcp_cache_close(c);
+	unlink(path);
+}
+END_TEST
+
+START_TEST(cache_header)
+{
+	static const uint32_t bad_magic = 0xdeadbeef;
+	struct dhcp_cache_entry e;
+	struct dhcp_cache *c;
+	char path[128];
+	struct stat st;
+	off_t size;
+	ssize_t l;
+	int r, fd;
+
+	c = open_test_cache(path, true);
+	r = dhcp_cache_store(c, CACHE_MAC, DHCP_CACHE_CLIENT, 0x0a,
+			     0xc0a83102, time(NULL) + 100);
+	ck_assert_int_ge(r, 0);
+	dhcp_cache_close(c);
+
+	/* a file of the right size with a bad header starts over */
+	fd = open(path, O_WRONLY | O_CLOEXEC);
+	ck_assert_int_ge(fd, 0);
+	l = pwrite(fd, &bad_magic, sizeof(bad_magic), 0);
+	ck_assert_int_eq(l, sizeof(bad_magic));
+	close(fd);
+
+	c = open_test_cache(path, false);
+	r = dhcp_cache_lookup(c, CACHE_MAC, DHCP_CACHE_CLIENT, &e);
+	ck_assert_int_eq(r, -ENOENT);
+
+	r = dhcp_cache_store(c, CACHE_MAC, DHCP_CACHE_CLIENT, 0x0a,
+			     0xc0a83102, time(NULL) + 100);
+	ck_assert_int_ge(r, 0);
+	dhcp_cache_close(c);
+
+	/* the new header is valid, so the entry survives a reopen */
+	c = open_test_cache(path, false);
+	r = dhcp_cache_lookup(c, CACHE_MAC, DHCP_CACHE_CLIENT, &e);
+	ck_assert_int_ge(r, 0);
+	dhcp_cache_close(c);
+
+	r = stat(path, &st);
+	ck_assert_int_ge(r, 0);
+	size = st.st_size;
+
+	/* a file of the wrong size starts over, too */
+	fd = open(path, O_WRONLY | O_TRUNC | O_CLOEXEC);
+	ck_assert_int_ge(fd, 0);
+	l = write(fd, "garbage", 7);
+	ck_assert_int_eq(l, 7);
+	close(fd);
+
+	c = open_test_cache(path, false);
+	r = dhcp_cache_lookup(c, CACHE_MAC, DHCP_CACHE_CLIENT, &e);
+	ck_assert_int_eq(r, -ENOENT);
+	r = dhcp_cache_store(c, CACHE_MAC, DHCP_CACHE_CLIENT, 0x0a,
+			     0xc0a83102, time(NULL) + 100);
+	ck_assert_int_ge(r, 0);
+	dhcp_cache_close(c);
+
+	c = open_test_cache(path, false);
+	r = dhcp_cache_lookup(c, CACHE_MAC, DHCP_CACHE_CLIENT, &e);
+	ck_assert_int_ge(r, 0);
+	dhcp_cache_close(c);
+
+	r = stat(path, &st);
+	ck_assert_int_ge(r, 0);
+	ck_assert_int_eq(st.st_size, size);
+
+	unlink(path);
+}
+END_TEST
+
+TEST_DEFINE_CASE(cache)
+	TEST(cache_store)
+	TEST(cache_update)
+	TEST(cache_expire)
+	TEST(cache_evict)
+	TEST(cache_header)
+TEST_END_CASE
+
+TEST_DEFINE(
+	TEST_SUITE(dhcp,
+		TEST_CASE(engine),
+		TEST_CASE(pool),
+		TEST_CASE(cache),
+		TEST_END
+	)
+)
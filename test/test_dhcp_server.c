@@ -0,0 +1,499 @@
+/*
+ * MiracleCast - Wifi-Display/Miracast Implementation
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * MiracleCast is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * MiracleCast is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MiracleCast; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The lease table of the DHCP server is all static, so server.c is built
+ * right into this test. Packets are fed to listener_event() and replies are
+ * captured instead of going through sockets, so no interface and no root
+ * privileges are needed.
+ */
+
+#include "test_common.h"
+
+#define dhcp_recv_l3_packet test_recv_l3_packet
+#define dhcp_send_raw_packet test_send_raw_packet
+#include "server.c"
+
+#define TEST_SERVER_NIP 0xc0a84dfe		/* 192.168.77.254 */
+#define TEST_START_NIP 0xc0a84d01		/* 192.168.77.1 */
+#define TEST_END_NIP 0xc0a84d08			/* 192.168.77.8 */
+#define TEST_POOL_SIZE 8
+
+static struct dhcp_packet recv_packet;
+static struct dhcp_packet sent_packet;
+static unsigned int n_sent;
+static unsigned int n_events;
+static char event_ip[INET_ADDRSTRLEN];
+
+int test_recv_l3_packet(struct dhcp_packet *packet, int fd)
+{
+	*packet = recv_packet;
+	return sizeof(*packet);
+}
+
+int test_send_raw_packet(struct dhcp_packet *dhcp_pkt,
+			 uint32_t source_ip, int source_port, uint32_t dest_ip,
+			 int dest_port, const uint8_t *dest_arp, int ifindex)
+{
+	sent_packet = *dhcp_pkt;
+	++n_sent;
+	return 0;
+}
+
+static void test_event_fn(const char *mac, const char *ip, void *data)
+{
+	++n_events;
+	snprintf(event_ip, sizeof(event_ip), "%s", ip);
+}
+
+static GDHCPServer *test_server_new(void)
+{
+	GDHCPServer *server;
+	int r;
+
+	server = g_try_new0(GDHCPServer, 1);
+	ck_assert(server);
+
+	server->ref_count = 1;
+	server->listener_sockfd = -1;
+	server->server_nip = htonl(TEST_SERVER_NIP);
+	server->lease_seconds = DEFAULT_DHCP_LEASE_SEC;
+	server->nip_lease_hash = g_hash_table_new_full(g_direct_hash,
+						g_direct_equal, NULL, NULL);
+	server->mac_lease_hash = g_hash_table_new_full(mac_hash,
+						mac_equal, NULL, NULL);
+	server->option_hash = g_hash_table_new_full(g_direct_hash,
+						g_direct_equal, NULL, NULL);
+	server->event_fn = test_event_fn;
+
+	r = g_dhcp_server_set_ip_range(server, "192.168.77.1",
+				       "192.168.77.8");
+	ck_assert_int_ge(r, 0);
+
+	n_sent = 0;
+	n_events = 0;
+	return server;
+}
+
+static void test_mac(uint8_t *mac, unsigned int id)
+{
+	memset(mac, 0, ETH_ALEN);
+	mac[0] = 0x02;
+	mac[5] = id;
+}
+
+static void test_packet(struct dhcp_packet *p, char type, const uint8_t *mac)
+{
+	dhcp_init_header(p, type);
+	p->xid = 0x1234;
+	memcpy(p->chaddr, mac, ETH_ALEN);
+}
+
+/* feed @p to the server, return the type of the reply or 0 for none */
+static uint8_t test_send(GDHCPServer *server, struct dhcp_packet *p)
+{
+	unsigned int n = n_sent;
+	uint8_t *type;
+
+	recv_packet = *p;
+	listener_event(NULL, G_IO_IN, server);
+
+	if (n_sent == n)
+		return 0;
+
+	type = dhcp_get_option(&sent_packet, DHCP_MESSAGE_TYPE);
+	ck_assert(type);
+	return *type;
+}
+
+static uint32_t test_discover(GDHCPServer *server, const uint8_t *mac)
+{
+	struct dhcp_packet p;
+
+	test_packet(&p, DHCPDISCOVER, mac);
+	if (test_send(server, &p) != DHCPOFFER)
+		return 0;
+
+	return ntohl(sent_packet.yiaddr);
+}
+
+static uint8_t test_request(GDHCPServer *server, const uint8_t *mac,
+			    uint32_t nip)
+{
+	struct dhcp_packet p;
+
+	test_packet(&p, DHCPREQUEST, mac);
+	dhcp_add_option_uint32(&p, DHCP_REQUESTED_IP, nip);
+	dhcp_add_option_uint32(&p, DHCP_SERVER_ID, TEST_SERVER_NIP);
+	return test_send(server, &p);
+}
+
+static void test_release(GDHCPServer *server, const uint8_t *mac,
+			 uint32_t nip)
+{
+	struct dhcp_packet p;
+
+	test_packet(&p, DHCPRELEASE, mac);
+	p.ciaddr = htonl(nip);
+	dhcp_add_option_uint32(&p, DHCP_SERVER_ID, TEST_SERVER_NIP);
+	ck_assert_int_eq(test_send(server, &p), 0);
+}
+
+static void test_decline(GDHCPServer *server, const uint8_t *mac,
+			 uint32_t nip)
+{
+	struct dhcp_packet p;
+
+	test_packet(&p, DHCPDECLINE, mac);
+	dhcp_add_option_uint32(&p, DHCP_REQUESTED_IP, nip);
+	dhcp_add_option_uint32(&p, DHCP_SERVER_ID, TEST_SERVER_NIP);
+	ck_assert_int_eq(test_send(server, &p), 0);
+}
+
+/* the heap, both hashes and the pool must always describe the same leases */
+static void check_leases(GDHCPServer *server)
+{
+	struct dhcp_lease *lease;
+	guint i;
+
+	for (i = 0; i < server->lease_heap_len; ++i) {
+		lease = server->lease_heap[i];
+
+		ck_assert_int_eq(lease->heap_index, i);
+		if (i > 0)
+			ck_assert_int_le(server->lease_heap[(i - 1) / 2]->expire,
+					 lease->expire);
+
+		ck_assert_ptr_eq(find_lease_by_nip(server, lease->lease_nip),
+				 lease);
+		ck_assert_ptr_eq(find_lease_by_mac(server, lease->lease_mac),
+				 lease);
+		ck_assert(ip_pool_is_taken(&server->nip_pool,
+					   lease->lease_nip));
+	}
+
+	ck_assert_int_eq(g_hash_table_size(server->nip_lease_hash),
+			 server->lease_heap_len);
+	ck_assert_int_eq(g_hash_table_size(server->mac_lease_hash),
+			 server->lease_heap_len);
+
+	/* the range has no reserved addresses */
+	ck_assert_int_eq(server->nip_pool.used, server->lease_heap_len);
+}
+
+START_TEST(lease_add)
+{
+	GDHCPServer *server;
+	struct dhcp_lease *lease;
+	uint8_t mac[ETH_ALEN];
+	uint32_t nip;
+	unsigned int i;
+
+	server = test_server_new();
+
+	for (i = 1; i <= TEST_POOL_SIZE; ++i) {
+		test_mac(mac, i);
+
+		nip = test_discover(server, mac);
+		ck_assert_int_ge(nip, TEST_START_NIP);
+		ck_assert_int_le(nip, TEST_END_NIP);
+		check_leases(server);
+
+		ck_assert_int_eq(test_request(server, mac, nip), DHCPACK);
+		ck_assert_int_eq(ntohl(sent_packet.yiaddr), nip);
+		check_leases(server);
+
+		lease = find_lease_by_mac(server, mac);
+		ck_assert(lease);
+		ck_assert_int_eq(lease->lease_nip, nip);
+		ck_assert(!is_expired_lease(lease));
+	}
+
+	ck_assert_int_eq(server->lease_heap_len, TEST_POOL_SIZE);
+
+	/* pool is full and no lease expired */
+	test_mac(mac, TEST_POOL_SIZE + 1);
+	ck_assert_int_eq(test_discover(server, mac), 0);
+	check_leases(server);
+
+	g_dhcp_server_unref(server);
+}
+END_TEST
+
+START_TEST(lease_renew)
+{
+	GDHCPServer *server;
+	struct dhcp_lease *lease;
+	uint8_t mac[ETH_ALEN];
+	uint32_t nips[TEST_POOL_SIZE + 1];
+	unsigned int i;
+
+	server = test_server_new();
+
+	for (i = 1; i <= TEST_POOL_SIZE; ++i) {
+		test_mac(mac, i);
+		nips[i] = test_discover(server, mac);
+		ck_assert_int_eq(test_request(server, mac, nips[i]), DHCPACK);
+	}
+
+	/* stagger the expiry times, so client 1 ends up on top */
+	for (i = 1; i <= TEST_POOL_SIZE; ++i) {
+		test_mac(mac, i);
+		lease_set_expire(server, find_lease_by_mac(server, mac),
+				 time(NULL) + i);
+		check_leases(server);
+	}
+
+	test_mac(mac, 1);
+	ck_assert_ptr_eq(server->lease_heap[0],
+			 find_lease_by_mac(server, mac));
+
+	ck_assert_int_eq(test_request(server, mac, nips[1]), DHCPACK);
+	check_leases(server);
+
+	lease = find_lease_by_mac(server, mac);
+	ck_assert_int_eq(lease->lease_nip, nips[1]);
+	ck_assert_int_ge(lease->expire,
+			 time(NULL) + DEFAULT_DHCP_LEASE_SEC - 1);
+	ck_assert_int_eq(server->lease_heap_len, TEST_POOL_SIZE);
+
+	/* a DISCOVER from a known client offers its own address again */
+	test_mac(mac, 2);
+	ck_assert_int_eq(test_discover(server, mac), nips[2]);
+	check_leases(server);
+	ck_assert_int_eq(server->lease_heap_len, TEST_POOL_SIZE);
+
+	g_dhcp_server_unref(server);
+}
+END_TEST
+
+START_TEST(lease_release)
+{
+	GDHCPServer *server;
+	struct dhcp_lease *lease;
+	uint8_t mac[ETH_ALEN];
+	uint32_t nips[TEST_POOL_SIZE + 1];
+	unsigned int i;
+
+	server = test_server_new();
+
+	for (i = 1; i <= TEST_POOL_SIZE; ++i) {
+		test_mac(mac, i);
+		nips[i] = test_discover(server, mac);
+		ck_assert_int_eq(test_request(server, mac, nips[i]), DHCPACK);
+	}
+
+	/* released leases stay around, but expire and move to the top */
+	for (i = 3; i <= 5; ++i) {
+		test_mac(mac, i);
+		test_release(server, mac, nips[i]);
+		check_leases(server);
+
+		lease = find_lease_by_mac(server, mac);
+		ck_assert(lease);
+		ck_assert_int_le(lease->expire, time(NULL));
+		ck_assert_int_le(server->lease_heap[0]->expire, time(NULL));
+	}
+
+	ck_assert_int_eq(server->lease_heap_len, TEST_POOL_SIZE);
+
+	/* a RELEASE for somebody else's address is ignored */
+	test_mac(mac, 6);
+	test_release(server, mac, nips[7]);
+	check_leases(server);
+	ck_assert(!is_expired_lease(find_lease_by_mac(server, mac)));
+
+	/* the oldest expired lease is handed out first once the pool is full */
+	for (i = 3; i <= 5; ++i) {
+		test_mac(mac, i);
+		lease_set_expire(server, find_lease_by_mac(server, mac),
+				 time(NULL) - (i == 4 ? 100 : 50));
+		check_leases(server);
+	}
+
+	test_mac(mac, TEST_POOL_SIZE + 1);
+	ck_assert_int_eq(test_discover(server, mac), nips[4]);
+	check_leases(server);
+	ck_assert_int_eq(test_request(server, mac, nips[4]), DHCPACK);
+	check_leases(server);
+
+	/* the lease moved over to the new client */
+	test_mac(mac, 4);
+	ck_assert(!find_lease_by_mac(server, mac));
+	ck_assert_int_eq(server->lease_heap_len, TEST_POOL_SIZE);
+
+	g_dhcp_server_unref(server);
+}
+END_TEST
+
+START_TEST(lease_decline)
+{
+	GDHCPServer *server;
+	uint8_t mac[ETH_ALEN];
+	uint32_t nips[TEST_POOL_SIZE + 1];
+	unsigned int i;
+
+	server = test_server_new();
+
+	for (i = 1; i <= TEST_POOL_SIZE; ++i) {
+		test_mac(mac, i);
+		nips[i] = test_discover(server, mac);
+		ck_assert_int_eq(test_request(server, mac, nips[i]), DHCPACK);
+	}
+
+	/* a DECLINE for the wrong address is ignored */
+	test_mac(mac, 1);
+	test_decline(server, mac, nips[2]);
+	check_leases(server);
+	ck_assert_int_eq(server->lease_heap_len, TEST_POOL_SIZE);
+
+	/* declined leases are dropped from everything, from any position */
+	for (i = 1; i <= TEST_POOL_SIZE; i += 3) {
+		test_mac(mac, i);
+		test_decline(server, mac, nips[i]);
+		check_leases(server);
+
+		ck_assert(!find_lease_by_mac(server, mac));
+		ck_assert(!find_lease_by_nip(server, nips[i]));
+		ck_assert(!ip_pool_is_taken(&server->nip_pool, nips[i]));
+	}
+
+	ck_assert_int_eq(server->lease_heap_len, TEST_POOL_SIZE - 3);
+
+	/* ...and their addresses are free again */
+	for (i = 1; i <= 3; ++i) {
+		test_mac(mac, 0x10 + i);
+		ck_assert_int_ne(test_discover(server, mac), 0);
+		check_leases(server);
+	}
+
+	g_dhcp_server_unref(server);
+}
+END_TEST
+
+TEST_DEFINE_CASE(lease)
+	TEST(lease_add)
+	TEST(lease_renew)
+	TEST(lease_release)
+	TEST(lease_decline)
+TEST_END_CASE
+
+static uint8_t test_rapid_discover(GDHCPServer *server, const uint8_t *mac)
+{
+	struct dhcp_packet p;
+
+	test_packet(&p, DHCPDISCOVER, mac);
+	dhcp_add_option_flag(&p, DHCP_RAPID_COMMIT);
+	return test_send(server, &p);
+}
+
+START_TEST(rapid_commit)
+{
+	GDHCPServer *server;
+	struct dhcp_lease *lease;
+	struct in_addr addr;
+	uint8_t mac[ETH_ALEN], *opt;
+	uint32_t nip;
+
+	server = test_server_new();
+	g_dhcp_server_set_rapid_commit(server, true);
+
+	test_mac(mac, 1);
+	ck_assert_int_eq(test_rapid_discover(server, mac), DHCPACK);
+	ck_assert(dhcp_get_option(&sent_packet, DHCP_RAPID_COMMIT));
+
+	opt = dhcp_get_option(&sent_packet, DHCP_LEASE_TIME);
+	ck_assert(opt);
+	ck_assert_int_eq(get_be32(opt), DEFAULT_DHCP_LEASE_SEC);
+
+	/* the lease is committed right away, not just offered */
+	nip = ntohl(sent_packet.yiaddr);
+	ck_assert_int_ge(nip, TEST_START_NIP);
+	ck_assert_int_le(nip, TEST_END_NIP);
+	check_leases(server);
+
+	lease = find_lease_by_mac(server, mac);
+	ck_assert(lease);
+	ck_assert_int_eq(lease->lease_nip, nip);
+	ck_assert_int_ge(lease->expire,
+			 time(NULL) + DEFAULT_DHCP_LEASE_SEC - 1);
+
+	addr.s_addr = htonl(nip);
+	ck_assert_int_eq(n_events, 1);
+	ck_assert_str_eq(event_ip, inet_ntoa(addr));
+
+	/* nobody else gets that address */
+	test_mac(mac, 2);
+	ck_assert_int_eq(test_rapid_discover(server, mac), DHCPACK);
+	ck_assert_int_ne(ntohl(sent_packet.yiaddr), nip);
+	check_leases(server);
+	ck_assert_int_eq(server->lease_heap_len, 2);
+
+	g_dhcp_server_unref(server);
+}
+END_TEST
+
+START_TEST(rapid_commit_fallback)
+{
+	GDHCPServer *server;
+	uint8_t mac[ETH_ALEN];
+	uint32_t nip;
+
+	server = test_server_new();
+	g_dhcp_server_set_rapid_commit(server, true);
+
+	/* clients without the option go through OFFER/REQUEST */
+	test_mac(mac, 1);
+	nip = test_discover(server, mac);
+	ck_assert_int_ne(nip, 0);
+	ck_assert(!dhcp_get_option(&sent_packet, DHCP_RAPID_COMMIT));
+	ck_assert_int_lt(find_lease_by_mac(server, mac)->expire,
+			 time(NULL) + DEFAULT_DHCP_LEASE_SEC - 1);
+	ck_assert_int_eq(n_events, 0);
+
+	ck_assert_int_eq(test_request(server, mac, nip), DHCPACK);
+	ck_assert(!dhcp_get_option(&sent_packet, DHCP_RAPID_COMMIT));
+	ck_assert_int_eq(n_events, 1);
+	check_leases(server);
+
+	/* the option is ignored unless rapid commit is enabled */
+	g_dhcp_server_set_rapid_commit(server, false);
+
+	test_mac(mac, 2);
+	ck_assert_int_eq(test_rapid_discover(server, mac), DHCPOFFER);
+	ck_assert(!dhcp_get_option(&sent_packet, DHCP_RAPID_COMMIT));
+	ck_assert_int_eq(n_events, 1);
+	check_leases(server);
+
+	g_dhcp_server_unref(server);
+}
+END_TEST
+
+TEST_DEFINE_CASE(rapid)
+	TEST(rapid_commit)
+	TEST(rapid_commit_fallback)
+TEST_END_CASE
+
+TEST_DEFINE(
+	TEST_SUITE(dhcp_server,
+		TEST_CASE(lease),
+		TEST_CASE(rapid),
+		TEST_END
+	)
+)
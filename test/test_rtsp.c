@@ -605,9 +605,80 @@ START_TEST(msg_new)
 }
 END_TEST
 
+START_TEST(msg_lookup)
+{
+	static const char *keys[] = {
+		"wfd_audio_codecs", "wfd_video_formats", "wfd_3d_video_formats",
+		"wfd_content_protection", "wfd_display_edid",
+		"wfd_coupled_sink", "wfd_client_rtp_ports", "wfd_uibc_capability",
+		"wfd_standby_resume_capability", "wfd_connector_type",
+		"wfd_I2C", "wfd_idr_request",
+	};
+	struct rtsp *bus;
+	struct rtsp_message *m;
+	const char *str;
+	char name[64];
+	size_t i, j;
+	int r, fd;
+
+	fd = dup(0);
+	ck_assert_int_ge(fd, 0);
+	r = rtsp_open(&bus, fd);
+	ck_assert_int_ge(r, 0);
+
+	r = rtsp_message_new_reply(bus, &m, 1, RTSP_CODE_OK, NULL);
+	ck_assert_int_ge(r, 0);
+
+	for (i = 0; i < SHL_ARRAY_LENGTH(keys); ++i) {
+		r = rtsp_message_append(m, "<s>", keys[i], keys[i]);
+		ck_assert_int_ge(r, 0);
+	}
+
+	r = rtsp_message_append(m, "{");
+	ck_assert_int_ge(r, 0);
+	for (i = 0; i < SHL_ARRAY_LENGTH(keys); ++i) {
+		r = rtsp_message_append(m, "<s>", keys[i], "body");
+		ck_assert_int_ge(r, 0);
+	}
+	/* duplicates must not shadow the first header of that name */
+	r = rtsp_message_append(m, "<s>", keys[0], "duplicate");
+	ck_assert_int_ge(r, 0);
+	r = rtsp_message_append(m, "}");
+	ck_assert_int_ge(r, 0);
+
+	r = rtsp_message_seal(m);
+	ck_assert_int_ge(r, 0);
+
+	for (i = 0; i < SHL_ARRAY_LENGTH(keys); ++i) {
+		/* lookups are case-insensitive */
+		for (j = 0; keys[i][j]; ++j)
+			name[j] = keys[i][j] >= 'a' && keys[i][j] <= 'z' ?
+				  keys[i][j] - 'a' + 'A' : keys[i][j];
+		name[j] = 0;
+
+		r = rtsp_message_read(m, "<s>", name, &str);
+		ck_assert_int_ge(r, 0);
+		ck_assert_str_eq(str, keys[i]);
+
+		r = rtsp_message_read(m, "{<s>}", keys[i], &str);
+		ck_assert_int_ge(r, 0);
+		ck_assert_str_eq(str, "body");
+	}
+
+	r = rtsp_message_read(m, "<s>", "wfd_unknown", &str);
+	ck_assert_int_eq(r, -ENOENT);
+	r = rtsp_message_read(m, "{<s>}", "wfd_unknown", &str);
+	ck_assert_int_eq(r, -ENOENT);
+
+	rtsp_message_unref(m);
+	rtsp_unref(bus);
+}
+END_TEST
+
 TEST_DEFINE_CASE(msg)
 	TEST(msg_new_invalid)
 	TEST(msg_new)
+	TEST(msg_lookup)
 TEST_END_CASE
 
 static struct rtsp *server, *client;
@@ -698,8 +769,630 @@ START_TEST(run_all)
 }
 END_TEST
 
+static int match_batch(struct rtsp *bus,
+		       struct rtsp_message *m,
+		       void *data)
+{
+	size_t *cnt = data;
+
+	ck_assert(!!m);
+	++*cnt;
+
+	return 0;
+}
+
+START_TEST(run_batch)
+{
+	struct rtsp_message *m;
+	size_t expected, cnt;
+	int r, i;
+
+	start_test_client();
+
+	cnt = 0;
+	expected = 0;
+	r = rtsp_add_match(server, match_batch, &cnt);
+	ck_assert_int_ge(r, 0);
+
+	/* queue all requests while corked, they must arrive in one batch */
+	rtsp_cork(client);
+
+	for (i = 0; i < SHL_ARRAY_LENGTH(recipes); ++i) {
+		if (recipes[i].type == RTSP_MESSAGE_REPLY)
+			continue;
+
+		m = create_from_recipe(client, &recipes[i]);
+		r = rtsp_send(client, m);
+		ck_assert_int_ge(r, 0);
+		rtsp_message_unref(m);
+		++expected;
+	}
+
+	r = sd_event_run(event, 0);
+	ck_assert_int_ge(r, 0);
+	ck_assert_int_eq(cnt, 0);
+
+	rtsp_uncork(client);
+
+	while (cnt < expected) {
+		r = sd_event_run(event, (uint64_t)-1);
+		ck_assert_int_ge(r, 0);
+	}
+
+	ck_assert_int_eq(cnt, expected);
+
+	stop_test_client();
+}
+END_TEST
+
+static void send_keepalive(size_t *cnt)
+{
+	struct rtsp_message *m;
+	size_t expected = *cnt + 1;
+	int r;
+
+	r = rtsp_message_new_request(client, &m, "GET_PARAMETER",
+				     "rtsp://localhost/wfd1.0");
+	ck_assert_int_ge(r, 0);
+
+	r = rtsp_message_append(m, "<s>", "Session", "0123456789");
+	ck_assert_int_ge(r, 0);
+
+	r = rtsp_message_seal(m);
+	ck_assert_int_ge(r, 0);
+
+	r = rtsp_send(client, m);
+	ck_assert_int_ge(r, 0);
+	rtsp_message_unref(m);
+
+	while (*cnt < expected) {
+		r = sd_event_run(event, (uint64_t)-1);
+		ck_assert_int_ge(r, 0);
+	}
+}
+
+START_TEST(run_alloc)
+{
+	struct rtsp_alloc_stats cs, ss, stats;
+	size_t cnt;
+	int r, i;
+
+	start_test_client();
+
+	cnt = 0;
+	r = rtsp_add_match(server, match_batch, &cnt);
+	ck_assert_int_ge(r, 0);
+
+	/* warm up arena caches and scratch buffers */
+	for (i = 0; i < 4; ++i)
+		send_keepalive(&cnt);
+
+	rtsp_get_alloc_stats(client, &cs);
+	rtsp_get_alloc_stats(server, &ss);
+
+	/* steady-state traffic must not hit the heap */
+	for (i = 0; i < 64; ++i)
+		send_keepalive(&cnt);
+
+	rtsp_get_alloc_stats(client, &stats);
+	ck_assert(stats.heap_allocs == cs.heap_allocs);
+	ck_assert(stats.allocs > cs.allocs);
+	ck_assert(stats.arenas_recycled >= cs.arenas_recycled + 64);
+
+	rtsp_get_alloc_stats(server, &stats);
+	ck_assert(stats.heap_allocs == ss.heap_allocs);
+	ck_assert(stats.arenas_recycled >= ss.arenas_recycled + 64);
+
+	/* without a cache, each message needs a fresh arena */
+	r = rtsp_set_arena_cache(client, 0);
+	ck_assert_int_ge(r, 0);
+	r = rtsp_set_arena_cache(client, (size_t)-1);
+	ck_assert_int_lt(r, 0);
+
+	rtsp_get_alloc_stats(client, &cs);
+	send_keepalive(&cnt);
+	rtsp_get_alloc_stats(client, &stats);
+	ck_assert(stats.heap_allocs > cs.heap_allocs);
+	ck_assert(stats.arenas_recycled == cs.arenas_recycled);
+
+	stop_test_client();
+}
+END_TEST
+
+static int match_timeout(struct rtsp *bus,
+			 struct rtsp_message *m,
+			 void *data)
+{
+	size_t *cnt = data;
+
+	/* timeouts are reported without a reply */
+	ck_assert(!m);
+	++*cnt;
+
+	return 0;
+}
+
+START_TEST(run_timeout)
+{
+	struct rtsp_message *m;
+	uint64_t start, cookie;
+	size_t cnt, i;
+	int r;
+
+	start_test_client();
+
+	cnt = 0;
+	start = shl_now(CLOCK_MONOTONIC);
+
+	/* nobody replies, so all but the cancelled request time out */
+	for (i = 0; i < 4; ++i) {
+		r = rtsp_message_new_request(client, &m, "OPTIONS", "*");
+		ck_assert_int_ge(r, 0);
+
+		r = rtsp_message_seal(m);
+		ck_assert_int_ge(r, 0);
+
+		r = rtsp_call_async(client, m, match_timeout, &cnt,
+				    (i + 1) * 20 * 1000ULL, &cookie);
+		ck_assert_int_ge(r, 0);
+		rtsp_message_unref(m);
+
+		if (i == 1)
+			rtsp_call_async_cancel(client, cookie);
+	}
+
+	while (cnt < 3) {
+		r = sd_event_run(event, (uint64_t)-1);
+		ck_assert_int_ge(r, 0);
+	}
+
+	/* timeouts must never fire early */
+	ck_assert(shl_now(CLOCK_MONOTONIC) - start >= 80 * 1000ULL);
+
+	r = sd_event_run(event, 50 * 1000ULL);
+	ck_assert_int_ge(r, 0);
+	ck_assert_int_eq(cnt, 3);
+
+	stop_test_client();
+}
+END_TEST
+
+static int match_data(struct rtsp *bus,
+		      struct rtsp_message *m,
+		      void *data)
+{
+	size_t *cnt = data;
+
+	ck_assert(!!m);
+	ck_assert_int_eq(rtsp_message_get_type(m), RTSP_MESSAGE_DATA);
+	ck_assert_int_eq(rtsp_message_get_channel(m), 1);
+	++*cnt;
+
+	return 0;
+}
+
+static int handle_data(struct rtsp *bus,
+		       unsigned int channel,
+		       const void *data,
+		       size_t size,
+		       void *userdata)
+{
+	size_t *cnt = userdata;
+
+	ck_assert_int_eq(channel, 0);
+	ck_assert_int_eq(size, 4);
+	ck_assert(!memcmp(data, "RTP!", 4));
+	++*cnt;
+
+	return 0;
+}
+
+START_TEST(run_data)
+{
+	struct rtsp_message *m;
+	size_t handled, matched, i;
+	int r;
+
+	start_test_client();
+
+	handled = 0;
+	matched = 0;
+
+	r = rtsp_add_match(server, match_data, &matched);
+	ck_assert_int_ge(r, 0);
+	r = rtsp_add_data_handler(server, 0, handle_data, &handled);
+	ck_assert_int_ge(r, 0);
+	r = rtsp_add_data_handler(server, 0, handle_data, &handled);
+	ck_assert_int_eq(r, -EALREADY);
+	r = rtsp_add_data_handler(server, 256, handle_data, &handled);
+	ck_assert_int_eq(r, -EINVAL);
+
+	/* channel 0 goes to the handler, channel 1 to the match-callbacks */
+	for (i = 0; i < 16; ++i) {
+		r = rtsp_message_new_data(client, &m, i % 2, "RTP!", 4);
+		ck_assert_int_ge(r, 0);
+		r = rtsp_message_seal(m);
+		ck_assert_int_ge(r, 0);
+		r = rtsp_send(client, m);
+		ck_assert_int_ge(r, 0);
+		rtsp_message_unref(m);
+	}
+
+	while (handled + matched < 16) {
+		r = sd_event_run(event, (uint64_t)-1);
+		ck_assert_int_ge(r, 0);
+	}
+
+	ck_assert_int_eq(handled, 8);
+	ck_assert_int_eq(matched, 8);
+
+	stop_test_client();
+}
+END_TEST
+
+static int match_limits_request(struct rtsp *bus,
+				struct rtsp_message *m,
+				void *data)
+{
+	struct rtsp_message *rep;
+	size_t *cnt = data;
+	int r;
+
+	ck_assert(!!m);
+	ck_assert_int_eq(rtsp_message_get_type(m), RTSP_MESSAGE_REQUEST);
+	++*cnt;
+
+	r = rtsp_message_new_reply_for(m, &rep, RTSP_CODE_OK, NULL);
+	ck_assert_int_ge(r, 0);
+	r = rtsp_message_seal(rep);
+	ck_assert_int_ge(r, 0);
+	r = rtsp_send(bus, rep);
+	ck_assert_int_ge(r, 0);
+	rtsp_message_unref(rep);
+
+	return 1;
+}
+
+static int match_limits_reply(struct rtsp *bus,
+			      struct rtsp_message *m,
+			      void *data)
+{
+	unsigned int *code = data;
+
+	ck_assert(!!m);
+	*code = rtsp_message_get_code(m);
+
+	return 0;
+}
+
+static unsigned int call_limits(struct rtsp_message *m)
+{
+	unsigned int code = 0;
+	int r;
+
+	r = rtsp_message_seal(m);
+	ck_assert_int_ge(r, 0);
+	r = rtsp_call_async(client, m, match_limits_reply, &code, 0, NULL);
+	ck_assert_int_ge(r, 0);
+	rtsp_message_unref(m);
+
+	while (!code) {
+		r = sd_event_run(event, (uint64_t)-1);
+		ck_assert_int_ge(r, 0);
+	}
+
+	return code;
+}
+
+START_TEST(run_limits)
+{
+	struct rtsp_limits limits;
+	struct rtsp_mem_stats stats;
+	struct rtsp_message *m;
+	char body[4096], key[16];
+	size_t delivered, i;
+	int r;
+
+	start_test_client();
+
+	rtsp_get_limits(server, &limits);
+	ck_assert_int_gt(limits.max_ring, 0);
+	limits.max_headers = 4;
+	limits.max_body = 1024;
+	limits.idle_shrink = 0;
+	r = rtsp_set_limits(server, &limits);
+	ck_assert_int_ge(r, 0);
+
+	delivered = 0;
+	r = rtsp_add_match(server, match_limits_request, &delivered);
+	ck_assert_int_ge(r, 0);
+
+	/* too many headers */
+	r = rtsp_message_new_request(client, &m, "OPTIONS", "*");
+	ck_assert_int_ge(r, 0);
+	for (i = 0; i < 8; ++i) {
+		sprintf(key, "X-Test-%zu", i);
+		r = rtsp_message_append(m, "<u>", key, (unsigned int)i);
+		ck_assert_int_ge(r, 0);
+	}
+	ck_assert_int_eq(call_limits(m), RTSP_CODE_BAD_REQUEST);
+
+	/* oversized body, which must be skipped */
+	memset(body, 'a', sizeof(body) - 1);
+	body[sizeof(body) - 1] = 0;
+	r = rtsp_message_new_request(client, &m, "SET_PARAMETER", "*");
+	ck_assert_int_ge(r, 0);
+	r = rtsp_message_append(m, "{&}", body);
+	ck_assert_int_ge(r, 0);
+	ck_assert_int_eq(call_limits(m), RTSP_CODE_REQUEST_ENTITY_TOO_LARGE);
+
+	/* the stream is still in sync */
+	r = rtsp_message_new_request(client, &m, "SET_PARAMETER", "*");
+	ck_assert_int_ge(r, 0);
+	r = rtsp_message_append(m, "{&}", "wfd_trigger_method: SETUP");
+	ck_assert_int_ge(r, 0);
+	ck_assert_int_eq(call_limits(m), RTSP_CODE_OK);
+	ck_assert_int_eq(delivered, 1);
+
+	rtsp_get_mem_stats(server, &stats);
+	ck_assert_int_eq(stats.rejected, 2);
+	ck_assert_int_gt(stats.current, 0);
+	ck_assert_int_ge(stats.peak, stats.current);
+	ck_assert_int_eq(stats.shrinks, 0);
+
+	/* idle buffers are released */
+	limits.idle_shrink = 20 * 1000ULL;
+	r = rtsp_set_limits(server, &limits);
+	ck_assert_int_ge(r, 0);
+
+	while (!stats.shrinks) {
+		r = sd_event_run(event, (uint64_t)-1);
+		ck_assert_int_ge(r, 0);
+		rtsp_get_mem_stats(server, &stats);
+	}
+
+	ck_assert_int_eq(stats.current, 0);
+	ck_assert_int_gt(stats.peak, 0);
+
+	limits.max_ring = 1024;
+	r = rtsp_set_limits(server, &limits);
+	ck_assert_int_eq(r, -EINVAL);
+
+	stop_test_client();
+}
+END_TEST
+
+static int match_limits_large_request(struct rtsp *bus,
+				      struct rtsp_message *m,
+				      void *data)
+{
+	struct rtsp_message *rep;
+	char body[4096];
+	int r;
+
+	ck_assert(!!m);
+
+	memset(body, 'a', sizeof(body) - 1);
+	body[sizeof(body) - 1] = 0;
+
+	r = rtsp_message_new_reply_for(m, &rep, RTSP_CODE_OK, NULL);
+	ck_assert_int_ge(r, 0);
+	r = rtsp_message_append(rep, "{&}", body);
+	ck_assert_int_ge(r, 0);
+	r = rtsp_message_seal(rep);
+	ck_assert_int_ge(r, 0);
+	r = rtsp_send(bus, rep);
+	ck_assert_int_ge(r, 0);
+	rtsp_message_unref(rep);
+
+	return 1;
+}
+
+static int match_limits_hup(struct rtsp *bus,
+			    struct rtsp_message *m,
+			    void *data)
+{
+	bool *hup = data;
+
+	if (!m)
+		*hup = true;
+
+	return 0;
+}
+
+START_TEST(run_limits_reply)
+{
+	struct rtsp_limits limits;
+	struct rtsp_mem_stats stats;
+	struct rtsp_message *m;
+	bool hup = false;
+	int r;
+
+	start_test_client();
+
+	/* replies are never answered, an oversized one must not go unnoticed */
+	rtsp_get_limits(client, &limits);
+	limits.max_body = 1024;
+	r = rtsp_set_limits(client, &limits);
+	ck_assert_int_ge(r, 0);
+
+	r = rtsp_add_match(server, match_limits_large_request, NULL);
+	ck_assert_int_ge(r, 0);
+	r = rtsp_add_match(client, match_limits_hup, &hup);
+	ck_assert_int_ge(r, 0);
+
+	r = rtsp_message_new_request(client, &m, "GET_PARAMETER", "*");
+	ck_assert_int_ge(r, 0);
+	r = rtsp_message_seal(m);
+	ck_assert_int_ge(r, 0);
+	r = rtsp_send(client, m);
+	ck_assert_int_ge(r, 0);
+	rtsp_message_unref(m);
+
+	while (!hup) {
+		r = sd_event_run(event, (uint64_t)-1);
+		ck_assert_int_ge(r, 0);
+	}
+
+	rtsp_get_mem_stats(client, &stats);
+	ck_assert_int_eq(stats.rejected, 1);
+
+	stop_test_client();
+}
+END_TEST
+
+static struct rtsp_template *reply_template;
+
+static int match_template_request(struct rtsp *bus,
+				  struct rtsp_message *m,
+				  void *data)
+{
+	const char *values[] = { "12345", NULL };
+	struct rtsp_message *rep;
+	unsigned int port;
+	const char *str;
+	int r;
+
+	ck_assert(!!m);
+	ck_assert_int_eq(rtsp_message_get_type(m), RTSP_MESSAGE_REQUEST);
+	ck_assert_str_eq(rtsp_message_get_method(m), "SET_PARAMETER");
+
+	r = rtsp_message_read(m, "<s>", "Session", &str);
+	ck_assert_int_ge(r, 0);
+	ck_assert_str_eq(str, "deadbeef");
+
+	r = rtsp_message_read(m, "{<s>}", "wfd_presentation_URL", &str);
+	ck_assert_int_ge(r, 0);
+	ck_assert_str_eq(str, "rtsp://192.168.0.1/wfd1.0/streamid=0");
+
+	r = rtsp_message_read(m, "{<*u>}", "wfd_client_rtp_ports", &port);
+	ck_assert_int_ge(r, 0);
+
+	r = rtsp_template_stamp_reply_for(reply_template, m, &rep, values);
+	ck_assert_int_ge(r, 0);
+
+	r = rtsp_send(bus, rep);
+	ck_assert_int_ge(r, 0);
+	rtsp_message_unref(rep);
+
+	return 1;
+}
+
+static int match_template_reply(struct rtsp *bus,
+				struct rtsp_message *m,
+				void *data)
+{
+	size_t *cnt = data;
+	unsigned int port;
+	const char *str;
+	int r;
+
+	ck_assert(!!m);
+	ck_assert_int_eq(rtsp_message_get_code(m), RTSP_CODE_OK);
+
+	r = rtsp_message_read(m, "{<s>}", "wfd_audio_codecs", &str);
+	ck_assert_int_ge(r, 0);
+	ck_assert_str_eq(str, "AAC");
+
+	r = rtsp_message_read(m, "{<*u>}", "wfd_client_rtp_ports", &port);
+	ck_assert_int_ge(r, 0);
+	ck_assert_int_eq(port, 12345);
+
+	++*cnt;
+	return 0;
+}
+
+START_TEST(run_template)
+{
+	static const char *placeholders[] = { "@SESSION@", "@URL@", "@PORT@",
+					      NULL };
+	static const char *reply_placeholders[] = { "@PORT@", NULL };
+	struct rtsp_template *req_template;
+	struct rtsp_message *m;
+	size_t cnt, i;
+	char port[16];
+	int r;
+
+	start_test_client();
+
+	r = rtsp_message_new_request(client, &m, "SET_PARAMETER",
+				     "rtsp://localhost/wfd1.0");
+	ck_assert_int_ge(r, 0);
+	r = rtsp_message_append(m, "<s>", "Session", "@SESSION@");
+	ck_assert_int_ge(r, 0);
+	r = rtsp_message_append(m, "{&}",
+				"wfd_presentation_URL: @URL@ none");
+	ck_assert_int_ge(r, 0);
+	r = rtsp_message_append(m, "{&}",
+				"wfd_client_rtp_ports: RTP/AVP/UDP;unicast @PORT@ 0 mode=play");
+	ck_assert_int_ge(r, 0);
+
+	r = rtsp_template_new(&req_template, m, placeholders);
+	ck_assert_int_ge(r, 0);
+	rtsp_message_unref(m);
+
+	r = rtsp_message_new_reply(server, &m, 1, RTSP_CODE_OK, NULL);
+	ck_assert_int_ge(r, 0);
+	r = rtsp_message_append(m, "{&}", "wfd_audio_codecs: AAC 00000001 00");
+	ck_assert_int_ge(r, 0);
+	r = rtsp_message_append(m, "{&}",
+				"wfd_client_rtp_ports: RTP/AVP/UDP;unicast @PORT@ 0 mode=play");
+	ck_assert_int_ge(r, 0);
+
+	r = rtsp_template_new(&reply_template, m, reply_placeholders);
+	ck_assert_int_ge(r, 0);
+	rtsp_message_unref(m);
+
+	/* unknown placeholders are rejected */
+	r = rtsp_message_new_reply(server, &m, 1, RTSP_CODE_OK, NULL);
+	ck_assert_int_ge(r, 0);
+	r = rtsp_template_new(&req_template, m, reply_placeholders);
+	ck_assert_int_eq(r, -EINVAL);
+	rtsp_message_unref(m);
+
+	r = rtsp_add_match(server, match_template_request, NULL);
+	ck_assert_int_ge(r, 0);
+
+	cnt = 0;
+	for (i = 0; i < 8; ++i) {
+		/* vary the value lengths to move Content-Length around */
+		const char *values[] = { "deadbeef",
+					 "rtsp://192.168.0.1/wfd1.0/streamid=0",
+					 port, NULL };
+
+		sprintf(port, "%zu", i * 1111);
+		r = rtsp_template_stamp(req_template, client, &m, values);
+		ck_assert_int_ge(r, 0);
+		ck_assert(rtsp_message_is_sealed(m));
+
+		r = rtsp_call_async(client, m, match_template_reply, &cnt,
+				    0, NULL);
+		ck_assert_int_ge(r, 0);
+		rtsp_message_unref(m);
+
+		while (cnt <= i) {
+			r = sd_event_run(event, (uint64_t)-1);
+			ck_assert_int_ge(r, 0);
+		}
+	}
+
+	rtsp_template_free(req_template);
+	rtsp_template_free(reply_template);
+	reply_template = NULL;
+
+	stop_test_client();
+}
+END_TEST
+
 TEST_DEFINE_CASE(run)
 	TEST(run_all)
+	TEST(run_batch)
+	TEST(run_alloc)
+	TEST(run_timeout)
+	TEST(run_data)
+	TEST(run_template)
+	TEST(run_limits)
+	TEST(run_limits_reply)
 TEST_END_CASE
 
 TEST_DEFINE(
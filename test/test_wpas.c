@@ -17,6 +17,7 @@
  * along with MiracleCast; If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <sys/un.h>
 #include "test_common.h"
 #include "wpas.h"
 
@@ -432,6 +433,111 @@ START_TEST(msg_append)
 }
 END_TEST
 
+static void check_dict(struct wpas_message *m)
+{
+	const char *str;
+	uint32_t u;
+	int32_t i;
+	unsigned int k;
+	int r;
+
+	/* lookups must be repeatable, the index caches integers */
+	for (k = 0; k < 2; ++k) {
+		r = wpas_message_dict_read(m, "name", 's', &str);
+		ck_assert_int_ge(r, 0);
+		ck_assert_str_eq(str, "Living Room");
+
+		r = wpas_message_dict_read(m, "dup", 's', &str);
+		ck_assert_int_ge(r, 0);
+		ck_assert_str_eq(str, "first");
+
+		r = wpas_message_dict_read(m, "num", 'i', &i);
+		ck_assert_int_ge(r, 0);
+		ck_assert_int_eq(i, -7);
+
+		r = wpas_message_dict_read(m, "num", 's', &str);
+		ck_assert_int_ge(r, 0);
+		ck_assert_str_eq(str, "-7");
+
+		r = wpas_message_dict_read(m, "big", 'u', &u);
+		ck_assert_int_ge(r, 0);
+		ck_assert(u == 4294967295U);
+
+		r = wpas_message_dict_read(m, "hex", 'u', &u);
+		ck_assert_int_ge(r, 0);
+		ck_assert_int_eq(u, 0);
+
+		r = wpas_message_dict_read(m, "bad", 'i', &i);
+		ck_assert_int_eq(r, -EINVAL);
+
+		r = wpas_message_dict_read(m, "empty", 's', &str);
+		ck_assert_int_ge(r, 0);
+		ck_assert_str_eq(str, "");
+
+		r = wpas_message_dict_read(m, "string", 's', &str);
+		ck_assert_int_eq(r, -ENOENT);
+		r = wpas_message_dict_read(m, "nam", 's', &str);
+		ck_assert_int_eq(r, -ENOENT);
+		r = wpas_message_dict_read(m, "name2", 's', &str);
+		ck_assert_int_eq(r, -ENOENT);
+	}
+}
+
+START_TEST(msg_dict)
+{
+	struct wpas_message *m;
+	struct wpas *w;
+	const char *str;
+	char key[16];
+	unsigned int k;
+	int r;
+
+	w = start_test_client();
+
+	r = wpas_message_new_event(w, "name", 5, &m);
+	ck_assert_int_ge(r, 0);
+
+	r = wpas_message_append(m,
+				"seeeeeeee",
+				"string",
+				"name", "Living Room",
+				"dup", "first",
+				"num", "-7",
+				"big", "4294967295",
+				"hex", "0x188",
+				"bad", "xyz",
+				"empty", "",
+				"dup", "second");
+	ck_assert_int_ge(r, 0);
+
+	/* enough keys to force collisions in the index */
+	for (k = 0; k < 40; ++k) {
+		sprintf(key, "k%u", k);
+		r = wpas_message_append(m, "e", key, key);
+		ck_assert_int_ge(r, 0);
+	}
+
+	/* unsealed messages are scanned linearly, sealed ones indexed */
+	check_dict(m);
+
+	r = wpas_message_seal(m);
+	ck_assert_int_ge(r, 0);
+
+	check_dict(m);
+
+	for (k = 0; k < 40; ++k) {
+		sprintf(key, "k%u", k);
+		r = wpas_message_dict_read(m, key, 's', &str);
+		ck_assert_int_ge(r, 0);
+		ck_assert_str_eq(str, key);
+	}
+
+	wpas_message_unref(m);
+
+	stop_test_client();
+}
+END_TEST
+
 TEST_DEFINE_CASE(msg)
 	TEST(msg_invalid_new)
 	TEST(msg_new_event)
@@ -439,6 +545,7 @@ TEST_DEFINE_CASE(msg)
 	TEST(msg_new_reply)
 	TEST(msg_peer)
 	TEST(msg_append)
+	TEST(msg_dict)
 TEST_END_CASE
 
 START_TEST(run_invalid_msg)
@@ -685,11 +792,279 @@ START_TEST(run_parse)
 }
 END_TEST
 
+static int match_batch(struct wpas *w,
+		       struct wpas_message *m,
+		       void *data)
+{
+	unsigned int *cnt = data;
+	char name[32];
+
+	if (!m)
+		ck_assert_msg(0, "HUP not expected");
+
+	/* messages must be dispatched in order */
+	sprintf(name, "P2P-DEVICE-FOUND-%u", *cnt);
+	ck_assert(wpas_message_is_request(m, name));
+	++*cnt;
+
+	return 0;
+}
+
+START_TEST(run_batch)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	struct wpas_stats stats;
+	unsigned int cnt, i;
+	char buf[32];
+	ssize_t l;
+	int r, fd;
+
+	start_test_client();
+
+	r = wpas_add_match(server, match_batch, &cnt);
+	ck_assert_int_ge(r, 0);
+
+	/* Flood the server before it gets a chance to read. The socket queue
+	 * is limited by net.unix.max_dgram_qlen, so send as much as fits and
+	 * let the server drain in between. */
+	fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	ck_assert_int_ge(fd, 0);
+	sprintf(addr.sun_path, "/tmp/miracle-test-sock-%d", getpid());
+
+	cnt = 0;
+	i = 0;
+	while (cnt < 40) {
+		for ( ; i < 40; ++i) {
+			sprintf(buf, "P2P-DEVICE-FOUND-%u", i);
+			l = sendto(fd, buf, strlen(buf), MSG_DONTWAIT,
+				   (struct sockaddr*)&addr, sizeof(addr));
+			if (l < 0 && errno == EAGAIN)
+				break;
+			ck_assert_int_eq(l, strlen(buf));
+		}
+
+		r = sd_event_run(event, (uint64_t)-1);
+		ck_assert_int_ge(r, 0);
+	}
+
+	/* each wakeup dispatches a whole batch */
+	wpas_get_stats(server, &stats);
+	ck_assert_int_eq(stats.messages, 40);
+	ck_assert_int_lt(stats.wakeups, 40);
+	ck_assert_int_gt(stats.batch_max, 1);
+	ck_assert_int_le(stats.batch_max, 16);
+
+	close(fd);
+	stop_test_client();
+}
+END_TEST
+
+static int match_pool(struct wpas *w,
+		      struct wpas_message *m,
+		      void *data)
+{
+	struct wpas_message **keep = data;
+	const char *net, *key, *val;
+	int r;
+
+	if (!m)
+		ck_assert_msg(0, "HUP not expected");
+
+	ck_assert(wpas_message_is_request(m, "SET_NETWORK"));
+	ck_assert_str_eq(wpas_message_get_ifname(m), "p2p-dev-wlan0");
+
+	r = wpas_message_read(m, "sss", &net, &key, &val);
+	ck_assert_int_ge(r, 0);
+	ck_assert_str_eq(net, "0");
+	ck_assert_str_eq(key, "ssid");
+	ck_assert_str_eq(val, "my \"net\"");
+
+	if (!*keep) {
+		wpas_message_ref(m);
+		*keep = m;
+	}
+
+	sd_event_exit(event, 0);
+
+	return 0;
+}
+
+START_TEST(run_pool)
+{
+	static const char raw[] =
+		"IFNAME=p2p-dev-wlan0 SET_NETWORK 0  ssid 'my \"net\"'";
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	struct wpas_message *keep = NULL;
+	struct wpas_stats stats;
+	uint64_t allocs = 0;
+	unsigned int i;
+	ssize_t l;
+	int r, fd;
+
+	start_test_client();
+
+	r = wpas_add_match(server, match_pool, &keep);
+	ck_assert_int_ge(r, 0);
+
+	fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	ck_assert_int_ge(fd, 0);
+	sprintf(addr.sun_path, "/tmp/miracle-test-sock-%d", getpid());
+
+	for (i = 0; i < 8; ++i) {
+		l = sendto(fd, raw, strlen(raw), 0,
+			   (struct sockaddr*)&addr, sizeof(addr));
+		ck_assert_int_eq(l, strlen(raw));
+
+		r = sd_event_loop(event);
+		ck_assert_int_ge(r, 0);
+
+		/* recycled messages must not allocate */
+		wpas_get_stats(server, &stats);
+		if (i > 1)
+			ck_assert_int_eq(stats.allocs, allocs);
+		allocs = stats.allocs;
+	}
+
+	/* a message that is kept alive still owns its buffers */
+	ck_assert_str_eq(wpas_message_get_raw(keep), raw);
+	ck_assert_str_eq(wpas_message_get_name(keep), "SET_NETWORK");
+	wpas_message_unref(keep);
+
+	close(fd);
+	stop_test_client();
+}
+END_TEST
+
+static const struct {
+	const char *name;
+	unsigned int id;
+} event_table[] = {
+	{ "AP-STA-CONNECTED", 1 },
+	{ "P2P-DEVICE-FOUND", 2 },
+	{ "P2P-DEVICE-LOST", 3 },
+	{ "P2P-FIND-STOPPED", 4 },
+};
+
+static int match_event_id(struct wpas *w,
+			  struct wpas_message *m,
+			  void *data)
+{
+	struct wpas_message **req = data;
+	struct wpas_message *ev;
+	int r;
+
+	if (!m)
+		ck_assert_msg(0, "HUP not expected");
+
+	if (wpas_is_server(w)) {
+		/* remember the client address to send events to */
+		wpas_message_ref(m);
+		*req = m;
+		return 0;
+	}
+
+	if (wpas_message_is_event(m, "P2P-DEVICE-LOST")) {
+		ck_assert_int_eq(wpas_message_get_event_id(m), 3);
+		sd_event_exit(event, 0);
+		return 0;
+	}
+
+	ck_assert(wpas_message_is_event(m, "P2P-GROUP-STARTED"));
+	ck_assert_int_eq(wpas_message_get_event_id(m), 0);
+
+	r = wpas_message_new_event(server, "P2P-DEVICE-LOST", 3, &ev);
+	ck_assert_int_ge(r, 0);
+	wpas_message_set_peer(ev, wpas_message_get_peer(*req));
+	r = wpas_send(server, ev, 0);
+	ck_assert_int_ge(r, 0);
+	wpas_message_unref(ev);
+
+	return 0;
+}
+
+START_TEST(run_event_id)
+{
+	const char *unsorted[] = { "b", "a" };
+	const char *dup[] = { "a", "a" };
+	struct wpas_message *m, *req = NULL;
+	int r;
+
+	start_test_client();
+
+	r = wpas_set_event_table(client, unsorted, 2, sizeof(*unsorted));
+	ck_assert_int_eq(r, -EINVAL);
+	r = wpas_set_event_table(client, dup, 2, sizeof(*dup));
+	ck_assert_int_eq(r, -EINVAL);
+	r = wpas_set_event_table(client, event_table, 4, 1);
+	ck_assert_int_eq(r, -EINVAL);
+
+	r = wpas_set_event_table(client,
+				 event_table,
+				 SHL_ARRAY_LENGTH(event_table),
+				 sizeof(*event_table));
+	ck_assert_int_ge(r, 0);
+
+	/* ids are table index + 1, 0 for unknown events and non-events */
+	r = wpas_message_new_event(client, "AP-STA-CONNECTED", 3, &m);
+	ck_assert_int_ge(r, 0);
+	ck_assert_int_eq(wpas_message_get_event_id(m), 1);
+	wpas_message_unref(m);
+
+	r = wpas_message_new_event(client, "P2P-FIND-STOPPED", 3, &m);
+	ck_assert_int_ge(r, 0);
+	ck_assert_int_eq(wpas_message_get_event_id(m), 4);
+	wpas_message_unref(m);
+
+	r = wpas_message_new_event(client, "P2P-DEVICE", 3, &m);
+	ck_assert_int_ge(r, 0);
+	ck_assert_int_eq(wpas_message_get_event_id(m), 0);
+	wpas_message_unref(m);
+
+	r = wpas_message_new_request(client, "P2P-DEVICE-FOUND", &m);
+	ck_assert_int_ge(r, 0);
+	ck_assert_int_eq(wpas_message_get_event_id(m), 0);
+	wpas_message_unref(m);
+
+	/* received events are resolved while parsing */
+	r = wpas_add_match(server, match_event_id, &req);
+	ck_assert_int_ge(r, 0);
+	r = wpas_add_match(client, match_event_id, &req);
+	ck_assert_int_ge(r, 0);
+
+	r = wpas_message_new_request(client, "ATTACH", &m);
+	ck_assert_int_ge(r, 0);
+	r = wpas_send(client, m, 0);
+	ck_assert_int_ge(r, 0);
+	wpas_message_unref(m);
+
+	while (!req) {
+		r = sd_event_run(event, (uint64_t)-1);
+		ck_assert_int_ge(r, 0);
+	}
+
+	r = wpas_message_new_event(server, "P2P-GROUP-STARTED", 3, &m);
+	ck_assert_int_ge(r, 0);
+	wpas_message_set_peer(m, wpas_message_get_peer(req));
+	r = wpas_send(server, m, 0);
+	ck_assert_int_ge(r, 0);
+	wpas_message_unref(m);
+
+	r = sd_event_loop(event);
+	ck_assert_int_ge(r, 0);
+
+	wpas_message_unref(req);
+	stop_test_client();
+}
+END_TEST
+
 TEST_DEFINE_CASE(run)
 	TEST(run_invalid_msg)
 	TEST(run_msg)
 	TEST(run_send)
 	TEST(run_parse)
+	TEST(run_batch)
+	TEST(run_pool)
+	TEST(run_event_id)
 TEST_END_CASE
 
 TEST_DEFINE(